@@ -377,6 +377,8 @@ static void dobanner(void)
 #ifdef HAVE_ZLIB
         if (!backupd_compress_done && !backupd_starttls_done) {
             prot_printf(backupd_out, "* COMPRESS DEFLATE\r\n");
+            if (prot_compress_available("ZSTD"))
+                prot_printf(backupd_out, "* COMPRESS ZSTD\r\n");
         }
 #endif
     }
@@ -1259,19 +1261,19 @@ static void cmd_compress(const char *alg)
         prot_printf(backupd_out, "NO Compression already active: %s\r\n", alg);
         return;
     }
-    if (strcasecmp(alg, "DEFLATE")) {
+    if (!prot_compress_available(alg)) {
         prot_printf(backupd_out, "NO Unknown compression algorithm: %s\r\n", alg);
         return;
     }
-    if (ZLIB_VERSION[0] != zlibVersion()[0]) {
+    if (!strcasecmp(alg, "DEFLATE") && ZLIB_VERSION[0] != zlibVersion()[0]) {
         prot_printf(backupd_out, "NO Error initializing %s "
                     "(incompatible zlib version)\r\n", alg);
         return;
     }
     prot_printf(backupd_out, "OK %s active\r\n", alg);
     prot_flush(backupd_out);
-    prot_setcompress(backupd_in);
-    prot_setcompress(backupd_out);
+    prot_setcompress_alg(backupd_in, alg);
+    prot_setcompress_alg(backupd_out, alg);
     backupd_compress_done = 1;
 }
 
@@ -575,23 +575,15 @@ static struct backend *restore_connect(const char *servername,
 
 #ifdef HAVE_ZLIB
     /* Does the backend support compression? */
-    if (CAPA(backend, CAPA_COMPRESS)) {
-        prot_printf(backend->out, "%s\r\n",
-                    backend->prot->u.std.compress_cmd.cmd);
-        prot_flush(backend->out);
-
-        if (sync_parse_response("COMPRESS", backend->in, NULL)) {
-            if (options->require_compression)
-                fatal("Failed to enable compression, aborting", EX_SOFTWARE);
-            syslog(LOG_NOTICE, "Failed to enable compression, continuing uncompressed");
-        }
-        else {
-            prot_setcompress(backend->in);
-            prot_setcompress(backend->out);
-        }
-    }
-    else if (options->require_compression) {
-        fatal("Backend does not support compression, aborting", EX_SOFTWARE);
+    int r = sync_compress(backend);
+    if (r == IMAP_NOTFOUND) {
+        if (options->require_compression)
+            fatal("Backend does not support compression, aborting", EX_SOFTWARE);
+    }
+    else if (r) {
+        if (options->require_compression)
+            fatal("Failed to enable compression, aborting", EX_SOFTWARE);
+        syslog(LOG_NOTICE, "Failed to enable compression, continuing uncompressed");
     }
 #endif
 
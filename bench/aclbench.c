@@ -0,0 +1,272 @@
+/* aclbench.c: ACL rights benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Works out the rights a user has on each of a large set of mailboxes,
+ * as LIST "*" does, with cyrus_acl_myrights() and with a copy of the
+ * uncached code it replaced.  The user is a pts user in many groups,
+ * made up in memory, so no ptloader is needed:
+ *
+ *   aclbench
+ *   aclbench -f 20000 -g 1000
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sysexits.h>
+
+#include "acl.h"
+#include "auth.h"
+#include "auth_pts.h"
+#include "bench/benchutil.h"
+#include "libcyr_cfg.h"
+#include "strhash.h"
+#include "util.h"
+#include "xmalloc.h"
+#include "xstrlcpy.h"
+
+static int RUNS = 5;
+
+EXPORTED void fatal(const char *message, int code)
+{
+    fprintf(stderr, "fatal error: %s\n", message);
+    exit(code);
+}
+
+static const char * const usage_options[] = {
+    "-f      number of mailboxes (default: 5000)",
+    "-g      number of groups the user is in (default: 200)",
+    "-n      runs of each LIST (default: 5)",
+    NULL
+};
+
+/* the baseline: auth_pts's memberof and the ACL walk as they were */
+
+static int old_memberof(const struct auth_state *auth_state,
+                        const char *identifier)
+{
+    unsigned idhash = strhash(identifier);
+    int i;
+
+    if (!strcmp(identifier, "anyone")) return 1;
+
+    if (idhash == auth_state->userid.hash &&
+        !strcmp(identifier, auth_state->userid.id)) return 3;
+
+    for (i = 0; i < auth_state->ngroups; i++)
+        if (idhash == auth_state->groups[i].hash &&
+            !strcmp(identifier, auth_state->groups[i].id))
+            return 2;
+
+    return 0;
+}
+
+static int old_myrights(const struct auth_state *auth_state,
+                        const char *origacl)
+{
+    char *acl = xstrdupsafe(origacl);
+    char *thisid, *rights, *nextid;
+    long acl_positive = 0, acl_negative = 0;
+    long *acl_ptr;
+
+    for (thisid = acl; *thisid; thisid = nextid) {
+        acl_ptr = &acl_positive;
+        rights = strchr(thisid, '\t');
+        if (!rights) break;
+        *rights++ = '\0';
+
+        nextid = strchr(rights, '\t');
+        if (!nextid) break;
+        *nextid++ = '\0';
+
+        if (*thisid == '-') {
+            acl_ptr = &acl_negative;
+            thisid++;
+        }
+        if (old_memberof(auth_state, thisid)) {
+            int mask;
+            cyrus_acl_strtomask(rights, &mask);
+            *acl_ptr |= mask;
+        }
+    }
+
+    free(acl);
+
+    return acl_positive & ~acl_negative;
+}
+
+static void set_ident(struct auth_ident *ident, const char *id)
+{
+    strlcpy(ident->id, id, sizeof(ident->id));
+    ident->hash = strhash(ident->id);
+}
+
+/* a user in 'ngroups' groups, the way ptloader would hand it over */
+static struct auth_state *make_state(int ngroups)
+{
+    struct auth_state *state;
+    char id[64];
+    int i;
+
+    state = xzmalloc(sizeof(struct auth_state) +
+                     ngroups * sizeof(struct auth_ident));
+    set_ident(&state->userid, "fred");
+    state->ngroups = ngroups;
+    for (i = 0; i < ngroups; i++) {
+        snprintf(id, sizeof(id), "group:team%d", i);
+        set_ident(&state->groups[i], id);
+    }
+
+    return state;
+}
+
+/* Mostly the user's own folders, which all have the same ACL, then
+ * folders shared with one of the user's teams (or one they aren't
+ * in), and a few public ones.  Every mailbox gets its own copy of its
+ * ACL, as it would reading them out of mailboxes.db. */
+static char **make_acls(int nfolders, int ngroups)
+{
+    char **acls = xmalloc(nfolders * sizeof(char *));
+    struct buf acl = BUF_INITIALIZER;
+    int i;
+
+    for (i = 0; i < nfolders; i++) {
+        buf_reset(&acl);
+        switch (i % 20) {
+        case 0: case 1: case 2:
+            buf_printf(&acl, "user%d\tlrswipkxtecdan\tgroup:team%d\tlrs\t",
+                       i % 997, i % (2 * ngroups));
+            break;
+        case 3:
+            buf_appendcstr(&acl, "anyone\tlrs\tgroup:staff\tlrswipkxtecdn\t"
+                                 "-group:interns\tw\t");
+            break;
+        default:
+            buf_appendcstr(&acl, "fred\tlrswipkxtecdan\t");
+            break;
+        }
+        acls[i] = buf_newcstring(&acl);
+    }
+
+    buf_free(&acl);
+    return acls;
+}
+
+static void report(const char *what, int nfolders, double *times)
+{
+    bench_sort(times, RUNS);
+    printf("%-10s %6d mailboxes: min %.2fms  median %.2fms  max %.2fms\n",
+           what, nfolders, times[0] * 1000, times[RUNS / 2] * 1000,
+           times[RUNS - 1] * 1000);
+}
+
+int main(int argc, char *argv[])
+{
+    struct auth_state *state;
+    struct timeval start;
+    int nfolders = 5000, ngroups = 200;
+    double *now, *old;
+    char **acls;
+    long check_now = 0, check_old = 0;
+    int opt, i, j;
+
+    while ((opt = getopt(argc, argv, "f:g:n:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            nfolders = atoi(optarg);
+            break;
+        case 'g':
+            ngroups = atoi(optarg);
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], NULL, usage_options);
+        }
+    }
+
+    if (optind != argc || RUNS < 1 || nfolders < 1 || ngroups < 1)
+        bench_usage(argv[0], NULL, usage_options);
+
+    /* pts answers memberof from the auth_state alone */
+    libcyrus_config_setstring(CYRUSOPT_AUTH_MECH, "pts");
+
+    state = make_state(ngroups);
+    acls = make_acls(nfolders, ngroups);
+    now = xmalloc(RUNS * sizeof(double));
+    old = xmalloc(RUNS * sizeof(double));
+
+    for (i = 0; i < RUNS; i++) {
+        gettimeofday(&start, NULL);
+        for (j = 0; j < nfolders; j++)
+            check_now += cyrus_acl_myrights(state, acls[j]);
+        now[i] = bench_since(&start);
+
+        gettimeofday(&start, NULL);
+        for (j = 0; j < nfolders; j++)
+            check_old += old_myrights(state, acls[j]);
+        old[i] = bench_since(&start);
+    }
+
+    if (check_now != check_old) fatal("rights differ", EX_SOFTWARE);
+
+    printf("LIST \"*\" as a user in %d groups\n", ngroups);
+    report("cached", nfolders, now);
+    report("uncached", nfolders, old);
+
+    for (i = 0; i < nfolders; i++) free(acls[i]);
+    free(acls);
+    free(now);
+    free(old);
+    auth_freestate(state);
+
+    return 0;
+}
@@ -0,0 +1,248 @@
+/* annotbench.c: message annotation fetch benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Times FETCH 1:* ANNOTATION (/comment value.shared) the way imapd does
+ * it, one annotate_state_fetch() per message: "single" looks each
+ * message up in the annotations db, "batch" first loads the whole
+ * mailbox with annotatemore_cache_uids() as index_fetchresponses() now
+ * does.  -a gives every Nth message a /comment first:
+ *
+ *   annotbench -a 10 user.big
+ *   annotbench -n 10 user.big
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sysexits.h>
+
+#include "annotate.h"
+#include "bench/benchutil.h"
+#include "global.h"
+#include "mailbox.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* generated headers are not necessarily in current directory */
+#include "imap/imap_err.h"
+
+static int RUNS = 5;
+
+static const char * const usage_options[] = {
+    "-C      alternate config file",
+    "-a      annotate every Nth message first",
+    "-n      runs of each mode (default: 5)",
+    NULL
+};
+
+static int annotate_every(const char *name, unsigned every)
+{
+    struct mailbox *mailbox = NULL;
+    struct mailbox_iter *iter;
+    const message_t *msg;
+    struct buf val = BUF_INITIALIZER;
+    int r;
+
+    r = mailbox_open_iwl(name, &mailbox);
+    if (r) return r;
+
+    iter = mailbox_iter_init(mailbox, 0, ITER_SKIP_EXPUNGED);
+    while (!r && (msg = mailbox_iter_step(iter))) {
+        const struct index_record *record = msg_record(msg);
+        annotate_state_t *astate = NULL;
+
+        if (record->uid % every) continue;
+
+        buf_reset(&val);
+        buf_printf(&val, "annotbench comment on message %u", record->uid);
+        r = mailbox_get_annotate_state(mailbox, record->uid, &astate);
+        if (!r) r = annotate_state_write(astate, "/comment", "", &val);
+    }
+    mailbox_iter_done(&iter);
+
+    if (!r) r = mailbox_commit(mailbox);
+    mailbox_close(&mailbox);
+    buf_free(&val);
+
+    return r;
+}
+
+static void count_cb(const char *mboxname __attribute__((unused)),
+                     uint32_t uid __attribute__((unused)),
+                     const char *entry __attribute__((unused)),
+                     struct attvaluelist *attvalues __attribute__((unused)),
+                     void *rock)
+{
+    (*(unsigned *) rock)++;
+}
+
+/* one FETCH 1:* ANNOTATION, returning the seconds it took */
+static double fetch_all(struct mailbox *mailbox, int batch, unsigned *found)
+{
+    strarray_t entries = STRARRAY_INITIALIZER;
+    strarray_t attribs = STRARRAY_INITIALIZER;
+    struct seqset *uids = NULL;
+    struct mailbox_iter *iter;
+    const message_t *msg;
+    struct timeval start;
+    double secs;
+
+    strarray_append(&entries, "/comment");
+    strarray_append(&attribs, "value.shared");
+    *found = 0;
+
+    gettimeofday(&start, NULL);
+
+    if (batch) {
+        uids = seqset_init(0, SEQ_SPARSE);
+        iter = mailbox_iter_init(mailbox, 0, ITER_SKIP_EXPUNGED);
+        while ((msg = mailbox_iter_step(iter)))
+            seqset_add(uids, msg_record(msg)->uid, 1);
+        mailbox_iter_done(&iter);
+        annotatemore_cache_uids(mailbox->name, uids);
+    }
+
+    iter = mailbox_iter_init(mailbox, 0, ITER_SKIP_EXPUNGED);
+    while ((msg = mailbox_iter_step(iter))) {
+        annotate_state_t *astate = NULL;
+
+        if (mailbox_get_annotate_state(mailbox, msg_record(msg)->uid, &astate))
+            continue;
+        annotate_state_set_auth(astate, /*isadmin*/1, "cyrus", NULL);
+        annotate_state_fetch(astate, &entries, &attribs, count_cb, found);
+    }
+    mailbox_iter_done(&iter);
+
+    if (batch) {
+        annotatemore_uncache(mailbox->name);
+        seqset_free(uids);
+    }
+
+    secs = bench_since(&start);
+
+    strarray_fini(&entries);
+    strarray_fini(&attribs);
+
+    return secs;
+}
+
+static void bench(struct mailbox *mailbox, int batch)
+{
+    double *times = xmalloc(RUNS * sizeof(double));
+    unsigned found = 0;
+    int i;
+
+    for (i = 0; i < RUNS; i++)
+        times[i] = fetch_all(mailbox, batch, &found);
+
+    bench_sort(times, RUNS);
+    printf("%-6s %u messages, %u responses: "
+           "min %.1fms  median %.1fms  max %.1fms  (%.0f msgs/s)\n",
+           batch ? "batch" : "single", mailbox->i.exists, found,
+           times[0] * 1000, times[RUNS / 2] * 1000, times[RUNS - 1] * 1000,
+           mailbox->i.exists / times[RUNS / 2]);
+
+    free(times);
+}
+
+int main(int argc, char *argv[])
+{
+    struct mailbox *mailbox = NULL;
+    const char *alt_config = NULL;
+    const char *name;
+    int opt, every = 0, r;
+
+    while ((opt = getopt(argc, argv, "C:a:n:h")) != -1) {
+        switch (opt) {
+        case 'C':
+            alt_config = optarg;
+            break;
+        case 'a':
+            every = atoi(optarg);
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], "mailbox", usage_options);
+        }
+    }
+
+    if (optind != argc - 1 || RUNS < 1 || every < 0)
+        bench_usage(argv[0], "mailbox", usage_options);
+    name = argv[optind];
+
+    cyrus_init(alt_config, "annotbench", 0, CONFIG_NEED_PARTITION_DATA);
+    annotate_init(NULL, NULL);
+    annotatemore_open();
+
+    if (every) {
+        r = annotate_every(name, every);
+        if (r) {
+            fprintf(stderr, "%s: can't annotate: %s\n", name, error_message(r));
+            exit(EX_SOFTWARE);
+        }
+    }
+
+    r = mailbox_open_irl(name, &mailbox);
+    if (r) {
+        fprintf(stderr, "%s: %s\n", name, error_message(r));
+        exit(EX_SOFTWARE);
+    }
+    bench(mailbox, 0);
+    bench(mailbox, 1);
+    mailbox_close(&mailbox);
+
+    annotatemore_close();
+    annotate_done();
+    cyrus_done();
+
+    return 0;
+}
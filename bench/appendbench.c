@@ -0,0 +1,335 @@
+/* appendbench.c: message append CPU benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Copies messages from a protstream into spool files and parses them,
+ * as APPEND and append_fromstream() do, and reports the CPU time spent
+ * per MB delivered.  "rehash" is the copy, header check and parse as
+ * they were, hashing the GUID in a second pass over the mapped file;
+ * "stream" hashes the GUID as the message is copied in and hands it to
+ * the parse.  Needs an imapd.conf for the 8bit options:
+ *
+ *   appendbench -C imapd.conf
+ *   appendbench -C imapd.conf -s 1024 -m 500 -d /var/spool/tmp
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "bench/benchutil.h"
+#include "global.h"
+#include "message.h"
+#include "message_guid.h"
+#include "prot.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* generated headers are not necessarily in current directory */
+#include "imap/imap_err.h"
+
+static int RUNS = 5;
+static size_t MSGKB = 100;
+static size_t MEGS = 100;
+static const char *SPOOLDIR = "/tmp";
+
+static const char * const usage_options[] = {
+    "-C      alternate config file",
+    "-s      message size in KB (default: 100)",
+    "-m      megabytes delivered per run (default: 100)",
+    "-d      directory for the spool files (default: /tmp)",
+    "-n      runs of each mode (default: 5)",
+    NULL
+};
+
+/* something like a plain text message, 'kb' kilobytes long */
+static void make_message(struct buf *msg, size_t kb)
+{
+    static const char *words[] = {
+        "the ", "message ", "mailbox ", "cyrus ", "replication ",
+        "literal ", "delivery ", "from ", "by ", "with ", "ESMTP ",
+        "spool ", "Subject ", "Re ", "quota ", "annotation "
+    };
+    unsigned seed = 42;
+    size_t col = 0;
+
+    buf_appendcstr(msg,
+        "Return-Path: <fbloggs@example.com>\r\n"
+        "Received: from mx.example.com (mx.example.com [192.0.2.1])\r\n"
+        "\tby mail.example.com with ESMTPS; Mon, 5 Aug 2019 10:00:00 +1000\r\n"
+        "Message-ID: <appendbench@example.com>\r\n"
+        "Date: Mon, 5 Aug 2019 10:00:00 +1000\r\n"
+        "From: Fred Bloggs <fbloggs@example.com>\r\n"
+        "To: Sarah Jane Smith <sjsmith@example.com>\r\n"
+        "Subject: appendbench\r\n"
+        "MIME-Version: 1.0\r\n"
+        "Content-Type: text/plain; charset=us-ascii\r\n"
+        "\r\n");
+
+    while (msg->len < kb * 1024) {
+        const char *w = words[(seed = seed * 1103515245 + 12345) >> 28];
+
+        buf_appendcstr(msg, w);
+        col += strlen(w);
+        if (col > 70) {
+            buf_appendcstr(msg, "\r\n");
+            col = 0;
+        }
+    }
+    buf_truncate(msg, kb * 1024 - 2);
+    buf_appendcstr(msg, "\r\n");
+}
+
+/* the baseline: message_copy_strict() as it was, copying to a file */
+static int old_copy_strict(struct protstream *from, FILE *to,
+                           unsigned size, int allow_null)
+{
+    char buf[4096+1];
+    unsigned char *p, *endp;
+    int r = 0;
+    size_t n;
+    int sawcr = 0, sawnl;
+    int reject8bit = config_getswitch(IMAPOPT_REJECT8BIT);
+    int munge8bit = config_getswitch(IMAPOPT_MUNGE8BIT);
+    int inheader = 1, blankline = 1;
+
+    while (size) {
+        n = prot_read(from, buf, size > 4096 ? 4096 : size);
+        if (!n) return IMAP_IOERROR;
+
+        buf[n] = '\0';
+
+        if (!allow_null && (n != strlen(buf))) {
+            r = IMAP_MESSAGE_CONTAINSNULL;
+        }
+
+        size -= n;
+        if (r) continue;
+
+        for (p = (unsigned char *)buf, endp = p + n; p < endp; p++) {
+            if (!*p && inheader) {
+                r = IMAP_MESSAGE_CONTAINSNULL;
+            }
+            else if (*p == '\n') {
+                if (!sawcr && (inheader || !allow_null))
+                    r = IMAP_MESSAGE_CONTAINSNL;
+                sawcr = 0;
+                if (blankline) {
+                    inheader = 0;
+                }
+                blankline = 1;
+            }
+            else if (*p == '\r') {
+                sawcr = 1;
+            }
+            else {
+                sawcr = 0;
+                blankline = 0;
+                if (inheader && *p >= 0x80) {
+                    if (reject8bit) {
+                        if (!r) r = IMAP_MESSAGE_CONTAINS8BIT;
+                    } else if (munge8bit) {
+                        *p = 'X';
+                    }
+                }
+            }
+        }
+
+        fwrite(buf, 1, n, to);
+    }
+
+    if (r) return r;
+
+    fflush(to);
+    if (ferror(to) || fsync(fileno(to))) return IMAP_IOERROR;
+    rewind(to);
+
+    /* Go back and check headers */
+    sawnl = 1;
+    for (;;) {
+        if (!fgets(buf, sizeof(buf), to))
+            return sawnl ? 0 : IMAP_MESSAGE_BADHEADER;
+
+        if (sawnl && buf[0] == '\r') return 0;
+
+        if (sawnl && buf[0] != ' ' && buf[0] != '\t') {
+            if (buf[0] == ':') return IMAP_MESSAGE_BADHEADER;
+            if (strstr(buf, "From ") != buf) {
+                for (p = (unsigned char *)buf; *p && *p != ':'; p++) {
+                    if (*p <= ' ') return IMAP_MESSAGE_BADHEADER;
+                }
+            }
+        }
+
+        for(p = (unsigned char*) buf; *p; p++);
+
+        sawnl = (p > (unsigned char *)buf) && (p[-1] == '\n');
+    }
+}
+
+/* deliver 'count' copies of 'msg', returning the CPU seconds it took */
+static double deliver(const struct buf *msg, int count, int stream,
+                      struct message_guid *guid)
+{
+    char fname[1024];
+    double cpu = bench_cpu_seconds();
+    int i, r;
+
+    snprintf(fname, sizeof(fname), "%s/appendbench.%d",
+             SPOOLDIR, (int) getpid());
+
+    for (i = 0; i < count; i++) {
+        struct protstream *from = prot_readmap(msg->s, msg->len);
+        struct body *body = NULL;
+        FILE *f;
+
+        unlink(fname);
+        f = fopen(fname, "w+");
+        if (!f) {
+            perror(fname);
+            exit(EX_CANTCREAT);
+        }
+
+        if (stream) {
+            r = message_copy_strict_full(from, f, msg->len, 0, guid);
+            if (!r) r = message_parse_file_full(f, NULL, NULL, &body,
+                                                fname, guid);
+        }
+        else {
+            r = old_copy_strict(from, f, msg->len, 0);
+            if (!r) r = message_parse_file(f, NULL, NULL, &body, fname);
+        }
+        if (r) {
+            fprintf(stderr, "%s: %s\n", fname, error_message(r));
+            exit(EX_SOFTWARE);
+        }
+        if (!stream) message_guid_copy(guid, &body->guid);
+
+        message_free_body(body);
+        free(body);
+        fclose(f);
+        prot_free(from);
+    }
+    unlink(fname);
+
+    return bench_cpu_seconds() - cpu;
+}
+
+static void bench(const struct buf *msg, int stream, struct message_guid *guid)
+{
+    int count = (MEGS * 1024 + MSGKB - 1) / MSGKB;
+    double mb = (double) count * msg->len / (1024 * 1024);
+    double *times = xmalloc(RUNS * sizeof(double));
+    int i;
+
+    for (i = 0; i < RUNS; i++)
+        times[i] = deliver(msg, count, stream, guid) / mb;
+
+    bench_sort(times, RUNS);
+    printf("%-7s %5zuKB x %-6d CPU per MB: "
+           "min %.2fms  median %.2fms  max %.2fms\n",
+           stream ? "stream" : "rehash", MSGKB, count, times[0] * 1000,
+           times[RUNS / 2] * 1000, times[RUNS - 1] * 1000);
+
+    free(times);
+}
+
+int main(int argc, char *argv[])
+{
+    struct message_guid old, new;
+    struct buf msg = BUF_INITIALIZER;
+    const char *alt_config = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "C:s:m:d:n:h")) != -1) {
+        switch (opt) {
+        case 'C':
+            alt_config = optarg;
+            break;
+        case 's':
+            MSGKB = atol(optarg);
+            break;
+        case 'm':
+            MEGS = atol(optarg);
+            break;
+        case 'd':
+            SPOOLDIR = optarg;
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], NULL, usage_options);
+        }
+    }
+
+    if (optind != argc || RUNS < 1 || MSGKB < 1 || !MEGS)
+        bench_usage(argv[0], NULL, usage_options);
+
+    cyrus_init(alt_config, "appendbench", 0, 0);
+
+    make_message(&msg, MSGKB);
+
+    bench(&msg, 0, &old);
+    bench(&msg, 1, &new);
+
+    if (!message_guid_equal(&old, &new)) {
+        fprintf(stderr, "GUIDs differ: %s", message_guid_encode(&old));
+        fprintf(stderr, " %s\n", message_guid_encode(&new));
+        exit(EX_SOFTWARE);
+    }
+
+    buf_free(&msg);
+    cyrus_done();
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+/* benchdeliver.c -- deliveries in the background while a benchmark runs
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "append.h"
+#include "bench/benchutil.h"
+
+/* generated headers are not necessarily in current directory */
+#include "imap/imap_err.h"
+
+EXPORTED pid_t bench_deliverer_fork(int rate)
+{
+    pid_t pid;
+
+    if (!rate) return -1;
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EX_OSERR);
+    }
+
+    return pid;
+}
+
+static int deliver_one(const char *name, const struct buf *buf)
+{
+    struct appendstate as;
+    struct body *body = NULL;
+    struct protstream *msg;
+    int r;
+
+    r = append_setup(&as, name, NULL, NULL, 0, NULL, NULL, 0,
+                     EVENT_MESSAGE_NEW);
+    if (r) return r;
+
+    msg = prot_readmap(buf->s, buf->len);
+    r = append_fromstream(&as, &body, msg, buf->len, time(NULL), NULL);
+    /* n.b. append_fromstream calls append_abort itself if it fails */
+    if (!r) r = append_commit(&as);
+    prot_free(msg);
+
+    if (body) {
+        message_free_body(body);
+        free(body);
+    }
+
+    return r;
+}
+
+EXPORTED void bench_deliverer_run(const strarray_t *names, int rate,
+                                  bench_message_cb *cb, void *rock)
+{
+    struct buf buf = BUF_INITIALIZER;
+    unsigned n;
+
+    for (n = 0; ; n++) {
+        const char *name = strarray_nth(names, rand() % names->count);
+        int r;
+
+        buf_reset(&buf);
+        cb(&buf, n, rock);
+
+        r = deliver_one(name, &buf);
+        if (r) {
+            fprintf(stderr, "%s: delivery failed: %s\n",
+                    name, error_message(r));
+            exit(EX_SOFTWARE);
+        }
+
+        usleep(1000000 / rate);
+    }
+}
+
+EXPORTED void bench_deliverer_stop(pid_t pid)
+{
+    if (pid <= 0) return;
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
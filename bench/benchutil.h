@@ -0,0 +1,83 @@
+/* benchutil.h -- helpers shared by the benchmark tools
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BENCH_BENCHUTIL_H
+#define BENCH_BENCHUTIL_H
+
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "strarray.h"
+#include "util.h"
+
+/* print the usage message: 'args' after the options, if any, and then
+ * 'options', a NULL-terminated list of their descriptions, and exit */
+extern void bench_usage(const char *progname, const char *args,
+                        const char * const *options)
+    __attribute__((noreturn));
+
+/* seconds of wall clock time since 'start' */
+extern double bench_since(const struct timeval *start);
+
+/* seconds of CPU time used by this process so far */
+extern double bench_cpu_seconds(void);
+
+/* sort 'n' times, so that times[0] is the least, times[n / 2] the
+ * median and times[n - 1] the greatest */
+extern void bench_sort(double *times, int n);
+
+/* Another process delivering to the mailboxes being benchmarked, the
+ * way lmtpd would.  Fork it with bench_deliverer_fork() before
+ * cyrus_init(), so it opens its own databases; it returns the pid in
+ * the benchmark, 0 in the deliverer and -1 if 'rate' is 0.  The
+ * deliverer then calls bench_deliverer_run(), which delivers 'rate'
+ * messages a second to random ones of 'names' until it is stopped with
+ * bench_deliverer_stop().  'cb' writes the 'n'th message into 'buf'. */
+typedef void bench_message_cb(struct buf *buf, unsigned n, void *rock);
+
+extern pid_t bench_deliverer_fork(int rate);
+extern void bench_deliverer_run(const strarray_t *names, int rate,
+                                bench_message_cb *cb, void *rock)
+    __attribute__((noreturn));
+extern void bench_deliverer_stop(pid_t pid);
+
+#endif /* BENCH_BENCHUTIL_H */
@@ -0,0 +1,200 @@
+/* convsortbench.c: XCONVSORT latency benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Times XCONVSORT (REVERSE ARRIVAL) of the first page of a mailbox,
+ * optionally while another process keeps delivering to it, with
+ * whatever xconvsort_cache_size the config file says:
+ *
+ *   convsortbench -n 100 -d 10 user.big
+ *   convsortbench -C imapd-nocache.conf -n 100 -d 10 user.big
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "bench/benchutil.h"
+#include "global.h"
+#include "imapd.h"
+#include "index.h"
+#include "search_expr.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* generated headers are not necessarily in current directory */
+#include "imap/imap_err.h"
+
+static int RUNS = 20;
+static int RATE = 0;
+static unsigned PAGE = 50;
+
+static const char * const usage_options[] = {
+    "-C      alternate config file",
+    "-n      XCONVSORTs to run (default: 20)",
+    "-d      deliveries per second meanwhile (default: 0)",
+    "-l      page size (default: 50)",
+    NULL
+};
+
+static void make_message(struct buf *buf, unsigned n,
+                         void *rock __attribute__((unused)))
+{
+    buf_printf(buf, "From: convsortbench <convsortbench@example.com>\r\n"
+                    "Subject: convsortbench %u\r\n"
+                    "\r\n"
+                    "delivery %u\r\n", n, n);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sortcrit sortcrit[2];
+    struct windowargs windowargs;
+    struct searchargs *searchargs;
+    struct index_state *state = NULL;
+    struct index_init init;
+    const char *alt_config = NULL;
+    const char *name;
+    strarray_t names = STRARRAY_INITIALIZER;
+    double *times;
+    pid_t pid;
+    int opt, i, r;
+
+    while ((opt = getopt(argc, argv, "C:n:d:l:h")) != -1) {
+        switch (opt) {
+        case 'C':
+            alt_config = optarg;
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'd':
+            RATE = atoi(optarg);
+            break;
+        case 'l':
+            PAGE = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], "mailbox", usage_options);
+        }
+    }
+
+    if (optind != argc - 1 || RUNS < 1 || RATE < 0)
+        bench_usage(argv[0], "mailbox", usage_options);
+    name = argv[optind];
+    strarray_append(&names, name);
+
+    pid = bench_deliverer_fork(RATE);
+
+    cyrus_init(alt_config, "convsortbench", 0, CONFIG_NEED_PARTITION_DATA);
+
+    if (!pid) bench_deliverer_run(&names, RATE, make_message, NULL);
+
+    /* no userid, so \Seen is the internal one */
+    memset(&init, 0, sizeof(struct index_init));
+    init.out = prot_new(open("/dev/null", O_WRONLY), 1);
+
+    r = index_open(name, &init, &state);
+    if (r) {
+        fprintf(stderr, "%s: %s\n", name, error_message(r));
+        exit(EX_SOFTWARE);
+    }
+
+    memset(sortcrit, 0, sizeof(sortcrit));
+    sortcrit[0].key = SORT_ARRIVAL;
+    sortcrit[0].flags = SORT_REVERSE;
+    sortcrit[1].key = SORT_SEQUENCE;
+
+    memset(&windowargs, 0, sizeof(windowargs));
+    windowargs.limit = PAGE;
+    windowargs.position = 1;
+
+    searchargs = new_searchargs("*", GETSEARCH_CHARSET_FIRST, NULL,
+                                NULL, NULL, 1);
+    searchargs->root = search_expr_new(NULL, SEOP_TRUE);
+
+    times = xmalloc(RUNS * sizeof(double));
+    for (i = 0; i < RUNS; i++) {
+        struct timeval start;
+
+        gettimeofday(&start, NULL);
+        r = index_convsort(state, sortcrit, searchargs, &windowargs);
+        times[i] = bench_since(&start);
+        if (r) {
+            fprintf(stderr, "%s: XCONVSORT failed: %s\n",
+                    name, error_message(r));
+            exit(EX_SOFTWARE);
+        }
+        prot_flush(init.out);
+    }
+
+    bench_deliverer_stop(pid);
+
+    printf("%s: %u messages, cache %dKB, %d deliveries/s: first %.2fms\n",
+           name, state->exists, config_getint(IMAPOPT_XCONVSORT_CACHE_SIZE),
+           RATE, times[0] * 1000);
+    bench_sort(times, RUNS);
+    printf("XCONVSORT min %.2fms, median %.2fms, p90 %.2fms, max %.2fms\n",
+           times[0] * 1000, times[RUNS / 2] * 1000,
+           times[RUNS * 9 / 10] * 1000, times[RUNS - 1] * 1000);
+
+    free(times);
+    strarray_fini(&names);
+    freesearchargs(searchargs);
+    index_close(&state);
+    index_convsort_cache_free();
+    prot_free(init.out);
+    cyrus_done();
+
+    return 0;
+}
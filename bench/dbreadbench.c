@@ -0,0 +1,256 @@
+/* dbreadbench.c: cyrusdb reads during writes benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Reads from a twoskip database while another process keeps writing
+ * to it, as an IMAP or JMAP session reading a user's conversations
+ * database does while LMTP delivers to the same user.  The writer
+ * holds its lock for a while in each transaction, like a delivery
+ * waiting on fsync.  Each fetch and each short foreach is timed, first
+ * with read locks and then with snapshot reads:
+ *
+ *   dbreadbench
+ *   dbreadbench -n 100000 -w 20000 -s 5
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "bench/benchutil.h"
+#include "cyrusdb.h"
+#include "libcyr_cfg.h"
+#include "util.h"
+#include "xmalloc.h"
+
+static int NUMRECS = 20000;
+static int HOLD = 5000;         /* microseconds each write lock is held */
+static int SECS = 3;
+
+EXPORTED void fatal(const char *message, int code)
+{
+    fprintf(stderr, "fatal error: %s\n", message);
+    exit(code);
+}
+
+static const char * const usage_options[] = {
+    "-n      records in the database (default: 20000)",
+    "-w      microseconds the writer holds its lock (default: 5000)",
+    "-s      seconds to read for in each mode (default: 3)",
+    NULL
+};
+
+static const char *make_key(int i)
+{
+    static char key[32];
+
+    snprintf(key, sizeof(key), "%08d", i);
+    return key;
+}
+
+/* a delivery: a handful of records changed, with the lock held
+ * throughout, until killed */
+static void writer(const char *fname)
+{
+    struct db *db = NULL;
+    struct txn *txn = NULL;
+    char val[128];
+    int n, i;
+
+    if (cyrusdb_open("twoskip", fname, 0, &db)) _exit(EX_SOFTWARE);
+
+    for (n = 0; ; n++) {
+        for (i = 0; i < 10; i++) {
+            const char *key = make_key(rand() % NUMRECS);
+
+            snprintf(val, sizeof(val), "delivery %d record %d", n, i);
+            if (cyrusdb_store(db, key, strlen(key), val, strlen(val), &txn))
+                _exit(EX_SOFTWARE);
+        }
+        usleep(HOLD);
+        if (cyrusdb_commit(db, txn)) _exit(EX_SOFTWARE);
+        txn = NULL;
+    }
+}
+
+static int count_cb(void *rock,
+                    const char *key __attribute__((unused)),
+                    size_t keylen __attribute__((unused)),
+                    const char *data __attribute__((unused)),
+                    size_t datalen __attribute__((unused)))
+{
+    (*(int *) rock)++;
+    return 0;
+}
+
+static void report(const char *what, double *times, int n, double secs)
+{
+    bench_sort(times, n);
+    printf("%-8s %-7s %8d ops, %8.0f/s: min %7.1fus median %7.1fus "
+           "p99 %8.1fus max %8.1fus\n", what,
+           libcyrus_config_getswitch(CYRUSOPT_TWOSKIP_SNAPSHOT_READS)
+               ? "snap" : "lock",
+           n, n / secs, times[0] * 1e6, times[n / 2] * 1e6,
+           times[n * 99 / 100] * 1e6, times[n - 1] * 1e6);
+}
+
+static void bench_reads(const char *fname)
+{
+    struct db *db = NULL;
+    struct timeval start, op;
+    double *fetches = NULL, *foreaches = NULL;
+    int nfetch = 0, nforeach = 0, alloc = 0;
+    int r;
+
+    r = cyrusdb_open("twoskip", fname, 0, &db);
+    if (r) fatal("can't open database", EX_SOFTWARE);
+
+    gettimeofday(&start, NULL);
+    while (bench_since(&start) < SECS) {
+        const char *key = make_key(rand() % NUMRECS);
+        const char *data;
+        size_t datalen;
+        int count = 0;
+
+        if (nfetch == alloc) {
+            alloc = alloc ? alloc * 2 : 4096;
+            fetches = xrealloc(fetches, alloc * sizeof(double));
+            foreaches = xrealloc(foreaches, alloc * sizeof(double));
+        }
+
+        gettimeofday(&op, NULL);
+        r = cyrusdb_fetch(db, key, strlen(key), &data, &datalen, NULL);
+        fetches[nfetch++] = bench_since(&op);
+        if (r) fatal("fetch failed", EX_SOFTWARE);
+
+        /* and the hundred records around it */
+        gettimeofday(&op, NULL);
+        r = cyrusdb_foreach(db, key, 6, NULL, count_cb, &count, NULL);
+        foreaches[nforeach++] = bench_since(&op);
+        if (r) fatal("foreach failed", EX_SOFTWARE);
+    }
+
+    report("fetch", fetches, nfetch, SECS);
+    report("foreach", foreaches, nforeach, SECS);
+
+    cyrusdb_close(db);
+    free(fetches);
+    free(foreaches);
+}
+
+int main(int argc, char *argv[])
+{
+    char fname[] = "/tmp/dbreadbench-XXXXXX";
+    struct db *db = NULL;
+    struct txn *txn = NULL;
+    int opt, i, mode, fd;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "n:w:s:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            NUMRECS = atoi(optarg);
+            break;
+        case 'w':
+            HOLD = atoi(optarg);
+            break;
+        case 's':
+            SECS = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], NULL, usage_options);
+        }
+    }
+
+    if (NUMRECS < 100 || HOLD < 0 || SECS < 1)
+        bench_usage(argv[0], NULL, usage_options);
+
+    fd = mkstemp(fname);
+    if (fd < 0) fatal("can't create database", EX_CANTCREAT);
+    close(fd);
+    unlink(fname);
+
+    cyrusdb_init();
+
+    if (cyrusdb_open("twoskip", fname, CYRUSDB_CREATE, &db))
+        fatal("can't create database", EX_CANTCREAT);
+    for (i = 0; i < NUMRECS; i++) {
+        const char *key = make_key(i);
+
+        if (cyrusdb_store(db, key, strlen(key), "initial", 7, &txn))
+            fatal("store failed", EX_SOFTWARE);
+    }
+    if (cyrusdb_commit(db, txn)) fatal("commit failed", EX_SOFTWARE);
+    cyrusdb_close(db);
+
+    printf("%d records, writer holds its lock %dus per transaction\n",
+           NUMRECS, HOLD);
+
+    for (mode = 0; mode < 2; mode++) {
+        libcyrus_config_setswitch(CYRUSOPT_TWOSKIP_SNAPSHOT_READS, mode);
+
+        pid = fork();
+        if (pid < 0) fatal("fork failed", EX_OSERR);
+        if (!pid) writer(fname);
+
+        bench_reads(fname);
+
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+
+    cyrusdb_done();
+    unlink(fname);
+
+    return 0;
+}
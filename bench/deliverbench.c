@@ -0,0 +1,284 @@
+/* deliverbench.c: multi-recipient delivery benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Delivers one staged message to 1, 10, 100 and 1000 recipients the way
+ * append_fromstage() does for each of them: a hard link from the stage
+ * file into the recipient's directory, an fsync of the link, and the
+ * message's cache record.  "rebuild" builds the cache record for every
+ * recipient, as before it was kept with the parsed message; "shared"
+ * builds it once.  Reports wall clock and CPU time per recipient:
+ *
+ *   deliverbench -C imapd.conf
+ *   deliverbench -C imapd.conf -s 64 -n 3 -d /var/spool/imap
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sysexits.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "bench/benchutil.h"
+#include "global.h"
+#include "mailbox.h"
+#include "message.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* generated headers are not necessarily in current directory */
+#include "imap/imap_err.h"
+
+static int RUNS = 5;
+static size_t MSGKB = 20;
+static const char *SPOOLDIR = "/tmp";
+
+static const char * const usage_options[] = {
+    "-C      alternate config file",
+    "-s      message size in KB (default: 20)",
+    "-d      directory for the spool files (default: /tmp)",
+    "-n      runs of each mode (default: 5)",
+    NULL
+};
+
+/* a list message with a few recipients and a multipart body */
+static void make_message(FILE *f, size_t kb)
+{
+    size_t len = 0;
+    int line = 0;
+
+    fputs("Return-Path: <owner-list@example.com>\r\n"
+          "Received: from mx.example.com (mx.example.com [192.0.2.1])\r\n"
+          "\tby mail.example.com with ESMTPS; Mon, 5 Aug 2019 10:00:00 +1000\r\n"
+          "Message-ID: <deliverbench@example.com>\r\n"
+          "Date: Mon, 5 Aug 2019 10:00:00 +1000\r\n"
+          "From: Fred Bloggs <fbloggs@example.com>\r\n"
+          "To: Cyrus list <list@example.com>\r\n"
+          "Cc: Sarah Jane Smith <sjsmith@example.com>,\r\n"
+          "\tHarry Sullivan <hsullivan@example.com>\r\n"
+          "Subject: =?UTF-8?Q?deliverbench_=E2=80=94_list_traffic?=\r\n"
+          "MIME-Version: 1.0\r\n"
+          "Content-Type: multipart/alternative; boundary=\"b1\"\r\n"
+          "\r\n"
+          "--b1\r\n"
+          "Content-Type: text/plain; charset=us-ascii\r\n"
+          "\r\n", f);
+
+    while (len < kb * 512) {
+        len += fprintf(f, "line %d of the plain text part of the message\r\n",
+                       line++);
+    }
+    fputs("--b1\r\n"
+          "Content-Type: text/html; charset=us-ascii\r\n"
+          "\r\n", f);
+    while (len < kb * 1024) {
+        len += fprintf(f, "<p>line %d of the html part</p>\r\n", line++);
+    }
+    fputs("--b1--\r\n", f);
+}
+
+/* deliver the message in 'stagefile' to 'nrcpt' recipients,
+ * adding the seconds it took to 'wall' and 'cpu' */
+static void deliver(const char *stagefile, struct body *body, int nrcpt,
+                    int shared, double *wall, double *cpu)
+{
+    char dir[1024], fname[1100];
+    struct timeval start;
+    double c = bench_cpu_seconds();
+    int i, r;
+
+    gettimeofday(&start, NULL);
+
+    snprintf(dir, sizeof(dir), "%s/deliverbench.%d", SPOOLDIR, (int) getpid());
+    if (mkdir(dir, 0700) && errno != EEXIST) {
+        perror(dir);
+        exit(EX_CANTCREAT);
+    }
+
+    for (i = 0; i < nrcpt; i++) {
+        struct index_record record;
+        FILE *f;
+
+        snprintf(fname, sizeof(fname), "%s/%d.", dir, i);
+        if (link(stagefile, fname)) {
+            perror(fname);
+            exit(EX_CANTCREAT);
+        }
+
+        f = fopen(fname, "r");
+        if (!f) {
+            perror(fname);
+            exit(EX_IOERR);
+        }
+        fsync(fileno(f));
+        fclose(f);
+
+        if (!shared) {
+            buf_free(&body->cacherecord);
+            free(body->cacheitems);
+            body->cacheitems = NULL;
+        }
+
+        memset(&record, 0, sizeof(record));
+        r = message_write_cache(&record, body);
+        if (r) {
+            fprintf(stderr, "%s: %s\n", fname, error_message(r));
+            exit(EX_SOFTWARE);
+        }
+    }
+
+    *wall += bench_since(&start);
+    *cpu += bench_cpu_seconds() - c;
+
+    for (i = 0; i < nrcpt; i++) {
+        snprintf(fname, sizeof(fname), "%s/%d.", dir, i);
+        unlink(fname);
+    }
+    rmdir(dir);
+}
+
+static void bench(const char *stagefile, int nrcpt, int shared)
+{
+    double *walls = xmalloc(RUNS * sizeof(double));
+    double *cpus = xmalloc(RUNS * sizeof(double));
+    int i, r;
+
+    for (i = 0; i < RUNS; i++) {
+        struct body *body = NULL;
+        FILE *f = fopen(stagefile, "r");
+
+        /* parsed once per message, as lmtpd does */
+        r = message_parse_file(f, NULL, NULL, &body, stagefile);
+        fclose(f);
+        if (r) {
+            fprintf(stderr, "%s: %s\n", stagefile, error_message(r));
+            exit(EX_SOFTWARE);
+        }
+
+        walls[i] = cpus[i] = 0;
+        deliver(stagefile, body, nrcpt, shared, &walls[i], &cpus[i]);
+        walls[i] /= nrcpt;
+        cpus[i] /= nrcpt;
+
+        message_free_body(body);
+        free(body);
+    }
+
+    bench_sort(walls, RUNS);
+    bench_sort(cpus, RUNS);
+    printf("%-7s %4d recipients  per recipient: "
+           "median wall %.3fms  median CPU %.3fms\n",
+           shared ? "shared" : "rebuild", nrcpt,
+           walls[RUNS / 2] * 1000, cpus[RUNS / 2] * 1000);
+
+    free(walls);
+    free(cpus);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int nrcpts[] = { 1, 10, 100, 1000 };
+    char stagefile[1024];
+    const char *alt_config = NULL;
+    unsigned i;
+    FILE *f;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "C:s:d:n:h")) != -1) {
+        switch (opt) {
+        case 'C':
+            alt_config = optarg;
+            break;
+        case 's':
+            MSGKB = atol(optarg);
+            break;
+        case 'd':
+            SPOOLDIR = optarg;
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], NULL, usage_options);
+        }
+    }
+
+    if (optind != argc || RUNS < 1 || MSGKB < 1)
+        bench_usage(argv[0], NULL, usage_options);
+
+    cyrus_init(alt_config, "deliverbench", 0, 0);
+
+    snprintf(stagefile, sizeof(stagefile), "%s/deliverbench.%d.stage",
+             SPOOLDIR, (int) getpid());
+    f = fopen(stagefile, "w");
+    if (!f) {
+        perror(stagefile);
+        exit(EX_CANTCREAT);
+    }
+    make_message(f, MSGKB);
+    if (fflush(f) || fsync(fileno(f))) {
+        perror(stagefile);
+        exit(EX_IOERR);
+    }
+    fclose(f);
+
+    for (i = 0; i < sizeof(nrcpts) / sizeof(nrcpts[0]); i++) {
+        bench(stagefile, nrcpts[i], 0);
+        bench(stagefile, nrcpts[i], 1);
+    }
+
+    unlink(stagefile);
+    cyrus_done();
+
+    return 0;
+}
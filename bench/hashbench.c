@@ -0,0 +1,582 @@
+/* hashbench.c: hash table benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Times the lib/hash.c, hashu64 and hashset tables against copies of
+ * the chained tables they replaced, with the kinds of keys Cyrus puts
+ * in them.  The tables are constructed at an eighth of the final
+ * count, as callers that guess too low do:
+ *
+ *   hashbench
+ *   hashbench -c 1000000 -n 3
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sysexits.h>
+
+#include "bench/benchutil.h"
+#include "hash.h"
+#include "hashset.h"
+#include "hashu64.h"
+#include "strhash.h"
+#include "util.h"
+#include "xmalloc.h"
+
+static int RUNS = 5;
+static unsigned COUNT = 100000;
+
+EXPORTED void fatal(const char *message, int code)
+{
+    fprintf(stderr, "fatal error: %s\n", message);
+    exit(code);
+}
+
+static const char * const usage_options[] = {
+    "-c      number of keys (default: 100000)",
+    "-n      runs of each benchmark (default: 5)",
+    NULL
+};
+
+/* the baselines: the chained tables as they were, minus the mpool */
+
+struct old_bucket {
+    char *key;
+    uint64_t key64;
+    void *data;
+    struct old_bucket *next;
+};
+
+struct old_table {
+    size_t size;
+    struct old_bucket **table;
+};
+
+static void old_construct(struct old_table *t, size_t size)
+{
+    t->size = size;
+    t->table = xzmalloc(size * sizeof(struct old_bucket *));
+}
+
+/* sorted chains, so lookups and misses can stop early */
+static struct old_bucket **old_find(struct old_table *t, const char *key,
+                                    int *found)
+{
+    struct old_bucket **prev = &t->table[strhash(key) % t->size];
+
+    *found = 0;
+    for (; *prev; prev = &(*prev)->next) {
+        int cmp = strcmp(key, (*prev)->key);
+        if (cmp <= 0) {
+            *found = !cmp;
+            break;
+        }
+    }
+    return prev;
+}
+
+static void old_insert(const char *key, void *data, struct old_table *t)
+{
+    int found;
+    struct old_bucket **prev = old_find(t, key, &found);
+
+    if (found) {
+        (*prev)->data = data;
+    }
+    else {
+        struct old_bucket *b = xmalloc(sizeof(struct old_bucket));
+        b->key = xstrdup(key);
+        b->key64 = 0;
+        b->data = data;
+        b->next = *prev;
+        *prev = b;
+    }
+}
+
+static void *old_lookup(const char *key, struct old_table *t)
+{
+    int found;
+    struct old_bucket **prev = old_find(t, key, &found);
+
+    return found ? (*prev)->data : NULL;
+}
+
+static void *old_del(const char *key, struct old_table *t)
+{
+    int found;
+    struct old_bucket **prev = old_find(t, key, &found);
+    struct old_bucket *b = *prev;
+    void *data;
+
+    if (!found) return NULL;
+    data = b->data;
+    *prev = b->next;
+    free(b->key);
+    free(b);
+    return data;
+}
+
+static struct old_bucket **old_find64(struct old_table *t, uint64_t key,
+                                      int *found)
+{
+    struct old_bucket **prev = &t->table[key % t->size];
+
+    *found = 0;
+    for (; *prev; prev = &(*prev)->next) {
+        if (key <= (*prev)->key64) {
+            *found = key == (*prev)->key64;
+            break;
+        }
+    }
+    return prev;
+}
+
+static void old_insert64(uint64_t key, void *data, struct old_table *t)
+{
+    int found;
+    struct old_bucket **prev = old_find64(t, key, &found);
+
+    if (found) {
+        (*prev)->data = data;
+    }
+    else {
+        struct old_bucket *b = xmalloc(sizeof(struct old_bucket));
+        b->key = NULL;
+        b->key64 = key;
+        b->data = data;
+        b->next = *prev;
+        *prev = b;
+    }
+}
+
+static void *old_lookup64(uint64_t key, struct old_table *t)
+{
+    int found;
+    struct old_bucket **prev = old_find64(t, key, &found);
+
+    return found ? (*prev)->data : NULL;
+}
+
+static void old_free(struct old_table *t)
+{
+    size_t i;
+
+    for (i = 0; i < t->size; i++) {
+        struct old_bucket *b, *next;
+        for (b = t->table[i]; b; b = next) {
+            next = b->next;
+            free(b->key);
+            free(b);
+        }
+    }
+    free(t->table);
+}
+
+/* the old hashset: chained on the first two bytes of the value */
+struct old_hashset {
+    uint32_t starts[65536];
+    size_t recsize, count;
+    char *data;
+};
+
+static int old_hashset_add(struct old_hashset *hs, const char *value,
+                           size_t bytesize)
+{
+    uint32_t *pos = &hs->starts[*((uint16_t *)value)];
+    size_t offset;
+
+    while (*pos) {
+        offset = hs->recsize * (*pos - 1);
+        if (!memcmp(hs->data + offset, value, bytesize)) return 0;
+        pos = (uint32_t *) (hs->data + offset + bytesize);
+    }
+
+    offset = hs->recsize * hs->count;
+    memcpy(hs->data + offset, value, bytesize);
+    memset(hs->data + offset + bytesize, 0, 4);
+    *pos = ++hs->count;
+    return 1;
+}
+
+static int old_hashset_exists(struct old_hashset *hs, const char *value,
+                              size_t bytesize)
+{
+    uint32_t pos = hs->starts[*((uint16_t *)value)];
+
+    while (pos) {
+        size_t offset = hs->recsize * (pos - 1);
+        if (!memcmp(hs->data + offset, value, bytesize)) return 1;
+        memcpy(&pos, hs->data + offset + bytesize, 4);
+    }
+    return 0;
+}
+
+/* keys */
+
+enum keytype { MBOXNAME, UNIQUEID, NUMBER };
+
+static const char *keytype_name[] = { "mboxname", "uniqueid", "number" };
+
+/* 'miss' keys are distinct from all the others */
+static char **make_keys(enum keytype type, unsigned n, int miss)
+{
+    char **keys = xmalloc(n * sizeof(char *));
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        unsigned k = miss ? n + i : i;
+        char buf[64];
+
+        switch (type) {
+        case MBOXNAME:
+            /* a handful of folders per user */
+            snprintf(buf, sizeof(buf), "user.u%06u.%s%u", k / 8,
+                     (k % 8) < 4 ? "Archive." : "", k % 8);
+            break;
+        case UNIQUEID:
+            snprintf(buf, sizeof(buf), "%08x-%04x-%04x-%012x",
+                     k * 2654435761U, k & 0xffff, k >> 16, k);
+            break;
+        case NUMBER:
+            snprintf(buf, sizeof(buf), "%u", k);
+            break;
+        }
+        keys[i] = xstrdup(buf);
+    }
+
+    return keys;
+}
+
+static void free_keys(char **keys, unsigned n)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++) free(keys[i]);
+    free(keys);
+}
+
+/* timings, in nanoseconds per operation */
+
+enum { INSERT, HIT, MISS, DELETE, NOPS };
+
+static const char *op_name[] = { "insert", "hit", "miss", "delete" };
+
+static void bench_hash(char **keys, char **misses, unsigned n, double *ns)
+{
+    hash_table ht = HASH_TABLE_INITIALIZER;
+    struct timeval start;
+    unsigned i, found = 0;
+
+    gettimeofday(&start, NULL);
+    construct_hash_table(&ht, n / 8, 0);
+    for (i = 0; i < n; i++) hash_insert(keys[i], keys[i], &ht);
+    ns[INSERT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) found += !!hash_lookup(keys[i], &ht);
+    ns[HIT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) found += !!hash_lookup(misses[i], &ht);
+    ns[MISS] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) hash_del(keys[i], &ht);
+    ns[DELETE] = bench_since(&start) * 1e9 / n;
+
+    if (found != n) fatal("hash_lookup is broken", EX_SOFTWARE);
+    free_hash_table(&ht, NULL);
+}
+
+static void bench_old(char **keys, char **misses, unsigned n, double *ns)
+{
+    struct old_table ot;
+    struct timeval start;
+    unsigned i, found = 0;
+
+    gettimeofday(&start, NULL);
+    old_construct(&ot, n / 8);
+    for (i = 0; i < n; i++) old_insert(keys[i], keys[i], &ot);
+    ns[INSERT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) found += !!old_lookup(keys[i], &ot);
+    ns[HIT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) found += !!old_lookup(misses[i], &ot);
+    ns[MISS] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) old_del(keys[i], &ot);
+    ns[DELETE] = bench_since(&start) * 1e9 / n;
+
+    if (found != n) fatal("old lookup is broken", EX_SOFTWARE);
+    old_free(&ot);
+}
+
+/* sparse 64 bit keys, like modseqs or conversation ids */
+static void bench_hashu64(unsigned n, double *ns)
+{
+    hashu64_table ht = HASHU64_TABLE_INITIALIZER;
+    struct timeval start;
+    unsigned i, found = 0;
+
+    gettimeofday(&start, NULL);
+    construct_hashu64_table(&ht, n / 8, 0);
+    for (i = 1; i <= n; i++) hashu64_insert((uint64_t) i << 20, &ht, &ht);
+    ns[INSERT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 1; i <= n; i++) found += !!hashu64_lookup((uint64_t) i << 20, &ht);
+    ns[HIT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 1; i <= n; i++) found += !!hashu64_lookup(((uint64_t) i << 20) + 1, &ht);
+    ns[MISS] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 1; i <= n; i++) hashu64_del((uint64_t) i << 20, &ht);
+    ns[DELETE] = bench_since(&start) * 1e9 / n;
+
+    if (found != n) fatal("hashu64_lookup is broken", EX_SOFTWARE);
+    free_hashu64_table(&ht, NULL);
+}
+
+static void bench_oldu64(unsigned n, double *ns)
+{
+    struct old_table ot;
+    struct timeval start;
+    unsigned i, found = 0;
+
+    gettimeofday(&start, NULL);
+    old_construct(&ot, n / 8);
+    for (i = 1; i <= n; i++) old_insert64((uint64_t) i << 20, &ot, &ot);
+    ns[INSERT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 1; i <= n; i++) found += !!old_lookup64((uint64_t) i << 20, &ot);
+    ns[HIT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 1; i <= n; i++) found += !!old_lookup64(((uint64_t) i << 20) + 1, &ot);
+    ns[MISS] = bench_since(&start) * 1e9 / n;
+
+    /* deleting is the same walk as a hit */
+    ns[DELETE] = ns[HIT];
+
+    if (found != n) fatal("old u64 lookup is broken", EX_SOFTWARE);
+    old_free(&ot);
+}
+
+/* guids, as JMAP Email/query dedups them: as good as random */
+static char *make_guids(unsigned n, int miss)
+{
+    char *guids = xmalloc(n * 12);
+    uint64_t x = miss ? 0x9e3779b97f4a7c15 : 0x2545f4914f6cdd1d;
+    unsigned i;
+
+    for (i = 0; i < n * 3; i++) {
+        uint32_t word;
+
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        word = x >> 32;
+        memcpy(guids + i * 4, &word, 4);
+    }
+
+    return guids;
+}
+
+static void bench_hashset(const char *guids, const char *misses, unsigned n,
+                          double *ns)
+{
+    struct hashset *hs = hashset_new(12);
+    struct timeval start;
+    unsigned i, found = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) hashset_add(hs, guids + i * 12);
+    ns[INSERT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) found += hashset_exists(hs, guids + i * 12);
+    ns[HIT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) found += hashset_exists(hs, misses + i * 12);
+    ns[MISS] = bench_since(&start) * 1e9 / n;
+
+    ns[DELETE] = 0;
+
+    if (found != n) fatal("hashset_exists is broken", EX_SOFTWARE);
+    hashset_free(&hs);
+}
+
+static void bench_oldset(const char *guids, const char *misses, unsigned n,
+                         double *ns)
+{
+    struct old_hashset *hs = xzmalloc(sizeof(struct old_hashset));
+    struct timeval start;
+    unsigned i, found = 0;
+
+    hs->recsize = 12 + 4;
+    hs->data = xmalloc(n * hs->recsize);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) old_hashset_add(hs, guids + i * 12, 12);
+    ns[INSERT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) found += old_hashset_exists(hs, guids + i * 12, 12);
+    ns[HIT] = bench_since(&start) * 1e9 / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) found += old_hashset_exists(hs, misses + i * 12, 12);
+    ns[MISS] = bench_since(&start) * 1e9 / n;
+
+    ns[DELETE] = 0;
+
+    if (found != n) fatal("old hashset is broken", EX_SOFTWARE);
+    free(hs->data);
+    free(hs);
+}
+
+/* 'times' holds NOPS timings for each run */
+static void report(const char *what, double *times)
+{
+    double *col = xmalloc(RUNS * sizeof(double));
+    int op, i;
+
+    printf("%-22s", what);
+    for (op = 0; op < NOPS; op++) {
+        for (i = 0; i < RUNS; i++) col[i] = times[i * NOPS + op];
+        bench_sort(col, RUNS);
+        if (col[RUNS / 2] > 0)
+            printf("  %s %7.1f", op_name[op], col[RUNS / 2]);
+    }
+    printf("  ns/op (median)\n");
+
+    free(col);
+}
+
+int main(int argc, char *argv[])
+{
+    double *now, *old;
+    enum keytype type;
+    char buf[64];
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "c:n:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            COUNT = atoi(optarg);
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], NULL, usage_options);
+        }
+    }
+
+    if (optind != argc || RUNS < 1 || COUNT < 8)
+        bench_usage(argv[0], NULL, usage_options);
+
+    now = xmalloc(RUNS * NOPS * sizeof(double));
+    old = xmalloc(RUNS * NOPS * sizeof(double));
+
+    printf("%u keys, tables constructed for %u\n", COUNT, COUNT / 8);
+
+    for (type = MBOXNAME; type <= NUMBER; type++) {
+        char **keys = make_keys(type, COUNT, 0);
+        char **misses = make_keys(type, COUNT, 1);
+
+        for (i = 0; i < RUNS; i++) {
+            bench_hash(keys, misses, COUNT, now + i * NOPS);
+            bench_old(keys, misses, COUNT, old + i * NOPS);
+        }
+        snprintf(buf, sizeof(buf), "hash %s", keytype_name[type]);
+        report(buf, now);
+        report("  (chained)", old);
+
+        free_keys(keys, COUNT);
+        free_keys(misses, COUNT);
+    }
+
+    for (i = 0; i < RUNS; i++) {
+        bench_hashu64(COUNT, now + i * NOPS);
+        bench_oldu64(COUNT, old + i * NOPS);
+    }
+    report("hashu64", now);
+    report("  (chained)", old);
+
+    {
+        char *guids = make_guids(COUNT, 0);
+        char *misses = make_guids(COUNT, 1);
+
+        for (i = 0; i < RUNS; i++) {
+            bench_hashset(guids, misses, COUNT, now + i * NOPS);
+            bench_oldset(guids, misses, COUNT, old + i * NOPS);
+        }
+        report("hashset guid", now);
+        report("  (two byte chains)", old);
+
+        free(guids);
+        free(misses);
+    }
+
+    free(now);
+    free(old);
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+/* indexbench.c: cyrus.index scan benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Times the index scans that only need flags and modseqs: a full
+ * record iteration, the same with ITER_HOTFIELDS, and the refresh
+ * that IDLE and NOOP do.  Run it against a big mailbox once per index
+ * version to compare layouts:
+ *
+ *   indexbench -V 17 user.big
+ *   indexbench -V 18 user.big
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sysexits.h>
+
+#include "bench/benchutil.h"
+#include "global.h"
+#include "index.h"
+#include "mailbox.h"
+#include "util.h"
+
+/* generated headers are not necessarily in current directory */
+#include "imap/imap_err.h"
+
+static int RUNS = 5;
+
+static const char * const usage_options[] = {
+    "-C      alternate config file",
+    "-V      set the index version first (e.g. 17, 18)",
+    "-n      runs of each scan (default: 5)",
+    NULL
+};
+
+static void report(const char *what, struct mailbox *mailbox, double secs)
+{
+    printf("v%-3d %-8s %u records: %.4fs per run, %.1f Mrecords/s\n",
+           mailbox->i.minor_version, what, mailbox->i.num_records,
+           secs / RUNS, RUNS * mailbox->i.num_records / secs / 1000000.0);
+}
+
+/* count \Seen, as the STATUS and SELECT fallbacks do */
+static void bench_scan(struct mailbox *mailbox, const char *what,
+                       unsigned flags)
+{
+    struct timeval start;
+    unsigned seen = 0;
+    int i;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < RUNS; i++) {
+        struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, flags);
+        const message_t *msg;
+
+        while ((msg = mailbox_iter_step(iter))) {
+            const struct index_record *record = msg_record(msg);
+            if (record->system_flags & FLAG_SEEN) seen++;
+        }
+        mailbox_iter_done(&iter);
+    }
+    report(what, mailbox, bench_since(&start));
+}
+
+static int bench_refresh(const char *name)
+{
+    struct index_state *state = NULL;
+    struct timeval start;
+    int i, r;
+
+    r = index_open(name, NULL, &state);
+    if (r) return r;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; !r && i < RUNS; i++) {
+        /* pretend something changed, so the whole map gets re-read */
+        state->highestmodseq = 0;
+        r = index_refresh(state);
+    }
+    if (!r) report("refresh", state->mailbox, bench_since(&start));
+
+    index_close(&state);
+    return r;
+}
+
+int main(int argc, char *argv[])
+{
+    struct mailbox *mailbox = NULL;
+    const char *alt_config = NULL;
+    const char *name;
+    int opt, version = 0, r;
+
+    while ((opt = getopt(argc, argv, "C:V:n:h")) != -1) {
+        switch (opt) {
+        case 'C':
+            alt_config = optarg;
+            break;
+        case 'V':
+            version = atoi(optarg);
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], "mailbox", usage_options);
+        }
+    }
+
+    if (optind != argc - 1 || RUNS < 1)
+        bench_usage(argv[0], "mailbox", usage_options);
+    name = argv[optind];
+
+    cyrus_init(alt_config, "indexbench", 0, CONFIG_NEED_PARTITION_DATA);
+
+    if (version) {
+        r = mailbox_open_iwl(name, &mailbox);
+        if (!r) r = mailbox_setversion(mailbox, version);
+        mailbox_close(&mailbox);
+        if (r) {
+            fprintf(stderr, "%s: can't set version %d: %s\n",
+                    name, version, error_message(r));
+            exit(EX_SOFTWARE);
+        }
+    }
+
+    r = mailbox_open_irl(name, &mailbox);
+    if (r) {
+        fprintf(stderr, "%s: %s\n", name, error_message(r));
+        exit(EX_SOFTWARE);
+    }
+    bench_scan(mailbox, "full", 0);
+    bench_scan(mailbox, "hot", ITER_HOTFIELDS);
+    mailbox_close(&mailbox);
+
+    r = bench_refresh(name);
+    if (r) {
+        fprintf(stderr, "%s: refresh failed: %s\n", name, error_message(r));
+        exit(EX_SOFTWARE);
+    }
+
+    cyrus_done();
+
+    return 0;
+}
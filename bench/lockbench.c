@@ -0,0 +1,255 @@
+/* lockbench.c: mailbox name lock benchmark.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Times mailbox name locks the two ways mboxname_lock() can take them:
+ * a lock file per name (fcntl), and the shared-memory lock table.
+ * First one process locks and unlocks many names in turn, then a
+ * number of processes take exclusive locks on a few hot names at once,
+ * holding each for a while, the way a burst of deliveries to the same
+ * users does:
+ *
+ *   lockbench
+ *   lockbench -p 32 -k 4 -n 200 -t 200
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "bench/benchutil.h"
+#include "cyr_lock.h"
+#include "locktable.h"
+#include "util.h"
+#include "xmalloc.h"
+
+EXPORTED void fatal(const char *message, int code)
+{
+    fprintf(stderr, "fatal error: %s\n", message);
+    exit(code);
+}
+
+static const char * const usage_options[] = {
+    "-d      directory for lock files (default: /tmp)",
+    "-f      names for the single process run (default: 10000)",
+    "-k      hot names (default: 4)",
+    "-n      locks per process (default: 200)",
+    "-p      processes (default: 16)",
+    "-t      microseconds each lock is held (default: 100)",
+    NULL
+};
+
+static const char *lockdir;
+static struct locktable *table;
+
+/* what mboxname_lock() and mboxname_release() do for each method */
+
+static int lock_name(int use_table, const char *name, int *fdp)
+{
+    char fname[1024];
+
+    if (use_table)
+        return locktable_lock(table, name, /*exclusive*/1, /*nonblock*/0,
+                              NULL);
+
+    snprintf(fname, sizeof(fname), "%s/%s.lock", lockdir, name);
+    *fdp = open(fname, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (*fdp == -1) return -1;
+
+    return lock_setlock(*fdp, /*exclusive*/1, /*nonblock*/0, fname);
+}
+
+static void unlock_name(int use_table, const char *name, int fd)
+{
+    if (use_table) {
+        locktable_unlock(table, name);
+        return;
+    }
+
+    lock_unlock(fd, name);
+    close(fd);
+}
+
+static double run_single(int use_table, int nnames)
+{
+    struct timeval start;
+    char name[64];
+    int i, fd = -1;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nnames; i++) {
+        snprintf(name, sizeof(name), "user.u%d", i);
+        if (lock_name(use_table, name, &fd)) fatal("lock failed", EX_OSERR);
+        unlock_name(use_table, name, fd);
+    }
+
+    return bench_since(&start);
+}
+
+static double run_contended(int use_table, int nprocs, int nlocks,
+                            int nhot, int hold_usec)
+{
+    struct timeval start;
+    pid_t *pids = xmalloc(nprocs * sizeof(pid_t));
+    int i, j, status, failed = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nprocs; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) fatal("fork failed", EX_OSERR);
+        if (pids[i]) continue;
+
+        for (j = 0; j < nlocks; j++) {
+            char name[64];
+            int fd = -1;
+
+            snprintf(name, sizeof(name), "user.hot%d", (i + j) % nhot);
+            if (lock_name(use_table, name, &fd)) _exit(1);
+            if (hold_usec) usleep(hold_usec);
+            unlock_name(use_table, name, fd);
+        }
+        _exit(0);
+    }
+
+    for (i = 0; i < nprocs; i++) {
+        waitpid(pids[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) failed++;
+    }
+    free(pids);
+
+    if (failed) fatal("a locking process failed", EX_SOFTWARE);
+
+    return bench_since(&start);
+}
+
+static int print_hot(const struct locktable_info *info,
+                     void *rock __attribute__((unused)))
+{
+    if (!info->nwaits) return 0;
+
+    printf("  %-12s %6llu locks %6llu waits  %8.1fms waiting  max %.1fms\n",
+           info->name,
+           (unsigned long long) info->nlocks,
+           (unsigned long long) info->nwaits,
+           info->wait_usec / 1000.0, info->max_wait_usec / 1000.0);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char tablename[64];
+    int nnames = 10000, nhot = 4, nlocks = 200, nprocs = 16, hold_usec = 100;
+    int opt, use_table;
+    double secs;
+
+    lockdir = "/tmp";
+
+    while ((opt = getopt(argc, argv, "d:f:k:n:p:t:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            lockdir = optarg;
+            break;
+        case 'f':
+            nnames = atoi(optarg);
+            break;
+        case 'k':
+            nhot = atoi(optarg);
+            break;
+        case 'n':
+            nlocks = atoi(optarg);
+            break;
+        case 'p':
+            nprocs = atoi(optarg);
+            break;
+        case 't':
+            hold_usec = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], NULL, usage_options);
+        }
+    }
+
+    if (optind != argc || nnames < 1 || nhot < 1 || nlocks < 1 ||
+        nprocs < 1 || hold_usec < 0)
+        bench_usage(argv[0], NULL, usage_options);
+
+    snprintf(tablename, sizeof(tablename), "/cyrus-lockbench-%d",
+             (int) getpid());
+    if (locktable_open(tablename, &table)) {
+        perror("locktable_open");
+        exit(EX_OSERR);
+    }
+
+    for (use_table = 0; use_table < 2; use_table++) {
+        const char *method = use_table ? "shm" : "file";
+
+        secs = run_single(use_table, nnames);
+        printf("%-5s %d names, one process: %.0f locks/sec\n",
+               method, nnames, nnames / secs);
+
+        secs = run_contended(use_table, nprocs, nlocks, nhot, hold_usec);
+        printf("%-5s %d processes on %d names, held %dus: %.0fms, %.0f locks/sec\n",
+               method, nprocs, nhot, hold_usec, secs * 1000,
+               nprocs * nlocks / secs);
+    }
+
+    printf("waits on the hot names (shm):\n");
+    locktable_foreach(table, print_hot, NULL);
+
+    locktable_close(&table);
+    shm_unlink(tablename);
+
+    return 0;
+}
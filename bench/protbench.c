@@ -0,0 +1,307 @@
+/* protbench.c: protstream output benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Writes a large literal through a protstream to a socketpair, and
+ * reports the write syscalls, wall and CPU time it took.  The reader
+ * is a child process that just drains the socket (completing the TLS
+ * handshake first, for the tls mode).
+ *
+ *   protbench -m plain -s 100
+ *   protbench -m plain -s 100 -b 4096     # as before adaptive buffers
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench/benchutil.h"
+#include "prot.h"
+#include "util.h"
+#include "xmalloc.h"
+
+static const char *MODE = "plain";
+static unsigned MAXBUF = PROT_BUFSIZE_MAX;
+static size_t CHUNK = 65536;
+static size_t MEGS = 100;
+
+static struct option long_options[] = {
+        {"mode", required_argument, NULL, 'm'},
+        {"maxbuf", required_argument, NULL, 'b'},
+        {"chunk", required_argument, NULL, 'c'},
+        {"size", required_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+};
+
+EXPORTED void fatal(const char *message, int code)
+{
+  static int recurse_code = 0;
+
+  if (recurse_code) {
+    exit(code);
+  }
+
+  recurse_code = code;
+  fprintf(stderr, "fatal error: %s\n", message);
+  exit(code);
+}
+
+static void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [OPTION]...\n", progname);
+    fprintf(stderr, "  -m, --mode      plain, tls, deflate or zstd (default: plain)\n");
+    fprintf(stderr, "  -b, --maxbuf    largest protstream buffer (default: %u)\n",
+            PROT_BUFSIZE_MAX);
+    fprintf(stderr, "  -c, --chunk     bytes per prot_write() call (default: 65536)\n");
+    fprintf(stderr, "  -s, --size      megabytes of literal to write (default: 100)\n");
+    exit(EXIT_FAILURE);
+}
+
+/* write syscalls made by this process so far, or -1 if the kernel
+ * doesn't do per-task I/O accounting */
+static long write_syscalls(void)
+{
+    FILE *f = fopen("/proc/self/io", "r");
+    char line[128];
+    long n = -1;
+
+    if (!f) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "syscw: %ld", &n) == 1) break;
+    }
+    fclose(f);
+
+    return n;
+}
+
+/* something like a message body: compressible, but not trivially */
+static void fill_chunk(char *buf, size_t len)
+{
+    static const char *words[] = {
+        "the ", "message ", "mailbox ", "cyrus ", "replication ",
+        "literal ", "Received: ", "from ", "by ", "with ", "ESMTP ",
+        "\r\n", "Subject: ", "Re: ", "quota ", "annotation "
+    };
+    unsigned seed = 42;
+    size_t i = 0;
+
+    while (i < len) {
+        const char *w = words[(seed = seed * 1103515245 + 12345) >> 28];
+        size_t n = strlen(w);
+
+        if (n > len - i) n = len - i;
+        memcpy(buf + i, w, n);
+        i += n;
+        if (i < len && !(seed & 0x300)) buf[i++] = 'A' + (seed & 0x1f);
+    }
+}
+
+#ifdef HAVE_SSL
+static SSL_CTX *bench_ssl_ctx(int server)
+{
+    SSL_CTX *ctx = SSL_CTX_new(server ? TLS_server_method()
+                                      : TLS_client_method());
+
+    if (!ctx) fatal("SSL_CTX_new failed", EXIT_FAILURE);
+
+    /* anonymous DH keeps the benchmark free of certificates */
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_cipher_list(ctx, "ADH-AES128-GCM-SHA256:@SECLEVEL=0");
+    SSL_CTX_set_dh_auto(ctx, 1);
+
+    return ctx;
+}
+#endif /* HAVE_SSL */
+
+static void reader(int fd, int tls)
+{
+    char buf[65536];
+    ssize_t n;
+
+#ifdef HAVE_SSL
+    if (tls) {
+        SSL *ssl = SSL_new(bench_ssl_ctx(0));
+
+        SSL_set_fd(ssl, fd);
+        if (SSL_connect(ssl) != 1) fatal("SSL_connect failed", EXIT_FAILURE);
+        while (SSL_read(ssl, buf, sizeof(buf)) > 0);
+        _exit(0);
+    }
+#else
+    (void) tls;
+#endif
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR));
+    _exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    struct protstream *out;
+    struct timeval start, end;
+    double cpu, wall;
+    long syscw;
+    size_t total, left;
+    int sv[2], opt, tls = 0;
+    pid_t pid;
+    char *chunk;
+
+    while ((opt = getopt_long(argc, argv, "m:b:c:s:h",
+                              long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            MODE = optarg;
+            break;
+        case 'b':
+            MAXBUF = atoi(optarg);
+            break;
+        case 'c':
+            CHUNK = atol(optarg);
+            break;
+        case 's':
+            MEGS = atol(optarg);
+            break;
+        case 'h':
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (!CHUNK || !MEGS) usage(argv[0]);
+    if (!strcmp(MODE, "tls")) tls = 1;
+    else if (strcmp(MODE, "plain") && strcmp(MODE, "deflate") &&
+             strcmp(MODE, "zstd")) usage(argv[0]);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        exit(EXIT_FAILURE);
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (!pid) {
+        close(sv[0]);
+        reader(sv[1], tls);
+    }
+    close(sv[1]);
+
+    out = prot_new(sv[0], 1);
+    prot_setmaxbufsize(out, MAXBUF);
+
+    if (tls) {
+#ifdef HAVE_SSL
+        SSL *ssl = SSL_new(bench_ssl_ctx(1));
+
+        SSL_set_fd(ssl, sv[0]);
+        if (SSL_accept(ssl) != 1) fatal("SSL_accept failed", EXIT_FAILURE);
+        prot_settls(out, ssl);
+#else
+        fatal("tls mode needs OpenSSL", EXIT_FAILURE);
+#endif
+    }
+    else if (strcmp(MODE, "plain")) {
+#ifdef HAVE_ZLIB
+        if (!prot_compress_available(!strcmp(MODE, "zstd") ? "ZSTD" : "DEFLATE") ||
+            prot_setcompress_alg(out, !strcmp(MODE, "zstd") ? "ZSTD" : "DEFLATE"))
+            fatal("compression not available", EXIT_FAILURE);
+#else
+        fatal("compression needs zlib", EXIT_FAILURE);
+#endif
+    }
+
+    chunk = xmalloc(CHUNK);
+    fill_chunk(chunk, CHUNK);
+    total = MEGS * 1024 * 1024;
+
+    syscw = write_syscalls();
+    cpu = bench_cpu_seconds();
+    gettimeofday(&start, NULL);
+
+    prot_printf(out, "* 1 FETCH (BODY[] {" SIZE_T_FMT "}\r\n", total);
+    for (left = total; left; ) {
+        size_t n = left < CHUNK ? left : CHUNK;
+
+        if (prot_write(out, chunk, n) == EOF) break;
+        left -= n;
+    }
+    prot_printf(out, ")\r\n");
+    prot_flush(out);
+
+    gettimeofday(&end, NULL);
+    cpu = bench_cpu_seconds() - cpu;
+    if (syscw >= 0) syscw = write_syscalls() - syscw;
+    wall = (end.tv_sec - start.tv_sec) +
+        (end.tv_usec - start.tv_usec) / 1000000.0;
+
+    if (prot_error(out)) {
+        fprintf(stderr, "write failed: %s\n", prot_error(out));
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-8s maxbuf=%-7u chunk=%-8zu %zu MB: %ld write syscalls, "
+           "%.3fs wall, %.3fs cpu, %.1f MB/s\n",
+           MODE, MAXBUF, CHUNK, MEGS, syscw, wall, cpu, MEGS / wall);
+
+    prot_free(out);
+    close(sv[0]);
+    waitpid(pid, NULL, 0);
+    free(chunk);
+
+    return 0;
+}
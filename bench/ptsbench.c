@@ -0,0 +1,352 @@
+/* ptsbench.c: pts auth_state cache load test.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Simulates a login storm against the pts cache: a number of client
+ * processes log in (canonify, then newstate) as users drawn from a
+ * small pool, some of which don't exist.  They talk to a stub ptloader
+ * forked by the benchmark, which speaks the real protocol and writes
+ * the real ptscache db, but makes its answers up after a fixed delay
+ * instead of asking a directory, so no LDAP server is needed:
+ *
+ *   ptsbench
+ *   ptsbench -S -N          (as ptloader behaved before: no coalescing,
+ *                            no negative caching)
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+
+#include "auth.h"
+#include "auth_pts.h"
+#include "bench/benchutil.h"
+#include "cyrusdb.h"
+#include "libcyr_cfg.h"
+#include "retry.h"
+#include "strhash.h"
+#include "util.h"
+#include "xmalloc.h"
+#include "xstrlcpy.h"
+
+#define CACHE_TIMEOUT    (3 * 60 * 60)
+#define NEGATIVE_TIMEOUT (5 * 60)
+
+static int nclients = 20;
+static int nlogins = 50;
+static int nusers = 50;
+static int missing = 20;        /* percent of logins as unknown users */
+static int ngroups = 20;
+static int latency = 20;        /* ms per stub directory lookup */
+static int coalesce = 1;
+static int negative = 1;
+
+static volatile sig_atomic_t stub_done;
+
+EXPORTED void fatal(const char *message, int code)
+{
+    fprintf(stderr, "fatal error: %s\n", message);
+    exit(code);
+}
+
+static const char * const usage_options[] = {
+    "-c      client processes (default: 20)",
+    "-n      logins per client (default: 50)",
+    "-u      distinct users (default: 50)",
+    "-m      percent of logins as unknown users (default: 20)",
+    "-g      groups per user (default: 20)",
+    "-l      stub lookup latency in ms (default: 20)",
+    "-S      don't coalesce requests in the stub ptloader",
+    "-N      don't cache unknown identifiers",
+    NULL
+};
+
+/* the stub directory: "userN" exists and is in ngroups groups,
+ * anything else doesn't */
+static struct auth_state *stub_lookup(const char *id, int *dsize)
+{
+    struct auth_state *state;
+    int exists = !strncmp(id, "user", 4);
+    int i;
+
+    poll(NULL, 0, latency);
+
+    *dsize = sizeof(struct auth_state) +
+        (exists ? ngroups * sizeof(struct auth_ident) : 0);
+    state = xzmalloc(*dsize);
+    strlcpy(state->userid.id, id, sizeof(state->userid.id));
+    state->userid.hash = strhash(id);
+    state->mark = time(0);
+    if (!exists) {
+        state->ngroups = PTS_NEGATIVE;
+        state->mark -= CACHE_TIMEOUT - NEGATIVE_TIMEOUT;
+        return state;
+    }
+
+    state->ngroups = ngroups;
+    for (i = 0; i < ngroups; i++) {
+        snprintf(state->groups[i].id, sizeof(state->groups[i].id),
+                 "group:team%u", (strhash(id) + i) % 100);
+        state->groups[i].hash = strhash(state->groups[i].id);
+    }
+
+    return state;
+}
+
+static void stub_stop(int sig __attribute__((unused)))
+{
+    stub_done = 1;
+}
+
+/* one request at a time, like a single ptloader process */
+static void stub_ptloader(int s, const char *dbpath)
+{
+    unsigned requests = 0, lookups = 0, notfound = 0;
+    struct sigaction action;
+    struct db *db = NULL;
+    int r;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stub_stop;
+    sigaction(SIGTERM, &action, NULL);
+
+    r = cyrusdb_open("twoskip", dbpath, CYRUSDB_CREATE, &db);
+    if (r) fatal("can't open ptscache db", EX_IOERR);
+
+    while (!stub_done) {
+        char user[PTS_DB_KEYSIZE + 1];
+        const char *reply = "OK";
+        const char *data = NULL;
+        size_t size = 0, datalen = 0;
+        struct auth_state *state;
+        int c, dsize;
+
+        c = accept(s, NULL, NULL);
+        if (c < 0) continue;
+        requests++;
+
+        memset(user, 0, sizeof(user));
+        if (retry_read(c, &size, sizeof(size)) != sizeof(size) ||
+            !size || size > PTS_DB_KEYSIZE ||
+            retry_read(c, user, size) != (ssize_t) size) {
+            close(c);
+            continue;
+        }
+
+        if (coalesce &&
+            !cyrusdb_fetch(db, user, size, &data, &datalen, NULL) &&
+            ((const struct auth_state *) data)->mark >
+            time(0) - CACHE_TIMEOUT) {
+            goto sendreply;
+        }
+
+        state = stub_lookup(user, &dsize);
+        lookups++;
+        if (state->ngroups == PTS_NEGATIVE) {
+            notfound++;
+            if (!negative) {
+                free(state);
+                reply = "identifier not found";
+                goto sendreply;
+            }
+        }
+        cyrusdb_store(db, user, size, (const char *) state, dsize, NULL);
+        free(state);
+
+    sendreply:
+        retry_write(c, reply, strlen(reply) + 1);
+        close(c);
+    }
+
+    cyrusdb_close(db);
+    printf("ptloader: %u requests, %u directory lookups (%u not found)\n",
+           requests, lookups, notfound);
+    exit(0);
+}
+
+/* what a login does: canonify the name, then build the auth_state */
+static void client(int n)
+{
+    unsigned seed = n + 1;
+    int i;
+
+    for (i = 0; i < nlogins; i++) {
+        struct auth_state *state;
+        const char *canon;
+        char id[64];
+
+        if ((int) (rand_r(&seed) % 100) < missing)
+            snprintf(id, sizeof(id), "ghost%d", rand_r(&seed) % nusers);
+        else
+            snprintf(id, sizeof(id), "user%d", rand_r(&seed) % nusers);
+
+        canon = auth_canonifyid(id, 0);
+        state = auth_newstate(canon ? canon : id);
+        auth_freestate(state);
+    }
+
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/ptsbench.XXXXXX";
+    struct sockaddr_un addr;
+    struct timeval start;
+    char *dbpath, *sockpath;
+    pid_t stub;
+    double secs;
+    int opt, s, i;
+
+    while ((opt = getopt(argc, argv, "c:n:u:m:g:l:SNh")) != -1) {
+        switch (opt) {
+        case 'c':
+            nclients = atoi(optarg);
+            break;
+        case 'n':
+            nlogins = atoi(optarg);
+            break;
+        case 'u':
+            nusers = atoi(optarg);
+            break;
+        case 'm':
+            missing = atoi(optarg);
+            break;
+        case 'g':
+            ngroups = atoi(optarg);
+            break;
+        case 'l':
+            latency = atoi(optarg);
+            break;
+        case 'S':
+            coalesce = 0;
+            break;
+        case 'N':
+            negative = 0;
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], NULL, usage_options);
+        }
+    }
+
+    if (optind != argc || nclients < 1 || nlogins < 1 || nusers < 1 ||
+        ngroups < 0 || latency < 0)
+        bench_usage(argv[0], NULL, usage_options);
+
+    if (!mkdtemp(dir)) {
+        perror(dir);
+        exit(EX_CANTCREAT);
+    }
+    dbpath = strconcat(dir, "/ptscache.db", (char *)NULL);
+    sockpath = strconcat(dir, "/ptsock", (char *)NULL);
+
+    libcyrus_config_setstring(CYRUSOPT_CONFIG_DIR, dir);
+    libcyrus_config_setstring(CYRUSOPT_AUTH_MECH, "pts");
+    libcyrus_config_setstring(CYRUSOPT_PTSCACHE_DB, "twoskip");
+    libcyrus_config_setstring(CYRUSOPT_PTSCACHE_DB_PATH, dbpath);
+    libcyrus_config_setstring(CYRUSOPT_PTLOADER_SOCK, sockpath);
+    libcyrus_config_setint(CYRUSOPT_PTS_CACHE_TIMEOUT, CACHE_TIMEOUT);
+    cyrusdb_init();
+
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strlcpy(addr.sun_path, sockpath, sizeof(addr.sun_path));
+    if (s < 0 || bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(s, 1024) < 0) {
+        perror(sockpath);
+        exit(EX_OSERR);
+    }
+
+    stub = fork();
+    if (!stub) stub_ptloader(s, dbpath);
+    close(s);
+
+    printf("%d clients x %d logins, %d users, %d%% unknown, "
+           "%dms per lookup%s%s\n", nclients, nlogins, nusers, missing,
+           latency, coalesce ? "" : ", no coalescing",
+           negative ? "" : ", no negative caching");
+    fflush(stdout);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nclients; i++) {
+        if (!fork()) client(i);
+    }
+    for (i = 0; i < nclients; i++) {
+        wait(NULL);
+    }
+    secs = bench_since(&start);
+
+    printf("clients: %.1fms, %.0f logins/s\n", secs * 1000,
+           nclients * nlogins / secs);
+    fflush(stdout);
+
+    /* poke it too, in case the signal landed outside accept() */
+    kill(stub, SIGTERM);
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    connect(s, (struct sockaddr *) &addr, sizeof(addr));
+    close(s);
+    waitpid(stub, NULL, 0);
+
+    cyrusdb_done();
+    unlink(dbpath);
+    unlink(sockpath);
+    rmdir(dir);
+    free(dbpath);
+    free(sockpath);
+
+    return 0;
+}
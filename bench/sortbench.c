@@ -0,0 +1,237 @@
+/* sortbench.c: SORT kernel benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Sorts synthetic message lists of growing size with
+ * index_msgdata_sort(), which uses the radix sort for numeric
+ * criteria, and with a plain qsort over an equivalent comparator, and
+ * reports both.  Nothing is read from disk, so no mailbox is needed:
+ *
+ *   sortbench
+ *   sortbench -s 10000 -m 5000000 -n 3
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "bench/benchutil.h"
+#include "imapd.h"
+#include "index.h"
+#include "util.h"
+#include "xmalloc.h"
+
+static int RUNS = 5;
+
+static const char * const usage_options[] = {
+    "-s      smallest number of messages (default: 10000)",
+    "-m      largest number of messages (default: 5000000)",
+    "-n      runs at each size (default: 5)",
+    NULL
+};
+
+/* the baselines: what the generic comparator does for each */
+
+static int cmp_reverse_date(const void *a, const void *b)
+{
+    const MsgData *md1 = *(MsgData * const *) a;
+    const MsgData *md2 = *(MsgData * const *) b;
+    time_t d1 = md1->sentdate ? md1->sentdate : md1->internaldate;
+    time_t d2 = md2->sentdate ? md2->sentdate : md2->internaldate;
+
+    if (d1 != d2) return d1 < d2 ? 1 : -1;
+    return md1->msgno < md2->msgno ? -1 : md1->msgno > md2->msgno;
+}
+
+static int cmp_reverse_arrival(const void *a, const void *b)
+{
+    const MsgData *md1 = *(MsgData * const *) a;
+    const MsgData *md2 = *(MsgData * const *) b;
+
+    if (md1->internaldate != md2->internaldate)
+        return md1->internaldate < md2->internaldate ? 1 : -1;
+    if (md1->createdmodseq != md2->createdmodseq)
+        return md1->createdmodseq < md2->createdmodseq ? 1 : -1;
+    return md1->uid < md2->uid ? -1 : md1->uid > md2->uid;
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+    const MsgData *md1 = *(MsgData * const *) a;
+    const MsgData *md2 = *(MsgData * const *) b;
+
+    if (md1->size != md2->size) return md1->size < md2->size ? -1 : 1;
+    return md1->msgno < md2->msgno ? -1 : md1->msgno > md2->msgno;
+}
+
+static const struct sortcrit reverse_date[] = {
+    { SORT_DATE, SORT_REVERSE, { { 0 } } },
+    { SORT_SEQUENCE, 0, { { 0 } } }
+};
+
+static const struct sortcrit reverse_arrival[] = {
+    { SORT_ARRIVAL, SORT_REVERSE, { { 0 } } },
+    { SORT_SEQUENCE, 0, { { 0 } } }
+};
+
+static const struct sortcrit size[] = {
+    { SORT_SIZE, 0, { { 0 } } },
+    { SORT_SEQUENCE, 0, { { 0 } } }
+};
+
+static const struct {
+    const char *name;
+    const struct sortcrit *sortcrit;
+    int (*cmp)(const void *, const void *);
+} benches[] = {
+    { "REVERSE DATE",    reverse_date,    cmp_reverse_date },
+    { "REVERSE ARRIVAL", reverse_arrival, cmp_reverse_arrival },
+    { "SIZE",            size,            cmp_size },
+    { NULL, NULL, NULL }
+};
+
+/* a mailbox that was filled over a few years, mostly in date order
+ * but with the odd late delivery */
+static MsgData *make_msgdata(unsigned n)
+{
+    MsgData *md = xzmalloc(n * sizeof(MsgData));
+    time_t t = 1400000000;
+    unsigned i;
+
+    srand(n);
+    for (i = 0; i < n; i++) {
+        t += rand() % 200;
+        md[i].uid = i + 1;
+        md[i].msgno = i + 1;
+        md[i].internaldate = (rand() % 50) ? t : t - rand() % 1000000;
+        md[i].sentdate = md[i].internaldate - rand() % 600;
+        md[i].createdmodseq = i + 1;
+        md[i].modseq = i + 1 + rand() % 1000;
+        md[i].size = 1000 + rand() % 100000;
+    }
+
+    return md;
+}
+
+static double bench_one(MsgData *md, MsgData **msgdata, unsigned n,
+                        const struct sortcrit *sortcrit,
+                        int (*cmp)(const void *, const void *))
+{
+    struct timeval start;
+    unsigned i;
+
+    /* always start from uid order, as index_msgdata_load() leaves it */
+    for (i = 0; i < n; i++)
+        msgdata[i] = &md[i];
+
+    gettimeofday(&start, NULL);
+    if (cmp) qsort(msgdata, n, sizeof(MsgData *), cmp);
+    else index_msgdata_sort(msgdata, n, sortcrit);
+
+    return bench_since(&start);
+}
+
+static void report(const char *what, unsigned n, double *times)
+{
+    bench_sort(times, RUNS);
+    printf("%-16s %8u msgs: min %.4fs  median %.4fs  max %.4fs\n",
+           what, n,
+           times[0], times[RUNS / 2], times[RUNS - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned smallest = 10000, largest = 5000000, n;
+    double *radix, *base;
+    int opt, b, i;
+
+    while ((opt = getopt(argc, argv, "s:m:n:h")) != -1) {
+        switch (opt) {
+        case 's':
+            smallest = atoi(optarg);
+            break;
+        case 'm':
+            largest = atoi(optarg);
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], NULL, usage_options);
+        }
+    }
+
+    if (optind != argc || RUNS < 1 || !smallest || smallest > largest)
+        bench_usage(argv[0], NULL, usage_options);
+
+    radix = xmalloc(RUNS * sizeof(double));
+    base = xmalloc(RUNS * sizeof(double));
+
+    for (n = smallest; n <= largest; n *= 5) {
+        MsgData *md = make_msgdata(n);
+        MsgData **msgdata = xmalloc(n * sizeof(MsgData *));
+
+        for (b = 0; benches[b].name; b++) {
+            for (i = 0; i < RUNS; i++) {
+                radix[i] = bench_one(md, msgdata, n, benches[b].sortcrit, NULL);
+                base[i] = bench_one(md, msgdata, n, NULL, benches[b].cmp);
+            }
+            report(benches[b].name, n, radix);
+            report("  (qsort)", n, base);
+        }
+
+        free(msgdata);
+        free(md);
+    }
+
+    free(radix);
+    free(base);
+
+    return 0;
+}
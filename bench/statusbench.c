@@ -0,0 +1,216 @@
+/* statusbench.c: LIST-STATUS latency benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Times what LIST ... RETURN (STATUS (MESSAGES UNSEEN)) costs for every
+ * folder of one user, optionally while another process keeps delivering
+ * to random folders of that user, so that the statuscache is forever
+ * going stale under it:
+ *
+ *   statusbench -n 50 user1
+ *   statusbench -n 50 -d 20 user1        # 20 deliveries/s meanwhile
+ *   statusbench -n 50 -d 20 -b user1
+ *
+ * Use -i to throw away the statuscache entries before every pass, and
+ * -b to look them all up with status_lookup_many(), as LIST does.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "bench/benchutil.h"
+#include "global.h"
+#include "imapd.h"
+#include "mboxlist.h"
+#include "statuscache.h"
+#include "strarray.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* generated headers are not necessarily in current directory */
+#include "imap/imap_err.h"
+
+static int RUNS = 20;
+static int RATE = 0;
+static int INVALIDATE = 0;
+static int BATCH = 0;
+
+static const char * const usage_options[] = {
+    "-C      alternate config file",
+    "-n      passes over the folder list (default: 20)",
+    "-d      deliveries per second meanwhile (default: 0)",
+    "-i      invalidate the statuscache before each pass",
+    "-b      batch the lookups with status_lookup_many()",
+    NULL
+};
+
+static int add_name(const mbentry_t *mbentry, void *rock)
+{
+    strarray_append((strarray_t *) rock, mbentry->name);
+    return 0;
+}
+
+static int print_error(const char *mboxname, int r,
+                       struct statusdata *sdata __attribute__((unused)),
+                       void *rock __attribute__((unused)))
+{
+    if (r) fprintf(stderr, "%s: %s\n", mboxname, error_message(r));
+    return r;
+}
+
+static void make_message(struct buf *buf, unsigned n, void *rock)
+{
+    const char *userid = rock;
+
+    buf_printf(buf, "From: statusbench <statusbench@example.com>\r\n"
+                    "To: %s\r\n"
+                    "Subject: statusbench %u\r\n"
+                    "\r\n"
+                    "delivery %u\r\n", userid, n, n);
+}
+
+int main(int argc, char *argv[])
+{
+    strarray_t names = STRARRAY_INITIALIZER;
+    const char *alt_config = NULL;
+    const char *userid;
+    pid_t pid;
+    double *passes;
+    int opt, i, r;
+
+    while ((opt = getopt(argc, argv, "C:n:d:ibh")) != -1) {
+        switch (opt) {
+        case 'C':
+            alt_config = optarg;
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'd':
+            RATE = atoi(optarg);
+            break;
+        case 'i':
+            INVALIDATE = 1;
+            break;
+        case 'b':
+            BATCH = 1;
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], "userid", usage_options);
+        }
+    }
+
+    if (optind != argc - 1 || RUNS < 1 || RATE < 0)
+        bench_usage(argv[0], "userid", usage_options);
+    userid = argv[optind];
+
+    pid = bench_deliverer_fork(RATE);
+
+    cyrus_init(alt_config, "statusbench", 0, CONFIG_NEED_PARTITION_DATA);
+    mboxlist_init(0);
+    mboxlist_open(NULL);
+
+    r = mboxlist_usermboxtree(userid, NULL, add_name, &names, 0);
+    if (r || !names.count) {
+        fprintf(stderr, "%s: no folders: %s\n", userid, error_message(r));
+        exit(EX_SOFTWARE);
+    }
+
+    if (!pid)
+        bench_deliverer_run(&names, RATE, make_message, (void *) userid);
+
+    passes = xmalloc(RUNS * sizeof(double));
+    for (i = 0; i < RUNS; i++) {
+        struct timeval start;
+        int j;
+
+        if (INVALIDATE) {
+            for (j = 0; j < names.count; j++)
+                statuscache_invalidate(strarray_nth(&names, j), NULL);
+        }
+
+        gettimeofday(&start, NULL);
+        if (BATCH) {
+            status_lookup_many(&names, userid, STATUS_MESSAGES|STATUS_UNSEEN,
+                               print_error, NULL);
+        }
+        else {
+            for (j = 0; j < names.count; j++) {
+                struct statusdata sdata = STATUSDATA_INIT;
+
+                r = status_lookup_mboxname(strarray_nth(&names, j), userid,
+                                           STATUS_MESSAGES|STATUS_UNSEEN,
+                                           &sdata);
+                if (print_error(strarray_nth(&names, j), r, &sdata, NULL))
+                    break;
+            }
+        }
+        passes[i] = bench_since(&start);
+    }
+
+    bench_deliverer_stop(pid);
+
+    bench_sort(passes, RUNS);
+    printf("%d folders%s, %d deliveries/s: LIST-STATUS min %.2fms, "
+           "median %.2fms, p90 %.2fms, max %.2fms\n",
+           names.count, BATCH ? " (batched)" : "", RATE, passes[0] * 1000, passes[RUNS / 2] * 1000,
+           passes[RUNS * 9 / 10] * 1000, passes[RUNS - 1] * 1000);
+
+    free(passes);
+    strarray_fini(&names);
+    mboxlist_close();
+    mboxlist_done();
+    cyrus_done();
+
+    return 0;
+}
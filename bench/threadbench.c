@@ -0,0 +1,195 @@
+/* threadbench.c: THREAD=REFERENCES benchmark tool.
+ *
+ * Copyright (c) 1994-2019 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Times THREAD=REFERENCES ALL on a mailbox, optionally while another
+ * process keeps delivering to it.  Run it against a big list archive,
+ * once with a config that sets thread_cache_min to 0 for the old
+ * behaviour, and once without; -r removes cyrus.thread before every
+ * run, to time rebuilding it:
+ *
+ *   threadbench -n 20 -d 5 user.lists.archive
+ *   threadbench -C imapd-nothreadcache.conf -n 20 user.lists.archive
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "bench/benchutil.h"
+#include "global.h"
+#include "imapd.h"
+#include "index.h"
+#include "mailbox.h"
+#include "search_expr.h"
+#include "util.h"
+#include "xmalloc.h"
+
+/* generated headers are not necessarily in current directory */
+#include "imap/imap_err.h"
+
+static int RUNS = 10;
+static int RATE = 0;
+static int REMOVE = 0;
+
+static const char * const usage_options[] = {
+    "-C      alternate config file",
+    "-n      THREADs to run (default: 10)",
+    "-d      deliveries per second meanwhile (default: 0)",
+    "-r      remove cyrus.thread before each THREAD",
+    NULL
+};
+
+/* replies to the message before, so the threads keep growing */
+static void make_message(struct buf *buf, unsigned n,
+                         void *rock __attribute__((unused)))
+{
+    buf_printf(buf, "From: threadbench <threadbench@example.com>\r\n"
+                    "Message-ID: <%u.%d@threadbench>\r\n", n, getpid());
+    if (n) buf_printf(buf, "References: <%u.%d@threadbench>\r\n",
+                      n - 1, getpid());
+    buf_printf(buf, "Subject: %sthreadbench\r\n"
+                    "\r\n"
+                    "delivery %u\r\n", n ? "Re: " : "", n);
+}
+
+int main(int argc, char *argv[])
+{
+    struct searchargs *searchargs;
+    struct index_state *state = NULL;
+    struct index_init init;
+    const char *alt_config = NULL;
+    const char *name;
+    strarray_t names = STRARRAY_INITIALIZER;
+    char *fname;
+    double *times;
+    pid_t pid;
+    char algname[] = "REFERENCES";  /* find_thread_algorithm() ucases it */
+    int opt, alg, i, r;
+
+    while ((opt = getopt(argc, argv, "C:n:d:rh")) != -1) {
+        switch (opt) {
+        case 'C':
+            alt_config = optarg;
+            break;
+        case 'n':
+            RUNS = atoi(optarg);
+            break;
+        case 'd':
+            RATE = atoi(optarg);
+            break;
+        case 'r':
+            REMOVE = 1;
+            break;
+        case 'h':
+        default:
+            bench_usage(argv[0], "mailbox", usage_options);
+        }
+    }
+
+    if (optind != argc - 1 || RUNS < 1 || RATE < 0)
+        bench_usage(argv[0], "mailbox", usage_options);
+    name = argv[optind];
+    strarray_append(&names, name);
+
+    pid = bench_deliverer_fork(RATE);
+
+    cyrus_init(alt_config, "threadbench", 0, CONFIG_NEED_PARTITION_DATA);
+
+    if (!pid) bench_deliverer_run(&names, RATE, make_message, NULL);
+
+    memset(&init, 0, sizeof(struct index_init));
+    init.out = prot_new(open("/dev/null", O_WRONLY), 1);
+
+    r = index_open(name, &init, &state);
+    if (r) {
+        fprintf(stderr, "%s: %s\n", name, error_message(r));
+        exit(EX_SOFTWARE);
+    }
+    fname = xstrdup(mailbox_meta_fname(state->mailbox, META_THREAD));
+
+    alg = find_thread_algorithm(algname);
+    searchargs = new_searchargs("*", GETSEARCH_CHARSET_FIRST, NULL,
+                                NULL, NULL, 1);
+    searchargs->root = search_expr_new(NULL, SEOP_TRUE);
+
+    times = xmalloc(RUNS * sizeof(double));
+    for (i = 0; i < RUNS; i++) {
+        struct timeval start;
+
+        if (REMOVE) unlink(fname);
+
+        gettimeofday(&start, NULL);
+        index_thread(state, alg, searchargs, /*usinguid*/1);
+        times[i] = bench_since(&start);
+        prot_flush(init.out);
+    }
+
+    bench_deliverer_stop(pid);
+
+    printf("%s: %u messages, thread_cache_min %d, %d deliveries/s: "
+           "first %.2fms\n", name, state->exists,
+           config_getint(IMAPOPT_THREAD_CACHE_MIN), RATE, times[0] * 1000);
+    bench_sort(times, RUNS);
+    printf("THREAD min %.2fms, median %.2fms, p90 %.2fms, max %.2fms\n",
+           times[0] * 1000, times[RUNS / 2] * 1000,
+           times[RUNS * 9 / 10] * 1000, times[RUNS - 1] * 1000);
+
+    free(times);
+    strarray_fini(&names);
+    free(fname);
+    freesearchargs(searchargs);
+    index_close(&state);
+    prot_free(init.out);
+    cyrus_done();
+
+    return 0;
+}
@@ -220,6 +220,26 @@ struct annotate_db
     struct db *db;
     struct txn *txn;
     int in_txn;
+    struct annotate_msgcache *cache;
+};
+
+/* Decoded message annotations for a set of UIDs, loaded in one scan by
+ * annotatemore_cache_uids() and held until annotatemore_uncache().
+ * Records are sorted by uid, and within a uid in database order. */
+struct annotate_msgcache_rec {
+    uint32_t uid;
+    char *entry;
+    char *userid;
+    struct buf value;
+    struct annotate_metadata mdata;
+};
+
+struct annotate_msgcache {
+    int refcount;
+    struct seqset *uids;        /* NULL once a write invalidated it */
+    struct annotate_msgcache_rec *recs;
+    size_t nrecs;
+    size_t alloc;
 };
 
 #define DB config_annotation_db
@@ -724,6 +744,35 @@ HIDDEN int annotate_getdb(const char *mboxname, annotate_db_t **dbp)
     return _annotate_getdb(mboxname, 1, CYRUSDB_CREATE, dbp);
 }
 
+static void msgcache_free(struct annotate_msgcache **cachep)
+{
+    struct annotate_msgcache *c = *cachep;
+    size_t i;
+
+    if (!c) return;
+
+    for (i = 0; i < c->nrecs; i++) {
+        free(c->recs[i].entry);
+        free(c->recs[i].userid);
+        buf_free(&c->recs[i].value);
+    }
+    free(c->recs);
+    seqset_free(c->uids);
+    free(c);
+    *cachep = NULL;
+}
+
+/* Stop answering from the cache once the db changes underneath it.
+ * The records stay allocated until annotatemore_uncache(), in case a
+ * findall() callback is walking them while it writes. */
+static void msgcache_invalidate(annotate_db_t *d)
+{
+    if (d->cache) {
+        seqset_free(d->cache->uids);
+        d->cache->uids = NULL;
+    }
+}
+
 static void annotate_closedb(annotate_db_t *d)
 {
     annotate_db_t *dx, *prev = NULL;
@@ -745,6 +794,7 @@ static void annotate_closedb(annotate_db_t *d)
         syslog(LOG_ERR, "DBERROR: error closing annotations %s: %s",
                d->filename, cyrusdb_strerror(r));
 
+    msgcache_free(&d->cache);
     free(d->filename);
     free(d->mboxname);
     memset(d, 0, sizeof(*d));   /* JIC */
@@ -1003,6 +1053,7 @@ struct find_rock {
     struct glob *mglob;
     struct glob *eglob;
     unsigned int uid;
+    struct seqset *uids;
     modseq_t since_modseq;
     annotate_db_t *d;
     annotatemore_find_proc_t proc;
@@ -1031,6 +1082,8 @@ static int find_p(void *rock, const char *key, size_t keylen,
         frock->uid != ANNOTATE_ANY_UID &&
         frock->uid != uid)
         return 0;
+    if (frock->uids && !seqset_ismember(frock->uids, uid))
+        return 0;
     if (!GLOB_MATCH(frock->mglob, mboxname))
         return 0;
     if (!GLOB_MATCH(frock->eglob, entry))
@@ -1099,13 +1152,92 @@ static int find_cb(void *rock, const char *key, size_t keylen,
     return r;
 }
 
-EXPORTED int annotatemore_findall(const char *mboxname, /* internal */
-                         unsigned int uid,
-                         const char *entry,
-                         modseq_t since_modseq,
-                         annotatemore_find_proc_t proc,
-                         void *rock,
-                         int flags)
+static int msgcache_covers(annotate_db_t *d, unsigned int uid)
+{
+    return d->cache && uid && uid != ANNOTATE_ANY_UID &&
+           seqset_ismember(d->cache->uids, uid);
+}
+
+/* index of the first cached record for @uid, or nrecs */
+static size_t msgcache_first(const struct annotate_msgcache *c, uint32_t uid)
+{
+    size_t lo = 0, hi = c->nrecs;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (c->recs[mid].uid < uid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* find_p() and find_cb() over the cached records of one message.
+ * Most callers ask for a single entry, which needs no glob */
+static int msgcache_findall(struct find_rock *frock, const char *entry)
+{
+    struct annotate_msgcache *c = frock->d->cache;
+    int literal = !strpbrk(entry, "*%");
+    size_t i;
+    int r = 0;
+
+    if (!literal)
+        frock->eglob = glob_init(entry, '/');
+
+    for (i = msgcache_first(c, frock->uid);
+         !r && i < c->nrecs && c->recs[i].uid == frock->uid; i++) {
+        const struct annotate_msgcache_rec *rec = &c->recs[i];
+
+        if (literal ? strcmp(entry, rec->entry)
+                    : !GLOB_MATCH(frock->eglob, rec->entry))
+            continue;
+        if (frock->since_modseq && frock->since_modseq >= rec->mdata.modseq)
+            continue;
+        if (((rec->mdata.flags & ANNOTATE_FLAG_DELETED) || !buf_len(&rec->value)) &&
+            !(frock->flags & ANNOTATE_TOMBSTONES))
+            continue;
+
+        r = frock->proc(frock->d->mboxname, rec->uid, rec->entry, rec->userid,
+                        &rec->value, &rec->mdata, frock->rock);
+    }
+
+    return r;
+}
+
+/* annotatemore_msg_lookup() for a cached message */
+static void msgcache_lookup(const struct annotate_msgcache *c, uint32_t uid,
+                            const char *entry, const char *userid,
+                            struct buf *value)
+{
+    size_t i;
+
+    for (i = msgcache_first(c, uid);
+         i < c->nrecs && c->recs[i].uid == uid; i++) {
+        const struct annotate_msgcache_rec *rec = &c->recs[i];
+
+        if (strcmp(rec->entry, entry) || strcmp(rec->userid, userid))
+            continue;
+
+        if (rec->mdata.flags & ANNOTATE_FLAG_DELETED)
+            buf_free(value);
+        else {
+            buf_setmap(value, rec->value.s, rec->value.len);
+            buf_cstring(value);
+        }
+        return;
+    }
+}
+
+static int _annotate_findall(const char *mboxname,
+                             unsigned int uid,
+                             struct seqset *uids,
+                             const char *entry,
+                             modseq_t since_modseq,
+                             annotatemore_find_proc_t proc,
+                             void *rock,
+                             int flags)
 {
     char key[MAX_MAILBOX_PATH+1], *p;
     size_t keylen;
@@ -1116,9 +1248,10 @@ EXPORTED int annotatemore_findall(const char *mboxname, /* internal */
 
     assert(mboxname);
     assert(entry);
-    frock.mglob = glob_init(mboxname, '.');
-    frock.eglob = glob_init(entry, '/');
+    frock.mglob = NULL;
+    frock.eglob = NULL;
     frock.uid = uid;
+    frock.uids = uids;
     frock.proc = proc;
     frock.rock = rock;
     frock.since_modseq = since_modseq;
@@ -1130,6 +1263,14 @@ EXPORTED int annotatemore_findall(const char *mboxname, /* internal */
         goto out;
     }
 
+    if (msgcache_covers(frock.d, uid)) {
+        r = msgcache_findall(&frock, entry);
+        goto out;
+    }
+
+    frock.mglob = glob_init(mboxname, '.');
+    frock.eglob = glob_init(entry, '/');
+
     /* Find fixed-string pattern prefix */
     keylen = make_key(mboxname, uid,
                       entry, NULL, key, sizeof(key));
@@ -1149,6 +1290,128 @@ out:
 
     return r;
 }
+
+EXPORTED int annotatemore_findall(const char *mboxname, /* internal */
+                         unsigned int uid,
+                         const char *entry,
+                         modseq_t since_modseq,
+                         annotatemore_find_proc_t proc,
+                         void *rock,
+                         int flags)
+{
+    return _annotate_findall(mboxname, uid, NULL, entry, since_modseq,
+                             proc, rock, flags);
+}
+
+/* Message keys start with the decimal uid, so they don't sort by uid
+ * and there's no narrower range to scan: walk the mailbox's whole db
+ * once and filter on @uids, rather than one prefix scan per message. */
+EXPORTED int annotatemore_findall_uids(const char *mboxname, /* internal */
+                                       struct seqset *uids,
+                                       const char *entry,
+                                       modseq_t since_modseq,
+                                       annotatemore_find_proc_t proc,
+                                       void *rock,
+                                       int flags)
+{
+    return _annotate_findall(mboxname, ANNOTATE_ANY_UID, uids, entry,
+                             since_modseq, proc, rock, flags);
+}
+
+static int msgcache_add_cb(const char *mailbox __attribute__((unused)),
+                           uint32_t uid,
+                           const char *entry, const char *userid,
+                           const struct buf *value,
+                           const struct annotate_metadata *mdata,
+                           void *rock)
+{
+    struct annotate_msgcache *c = (struct annotate_msgcache *) rock;
+    struct annotate_msgcache_rec *rec;
+
+    if (c->nrecs == c->alloc) {
+        c->alloc = c->alloc ? c->alloc * 2 : 64;
+        c->recs = xrealloc(c->recs, c->alloc * sizeof(*c->recs));
+    }
+    rec = &c->recs[c->nrecs++];
+    memset(rec, 0, sizeof(*rec));
+    rec->uid = uid;
+    rec->entry = xstrdup(entry);
+    rec->userid = xstrdup(userid);
+    buf_copy(&rec->value, value);
+    rec->mdata = *mdata;
+
+    return 0;
+}
+
+/* uid, then the order of the rest of the key in the db */
+static int msgcache_cmp(const void *a, const void *b)
+{
+    const struct annotate_msgcache_rec *ra = a, *rb = b;
+    int cmp;
+
+    if (ra->uid != rb->uid)
+        return ra->uid < rb->uid ? -1 : 1;
+    cmp = strcmp(ra->entry, rb->entry);
+    if (!cmp) cmp = strcmp(ra->userid, rb->userid);
+
+    return cmp;
+}
+
+EXPORTED int annotatemore_cache_uids(const char *mboxname, /* internal */
+                                     struct seqset *uids)
+{
+    annotate_db_t *d = NULL;
+    struct annotate_msgcache *c;
+    int r;
+
+    init_internal();
+
+    /* the reference is held until annotatemore_uncache() */
+    r = _annotate_getdb(mboxname, 1, 0, &d);
+    if (r) return (r == CYRUSDB_NOTFOUND ? 0 : r);
+
+    if (d->cache) {
+        /* nested request, the outer one's messages stay cached */
+        d->cache->refcount++;
+        return 0;
+    }
+
+    c = xzmalloc(sizeof(*c));
+    c->refcount = 1;
+
+    r = annotatemore_findall_uids(mboxname, uids, "*", 0, msgcache_add_cb,
+                                  c, ANNOTATE_TOMBSTONES);
+    if (r) {
+        msgcache_free(&c);
+        annotate_putdb(&d);
+        return r;
+    }
+
+    qsort(c->recs, c->nrecs, sizeof(*c->recs), msgcache_cmp);
+    c->uids = seqset_dup(uids);
+    d->cache = c;
+
+    return 0;
+}
+
+EXPORTED void annotatemore_uncache(const char *mboxname)
+{
+    annotate_db_t *d;
+
+    for (d = all_dbs_head ; d ; d = d->next) {
+        if (!strcmpsafe(mboxname, d->mboxname))
+            break;
+    }
+    /* nothing was cached if the mailbox has no annotations db */
+    if (!d || !d->cache)
+        return;
+
+    if (--d->cache->refcount == 0)
+        msgcache_free(&d->cache);
+
+    annotate_putdb(&d);
+}
+
 /***************************  Annotate State Management  ***************************/
 
 EXPORTED annotate_state_t *annotate_state_new(void)
@@ -2648,6 +2911,13 @@ EXPORTED int annotatemore_msg_lookup(const char *mboxname, uint32_t uid, const c
     if (r)
         return (r == CYRUSDB_NOTFOUND ? 0 : r);
 
+    /* the cache skips keys without a userid, so those go to the db */
+    if (userid && msgcache_covers(d, uid)) {
+        msgcache_lookup(d->cache, uid, entry, userid, value);
+        annotate_putdb(&d);
+        return 0;
+    }
+
     keylen = make_key(mboxname, uid, entry, userid, key, sizeof(key));
 
     do {
@@ -2815,6 +3085,8 @@ static int write_entry(struct mailbox *mailbox,
         }
     }
 
+    msgcache_invalidate(d);
+
     /* zero length annotation is deletion.
      * keep tombstones for message annotations */
     if (!value->len && !uid) {
@@ -2880,6 +3152,7 @@ EXPORTED int annotatemore_rawwrite(const char *mboxname, const char *entry,
 
     /* must be in a transaction to modify the db */
     annotate_begin(d);
+    msgcache_invalidate(d);
 
     keylen = make_key(mboxname, uid, entry, userid, key, sizeof(key));
 
@@ -3803,6 +4076,7 @@ HIDDEN int annotate_msg_cleanup(struct mailbox *mailbox, unsigned int uid)
      * about to copy, and that would be sad */
     assert(mailbox->annot_state != NULL);
     assert(mailbox->annot_state->d == d);
+    msgcache_invalidate(d);
 
     keylen = make_key(mailbox->name, uid, "", NULL, key, sizeof(key));
 
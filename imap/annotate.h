@@ -162,6 +162,26 @@ int annotatemore_findall(const char *mboxname, uint32_t uid,
                          annotatemore_find_proc_t proc, void *rock,
                          int flags);
 
+/* 'proc'ess the message annotations of every uid in 'uids' matching
+ * 'entry', in a single scan of the mailbox's annotations db.  Results
+ * come in database order, not uid order */
+int annotatemore_findall_uids(const char *mboxname, struct seqset *uids,
+                              const char *entry,
+                              modseq_t since_modseq,
+                              annotatemore_find_proc_t proc, void *rock,
+                              int flags);
+
+/* load the annotations of the messages in 'uids' with one scan, and
+ * answer findall() and msg_lookup() for them from memory until the
+ * matching uncache() call or the next write to the mailbox's db */
+int annotatemore_cache_uids(const char *mboxname, struct seqset *uids);
+void annotatemore_uncache(const char *mboxname);
+
+/* a single scan beats per-message lookups once a request covers
+ * a good part of the mailbox */
+#define ANNOTATE_CACHE_WORTHWHILE(n, exists) \
+    ((n) > 1 && (n) * 8 >= (exists))
+
 /* fetch annotations and output results */
 typedef void (*annotate_fetch_cb_t)(const char *mboxname, /* internal */
                                     uint32_t uid,
@@ -327,6 +327,7 @@ EXPORTED FILE *append_newstage_full(const char *mailboxname, time_t internaldate
 
     stage = xmalloc(sizeof(struct stagemsg));
     strarray_init(&stage->parts);
+    message_guid_set_null(&stage->guid);
 
     snprintf(stage->fname, sizeof(stage->fname), "%d-%d-%d",
              (int) getpid(), (int) internaldate, msgnum);
@@ -899,7 +900,8 @@ EXPORTED int append_fromstage_full(struct appendstate *as, struct body **body,
     if (!*body) {
         FILE *file = fopen(stage->parts.data[0], "r");
         if (file) {
-            r = message_parse_file(file, NULL, NULL, body, stage->parts.data[0]);
+            r = message_parse_file_full(file, NULL, NULL, body,
+                                        stage->parts.data[0], &stage->guid);
             fclose(file);
         }
         else
@@ -1167,6 +1169,7 @@ EXPORTED int append_fromstream(struct appendstate *as, struct body **body,
     const char *fname;
     msgrecord_t *msgrec = NULL;
     FILE *destfile;
+    struct message_guid guid;
     int r;
     struct mboxevent *mboxevent = NULL;
 
@@ -1200,11 +1203,12 @@ EXPORTED int append_fromstream(struct appendstate *as, struct body **body,
 
     /* XXX - also stream to stage directory and check out archive options */
 
-    /* Copy and parse message */
-    r = message_copy_strict(messagefile, destfile, size, 0);
+    /* Copy and parse message, hashing it on the way in */
+    r = message_copy_strict_full(messagefile, destfile, size, 0, &guid);
     if (!r) {
         if (!*body || (as->nummsg - 1))
-            r = message_parse_file(destfile, NULL, NULL, body, fname);
+            r = message_parse_file_full(destfile, NULL, NULL, body, fname,
+                                        &guid);
         if (!r) r = msgrecord_set_bodystructure(msgrec, *body);
 
         /* messageContent may be included with MessageAppend and MessageNew */
@@ -1617,3 +1621,8 @@ EXPORTED const char *append_stagefname(struct stagemsg *stage)
 {
     return strarray_nth(&stage->parts, 0);
 }
+
+EXPORTED struct message_guid *append_stageguid(struct stagemsg *stage)
+{
+    return &stage->guid;
+}
@@ -151,4 +151,9 @@ extern int append_run_annotator(struct appendstate *as,
 
 extern const char *append_stagefname(struct stagemsg *stage);
 
+/* GUID of the staged message, NULL until whoever writes the stage file
+ * sets it (e.g. with message_copy_strict_full()).  If set, it saves
+ * append_fromstage() hashing the file again. */
+extern struct message_guid *append_stageguid(struct stagemsg *stage);
+
 #endif /* INCLUDED_APPEND_H */
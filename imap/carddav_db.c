@@ -725,6 +725,22 @@ EXPORTED strarray_t *carddav_getgroup(struct carddav_db *carddavdb, const char *
     "INSERT INTO vcard_emails ( objid, pos, email, ispref, ispinned )"            \
     " VALUES ( :objid, :pos, :email, :ispref, :ispinned );"
 
+struct write_rows_rock {
+    const strarray_t *vals;
+    int ispinned;
+};
+
+static void email_fill(struct sqldb_bindval bval[], int row, void *rock)
+{
+    struct write_rows_rock *wrock = rock;
+    const char *pref = strarray_safenth(wrock->vals, row*2+1);
+
+    bval[1].val.i = row;
+    bval[2].val.s = strarray_safenth(wrock->vals, row*2);
+    bval[3].val.i = *pref ? 1 : 0;
+    bval[4].val.i = wrock->ispinned ? 1 : 0;
+}
+
 static int carddav_write_emails(struct carddav_db *carddavdb, int rowid, const strarray_t *emails, int ispinned)
 {
     struct sqldb_bindval bval[] = {
@@ -734,23 +750,15 @@ static int carddav_write_emails(struct carddav_db *carddavdb, int rowid, const s
         { ":ispref",       SQLITE_INTEGER, { .i = 0      } },
         { ":ispinned",     SQLITE_INTEGER, { .i = 0      } },
         { NULL,            SQLITE_NULL,    { .s = NULL   } } };
+    struct write_rows_rock wrock = { emails, ispinned };
     int r;
-    int i;
 
     /* clean up existing records if any */
     r = sqldb_exec(carddavdb->db, CMD_DELETE_EMAIL, bval, NULL, NULL);
     if (r) return r;
-    for (i = 0; i < strarray_size(emails)/2; i++) {
-        const char *pref = strarray_safenth(emails, i*2+1);
-        bval[1].val.i = i;
-        bval[2].val.s = strarray_safenth(emails, i*2);
-        bval[3].val.i = *pref ? 1 : 0;
-        bval[4].val.i = ispinned ? 1 : 0;
-        r = sqldb_exec(carddavdb->db, CMD_INSERT_EMAIL, bval, NULL, NULL);
-        if (r) return r;
-    }
 
-    return 0;
+    return sqldb_exec_many(carddavdb->db, CMD_INSERT_EMAIL, bval,
+                           strarray_size(emails)/2, &email_fill, &wrock);
 }
 
 static int carddav_delete_emails(struct carddav_db *carddavdb, int rowid)
@@ -787,6 +795,15 @@ static int carddav_delete_groups(struct carddav_db *carddavdb, int rowid)
     return 0;
 }
 
+static void group_fill(struct sqldb_bindval bval[], int row, void *rock)
+{
+    struct write_rows_rock *wrock = rock;
+
+    bval[1].val.i = row;
+    bval[2].val.s = strarray_safenth(wrock->vals, 2*row);
+    bval[3].val.s = strarray_safenth(wrock->vals, 2*row+1);
+}
+
 static int carddav_write_groups(struct carddav_db *carddavdb, int rowid, const strarray_t *member_uids)
 {
     struct sqldb_bindval bval[] = {
@@ -795,21 +812,15 @@ static int carddav_write_groups(struct carddav_db *carddavdb, int rowid, const s
         { ":member_uid",   SQLITE_TEXT,    { .s = NULL         } },
         { ":otheruser",    SQLITE_TEXT,    { .s = NULL         } },
         { NULL,            SQLITE_NULL,    { .s = NULL         } } };
+    struct write_rows_rock wrock = { member_uids, 0 };
     int r;
-    int i;
 
     /* remove any existing first */
     r = sqldb_exec(carddavdb->db, CMD_DELETE_GROUP, bval, NULL, NULL);
     if (r) return r;
-    for (i = 0; i < strarray_size(member_uids)/2; i++) {
-        bval[1].val.i = i;
-        bval[2].val.s = strarray_safenth(member_uids, 2*i);
-        bval[3].val.s = strarray_safenth(member_uids, 2*i+1);
-        r = sqldb_exec(carddavdb->db, CMD_INSERT_GROUP, bval, NULL, NULL);
-        if (r) return r;
-    }
 
-    return 0;
+    return sqldb_exec_many(carddavdb->db, CMD_INSERT_GROUP, bval,
+                           strarray_size(member_uids)/2, &group_fill, &wrock);
 }
 
 #define CMD_INSERT                                                      \
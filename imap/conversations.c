@@ -102,6 +102,13 @@
 
 #define CONVERSATIONS_VERSION 0
 
+/* B records in the compact binary format start with this byte rather
+ * than the ASCII version number of the dlist text format. */
+#define CONV_BINARY_VERSION 1
+#define CONV_BINARY_MAGIC (0x80 | CONV_BINARY_VERSION)
+#define CONV_ISBINARY(data, datalen) \
+    ((datalen) && (unsigned char)(data)[0] == CONV_BINARY_MAGIC)
+
 static struct conversations_open *open_conversations;
 
 static conv_status_t NULLSTATUS = CONV_STATUS_INIT;
@@ -308,11 +315,13 @@ EXPORTED int conversations_open_path(const char *fname, const char *userid, int
     /* open db */
     open->s.is_shared = shared;
     int flags = CYRUSDB_CREATE | (shared ? CYRUSDB_SHARED : CYRUSDB_CONVERT);
+    lockstats_requested(&open->s.lockstats);
     r = cyrusdb_lockopen(DB, fname, flags, &open->s.db, &open->s.txn);
     if (r || open->s.db == NULL) {
         free(open);
         return IMAP_IOERROR;
     }
+    lockstats_granted(&open->s.lockstats, LOCKSTATS_CONVERSATIONS, fname);
     open->s.path = xstrdup(fname);
     open->next = open_conversations;
     open_conversations = open;
@@ -330,6 +339,7 @@ EXPORTED int conversations_open_path(const char *fname, const char *userid, int
     }
     if (r) {
         cyrusdb_abort(open->s.db, open->s.txn);
+        lockstats_released(&open->s.lockstats, LOCKSTATS_CONVERSATIONS, fname);
         _conv_remove(&open->s);
         free(open);
         return r;
@@ -484,6 +494,7 @@ EXPORTED int conversations_abort(struct conversations_state **statep)
         cyrusdb_close(state->db);
     }
 
+    lockstats_released(&state->lockstats, LOCKSTATS_CONVERSATIONS, state->path);
     _conv_remove(state);
 
     return 0;
@@ -508,6 +519,7 @@ EXPORTED int conversations_commit(struct conversations_state **statep)
         cyrusdb_close(state->db);
     }
 
+    lockstats_released(&state->lockstats, LOCKSTATS_CONVERSATIONS, state->path);
     _conv_remove(state);
 
     return r;
@@ -847,7 +859,295 @@ EXPORTED int conversation_setstatus(struct conversations_state *state,
     return 0;
 }
 
-static void conv_to_buf(conversation_t *conv, struct buf *buf, int flagcount)
+/* varint encoding for the binary B record format: 7 bits per byte,
+ * least significant group first, high bit set on all but the last */
+static void _putvarint(struct buf *buf, uint64_t val)
+{
+    while (val >= 0x80) {
+        buf_putc(buf, (char)((val & 0x7f) | 0x80));
+        val >>= 7;
+    }
+    buf_putc(buf, (char)val);
+}
+
+/* signed values are zigzag-encoded so small negatives stay short */
+static void _putsvarint(struct buf *buf, int64_t val)
+{
+    _putvarint(buf, ((uint64_t)val << 1) ^ (uint64_t)(val >> 63));
+}
+
+static void _putvarstr(struct buf *buf, const char *str)
+{
+    if (!str) {
+        _putvarint(buf, 0);
+        return;
+    }
+    size_t len = strlen(str);
+    _putvarint(buf, len + 1);
+    buf_appendmap(buf, str, len);
+}
+
+struct convreader {
+    const unsigned char *p;
+    const unsigned char *end;
+    int err;
+};
+
+static uint64_t _getvarint(struct convreader *rd)
+{
+    uint64_t val = 0;
+    int shift = 0;
+
+    while (rd->p < rd->end && shift < 64) {
+        unsigned char c = *rd->p++;
+        val |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return val;
+        shift += 7;
+    }
+
+    rd->err = IMAP_MAILBOX_BADFORMAT;
+    return 0;
+}
+
+static int64_t _getsvarint(struct convreader *rd)
+{
+    uint64_t val = _getvarint(rd);
+    return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+/* returns a newly allocated string, or NULL */
+static char *_getvarstr(struct convreader *rd)
+{
+    uint64_t len = _getvarint(rd);
+    if (rd->err || !len) return NULL;
+    len--;
+    if ((uint64_t)(rd->end - rd->p) < len) {
+        rd->err = IMAP_MAILBOX_BADFORMAT;
+        return NULL;
+    }
+    char *str = xstrndup((const char *)rd->p, len);
+    rd->p += len;
+    return str;
+}
+
+/* skip a length-prefixed section, returning a reader limited to it */
+static struct convreader _getsection(struct convreader *rd)
+{
+    struct convreader sub = { rd->p, rd->p, 0 };
+    uint64_t len = _getvarint(rd);
+
+    if (rd->err || (uint64_t)(rd->end - rd->p) < len) {
+        rd->err = sub.err = IMAP_MAILBOX_BADFORMAT;
+        return sub;
+    }
+
+    sub.p = rd->p;
+    sub.end = rd->p + len;
+    rd->p += len;
+    return sub;
+}
+
+static void _putsection(struct buf *buf, const struct buf *section)
+{
+    _putvarint(buf, buf_len(section));
+    buf_append(buf, section);
+}
+
+/*
+ * Binary B record, version 1:
+ *
+ *   magic byte, then varints:
+ *   modseq createdmodseq num_records exists unseen size
+ *   ncounts count...
+ *   section: nfolders (numberdelta modseq num_records exists unseen)...
+ *   subject
+ *   section: nsenders (name route mailbox domain lastseen exists)...
+ *   section: nthreads (guid[20] exists internaldatedelta)...
+ *
+ * Folder numbers are delta encoded against the previous folder, thread
+ * internaldates against the previous thread entry (zigzag, since they
+ * are sorted but not guaranteed monotonic across equal dates).  Each
+ * list is a length-prefixed section so that callers which don't ask
+ * for it can skip it without decoding.
+ */
+static void conv_to_buf_binary(conversation_t *conv, struct buf *buf,
+                               int flagcount)
+{
+    struct buf section = BUF_INITIALIZER;
+    struct buf items = BUF_INITIALIZER;
+    const conv_folder_t *folder;
+    const conv_sender_t *sender;
+    const conv_thread_t *thread;
+    char guidbuf[MESSAGE_GUID_SIZE];
+    int prevnumber = 0;
+    time_t prevdate = 0;
+    int i, n;
+
+    buf_putc(buf, (char)CONV_BINARY_MAGIC);
+    _putvarint(buf, conv->modseq);
+    _putvarint(buf, conv->createdmodseq);
+    _putvarint(buf, conv->num_records);
+    _putvarint(buf, conv->exists);
+    _putvarint(buf, conv->unseen);
+    _putvarint(buf, conv->size);
+
+    _putvarint(buf, flagcount);
+    for (i = 0; i < flagcount; i++)
+        _putvarint(buf, conv->counts[i]);
+
+    n = 0;
+    for (folder = conv->folders ; folder ; folder = folder->next) {
+        if (!folder->num_records)
+            continue;
+        _putvarint(&items, folder->number - prevnumber);
+        _putvarint(&items, folder->modseq);
+        _putvarint(&items, folder->num_records);
+        _putvarint(&items, folder->exists);
+        _putvarint(&items, folder->unseen);
+        prevnumber = folder->number;
+        n++;
+    }
+    _putvarint(&section, n);
+    buf_append(&section, &items);
+    _putsection(buf, &section);
+
+    _putvarstr(buf, conv->subject);
+
+    buf_reset(&section);
+    buf_reset(&items);
+    n = 0;
+    for (sender = conv->senders ; sender ; sender = sender->next) {
+        if (!sender->exists)
+            continue;
+        /* don't ever store more than 100 senders */
+        if (n + 1 >= 100) break;
+        _putvarstr(&items, sender->name);
+        _putvarstr(&items, sender->route);
+        _putvarstr(&items, sender->mailbox);
+        _putvarstr(&items, sender->domain);
+        _putvarint(&items, (uint32_t)sender->lastseen);
+        _putvarint(&items, sender->exists);
+        n++;
+    }
+    _putvarint(&section, n);
+    buf_append(&section, &items);
+    _putsection(buf, &section);
+
+    buf_reset(&section);
+    buf_reset(&items);
+    n = 0;
+    for (thread = conv->thread; thread; thread = thread->next) {
+        if (!thread->exists)
+            continue;
+        message_guid_export(&thread->guid, guidbuf);
+        buf_appendmap(&items, guidbuf, MESSAGE_GUID_SIZE);
+        _putvarint(&items, thread->exists);
+        _putsvarint(&items, (int64_t)thread->internaldate - prevdate);
+        prevdate = thread->internaldate;
+        n++;
+    }
+    _putvarint(&section, n);
+    buf_append(&section, &items);
+    _putsection(buf, &section);
+
+    buf_free(&section);
+    buf_free(&items);
+}
+
+static int conversation_parse_binary(const char *data, size_t datalen,
+                                     conversation_t *conv, int flags)
+{
+    struct convreader rd = { (const unsigned char *)data + 1,
+                             (const unsigned char *)data + datalen, 0 };
+    struct convreader sub;
+    uint64_t i, n;
+
+    conv->modseq = _getvarint(&rd);
+    conv->createdmodseq = _getvarint(&rd);
+    conv->num_records = _getvarint(&rd);
+    conv->exists = _getvarint(&rd);
+    conv->unseen = _getvarint(&rd);
+    conv->prev_unseen = conv->unseen;
+    conv->size = _getvarint(&rd);
+
+    n = _getvarint(&rd);
+    for (i = 0; i < n && !rd.err; i++) {
+        uint32_t count = _getvarint(&rd);
+        if (i < 32) conv->counts[i] = count;
+    }
+
+    sub = _getsection(&rd);
+    if (!rd.err && (flags & CONV_WITHFOLDERS)) {
+        int number = 0;
+        n = _getvarint(&sub);
+        for (i = 0; i < n && !sub.err; i++) {
+            number += _getvarint(&sub);
+            conv_folder_t *folder = conversation_get_folder(conv, number, 1);
+            folder->modseq = _getvarint(&sub);
+            folder->num_records = _getvarint(&sub);
+            folder->exists = _getvarint(&sub);
+            folder->prev_exists = folder->exists;
+            folder->unseen = _getvarint(&sub);
+        }
+        if (sub.err) return sub.err;
+    }
+
+    if (flags & CONV_WITHSUBJECT) {
+        conv->subject = _getvarstr(&rd);
+    }
+    else {
+        free(_getvarstr(&rd));
+    }
+
+    sub = _getsection(&rd);
+    if (!rd.err && (flags & CONV_WITHSENDERS)) {
+        conv_sender_t **nextp = &conv->senders;
+        n = _getvarint(&sub);
+        for (i = 0; i < n && !sub.err; i++) {
+            conv_sender_t *sender = xzmalloc(sizeof(conv_sender_t));
+            sender->name = _getvarstr(&sub);
+            sender->route = _getvarstr(&sub);
+            sender->mailbox = _getvarstr(&sub);
+            sender->domain = _getvarstr(&sub);
+            sender->lastseen = _getvarint(&sub);
+            sender->exists = _getvarint(&sub);
+            /* stored already sorted, so just append */
+            *nextp = sender;
+            nextp = &sender->next;
+        }
+        if (sub.err) return sub.err;
+    }
+
+    sub = _getsection(&rd);
+    if (!rd.err && (flags & CONV_WITHTHREAD)) {
+        conv_thread_t **nextp = &conv->thread;
+        time_t date = 0;
+        n = _getvarint(&sub);
+        for (i = 0; i < n && !sub.err; i++) {
+            if (sub.end - sub.p < MESSAGE_GUID_SIZE) {
+                sub.err = IMAP_MAILBOX_BADFORMAT;
+                break;
+            }
+            conv_thread_t *thread = xzmalloc(sizeof(conv_thread_t));
+            message_guid_import(&thread->guid, (const char *)sub.p);
+            sub.p += MESSAGE_GUID_SIZE;
+            thread->exists = _getvarint(&sub);
+            date += _getsvarint(&sub);
+            thread->internaldate = date;
+            *nextp = thread;
+            nextp = &thread->next;
+        }
+        if (sub.err) return sub.err;
+    }
+
+    if (rd.err) return rd.err;
+
+    conv->flags = flags;
+
+    return 0;
+}
+
+static void conv_to_buf_text(conversation_t *conv, struct buf *buf, int flagcount)
 {
     struct dlist *dl, *n, *nn;
     const conv_folder_t *folder;
@@ -916,6 +1216,15 @@ static void conv_to_buf(conversation_t *conv, struct buf *buf, int flagcount)
     dlist_free(&dl);
 }
 
+static void conv_to_buf(conversation_t *conv, struct buf *buf, int flagcount)
+{
+    if (config_getenum(IMAPOPT_CONVERSATIONS_RECORD_FORMAT) ==
+        IMAP_ENUM_CONVERSATIONS_RECORD_FORMAT_BINARY)
+        conv_to_buf_binary(conv, buf, flagcount);
+    else
+        conv_to_buf_text(conv, buf, flagcount);
+}
+
 EXPORTED int conversation_store(struct conversations_state *state,
                        const char *key, int keylen,
                        conversation_t *conv)
@@ -1462,6 +1771,9 @@ EXPORTED int conversation_parse(const char *data, size_t datalen,
     bit64 version;
     int r;
 
+    if (CONV_ISBINARY(data, datalen))
+        return conversation_parse_binary(data, datalen, conv, flags);
+
     r = parsenum(data, &rest, datalen, &version);
     if (r) return IMAP_MAILBOX_BADFORMAT;
 
@@ -1544,8 +1856,9 @@ EXPORTED int conversation_load(struct conversations_state *state,
 
 /* Parse just enough of the B record to retrieve the modseq.
  * Fortunately the modseq is the first field after the record version
- * number, given the way that _conversation_save() and dlist works.  See
- * _conversation_load() for the full shebang. */
+ * number, given the way that _conversation_save() and dlist works, and
+ * the first varint in the binary format.  See _conversation_load() for
+ * the full shebang. */
 static int _conversation_load_modseq(const char *data, int datalen,
                                      modseq_t *modseqp)
 {
@@ -1554,6 +1867,13 @@ static int _conversation_load_modseq(const char *data, int datalen,
     bit64 version = ~0ULL;
     int r;
 
+    if (CONV_ISBINARY(data, datalen)) {
+        struct convreader rd = { (const unsigned char *)data + 1,
+                                 (const unsigned char *)end, 0 };
+        *modseqp = _getvarint(&rd);
+        return rd.err;
+    }
+
     r = parsenum(p, &p, (end-p), &version);
     if (r || version != CONVERSATIONS_VERSION)
         return IMAP_MAILBOX_BADFORMAT;
@@ -2876,9 +3196,101 @@ EXPORTED int conversations_cleanup_zero(struct conversations_state *state)
                            state, &state->txn);
 }
 
+struct dump_rock {
+    struct conversations_state *state;
+    FILE *fp;
+};
+
+static int dump_cb(void *rock,
+                   const char *key, size_t keylen,
+                   const char *val, size_t vallen)
+{
+    struct dump_rock *drock = (struct dump_rock *)rock;
+    struct conversations_state *state = drock->state;
+    struct buf buf = BUF_INITIALIZER;
+
+    /* always dump B records in the text format, so the dump stays
+     * readable and can be undumped whatever the configured format */
+    if (keylen && key[0] == 'B' && CONV_ISBINARY(val, vallen)) {
+        conversation_t conv = CONVERSATION_INIT;
+        if (!conversation_parse(val, vallen, &conv, CONV_WITHALL)) {
+            conv_to_buf_text(&conv, &buf, state->counted_flags ?
+                             state->counted_flags->count : 0);
+            val = buf_base(&buf);
+            vallen = buf_len(&buf);
+        }
+        conversation_fini(&conv);
+    }
+
+    fprintf(drock->fp, "%.*s\t%.*s\n", (int)keylen, key, (int)vallen, val);
+
+    buf_free(&buf);
+    return 0;
+}
+
 EXPORTED void conversations_dump(struct conversations_state *state, FILE *fp)
 {
-    cyrusdb_dumpfile(state->db, "", 0, fp, &state->txn);
+    struct dump_rock drock = { state, fp };
+    cyrusdb_foreach(state->db, "", 0, NULL, dump_cb, &drock, &state->txn);
+}
+
+struct rewrite_rock {
+    struct conversations_state *state;
+    size_t oldsize;
+    size_t newsize;
+    size_t count;
+};
+
+static int rewrite_b_cb(void *rock,
+                        const char *key, size_t keylen,
+                        const char *val, size_t vallen)
+{
+    struct rewrite_rock *rrock = (struct rewrite_rock *)rock;
+    struct conversations_state *state = rrock->state;
+    conversation_t conv = CONVERSATION_INIT;
+    struct buf buf = BUF_INITIALIZER;
+    int r;
+
+    r = conversation_parse(val, vallen, &conv, CONV_WITHALL);
+    if (r) {
+        syslog(LOG_ERR, "IOERROR: conversations_rewrite: %s %.*s: %s",
+               state->path, (int)keylen, key, error_message(r));
+        goto done;
+    }
+
+    conv_to_buf(&conv, &buf, state->counted_flags ?
+                state->counted_flags->count : 0);
+
+    rrock->oldsize += vallen;
+    rrock->newsize += buf_len(&buf);
+    rrock->count++;
+
+    if (buf_len(&buf) != vallen || memcmp(buf_base(&buf), val, vallen))
+        r = cyrusdb_store(state->db, key, keylen,
+                          buf_base(&buf), buf_len(&buf), &state->txn);
+
+done:
+    conversation_fini(&conv);
+    buf_free(&buf);
+    return r;
+}
+
+/* Rewrite every B record in the configured conversations_record_format.
+ * Returns the total size of the records before and after, if asked. */
+EXPORTED int conversations_rewrite_records(struct conversations_state *state,
+                                           size_t *oldsizep, size_t *newsizep,
+                                           size_t *countp)
+{
+    struct rewrite_rock rrock = { state, 0, 0, 0 };
+
+    int r = cyrusdb_foreach(state->db, "B", 1, NULL, rewrite_b_cb,
+                            &rrock, &state->txn);
+
+    if (oldsizep) *oldsizep = rrock.oldsize;
+    if (newsizep) *newsizep = rrock.newsize;
+    if (countp) *countp = rrock.count;
+
+    return r;
 }
 
 EXPORTED int conversations_truncate(struct conversations_state *state)
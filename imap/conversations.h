@@ -52,6 +52,7 @@
 #include "arrayu64.h"
 #include "hash.h"
 #include "hashu64.h"
+#include "lockstats.h"
 #include "message_guid.h"
 #include "strarray.h"
 #include "util.h"
@@ -83,6 +84,7 @@ struct conversations_state {
     char *trashmboxname;
     int is_shared;
     char *path;
+    struct lockstats_timer lockstats;
 };
 
 struct conversations_open {
@@ -306,6 +308,10 @@ extern int conversations_prune(struct conversations_state *state,
                                time_t thresh, unsigned int *,
                                unsigned int *);
 extern void conversations_dump(struct conversations_state *, FILE *);
+/* rewrite all B records in the configured conversations_record_format */
+extern int conversations_rewrite_records(struct conversations_state *state,
+                                         size_t *oldsizep, size_t *newsizep,
+                                         size_t *countp);
 extern int conversations_undump(struct conversations_state *, FILE *);
 
 extern int conversations_truncate(struct conversations_state *);
@@ -69,7 +69,8 @@
 /* config.c stuff */
 const int config_need_data = CONFIG_NEED_PARTITION_DATA;
 
-enum { UNKNOWN, DUMP, UNDUMP, ZERO, BUILD, RECALC, AUDIT, CHECKFOLDERS };
+enum { UNKNOWN, DUMP, UNDUMP, ZERO, BUILD, RECALC, AUDIT, CHECKFOLDERS,
+       REWRITE };
 
 int verbose = 0;
 
@@ -194,6 +195,31 @@ done:
     return r;
 }
 
+static int do_rewrite(const char *userid)
+{
+    struct conversations_state *state = NULL;
+    size_t oldsize = 0, newsize = 0, count = 0;
+    int r;
+
+    r = conversations_open_user(userid, 0/*shared*/, &state);
+    if (r) return r;
+
+    r = conversations_rewrite_records(state, &oldsize, &newsize, &count);
+    if (r) {
+        fprintf(stderr, "Failed to rewrite conversations for %s: %s\n",
+                userid, error_message(r));
+        conversations_abort(&state);
+        return r;
+    }
+
+    if (verbose)
+        printf("%s: rewrote %llu records, %llu bytes -> %llu bytes\n",
+               userid, (unsigned long long)count,
+               (unsigned long long)oldsize, (unsigned long long)newsize);
+
+    return conversations_commit(&state);
+}
+
 static int build_cid_cb(const mbentry_t *mbentry,
                         void *rock __attribute__((unused)))
 {
@@ -799,6 +825,11 @@ static int do_user(const char *userid, void *rock __attribute__((unused)))
             r = EX_NOINPUT;
         break;
 
+    case REWRITE:
+        if (do_rewrite(userid))
+            r = EX_NOINPUT;
+        break;
+
     case UNKNOWN:
         fatal("UNKNOWN MODE", EX_SOFTWARE);
     }
@@ -816,7 +847,7 @@ int main(int argc, char **argv)
     int r = 0;
     int recursive = 0;
 
-    while ((c = getopt(argc, argv, "durzSAbvRFC:T:")) != EOF) {
+    while ((c = getopt(argc, argv, "durzSAbvRFUC:T:")) != EOF) {
         switch (c) {
         case 'd':
             if (mode != UNKNOWN)
@@ -864,6 +895,12 @@ int main(int argc, char **argv)
             mode = CHECKFOLDERS;
             break;
 
+        case 'U':
+            if (mode != UNKNOWN)
+                usage(argv[0]);
+            mode = REWRITE;
+            break;
+
         case 'v':
             verbose++;
             break;
@@ -923,6 +960,8 @@ static int usage(const char *name)
     fprintf(stderr, "    -R             recalculate all counts\n");
     fprintf(stderr, "    -A             audit conversations DB counts\n");
     fprintf(stderr, "    -F             check folder names\n");
+    fprintf(stderr, "    -U             rewrite conversation records in the\n"
+                    "                   configured conversations_record_format\n");
     fprintf(stderr, "    -T dir         store temporary data for audit in dir\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "    -r             recursive mode: username is a prefix\n");
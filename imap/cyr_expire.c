@@ -64,6 +64,9 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <libgen.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 #include <sasl/sasl.h>
 
@@ -100,6 +103,7 @@ struct arguments {
     int expunge_seconds;
 
     int do_cid_expire;
+    int jobs;
 
     /* bools */
     bool do_expunge;
@@ -113,6 +117,7 @@ struct arguments {
 
 struct archive_rock {
     time_t archive_mark;
+    unsigned long mailboxes_seen;
     unsigned long messages_archived;
     bool skip_annotate;
 };
@@ -135,6 +140,7 @@ struct expire_rock {
 struct conversations_rock {
     struct hash_table seen;
     time_t expire_mark;
+    unsigned long mailboxes_seen;
     unsigned long databases_seen;
     unsigned long msgids_seen;
     unsigned long msgids_expired;
@@ -143,6 +149,8 @@ struct conversations_rock {
 struct delete_rock {
     time_t delete_mark;
     strarray_t to_delete;
+    unsigned long mailboxes_seen;
+    unsigned long mailboxes_deleted;
     bool skip_annotate;
 };
 
@@ -153,11 +161,34 @@ struct cyr_expire_ctx {
     struct conversations_rock crock;
     struct delete_rock drock;
     struct expire_rock erock;
+
+    /* with -j, the worker's share of the mailboxes */
+    int shard;
+    int nshards;
+    const char *phase;
+    char *statedir;
+};
+
+/* What a worker reports back to the parent at the end of a phase */
+struct expire_stats {
+    unsigned long archive_mailboxes;
+    unsigned long expire_mailboxes;
+    unsigned long messages_seen;
+    unsigned long messages_expired;
+    unsigned long messages_expunged;
+    unsigned long userflags_expunged;
+    unsigned long cid_mailboxes;
+    unsigned long databases_seen;
+    unsigned long msgids_seen;
+    unsigned long msgids_expired;
+    unsigned long delete_mailboxes;
+    unsigned long mailboxes_deleted;
 };
 
 static const struct cyr_expire_ctx zero_ctx;
 
 static void sighandler(int sig);
+static int delete_pending(struct cyr_expire_ctx *ctx);
 
 /* verbosep - a wrapper to print if the 'verbose' option is
    turned on.
@@ -213,6 +244,7 @@ static void cyr_expire_cleanup(struct cyr_expire_ctx *ctx)
     free_hash_table(&ctx->erock.table, free);
     free_hash_table(&ctx->crock.seen, NULL);
     strarray_fini(&ctx->drock.to_delete);
+    free(ctx->statedir);
 
     duplicate_done();
     sasl_done();
@@ -228,6 +260,7 @@ static void usage(void)
     fprintf(stderr, "-a                       skip annotation lookup\n");
     fprintf(stderr, "-c                       do not expire conversations\n");
     fprintf(stderr, "-h                       print this help and exit\n");
+    fprintf(stderr, "-j <jobs>                split the work by user across <jobs> processes\n");
     fprintf(stderr, "-p <mailbox-prefix>      specify prefix for mailboxes\n");
     fprintf(stderr, "-t                       remove user flags which are not used\n");
     fprintf(stderr, "-u <user-id>             specify user id for mailbox lookup\n");
@@ -388,6 +421,8 @@ static int archive(const mbentry_t *mbentry, void *rock)
     if (mailbox_open_iwl(mbentry->name, &mailbox))
         goto done;
 
+    arock->mailboxes_seen++;
+
     /* check /vendor/cmu/cyrus-imapd/archive */
     if (!arock->skip_annotate &&
         get_annotation_value(mbentry->name, IMAP_ANNOT_NS "archive",
@@ -549,6 +584,8 @@ static int delete(const mbentry_t *mbentry, void *rock)
     if (mbentry->mbtype & MBTYPE_REMOTE)
         goto done;
 
+    drock->mailboxes_seen++;
+
     /* check if this is a mailbox we want to examine */
     if (!mboxname_isdeletedmailbox(mbentry->name, &timestamp))
         goto done;
@@ -593,6 +630,8 @@ static int expire_conversations(const mbentry_t *mbentry, void *rock)
     if (mboxname_isdeletedmailbox(mbentry->name, NULL))
         goto done;
 
+    crock->mailboxes_seen++;
+
     filename = conversations_getmboxpath(mbentry->name);
     if (!filename)
         goto done;
@@ -624,28 +663,347 @@ static void sighandler(int sig __attribute((unused)))
     return;
 }
 
+/* Per-phase throughput, for both serial and -j runs */
+static void report_throughput(struct cyr_expire_ctx *ctx, const char *phase,
+                              unsigned long mailboxes,
+                              const struct timeval *start)
+{
+    struct timeval end;
+    double secs;
+
+    gettimeofday(&end, NULL);
+    secs = timesub(start, &end);
+
+    syslog(LOG_NOTICE, "%s: %lu mailboxes in %.3f seconds (%.1f/sec, %d jobs)",
+           phase, mailboxes, secs, secs > 0 ? mailboxes / secs : 0.0,
+           ctx->nshards ? ctx->nshards : 1);
+    verbosep("%s: %lu mailboxes in %.3f seconds (%.1f/sec, %d jobs)\n",
+             phase, mailboxes, secs, secs > 0 ? mailboxes / secs : 0.0,
+             ctx->nshards ? ctx->nshards : 1);
+}
+
+/*
+ * Checkpoints for -j runs live in <configdirectory>/cyr_expire:
+ *
+ *   run            the arguments of the run, then one line per finished phase
+ *   <phase>.<N>    the last user worker N finished in <phase>
+ *   expire.<N>     the expire marks worker N found, for duplicate_prune
+ *
+ * A run with the same arguments picks up where the last one stopped;
+ * the directory is removed once a run completes.
+ */
+static char *state_path(struct cyr_expire_ctx *ctx, const char *name, int shard)
+{
+    struct buf buf = BUF_INITIALIZER;
+
+    buf_printf(&buf, "%s/%s", ctx->statedir, name);
+    if (shard >= 0) buf_printf(&buf, ".%d", shard);
+
+    return buf_release(&buf);
+}
+
+static void state_signature(struct cyr_expire_ctx *ctx, struct buf *sig)
+{
+    buf_printf(sig, "jobs=%d A=%d D=%d E=%d X=%d c=%d x=%d t=%d a=%d",
+               ctx->nshards, ctx->args.archive_seconds,
+               ctx->args.delete_seconds, ctx->args.expire_seconds,
+               ctx->args.expunge_seconds, ctx->args.do_cid_expire,
+               ctx->args.do_expunge, ctx->args.do_userflags,
+               ctx->args.skip_annotate);
+}
+
+static void state_remove(struct cyr_expire_ctx *ctx)
+{
+    DIR *dirp = opendir(ctx->statedir);
+    struct dirent *dirent;
+
+    if (!dirp) return;
+
+    while ((dirent = readdir(dirp))) {
+        char *path;
+
+        if (dirent->d_name[0] == '.') continue;
+
+        path = strconcat(ctx->statedir, "/", dirent->d_name, (char *)NULL);
+        unlink(path);
+        free(path);
+    }
+    closedir(dirp);
+
+    rmdir(ctx->statedir);
+}
+
+/* when a worker last recorded any progress, or 0 if none has */
+static time_t state_lastprogress(struct cyr_expire_ctx *ctx)
+{
+    DIR *dirp = opendir(ctx->statedir);
+    struct dirent *dirent;
+    time_t last = 0;
+
+    if (!dirp) return 0;
+
+    while ((dirent = readdir(dirp))) {
+        struct stat sbuf;
+        char *path;
+
+        if (dirent->d_name[0] == '.') continue;
+
+        path = strconcat(ctx->statedir, "/", dirent->d_name, (char *)NULL);
+        if (!stat(path, &sbuf) && sbuf.st_mtime > last)
+            last = sbuf.st_mtime;
+        free(path);
+    }
+    closedir(dirp);
+
+    return last;
+}
+
+/* Set up the state directory, returning the phases an earlier
+ * interrupted run with the same arguments already finished */
+static void state_open(struct cyr_expire_ctx *ctx, strarray_t *finished)
+{
+    struct buf sig = BUF_INITIALIZER;
+    char *path;
+    FILE *f;
+
+    ctx->statedir = strconcat(config_dir, "/cyr_expire", (char *)NULL);
+    path = state_path(ctx, "run", -1);
+    state_signature(ctx, &sig);
+
+    f = fopen(path, "r");
+    if (f) {
+        time_t maxage = config_getduration(IMAPOPT_EXPIRE_CHECKPOINT_MAXAGE, 's');
+        time_t last = state_lastprogress(ctx);
+        char line[1024];
+
+        if (maxage > 0 && last + maxage < time(NULL)) {
+            long hours = (time(NULL) - last) / 3600;
+
+            verbosep("discarding checkpoints from a run last active %ld hours ago\n",
+                     hours);
+            syslog(LOG_NOTICE, "discarding checkpoints from a run last active %ld hours ago",
+                   hours);
+            state_remove(ctx);
+        }
+        else if (fgets(line, sizeof(line), f) &&
+            !strcmp(strtok(line, "\n"), buf_cstring(&sig))) {
+            while (fgets(line, sizeof(line), f))
+                strarray_append(finished, strtok(line, "\n"));
+            verbosep("resuming interrupted run\n");
+            syslog(LOG_NOTICE, "resuming interrupted run");
+        }
+        else {
+            verbosep("discarding checkpoints from a run with other arguments\n");
+            syslog(LOG_NOTICE, "discarding checkpoints from a run with other arguments");
+            state_remove(ctx);
+        }
+        fclose(f);
+    }
+
+    if (!strarray_size(finished)) {
+        if (cyrus_mkdir(path, 0755)) {
+            syslog(LOG_ERR, "IOERROR: creating %s: %m", ctx->statedir);
+            fatal("can't create checkpoint directory", EX_CANTCREAT);
+        }
+        f = fopen(path, "w");
+        if (!f || fputs(buf_cstring(&sig), f) == EOF || fclose(f)) {
+            syslog(LOG_ERR, "IOERROR: writing %s: %m", path);
+            fatal("can't write checkpoint", EX_IOERR);
+        }
+    }
+
+    buf_free(&sig);
+    free(path);
+}
+
+static void state_finish_phase(struct cyr_expire_ctx *ctx, const char *phase)
+{
+    char *path = state_path(ctx, "run", -1);
+    FILE *f = fopen(path, "a");
+
+    if (!f || fprintf(f, "\n%s", phase) < 0 || fclose(f))
+        syslog(LOG_ERR, "IOERROR: writing %s: %m", path);
+
+    free(path);
+}
+
+static char *checkpoint_read(struct cyr_expire_ctx *ctx)
+{
+    char *path = state_path(ctx, ctx->phase, ctx->shard);
+    struct buf buf = BUF_INITIALIZER;
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    char *after = NULL;
+
+    /* no file means this worker hasn't finished anyone yet; an empty
+     * one means it has done the shared mailboxes (user "") */
+    if (f) {
+        if (fgets(line, sizeof(line), f)) {
+            buf_setcstr(&buf, line);
+            buf_trim(&buf);
+        }
+        after = xstrdup(buf_cstring(&buf));
+        fclose(f);
+    }
+    free(path);
+    buf_free(&buf);
+
+    return after;
+}
+
+static void write_expire_mark(const char *name, void *data, void *rock)
+{
+    fprintf((FILE *) rock, "%lld %s\n", (long long) *((time_t *) data), name);
+}
+
+/* mboxlist_shardmbox() callback: 'userid' is completely done */
+static int checkpoint_user(const char *userid, void *rock)
+{
+    struct cyr_expire_ctx *ctx = (struct cyr_expire_ctx *) rock;
+    char *path, *tmppath;
+    FILE *f;
+
+    if (sigquit) return 1;
+
+    /* deletions and expire marks are only safe once checkpointed */
+    delete_pending(ctx);
+
+    if (hash_numrecords(&ctx->erock.table)) {
+        path = state_path(ctx, "expire", ctx->shard);
+        f = fopen(path, "a");
+        if (f) {
+            hash_enumerate(&ctx->erock.table, write_expire_mark, f);
+            fclose(f);
+        }
+        else {
+            syslog(LOG_ERR, "IOERROR: writing %s: %m", path);
+        }
+        free(path);
+
+        free_hash_table(&ctx->erock.table, free);
+        construct_hash_table(&ctx->erock.table, 1000, 1);
+    }
+
+    path = state_path(ctx, ctx->phase, ctx->shard);
+    tmppath = strconcat(path, ".NEW", (char *)NULL);
+    f = fopen(tmppath, "w");
+    if (!f || fprintf(f, "%s\n", userid) < 0 || fclose(f) ||
+        rename(tmppath, path)) {
+        syslog(LOG_ERR, "IOERROR: writing %s: %m", path);
+    }
+    free(tmppath);
+    free(path);
+
+    return 0;
+}
+
+struct shard_rock {
+    struct cyr_expire_ctx *ctx;
+    mboxlist_cb *proc;
+    void *rock;
+};
+
+static int shard_proc(const mbentry_t *mbentry, void *rock)
+{
+    struct shard_rock *srock = (struct shard_rock *) rock;
+    return srock->proc(mbentry, srock->rock);
+}
+
+static int shard_done(const char *userid, void *rock)
+{
+    struct shard_rock *srock = (struct shard_rock *) rock;
+    return checkpoint_user(userid, srock->ctx);
+}
+
+/* Walk the mailboxes this run is responsible for.  'flags' are the
+ * mboxlist_allmbox() flags; a user's deleted mailboxes are included
+ * when walking by user */
+static void expire_walk(struct cyr_expire_ctx *ctx,
+                        mboxlist_cb *proc, void *rock, int flags)
+{
+    if (ctx->nshards) {
+        struct shard_rock srock = { ctx, proc, rock };
+        char *after = checkpoint_read(ctx);
+
+        mboxlist_shardmbox(ctx->shard, ctx->nshards, after,
+                           shard_proc, shard_done, &srock, flags);
+        free(after);
+    }
+    else if (ctx->args.userid)
+        mboxlist_usermboxtree(ctx->args.userid, NULL, proc, rock,
+                              flags | MBOXTREE_DELETED);
+    else
+        mboxlist_allmbox(ctx->args.mbox_prefix, proc, rock, flags);
+}
+
+static bool archive_enabled(struct cyr_expire_ctx *ctx)
+{
+    return ctx->args.archive_seconds >= 0;
+}
+
+static void report_archive(struct cyr_expire_ctx *ctx,
+                           const struct timeval *start)
+{
+    report_throughput(ctx, "archive", ctx->arock.mailboxes_seen, start);
+}
+
 static int do_archive(struct cyr_expire_ctx *ctx)
 {
-    if (ctx->args.archive_seconds >= 0) {
+    struct timeval start;
+
+    if (archive_enabled(ctx)) {
         syslog(LOG_DEBUG, ">> do_archive: archive_seconds(%d) >= 0\n",
                ctx->args.archive_seconds);
         ctx->arock.archive_mark = time(0) - ctx->args.archive_seconds;
 
-        if (ctx->args.userid)
-            mboxlist_usermboxtree(ctx->args.userid, NULL, archive,
-                                  &ctx->arock, MBOXTREE_DELETED);
-        else
-            mboxlist_allmbox(ctx->args.mbox_prefix, archive, &ctx->arock, 0);
+        gettimeofday(&start, NULL);
+        expire_walk(ctx, archive, &ctx->arock, 0);
+
+        if (!ctx->nshards)
+            report_archive(ctx, &start);
     }
 
     return 0;
 }
 
+static bool expunge_enabled(struct cyr_expire_ctx *ctx)
+{
+    return ctx->args.do_expunge && (ctx->args.expunge_seconds >= 0 ||
+                                    ctx->args.expire_seconds ||
+                                    ctx->erock.do_userflags);
+}
+
+static void report_expunge(struct cyr_expire_ctx *ctx,
+                           const struct timeval *start)
+{
+    syslog(LOG_NOTICE, "Expired %lu and expunged %lu out of %lu "
+                        "messages from %lu mailboxes",
+                       ctx->erock.messages_expired,
+                       ctx->erock.messages_expunged,
+                       ctx->erock.messages_seen,
+                       ctx->erock.mailboxes_seen);
+    verbosep("\nExpired %lu and expunged %lu out of %lu "
+                   "messages from %lu mailboxes\n",
+                   ctx->erock.messages_expired,
+                   ctx->erock.messages_expunged,
+                   ctx->erock.messages_seen,
+                   ctx->erock.mailboxes_seen);
+
+    if (ctx->erock.do_userflags) {
+        syslog(LOG_NOTICE, "Expunged %lu user flags",
+                       ctx->erock.userflags_expunged);
+        verbosep("Expunged %lu user flags\n",
+                       ctx->erock.userflags_expunged);
+    }
+
+    report_throughput(ctx, "expunge", ctx->erock.mailboxes_seen, start);
+}
+
 static int do_expunge(struct cyr_expire_ctx *ctx)
 {
-    if (ctx->args.do_expunge && (ctx->args.expunge_seconds >= 0 ||
-                                 ctx->args.expire_seconds ||
-                                 ctx->erock.do_userflags)) {
+    struct timeval start;
+
+    if (expunge_enabled(ctx)) {
         /* XXX: better way to determine a size for this table? */
 
         /* expire messages from mailboxes,
@@ -664,41 +1022,43 @@ static int do_expunge(struct cyr_expire_ctx *ctx)
         /* XXX _ a control for this too? */
         ctx->erock.tombstone_mark = time(0) - SECS_IN_A_DAY*7;
 
-        if (ctx->args.userid)
-            mboxlist_usermboxtree(ctx->args.userid, NULL, expire,
-                                  &ctx->erock, MBOXTREE_DELETED|MBOXTREE_TOMBSTONES);
-        else
-            mboxlist_allmbox(ctx->args.mbox_prefix, expire, &ctx->erock,
-                             MBOXTREE_TOMBSTONES);
-
-        syslog(LOG_NOTICE, "Expired %lu and expunged %lu out of %lu "
-                            "messages from %lu mailboxes",
-                           ctx->erock.messages_expired,
-                           ctx->erock.messages_expunged,
-                           ctx->erock.messages_seen,
-                           ctx->erock.mailboxes_seen);
-        verbosep("\nExpired %lu and expunged %lu out of %lu "
-                       "messages from %lu mailboxes\n",
-                       ctx->erock.messages_expired,
-                       ctx->erock.messages_expunged,
-                       ctx->erock.messages_seen,
-                       ctx->erock.mailboxes_seen);
-
-        if (ctx->erock.do_userflags) {
-            syslog(LOG_NOTICE, "Expunged %lu user flags",
-                           ctx->erock.userflags_expunged);
-            verbosep("Expunged %lu user flags\n",
-                           ctx->erock.userflags_expunged);
-        }
+        gettimeofday(&start, NULL);
+        expire_walk(ctx, expire, &ctx->erock, MBOXTREE_TOMBSTONES);
 
+        if (!ctx->nshards)
+            report_expunge(ctx, &start);
     }
 
     return 0;
 }
 
+static bool cid_expire_enabled(struct cyr_expire_ctx *ctx)
+{
+    return ctx->args.do_cid_expire;
+}
+
+static void report_cid_expire(struct cyr_expire_ctx *ctx,
+                              const struct timeval *start)
+{
+    syslog(LOG_NOTICE, "Expired %lu entries of %lu entries seen "
+                        "in %lu conversation databases",
+                        ctx->crock.msgids_expired,
+                        ctx->crock.msgids_seen,
+                        ctx->crock.databases_seen);
+    verbosep("Expired %lu entries of %lu entries seen "
+                   "in %lu conversation databases\n",
+                   ctx->crock.msgids_expired,
+                   ctx->crock.msgids_seen,
+                   ctx->crock.databases_seen);
+
+    report_throughput(ctx, "cid_expire", ctx->crock.mailboxes_seen, start);
+}
+
 static int do_cid_expire(struct cyr_expire_ctx *ctx)
 {
-    if (ctx->args.do_cid_expire) {
+    struct timeval start;
+
+    if (cid_expire_enabled(ctx)) {
         int cid_expire_seconds;
 
         cid_expire_seconds = config_getduration(IMAPOPT_CONVERSATIONS_EXPIRE_AFTER, 'd');
@@ -707,65 +1067,78 @@ static int do_cid_expire(struct cyr_expire_ctx *ctx)
         verbosep("Removing conversation entries older than %0.2f days\n",
                        (double)(cid_expire_seconds/SECS_IN_A_DAY));
 
-        if (ctx->args.userid)
-            mboxlist_usermboxtree(ctx->args.userid, NULL, expire_conversations,
-                                  &ctx->crock, MBOXTREE_DELETED);
-        else
-            mboxlist_allmbox(ctx->args.mbox_prefix, expire_conversations,
-                             &ctx->crock, 0);
-
-        syslog(LOG_NOTICE, "Expired %lu entries of %lu entries seen "
-                            "in %lu conversation databases",
-                            ctx->crock.msgids_expired,
-                            ctx->crock.msgids_seen,
-                            ctx->crock.databases_seen);
-        verbosep("Expired %lu entries of %lu entries seen "
-                       "in %lu conversation databases\n",
-                       ctx->crock.msgids_expired,
-                       ctx->crock.msgids_seen,
-                       ctx->crock.databases_seen);
+        gettimeofday(&start, NULL);
+        expire_walk(ctx, expire_conversations, &ctx->crock, 0);
+
+        if (!ctx->nshards)
+            report_cid_expire(ctx, &start);
     }
 
     return 0;
 }
 
-static int do_delete(struct cyr_expire_ctx *ctx)
+static bool delete_enabled(struct cyr_expire_ctx *ctx)
+{
+    return (ctx->args.delete_seconds >= 0) &&
+        mboxlist_delayed_delete_isenabled() &&
+        config_getstring(IMAPOPT_DELETEDPREFIX);
+}
+
+/* remove the deleted mailboxes collected so far */
+static int delete_pending(struct cyr_expire_ctx *ctx)
 {
     int ret = 0;
+    int i;
 
-    if ((ctx->args.delete_seconds >= 0) &&
-        mboxlist_delayed_delete_isenabled() &&
-        config_getstring(IMAPOPT_DELETEDPREFIX)) {
-        int count = 0;
-        int i;
+    for (i = 0 ; i < ctx->drock.to_delete.count ; i++) {
+        char *name = ctx->drock.to_delete.data[i];
 
-        verbosep("Removing deleted mailboxes older than %0.2f days\n",
-                 ((double)ctx->args.delete_seconds/SECS_IN_A_DAY));
+        if (sigquit)
+            return ret;         /* return from here, will quit in main. */
 
-        ctx->drock.delete_mark = time(0) - ctx->args.delete_seconds;
+        verbosep("Removing: %s\n", name);
+
+        ret = mboxlist_deletemailboxlock(name, 1, NULL, NULL, NULL, 0, 0, 0, 0);
+        /* XXX: Ignoring the return from mboxlist_deletemailbox() ??? */
+        ctx->drock.mailboxes_deleted++;
+    }
+
+    strarray_truncate(&ctx->drock.to_delete, 0);
 
-        if (ctx->args.userid)
-            mboxlist_usermboxtree(ctx->args.userid, NULL, delete,
-                                  &ctx->drock, MBOXTREE_DELETED);
-        else
-            mboxlist_allmbox(ctx->args.mbox_prefix, delete, &ctx->drock, 0);
+    return ret;
+}
 
-        for (i = 0 ; i < ctx->drock.to_delete.count ; i++) {
-            char *name = ctx->drock.to_delete.data[i];
+static void report_delete(struct cyr_expire_ctx *ctx,
+                          const struct timeval *start)
+{
+    verbosep("Removed %lu deleted mailboxes\n", ctx->drock.mailboxes_deleted);
 
-            if (sigquit)
-                return ret;         /* return from here, will quit in main. */
+    syslog(LOG_NOTICE, "Removed %lu deleted mailboxes",
+           ctx->drock.mailboxes_deleted);
 
-            verbosep("Removing: %s\n", name);
+    report_throughput(ctx, "delete", ctx->drock.mailboxes_seen, start);
+}
 
-            ret = mboxlist_deletemailboxlock(name, 1, NULL, NULL, NULL, 0, 0, 0, 0);
-            /* XXX: Ignoring the return from mboxlist_deletemailbox() ??? */
-            count++;
-        }
+static int do_delete(struct cyr_expire_ctx *ctx)
+{
+    struct timeval start;
+    int ret = 0;
 
-        verbosep("Removed %d deleted mailboxes\n", count);
+    if (delete_enabled(ctx)) {
+        verbosep("Removing deleted mailboxes older than %0.2f days\n",
+                 ((double)ctx->args.delete_seconds/SECS_IN_A_DAY));
+
+        ctx->drock.delete_mark = time(0) - ctx->args.delete_seconds;
 
-        syslog(LOG_NOTICE, "Removed %d deleted mailboxes", count);
+        gettimeofday(&start, NULL);
+        expire_walk(ctx, delete, &ctx->drock, 0);
+
+        ret = delete_pending(ctx);
+        if (sigquit)
+            return ret;         /* return from here, will quit in main. */
+
+        if (!ctx->nshards)
+            report_delete(ctx, &start);
     }
 
     return ret;
@@ -780,6 +1153,247 @@ static int do_duplicate_prune(struct cyr_expire_ctx *ctx)
     return ret;
 }
 
+static const struct expire_phase {
+    const char *name;
+    bool (*enabled)(struct cyr_expire_ctx *ctx);
+    int (*run)(struct cyr_expire_ctx *ctx);
+    void (*report)(struct cyr_expire_ctx *ctx, const struct timeval *start);
+} expire_phases[] = {
+    { "archive",    archive_enabled,    do_archive,    report_archive },
+    { "expunge",    expunge_enabled,    do_expunge,    report_expunge },
+    { "cid_expire", cid_expire_enabled, do_cid_expire, report_cid_expire },
+    { "delete",     delete_enabled,     do_delete,     report_delete },
+    { NULL, NULL, NULL, NULL }
+};
+
+static void stats_collect(struct cyr_expire_ctx *ctx, struct expire_stats *st)
+{
+    memset(st, 0, sizeof(struct expire_stats));
+    st->archive_mailboxes = ctx->arock.mailboxes_seen;
+    st->expire_mailboxes = ctx->erock.mailboxes_seen;
+    st->messages_seen = ctx->erock.messages_seen;
+    st->messages_expired = ctx->erock.messages_expired;
+    st->messages_expunged = ctx->erock.messages_expunged;
+    st->userflags_expunged = ctx->erock.userflags_expunged;
+    st->cid_mailboxes = ctx->crock.mailboxes_seen;
+    st->databases_seen = ctx->crock.databases_seen;
+    st->msgids_seen = ctx->crock.msgids_seen;
+    st->msgids_expired = ctx->crock.msgids_expired;
+    st->delete_mailboxes = ctx->drock.mailboxes_seen;
+    st->mailboxes_deleted = ctx->drock.mailboxes_deleted;
+}
+
+/* a worker starts its phase from zero, whatever the parent has tallied */
+static void stats_clear(struct cyr_expire_ctx *ctx)
+{
+    ctx->arock.mailboxes_seen = 0;
+    ctx->erock.mailboxes_seen = 0;
+    ctx->erock.messages_seen = 0;
+    ctx->erock.messages_expired = 0;
+    ctx->erock.messages_expunged = 0;
+    ctx->erock.userflags_expunged = 0;
+    ctx->crock.mailboxes_seen = 0;
+    ctx->crock.databases_seen = 0;
+    ctx->crock.msgids_seen = 0;
+    ctx->crock.msgids_expired = 0;
+    ctx->drock.mailboxes_seen = 0;
+    ctx->drock.mailboxes_deleted = 0;
+}
+
+static void stats_add(struct cyr_expire_ctx *ctx, const struct expire_stats *st)
+{
+    ctx->arock.mailboxes_seen += st->archive_mailboxes;
+    ctx->erock.mailboxes_seen += st->expire_mailboxes;
+    ctx->erock.messages_seen += st->messages_seen;
+    ctx->erock.messages_expired += st->messages_expired;
+    ctx->erock.messages_expunged += st->messages_expunged;
+    ctx->erock.userflags_expunged += st->userflags_expunged;
+    ctx->crock.mailboxes_seen += st->cid_mailboxes;
+    ctx->crock.databases_seen += st->databases_seen;
+    ctx->crock.msgids_seen += st->msgids_seen;
+    ctx->crock.msgids_expired += st->msgids_expired;
+    ctx->drock.mailboxes_seen += st->delete_mailboxes;
+    ctx->drock.mailboxes_deleted += st->mailboxes_deleted;
+}
+
+/* Run one phase over all shards, one worker process per shard.
+ * Returns 0 if every worker finished its shard. */
+static int run_phase_sharded(struct cyr_expire_ctx *ctx,
+                             const struct expire_phase *phase)
+{
+    pid_t *pids = xzmalloc(ctx->nshards * sizeof(pid_t));
+    int *fds = xzmalloc(ctx->nshards * sizeof(int));
+    struct expire_stats st;
+    struct timeval start;
+    int i, running = 0, r = 0;
+
+    gettimeofday(&start, NULL);
+
+    /* the children open their own databases */
+    mboxlist_close();
+    ctx->phase = phase->name;
+
+    for (i = 0; i < ctx->nshards; i++) {
+        int pipefd[2];
+
+        if (pipe(pipefd) < 0) {
+            syslog(LOG_ERR, "IOERROR: pipe: %m");
+            r = IMAP_IOERROR;
+            break;
+        }
+
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            syslog(LOG_ERR, "IOERROR: fork: %m");
+            close(pipefd[0]);
+            close(pipefd[1]);
+            r = IMAP_IOERROR;
+            break;
+        }
+
+        if (!pids[i]) {
+            /* worker */
+            close(pipefd[0]);
+            ctx->shard = i;
+            stats_clear(ctx);
+            phase->run(ctx);
+
+            stats_collect(ctx, &st);
+            if (write(pipefd[1], &st, sizeof(st)) != sizeof(st))
+                syslog(LOG_ERR, "IOERROR: reporting %s results: %m", phase->name);
+            close(pipefd[1]);
+
+            cyr_expire_cleanup(ctx);
+            _exit(sigquit ? EX_TEMPFAIL : 0);
+        }
+
+        close(pipefd[1]);
+        fds[i] = pipefd[0];
+        running++;
+    }
+
+    while (running) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+
+        if (pid < 0) {
+            if (errno != EINTR) break;
+            if (sigquit) {
+                /* pass it on, the workers checkpoint and stop */
+                for (i = 0; i < ctx->nshards; i++)
+                    if (pids[i] > 0) kill(pids[i], SIGQUIT);
+            }
+            continue;
+        }
+
+        for (i = 0; i < ctx->nshards; i++) {
+            if (pids[i] != pid) continue;
+
+            if (read(fds[i], &st, sizeof(st)) == sizeof(st))
+                stats_add(ctx, &st);
+            close(fds[i]);
+            pids[i] = 0;
+            running--;
+
+            if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+                if (!sigquit)
+                    syslog(LOG_ERR, "%s worker %d failed (status %d)",
+                           phase->name, i, status);
+                r = IMAP_AGAIN;
+            }
+        }
+    }
+
+    if (!r && !sigquit) {
+        state_finish_phase(ctx, phase->name);
+        phase->report(ctx, &start);
+    }
+
+    free(pids);
+    free(fds);
+
+    return r;
+}
+
+/* read back the expire marks the expunge workers recorded */
+static void load_expire_marks(struct cyr_expire_ctx *ctx)
+{
+    int i;
+
+    for (i = 0; i < ctx->nshards; i++) {
+        char *path = state_path(ctx, "expire", i);
+        FILE *f = fopen(path, "r");
+        char line[1024];
+
+        while (f && fgets(line, sizeof(line), f)) {
+            char *name = NULL;
+            long long mark = strtoll(line, &name, 10);
+            time_t *markp;
+
+            if (*name++ != ' ') continue;
+            name[strcspn(name, "\n")] = '\0';
+
+            markp = hash_lookup(name, &ctx->erock.table);
+            if (!markp) {
+                markp = xmalloc(sizeof(time_t));
+                hash_insert(name, markp, &ctx->erock.table);
+            }
+            *markp = mark;
+        }
+
+        if (f) fclose(f);
+        free(path);
+    }
+}
+
+/* -j: run each phase with the mailboxes split by user across workers */
+static int run_sharded(struct cyr_expire_ctx *ctx)
+{
+    strarray_t finished = STRARRAY_INITIALIZER;
+    const struct expire_phase *phase;
+    int incomplete = 0;
+    int r = 0;
+
+    ctx->nshards = ctx->args.jobs;
+    state_open(ctx, &finished);
+
+    for (phase = expire_phases; phase->name; phase++) {
+        if (!phase->enabled(ctx))
+            continue;
+
+        if (strarray_find(&finished, phase->name, 0) >= 0) {
+            verbosep("%s: already finished by an earlier run\n", phase->name);
+            continue;
+        }
+
+        if (run_phase_sharded(ctx, phase))
+            incomplete = 1;
+
+        if (sigquit)
+            break;
+    }
+
+    if (sigquit) {
+        syslog(LOG_NOTICE, "interrupted, run again to resume");
+        verbosep("interrupted, run again to resume\n");
+    }
+    else {
+        load_expire_marks(ctx);
+
+        /* purge deliver.db entries of expired messages */
+        r = do_duplicate_prune(ctx);
+
+        /* keep the checkpoints if a worker failed, so a rerun only
+         * redoes what it didn't finish */
+        if (!incomplete)
+            state_remove(ctx);
+    }
+
+    strarray_fini(&finished);
+
+    return r;
+}
+
 static int parse_args(int argc, char *argv[], struct arguments *args)
 {
     extern char *optarg;
@@ -792,7 +1406,7 @@ static int parse_args(int argc, char *argv[], struct arguments *args)
     args->do_expunge = true;
     args->do_cid_expire = -1;
 
-    while ((opt = getopt(argc, argv, "C:D:E:X:A:p:u:vaxtch")) != EOF) {
+    while ((opt = getopt(argc, argv, "C:D:E:X:A:j:p:u:vaxtch")) != EOF) {
         switch (opt) {
         case 'A':
             if (!parse_duration(optarg, &args->archive_seconds)) usage();
@@ -825,6 +1439,11 @@ static int parse_args(int argc, char *argv[], struct arguments *args)
             args->do_cid_expire = 0;
             break;
 
+        case 'j':
+            args->jobs = atoi(optarg);
+            if (args->jobs < 1) usage();
+            break;
+
         case 'p':
             args->mbox_prefix = optarg;
             break;
@@ -863,6 +1482,12 @@ static int parse_args(int argc, char *argv[], struct arguments *args)
         return -EINVAL;
     }
 
+    if (args->jobs > 1 && (args->userid || args->mbox_prefix)) {
+        fprintf(stderr, "-j can't be combined with -p or -u.\n");
+        usage();
+        return -EINVAL;
+    }
+
 
     return 0;
 }
@@ -897,6 +1522,11 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    if (ctx.args.jobs > 1) {
+        r = run_sharded(&ctx);
+        goto finish;
+    }
+
     r = do_archive(&ctx);
 
     if (sigquit)
@@ -50,15 +50,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <sysexits.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 
 #include "global.h"
+#include "lockstats.h"
+#include "mboxname.h"
 #include "proc.h"
+#include "ptrarray.h"
 #include "util.h"
 #include "../master/masterconf.h"
 #include "xmalloc.h"
 
+/* generated headers are not necessarily in current directory */
+#include "imap/imap_err.h"
+
 /* config.c stuff */
 const char *MASTER_CONFIG_FILENAME = DEFAULT_MASTER_CONFIG_FILENAME;
 
@@ -85,6 +92,8 @@ static void usage(void)
     fprintf(stderr, "  * conf-all      - listing of all config values\n");
     fprintf(stderr, "  * conf-default  - listing of all default config values\n");
     fprintf(stderr, "  * conf-lint     - unknown config keys\n");
+    fprintf(stderr, "  * locks         - mailbox name locks, most waited for first\n");
+    fprintf(stderr, "  * lockwaits     - most waited for locks of any kind\n");
     fprintf(stderr, "  * proc          - listing of all open processes\n");
     fprintf(stderr, "  * version       - Cyrus version\n");
     fprintf(stderr, "\n");
@@ -111,6 +120,100 @@ static void do_proc(void)
     proc_foreach(print_procinfo, NULL);
 }
 
+struct lockinfo {
+    struct locktable_info info;
+    char *name;
+};
+
+static int collect_lockinfo(const struct locktable_info *info, void *rock)
+{
+    ptrarray_t *locks = (ptrarray_t *) rock;
+    struct lockinfo *item = xmalloc(sizeof(struct lockinfo));
+
+    item->info = *info;
+    item->name = xstrdup(info->name);
+    ptrarray_append(locks, item);
+
+    return 0;
+}
+
+static int lockinfo_cmp(const void **a, const void **b)
+{
+    const struct lockinfo *la = *a, *lb = *b;
+
+    if (la->info.wait_usec != lb->info.wait_usec)
+        return la->info.wait_usec < lb->info.wait_usec ? 1 : -1;
+    if (la->info.nlocks != lb->info.nlocks)
+        return la->info.nlocks < lb->info.nlocks ? 1 : -1;
+    return strcmp(la->name, lb->name);
+}
+
+static void do_locks(void)
+{
+    ptrarray_t locks = PTRARRAY_INITIALIZER;
+    int i, r;
+
+    r = mboxname_foreach_lockinfo(collect_lockinfo, &locks);
+    if (r) {
+        fprintf(stderr, "can't read lock table: %s\n",
+                r == IMAP_NOTFOUND ? "mboxname_lockmethod is not shm"
+                                   : error_message(r));
+        exit(EX_UNAVAILABLE);
+    }
+
+    ptrarray_sort(&locks, lockinfo_cmp);
+
+    printf("%-40s %4s %7s %7s %10s %10s %12s %10s\n",
+           "name", "mode", "holders", "waiters", "locks", "waits",
+           "wait_ms", "max_ms");
+    for (i = 0; i < locks.count; i++) {
+        struct lockinfo *item = ptrarray_nth(&locks, i);
+
+        printf("%-40s %4s %7u %7u %10llu %10llu %12.1f %10.1f\n",
+               item->name,
+               item->info.nholders ? (item->info.exclusive ? "ex" : "sh") : "-",
+               item->info.nholders, item->info.nwaiters,
+               (unsigned long long) item->info.nlocks,
+               (unsigned long long) item->info.nwaits,
+               item->info.wait_usec / 1000.0,
+               item->info.max_wait_usec / 1000.0);
+        free(item->name);
+        free(item);
+    }
+
+    ptrarray_fini(&locks);
+}
+
+static void do_lockwaits(void)
+{
+    ptrarray_t locks = PTRARRAY_INITIALIZER;
+    int i;
+
+    if (lockstats_foreach_contended(collect_lockinfo, &locks)) {
+        fprintf(stderr, "can't read lock wait table: %s\n",
+                errno == ENOENT ? "lock_statistics is not enabled"
+                                : strerror(errno));
+        exit(EX_UNAVAILABLE);
+    }
+
+    ptrarray_sort(&locks, lockinfo_cmp);
+
+    printf("%-50s %10s %12s %10s\n", "lock", "waits", "wait_ms", "max_ms");
+    for (i = 0; i < locks.count; i++) {
+        struct lockinfo *item = ptrarray_nth(&locks, i);
+
+        printf("%-50s %10llu %12.1f %10.1f\n",
+               item->name,
+               (unsigned long long) item->info.nwaits,
+               item->info.wait_usec / 1000.0,
+               item->info.max_wait_usec / 1000.0);
+        free(item->name);
+        free(item);
+    }
+
+    ptrarray_fini(&locks);
+}
+
 static void print_overflow(const char *key, const char *val,
                           void *rock __attribute__((unused)))
 {
@@ -511,6 +614,10 @@ int main(int argc, char *argv[])
         do_defconf(want_since, since);
     else if (!strcmp(argv[optind], "conf-lint"))
         do_lint();
+    else if (!strcmp(argv[optind], "locks"))
+        do_locks();
+    else if (!strcmp(argv[optind], "lockwaits"))
+        do_lockwaits();
     else
         usage();
 
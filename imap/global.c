@@ -70,10 +70,14 @@
 #include "global.h"
 #include "libconfig.h"
 #include "libcyr_cfg.h"
+#include "lockstats.h"
 #include "mboxlist.h"
 #include "mutex.h"
+#include "profiler.h"
+#include "prometheus.h"
 #include "prot.h" /* for PROT_BUFSIZE */
 #include "strarray.h"
+#include "strhash.h"
 #include "userdeny.h"
 #include "util.h"
 #include "xmalloc.h"
@@ -380,6 +384,8 @@ EXPORTED int cyrus_init(const char *alt_config, const char *ident, unsigned flag
                                   config_getswitch(IMAPOPT_SQL_USESSL));
         libcyrus_config_setswitch(CYRUSOPT_SKIPLIST_ALWAYS_CHECKPOINT,
                                   config_getswitch(IMAPOPT_SKIPLIST_ALWAYS_CHECKPOINT));
+        libcyrus_config_setswitch(CYRUSOPT_TWOSKIP_SNAPSHOT_READS,
+                                  config_getswitch(IMAPOPT_TWOSKIP_SNAPSHOT_READS));
 
         /* Not until all configuration parameters are set! */
         libcyrus_init();
@@ -391,6 +397,28 @@ EXPORTED int cyrus_init(const char *alt_config, const char *ident, unsigned flag
         debug_locks_longer_than = atof(locktime);
     }
 
+    if (config_getswitch(IMAPOPT_LOCK_STATISTICS)) {
+        char tablename[64];
+
+        /* one per configdirectory */
+        snprintf(tablename, sizeof(tablename), "/cyrus-lockwaits-%08x",
+                 strhash(config_dir));
+        lockstats_init(config_getswitch(IMAPOPT_PROMETHEUS_ENABLED) ?
+                       prometheus_lockstats_report : NULL,
+                       tablename);
+    }
+
+    const char *profdir = config_getstring(IMAPOPT_PROFILER_DIR);
+    if (profdir) {
+        const char *services = config_getstring(IMAPOPT_PROFILER_SERVICES);
+        strarray_t *sa = strarray_split(services, NULL, 0);
+
+        profiler_init(profdir, config_ident,
+                      config_getint(IMAPOPT_PROFILER_HZ),
+                      strarray_find(sa, config_ident, 0) >= 0);
+        strarray_free(sa);
+    }
+
     return 0;
 }
 
@@ -770,6 +798,9 @@ EXPORTED int mysasl_proxy_policy(sasl_conn_t *conn,
 /* call before a cyrus application exits */
 EXPORTED void cyrus_done(void)
 {
+    /* before the modules, so prometheus is still there to report to */
+    lockstats_done();
+    profiler_done();
     cyrus_modules_done();
     if (cyrus_init_run != RUNNING)
         return;
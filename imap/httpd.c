@@ -472,28 +472,49 @@ static struct sasl_callback mysasl_cb[] = {
 
 /* Array of HTTP methods known by our server. */
 const struct known_meth_t http_methods[] = {
-    { "ACL",            0,              CYRUS_HTTP_ACL_TOTAL },
-    { "BIND",           0,              CYRUS_HTTP_BIND_TOTAL },
-    { "CONNECT",        METH_NOBODY,    CYRUS_HTTP_CONNECT_TOTAL },
-    { "COPY",           METH_NOBODY,    CYRUS_HTTP_COPY_TOTAL },
-    { "DELETE",         METH_NOBODY,    CYRUS_HTTP_DELETE_TOTAL },
-    { "GET",            METH_NOBODY,    CYRUS_HTTP_GET_TOTAL },
-    { "HEAD",           METH_NOBODY,    CYRUS_HTTP_HEAD_TOTAL },
-    { "LOCK",           0,              CYRUS_HTTP_LOCK_TOTAL },
-    { "MKCALENDAR",     0,              CYRUS_HTTP_MKCALENDAR_TOTAL },
-    { "MKCOL",          0,              CYRUS_HTTP_MKCOL_TOTAL },
-    { "MOVE",           METH_NOBODY,    CYRUS_HTTP_MOVE_TOTAL },
-    { "OPTIONS",        METH_NOBODY,    CYRUS_HTTP_OPTIONS_TOTAL },
-    { "PATCH",          0,              CYRUS_HTTP_PATCH_TOTAL },
-    { "POST",           0,              CYRUS_HTTP_POST_TOTAL },
-    { "PROPFIND",       0,              CYRUS_HTTP_PROPFIND_TOTAL },
-    { "PROPPATCH",      0,              CYRUS_HTTP_PROPPATCH_TOTAL },
-    { "PUT",            0,              CYRUS_HTTP_PUT_TOTAL },
-    { "REPORT",         0,              CYRUS_HTTP_REPORT_TOTAL },
-    { "TRACE",          METH_NOBODY,    CYRUS_HTTP_TRACE_TOTAL },
-    { "UNBIND",         0,              CYRUS_HTTP_UNBIND_TOTAL },
-    { "UNLOCK",         METH_NOBODY,    CYRUS_HTTP_UNLOCK_TOTAL },
-    { NULL,             0,              0 }
+    { "ACL",            0,              CYRUS_HTTP_ACL_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_ACL_BUCKET_0 },
+    { "BIND",           0,              CYRUS_HTTP_BIND_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_BIND_BUCKET_0 },
+    { "CONNECT",        METH_NOBODY,    CYRUS_HTTP_CONNECT_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_CONNECT_BUCKET_0 },
+    { "COPY",           METH_NOBODY,    CYRUS_HTTP_COPY_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_COPY_BUCKET_0 },
+    { "DELETE",         METH_NOBODY,    CYRUS_HTTP_DELETE_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_DELETE_BUCKET_0 },
+    { "GET",            METH_NOBODY,    CYRUS_HTTP_GET_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_GET_BUCKET_0 },
+    { "HEAD",           METH_NOBODY,    CYRUS_HTTP_HEAD_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_HEAD_BUCKET_0 },
+    { "LOCK",           0,              CYRUS_HTTP_LOCK_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_LOCK_BUCKET_0 },
+    { "MKCALENDAR",     0,              CYRUS_HTTP_MKCALENDAR_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_MKCALENDAR_BUCKET_0 },
+    { "MKCOL",          0,              CYRUS_HTTP_MKCOL_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_MKCOL_BUCKET_0 },
+    { "MOVE",           METH_NOBODY,    CYRUS_HTTP_MOVE_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_MOVE_BUCKET_0 },
+    { "OPTIONS",        METH_NOBODY,    CYRUS_HTTP_OPTIONS_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_OPTIONS_BUCKET_0 },
+    { "PATCH",          0,              CYRUS_HTTP_PATCH_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_PATCH_BUCKET_0 },
+    { "POST",           0,              CYRUS_HTTP_POST_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_POST_BUCKET_0 },
+    { "PROPFIND",       0,              CYRUS_HTTP_PROPFIND_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_PROPFIND_BUCKET_0 },
+    { "PROPPATCH",      0,              CYRUS_HTTP_PROPPATCH_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_PROPPATCH_BUCKET_0 },
+    { "PUT",            0,              CYRUS_HTTP_PUT_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_PUT_BUCKET_0 },
+    { "REPORT",         0,              CYRUS_HTTP_REPORT_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_REPORT_BUCKET_0 },
+    { "TRACE",          METH_NOBODY,    CYRUS_HTTP_TRACE_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_TRACE_BUCKET_0 },
+    { "UNBIND",         0,              CYRUS_HTTP_UNBIND_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_UNBIND_BUCKET_0 },
+    { "UNLOCK",         METH_NOBODY,    CYRUS_HTTP_UNLOCK_TOTAL,
+      CYRUS_HTTP_REQUEST_SECONDS_METHOD_UNLOCK_BUCKET_0 },
+    { NULL,             0,              0, 0 }
 };
 
 /* WebSocket handler */
@@ -1773,6 +1794,37 @@ EXPORTED int examine_request(struct transaction_t *txn, const char *uri)
 }
 
 
+/* traffic on the connection when the current request started */
+static int request_bytes_start = 0;
+
+/* count the request's time in the prometheus stats, and log it if it
+ * was slow */
+static void request_timed(struct transaction_t *txn)
+{
+    const char **hdr = spool_getheader(txn->req_hdrs, ":jmap");
+    const char *path = NULL;
+    double cmdtime = 0.0, nettime = 0.0;
+    int bytes = prot_bytes_in(httpd_in) + prot_bytes_out(httpd_out)
+              - request_bytes_start;
+    struct buf cmd = BUF_INITIALIZER;
+
+    cmdtime_endtimer(&cmdtime, &nettime);
+
+    prometheus_observe(http_methods[txn->meth].seconds,
+                       cyrus_http_request_seconds_buckets,
+                       CYRUS_HTTP_REQUEST_SECONDS_NUM_BUCKETS, cmdtime);
+    prometheus_flush_before_read(httpd_in);
+
+    buf_setcstr(&cmd, http_methods[txn->meth].name);
+    if (hdr) buf_printf(&cmd, " %s", hdr[0]);
+
+    if (txn->req_tgt.mbentry) path = txn->req_tgt.mbentry->name;
+    else if (txn->req_uri) path = txn->req_uri->path;
+
+    cmdtime_log(httpd_userid, buf_cstring(&cmd), path, 0, bytes);
+    buf_free(&cmd);
+}
+
 EXPORTED int process_request(struct transaction_t *txn)
 {
     int ret = 0;
@@ -1789,6 +1841,8 @@ EXPORTED int process_request(struct transaction_t *txn)
         prometheus_increment(
             prometheus_lookup_label(http_methods[txn->meth].metric,
                                     txn->req_tgt.namespace->name));
+
+        request_timed(txn);
     }
 
     if (ret == HTTP_UNAUTHORIZED) {
@@ -1987,6 +2041,7 @@ static void cmdloop(struct http_connection *conn)
         
         /* Start command timer */
         cmdtime_starttimer();
+        request_bytes_start = prot_bytes_in(httpd_in) + prot_bytes_out(httpd_out);
 
         if (txn.conn->sess_ctx) {
             /* HTTP/2 input */
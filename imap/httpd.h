@@ -106,6 +106,7 @@ struct known_meth_t {
     const char *name;
     unsigned flags;
     enum prom_labelled_metric metric;
+    enum prom_metric_id seconds;        /* first bucket of its histogram */
 };
 extern const struct known_meth_t http_methods[];
 extern struct namespace_t *http_namespaces[];
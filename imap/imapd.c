@@ -1080,6 +1080,7 @@ void shut_down(int code)
     if (mupdate_h) mupdate_disconnect(&mupdate_h);
 
     index_text_extractor_destroy();
+    index_convsort_cache_free();
 
     if (idling)
         idle_stop(index_mboxname(imapd_index));
@@ -1208,8 +1209,7 @@ static void cmdloop(void)
     static struct buf tag, cmd, arg1, arg2, arg3;
     char *p, shut[MAX_MAILBOX_PATH+1], cmdname[100];
     const char *err;
-    const char * commandmintimer;
-    double commandmintimerd = 0.0;
+    int bytes_start = 0;
     struct sync_reserve_list *reserve_list =
         sync_reserve_list_create(SYNC_MESSAGE_LIST_HASH_SIZE);
     struct applepushserviceargs applepushserviceargs;
@@ -1228,14 +1228,9 @@ static void cmdloop(void)
 
     motd_file();
 
-    /* Get command timer logging paramater. This string
-     * is a time in seconds. Any command that takes >=
-     * this time to execute is logged */
-    commandmintimer = config_getstring(IMAPOPT_COMMANDMINTIMER);
-    cmdtime_settimer(commandmintimer ? 1 : 0);
-    if (commandmintimer) {
-      commandmintimerd = atof(commandmintimer);
-    }
+    /* Time commands for the prometheus stats.  Commands which take
+     * commandmintimer seconds or more are logged */
+    cmdtime_settimer(config_getswitch(IMAPOPT_PROMETHEUS_ENABLED));
 
     for (;;) {
         /* Release any held index */
@@ -1320,6 +1315,7 @@ static void cmdloop(void)
 
         /* Start command timer */
         cmdtime_starttimer();
+        bytes_start = prot_bytes_in(imapd_in) + prot_bytes_out(imapd_out);
 
         /* note that about half the commands (the common ones that don't
            hit the mailboxes file) now close the mailboxes file just in
@@ -2500,17 +2496,23 @@ static void cmdloop(void)
             eatline(imapd_in, c);
         }
 
-        /* End command timer - don't log "idle" commands */
-        if (commandmintimer && strcmp("idle", cmdname)) {
-            double cmdtime, nettime;
-            const char *mboxname = index_mboxname(imapd_index);
-            if (!mboxname) mboxname = "<none>";
+        /* End command timer - don't count "idle" commands */
+        if (strcmp("idle", cmdname)) {
+            double cmdtime = 0.0, nettime = 0.0;
+            int bytes = prot_bytes_in(imapd_in) + prot_bytes_out(imapd_out)
+                      - bytes_start;
+            int id;
+
             cmdtime_endtimer(&cmdtime, &nettime);
-            if (cmdtime >= commandmintimerd) {
-                syslog(LOG_NOTICE, "cmdtimer: '%s' '%s' '%s' '%f' '%f' '%f'",
-                    imapd_userid ? imapd_userid : "<none>", cmdname, mboxname,
-                    cmdtime, nettime, cmdtime + nettime);
-            }
+
+            id = prometheus_find_label(CYRUS_IMAP_COMMAND_SECONDS, cmdname);
+            if (id < 0) id = CYRUS_IMAP_COMMAND_SECONDS_COMMAND_OTHER_BUCKET_0;
+            prometheus_observe(id, cyrus_imap_command_seconds_buckets,
+                               CYRUS_IMAP_COMMAND_SECONDS_NUM_BUCKETS, cmdtime);
+            prometheus_flush_before_read(imapd_in);
+
+            cmdtime_log(imapd_userid, cmdname, index_mboxname(imapd_index),
+                        imapd_index ? imapd_index->exists : 0, bytes);
         }
         continue;
 
@@ -3291,6 +3293,9 @@ static void cmd_idle(char *tag)
         }
     }
 
+    /* this can take a while: don't sit on the command timings */
+    prometheus_flush();
+
     if (idle_timeout > 0) {
         errno = 0;
         if (clock_gettime(CLOCK_MONOTONIC, &deadline) == -1) {
@@ -4068,7 +4073,9 @@ static void cmd_append(char *tag, char *name, const char *cur_name)
             if (r) goto done;
 
             /* Copy message to stage */
-            r = message_copy_strict(imapd_in, curstage->f, size, curstage->binary);
+            r = message_copy_strict_full(imapd_in, curstage->f, size,
+                                         curstage->binary,
+                                         append_stageguid(curstage->stage));
         }
         qdiffs[QUOTA_STORAGE] += size;
         /* If this is a non-BINARY message, close the stage file.
@@ -11333,7 +11340,8 @@ static int xfer_backport_seen_item(struct xfer_item *item,
 
     outlist = seqset_init(mailbox->i.last_uid, SEQ_MERGE);
 
-    struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, ITER_SKIP_EXPUNGED);
+    struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0,
+                                                  ITER_SKIP_EXPUNGED|ITER_HOTFIELDS);
 
     const message_t *msg;
     while ((msg = mailbox_iter_step(iter))) {
@@ -13566,6 +13574,10 @@ static void list_data(struct listargs *listargs)
         strarray_set(&listargs->pat, 0, "INBOX*");
     }
 
+    /* read the statuscache for all of the user's folders in one go */
+    if (listargs->ret & LIST_RET_STATUS)
+        status_batch_begin(imapd_userid);
+
     if ((listargs->ret & LIST_RET_SUBSCRIBED) &&
         (backend_inbox || (backend_inbox = proxy_findinboxserver(imapd_userid)))) {
         list_data_remotesubscriptions(listargs);
@@ -13605,6 +13617,9 @@ static void list_data(struct listargs *listargs)
 
         if (rock.last_name) free(rock.last_name);
     }
+
+    if (listargs->ret & LIST_RET_STATUS)
+        status_batch_end();
 }
 
 /*
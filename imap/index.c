@@ -67,6 +67,7 @@
 #include "backend.h"
 #include "charset.h"
 #include "conversations.h"
+#include "cyr_lock.h"
 #include "dlist.h"
 #include "hash.h"
 #include "hashu64.h"
@@ -81,6 +82,7 @@
 #include "message.h"
 #include "msgrecord.h"
 #include "parseaddr.h"
+#include "retry.h"
 #include "search_engines.h"
 #include "search_query.h"
 #include "seen.h"
@@ -166,6 +168,14 @@ static void index_get_ids(MsgData *msgdata,
 
 static int index_sort_compare(MsgData *md1, MsgData *md2,
                               const struct sortcrit *call_data);
+typedef int msgdata_cmp_t(const void *, const void *);
+static msgdata_cmp_t *index_msgdata_comparator(const struct sortcrit *sortcrit);
+static MsgData **convsort_msgdata_load(struct index_state *state,
+                                       const struct sortcrit *sortcrit,
+                                       int *cached);
+static void convsort_msgdata_free(MsgData **msgdata, unsigned n,
+                                  int cached, int scribbled);
+static void msgdata_fini(MsgData *md);
 
 static void *index_thread_getnext(Thread *thread);
 static void index_thread_setnext(Thread *thread, Thread *next);
@@ -651,8 +661,9 @@ static void index_refresh_locked(struct index_state *state)
 
     seenlist = _readseen(state, &recentuid);
 
-    /* walk through all records */
-    struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, ITER_SKIP_UNLINKED);
+    /* walk through all records, only the mutable fields are needed */
+    struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0,
+                                                  ITER_SKIP_UNLINKED|ITER_HOTFIELDS);
     while ((msg = mailbox_iter_step(iter))) {
         const struct index_record *record = msg_record(msg);
         im = &state->map[msgno-1];
@@ -950,7 +961,8 @@ struct seqset *index_vanished(struct index_state *state,
         const message_t *msg;
         /* all records are significant */
         /* List only expunged UIDs with MODSEQ > requested */
-        struct mailbox_iter *iter = mailbox_iter_init(mailbox, params->modseq, 0);
+        struct mailbox_iter *iter = mailbox_iter_init(mailbox, params->modseq,
+                                                      ITER_HOTFIELDS);
         while ((msg = mailbox_iter_step(iter))) {
             const struct index_record *record = msg_record(msg);
             if (!(record->internal_flags & FLAG_INTERNAL_EXPUNGED))
@@ -990,7 +1002,8 @@ struct seqset *index_vanished(struct index_state *state,
         }
 
         const message_t *msg;
-        struct mailbox_iter *iter = mailbox_iter_init(mailbox, params->modseq, ITER_SKIP_EXPUNGED);
+        struct mailbox_iter *iter = mailbox_iter_init(mailbox, params->modseq,
+                                                      ITER_SKIP_EXPUNGED|ITER_HOTFIELDS);
         mailbox_iter_startuid(iter, prevuid);
 
         /* possible efficiency improvement - use "seq_getnext" on seq
@@ -1079,10 +1092,13 @@ EXPORTED void index_fetchresponses(struct index_state *state,
     struct index_map *im;
     int fetched = 0;
     annotate_db_t *annot_db = NULL;
+    struct seqset *annot_uids = NULL;
 
     /* Keep an open reference on the per-mailbox db to avoid
      * doing too many slow database opens during the fetch */
-    if ((fetchargs->fetchitems & FETCH_ANNOTATION))
+    if ((fetchargs->fetchitems & FETCH_ANNOTATION) ||
+        ((fetchargs->fetchitems & FETCH_PREVIEW) &&
+         config_getstring(IMAPOPT_JMAP_PREVIEW_ANNOT)))
         annotate_getdb(state->mboxname, &annot_db);
 
     start = 1;
@@ -1123,6 +1139,26 @@ EXPORTED void index_fetchresponses(struct index_state *state,
     if (start < 1) start = 1;
     if (end > state->exists) end = state->exists;
 
+    /* and for a big enough fetch, read all their annotations at once */
+    if (annot_db) {
+        unsigned n = 0;
+
+        annot_uids = seqset_init(0, SEQ_SPARSE);
+        for (msgno = start; msgno <= end; msgno++) {
+            im = &state->map[msgno-1];
+            if (seq && !seqset_ismember(seq, usinguid ? im->uid : msgno))
+                continue;
+            seqset_add(annot_uids, im->uid, 1);
+            n++;
+        }
+
+        if (!ANNOTATE_CACHE_WORTHWHILE(n, state->exists) ||
+            annotatemore_cache_uids(state->mboxname, annot_uids)) {
+            seqset_free(annot_uids);
+            annot_uids = NULL;
+        }
+    }
+
     for (msgno = start; msgno <= end; msgno++) {
         im = &state->map[msgno-1];
         if (seq && !seqset_ismember(seq, usinguid ? im->uid : msgno)) {
@@ -1140,6 +1176,10 @@ EXPORTED void index_fetchresponses(struct index_state *state,
     state->oldhighestmodseq = state->highestmodseq;
 
     if (fetchedsomething) *fetchedsomething = fetched;
+    if (annot_uids) {
+        annotatemore_uncache(state->mboxname);
+        seqset_free(annot_uids);
+    }
     annotate_putdb(&annot_db);
 }
 
@@ -2126,12 +2166,12 @@ EXPORTED int index_convsort(struct index_state *state,
                             const struct windowargs *windowargs)
 {
     MsgData **msgdata = NULL;
+    int cached = 0;
     unsigned int mi;
     modseq_t xconvmodseq = 0;
     int i;
     hashu64_table seen_cids = HASHU64_TABLE_INITIALIZER;
     uint32_t pos = 0;
-    int found_anchor = 0;
     uint32_t anchor_pos = 0;
     uint32_t first_pos = 0;
     unsigned int ninwindow = 0;
@@ -2171,19 +2211,19 @@ EXPORTED int index_convsort(struct index_state *state,
 
     construct_hashu64_table(&seen_cids, state->exists/4+4, 0);
 
-    /* Create/load the msgdata array.
+    if (windowargs->anchor) {
+        uint32_t msgno = index_finduid(state, windowargs->anchor);
+        if (!msgno || index_getuid(state, msgno) != windowargs->anchor) {
+            r = IMAP_ANCHOR_NOT_FOUND;
+            goto out;
+        }
+    }
+
+    /* Create/load the msgdata array, sorted based on the given criteria.
      * load data for ALL messages always.  We sort before searching so
      * we can take advantage of the window arguments to stop searching
      * early */
-    msgdata = index_msgdata_load(state, NULL, state->exists, sortcrit,
-                                 windowargs->anchor, &found_anchor);
-    if (windowargs->anchor && !found_anchor) {
-        r = IMAP_ANCHOR_NOT_FOUND;
-        goto out;
-    }
-
-    /* Sort the messages based on the given criteria */
-    index_msgdata_sort(msgdata, state->exists, sortcrit);
+    msgdata = convsort_msgdata_load(state, sortcrit, &cached);
 
     /* One pass through the message list */
     for (mi = 0 ; mi < state->exists ; mi++) {
@@ -2283,7 +2323,7 @@ out:
     }
 
     /* free all our temporary data */
-    index_msgdata_free(msgdata, state->exists);
+    convsort_msgdata_free(msgdata, state->exists, cached, 0);
     ptrarray_fini(&results);
     free_hashu64_table(&seen_cids, NULL);
 
@@ -2635,6 +2675,7 @@ EXPORTED int index_convupdates(struct index_state *state,
                       const struct windowargs *windowargs)
 {
     MsgData **msgdata = NULL;
+    int cached = 0;
     modseq_t xconvmodseq = 0;
     unsigned int mi;
     int i;
@@ -2680,12 +2721,9 @@ EXPORTED int index_convupdates(struct index_state *state,
     construct_hashu64_table(&seen_cids, state->exists/4+4, 0);
     construct_hashu64_table(&old_seen_cids, state->exists/4+4, 0);
 
-    /* Create/load the msgdata array
+    /* Create/load the msgdata array, sorted based on the given criteria
      * initial list - load data for ALL messages always */
-    msgdata = index_msgdata_load(state, NULL, state->exists, sortcrit, 0, NULL);
-
-    /* Sort the messages based on the given criteria */
-    index_msgdata_sort(msgdata, state->exists, sortcrit);
+    msgdata = convsort_msgdata_load(state, sortcrit, &cached);
 
     /* Discover exemplars */
     for (mi = 0 ; mi < state->exists ; mi++) {
@@ -2819,7 +2857,7 @@ out:
     }
 
     /* free all our temporary data */
-    index_msgdata_free(msgdata, state->exists);
+    convsort_msgdata_free(msgdata, state->exists, cached, 1);
     ptrarray_fini(&added);
     ptrarray_fini(&removed);
     ptrarray_fini(&changed);
@@ -6757,32 +6795,634 @@ static int index_sort_compare_reverse_flagged(const void *v1, const void *v2)
     return message_guid_cmp(&md1->guid, &md2->guid);
 }
 
-void index_msgdata_sort(MsgData **msgdata, int n, const struct sortcrit *sortcrit)
+static msgdata_cmp_t *index_msgdata_comparator(const struct sortcrit *sortcrit)
+{
+    if (sortcrit_is_uid(sortcrit))
+        return index_sort_compare_uid;
+    if (sortcrit_is_reverse_uid(sortcrit))
+        return index_sort_compare_reverse_uid;
+    if (sortcrit_is_modseq(sortcrit))
+        return index_sort_compare_modseq;
+    if (sortcrit_is_arrival(sortcrit))
+        return index_sort_compare_arrival;
+    if (sortcrit_is_reverse_arrival(sortcrit))
+        return index_sort_compare_reverse_arrival;
+    if (sortcrit_is_reverse_flagged(sortcrit))
+        return index_sort_compare_reverse_flagged;
+
+    char *tmp = sortcrit_as_string(sortcrit);
+    syslog(LOG_DEBUG, "GENERICSORT: %s", tmp);
+    free(tmp);
+    the_sortcrit = (struct sortcrit *)sortcrit;
+    return index_sort_compare_generic_qsort;
+}
+
+/*
+ * Radix sort for numeric sort criteria
+ *
+ * Sorting a big mailbox by date, size or uid with qsort spends most
+ * of its time chasing MsgData pointers in the comparator.  When every
+ * criterion is numeric we can instead pull each key out once into a
+ * packed (key, MsgData *) array and do a stable LSD radix sort on it,
+ * a key at a time from the least significant, which gives the same
+ * order as the comparators (they all end in UID or sequence order, so
+ * there are no ties left for the GUID tiebreak to settle).
+ */
+
+#define RADIX_SORT_MIN   1024   /* below this, qsort is just as quick */
+#define RADIX_MAX_KEYS   8
+
+typedef uint64_t radix_key_t(const MsgData *md);
+
+struct radix_key {
+    radix_key_t *get;
+    uint64_t mask;
+    int reverse;
+};
+
+struct radix_item {
+    uint64_t key;
+    MsgData *md;
+};
+
+static uint64_t radix_uid(const MsgData *md)
+{
+    return md->uid;
+}
+
+static uint64_t radix_msgno(const MsgData *md)
+{
+    return md->msgno;
+}
+
+static uint64_t radix_internaldate(const MsgData *md)
+{
+    /* compared as unsigned, like numcmp() does */
+    return (uint64_t) md->internaldate;
+}
+
+static uint64_t radix_date(const MsgData *md)
+{
+    return (uint64_t) (md->sentdate ? md->sentdate : md->internaldate);
+}
+
+static uint64_t radix_savedate(const MsgData *md)
+{
+    return (uint64_t) (md->savedate ? md->savedate : md->internaldate);
+}
+
+static uint64_t radix_size(const MsgData *md)
+{
+    return md->size;
+}
+
+static uint64_t radix_modseq(const MsgData *md)
+{
+    return md->modseq;
+}
+
+static uint64_t radix_createdmodseq(const MsgData *md)
+{
+    return md->createdmodseq;
+}
+
+static uint64_t radix_spamscore(const MsgData *md)
+{
+    return md->spamscore;
+}
+
+static uint64_t radix_hasflag(const MsgData *md)
+{
+    return md->hasflag;
+}
+
+/* the keys, most significant first, that give the same order as
+ * index_msgdata_comparator() would, or 0 if there aren't any */
+static int radix_sort_keys(const struct sortcrit *sortcrit,
+                           struct radix_key *keys)
 {
+    int i = 0, n = 0;
+
+#define RADIX_MASKED_KEY(fn, m, rev) do { \
+        keys[n].get = (fn); keys[n].mask = (m); keys[n].reverse = (rev); \
+        n++; \
+    } while (0)
+#define RADIX_KEY(fn, rev) RADIX_MASKED_KEY(fn, ~0ULL, rev)
+
+    /* the special comparators have their own tiebreaks */
     if (sortcrit_is_uid(sortcrit)) {
-        qsort(msgdata, n, sizeof(MsgData *), index_sort_compare_uid);
+        RADIX_KEY(radix_uid, 0);
     }
     else if (sortcrit_is_reverse_uid(sortcrit)) {
-        qsort(msgdata, n, sizeof(MsgData *), index_sort_compare_reverse_uid);
+        RADIX_KEY(radix_uid, 1);
     }
     else if (sortcrit_is_modseq(sortcrit)) {
-        qsort(msgdata, n, sizeof(MsgData *), index_sort_compare_modseq);
+        RADIX_KEY(radix_modseq, 0);
+        RADIX_KEY(radix_uid, 0);
     }
     else if (sortcrit_is_arrival(sortcrit)) {
-        qsort(msgdata, n, sizeof(MsgData *), index_sort_compare_arrival);
+        RADIX_KEY(radix_internaldate, 0);
+        RADIX_KEY(radix_createdmodseq, 0);
+        RADIX_KEY(radix_uid, 0);
     }
     else if (sortcrit_is_reverse_arrival(sortcrit)) {
-        qsort(msgdata, n, sizeof(MsgData *), index_sort_compare_reverse_arrival);
+        RADIX_KEY(radix_internaldate, 1);
+        RADIX_KEY(radix_createdmodseq, 1);
+        RADIX_KEY(radix_uid, 0);
     }
     else if (sortcrit_is_reverse_flagged(sortcrit)) {
-        qsort(msgdata, n, sizeof(MsgData *), index_sort_compare_reverse_flagged);
+        RADIX_KEY(radix_hasflag, 1);
+        RADIX_KEY(radix_internaldate, 1);
+        RADIX_KEY(radix_createdmodseq, 1);
+        RADIX_KEY(radix_uid, 0);
     }
     else {
-        char *tmp = sortcrit_as_string(sortcrit);
-        syslog(LOG_DEBUG, "GENERICSORT: %s", tmp);
-        free(tmp);
-        the_sortcrit = (struct sortcrit *)sortcrit;
-        qsort(msgdata, n, sizeof(MsgData *), index_sort_compare_generic_qsort);
+        /* the generic comparator, up to and including the sequence */
+        do {
+            int rev = !!(sortcrit->flags & SORT_REVERSE);
+
+            if (n == RADIX_MAX_KEYS) return 0;
+
+            switch (sortcrit->key) {
+            case SORT_SEQUENCE:
+                RADIX_KEY(radix_msgno, rev);
+                break;
+            case SORT_ARRIVAL:
+                RADIX_KEY(radix_internaldate, rev);
+                break;
+            case SORT_DATE:
+                RADIX_KEY(radix_date, rev);
+                break;
+            case SORT_SAVEDATE:
+                RADIX_KEY(radix_savedate, rev);
+                break;
+            case SORT_SIZE:
+                RADIX_KEY(radix_size, rev);
+                break;
+            case SORT_MODSEQ:
+                RADIX_KEY(radix_modseq, rev);
+                break;
+            case SORT_CREATEDMODSEQ:
+                RADIX_KEY(radix_createdmodseq, rev);
+                break;
+            case SORT_UID:
+                RADIX_KEY(radix_uid, rev);
+                break;
+            case SORT_SPAMSCORE:
+                RADIX_KEY(radix_spamscore, rev);
+                break;
+            case SORT_HASFLAG:
+            case SORT_HASCONVFLAG:
+                /* bit i of hasflag is this criterion's flag; the comparator
+                 * ignores any past the 31st, and so do we */
+                if (i < 31)
+                    RADIX_MASKED_KEY(radix_hasflag, 1ULL << i, rev);
+                break;
+            default:
+                return 0;
+            }
+            i++;
+        } while ((sortcrit++)->key != SORT_SEQUENCE);
+    }
+
+#undef RADIX_KEY
+#undef RADIX_MASKED_KEY
+
+    return n;
+}
+
+/* one stable LSD pass per byte of the key, skipping bytes that are
+ * the same everywhere (most of them, for dates and uids) */
+static void radix_sort_pass(struct radix_item **itemsp,
+                            struct radix_item **tmpp, unsigned n)
+{
+    unsigned counts[8][256];
+    struct radix_item *items = *itemsp, *tmp = *tmpp, *swap;
+    unsigned i, b;
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < n; i++) {
+        uint64_t key = items[i].key;
+        for (b = 0; b < 8; b++)
+            counts[b][(key >> (b * 8)) & 0xff]++;
+    }
+
+    for (b = 0; b < 8; b++) {
+        unsigned *count = counts[b];
+        unsigned offset = 0, c;
+        unsigned shift = b * 8;
+
+        if (count[(items[0].key >> shift) & 0xff] == n)
+            continue;
+
+        for (c = 0; c < 256; c++) {
+            unsigned this = count[c];
+            count[c] = offset;
+            offset += this;
+        }
+
+        for (i = 0; i < n; i++)
+            tmp[count[(items[i].key >> shift) & 0xff]++] = items[i];
+
+        swap = items;
+        items = tmp;
+        tmp = swap;
+    }
+
+    *itemsp = items;
+    *tmpp = tmp;
+}
+
+static int index_msgdata_radix_sort(MsgData **msgdata, unsigned n,
+                                    const struct sortcrit *sortcrit)
+{
+    struct radix_key keys[RADIX_MAX_KEYS];
+    struct radix_item *items, *tmp;
+    unsigned i;
+    int k;
+
+    int nkeys = radix_sort_keys(sortcrit, keys);
+    if (!nkeys) return -1;
+
+    /* msgnos and uids are only unique within a single mailbox */
+    for (i = 0; i < n; i++) {
+        if (msgdata[i]->folder) return -1;
+    }
+
+    items = xmalloc(n * sizeof(struct radix_item));
+    tmp = xmalloc(n * sizeof(struct radix_item));
+
+    for (i = 0; i < n; i++)
+        items[i].md = msgdata[i];
+
+    for (k = nkeys - 1; k >= 0; k--) {
+        uint64_t flip = keys[k].reverse ? ~0ULL : 0;
+        int sorted = 1;
+
+        for (i = 0; i < n; i++) {
+            items[i].key = (keys[k].get(items[i].md) & keys[k].mask) ^ flip;
+            if (i && items[i].key < items[i-1].key) sorted = 0;
+        }
+
+        /* typically the uid/sequence tiebreak, on a list loaded in
+         * uid order */
+        if (sorted) continue;
+
+        radix_sort_pass(&items, &tmp, n);
+    }
+
+    for (i = 0; i < n; i++)
+        msgdata[i] = items[i].md;
+
+    free(items);
+    free(tmp);
+
+    return 0;
+}
+
+void index_msgdata_sort(MsgData **msgdata, int n, const struct sortcrit *sortcrit)
+{
+    if (n >= RADIX_SORT_MIN &&
+        !index_msgdata_radix_sort(msgdata, n, sortcrit))
+        return;
+
+    qsort(msgdata, n, sizeof(MsgData *), index_msgdata_comparator(sortcrit));
+}
+
+/*
+ * XCONVSORT/XCONVUPDATES sort cache
+ *
+ * Webmail asks for the same sort of the same mailbox on every page
+ * view, with only a few messages changed in between.  Rather than
+ * loading and sorting the whole mailbox each time, keep the sorted
+ * MsgData array (per process, in LRU order, up to xconvsort_cache_size
+ * kilobytes) and bring it up to date by dropping the messages whose
+ * modseq moved on and merging in freshly loaded copies of them.
+ *
+ * Only the sort order is cached: the search program and window are
+ * applied to it afresh for every command, so every search over the
+ * same sort shares one entry.
+ */
+struct convsort_cache {
+    struct convsort_cache *next;    /* LRU order, most recent first */
+    char *key;
+    modseq_t highestmodseq;
+    MsgData **msgdata;              /* sorted, each one xmalloc()ed */
+    unsigned n;
+    size_t size;
+    int renumber;                   /* msgnos were reused by the caller */
+};
+
+static struct convsort_cache *convsort_cache = NULL;
+static size_t convsort_cache_used = 0;
+
+/* an entry too big to keep, freed at the next lookup */
+static struct convsort_cache *convsort_cache_orphan = NULL;
+
+static void msgdata_fini(MsgData *md)
+{
+    xfree(md->cc);
+    xfree(md->from);
+    xfree(md->to);
+    xfree(md->displayfrom);
+    xfree(md->displayto);
+    xfree(md->xsubj);
+    xfree(md->msgid);
+    xfree(md->listid);
+    xfree(md->contenttype);
+    strarray_fini(&md->ref);
+    strarray_fini(&md->annot);
+}
+
+static size_t msgdata_size(const MsgData *md)
+{
+    size_t size = sizeof(MsgData) + sizeof(MsgData *);
+    int i;
+
+    size += strlen(md->cc ? md->cc : "") + strlen(md->from ? md->from : "");
+    size += strlen(md->to ? md->to : "");
+    size += strlen(md->displayfrom ? md->displayfrom : "");
+    size += strlen(md->displayto ? md->displayto : "");
+    size += strlen(md->xsubj ? md->xsubj : "");
+    size += strlen(md->msgid ? md->msgid : "");
+    size += strlen(md->listid ? md->listid : "");
+    size += strlen(md->contenttype ? md->contenttype : "");
+    for (i = 0; i < md->ref.count; i++)
+        size += strlen(md->ref.data[i]) + sizeof(char *);
+
+    return size;
+}
+
+/* give each MsgData of an index_msgdata_load() array its own allocation,
+ * so they can be freed one by one */
+static MsgData **msgdata_detach(MsgData **msgdata, unsigned n)
+{
+    MsgData **copy = xmalloc(n * sizeof(MsgData *));
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        copy[i] = xmemdup(msgdata[i], sizeof(MsgData));
+
+    /* the MsgData themselves share the one allocation with the array */
+    free(msgdata);
+
+    return copy;
+}
+
+static void convsort_cache_free_entry(struct convsort_cache *entry)
+{
+    unsigned i;
+
+    for (i = 0; i < entry->n; i++) {
+        msgdata_fini(entry->msgdata[i]);
+        free(entry->msgdata[i]);
+    }
+    free(entry->msgdata);
+    free(entry->key);
+    free(entry);
+}
+
+/* the cache key, or 0 if this sort can't be cached */
+static int convsort_cache_key(struct index_state *state,
+                              const struct sortcrit *sortcrit,
+                              struct buf *key)
+{
+    buf_printf(key, "%s\t%s\t%u\t", state->userid ? state->userid : "",
+               index_mboxname(state), state->mailbox->i.uidvalidity);
+
+    do {
+        switch (sortcrit->key) {
+        case SORT_ANNOTATION:
+        case SORT_CONVMODSEQ:
+        case SORT_CONVEXISTS:
+        case SORT_CONVSIZE:
+        case SORT_HASCONVFLAG:
+        case SORT_SNOOZEDUNTIL:
+            /* these can change without the message's modseq changing */
+            return 0;
+        }
+
+        buf_printf(key, " %u/%d", sortcrit->key, sortcrit->flags);
+        if (sortcrit->key == SORT_HASFLAG)
+            buf_printf(key, "/%s", sortcrit->args.flag.name);
+    } while ((sortcrit++)->key != SORT_SEQUENCE);
+
+    return 1;
+}
+
+static void convsort_cache_evict(size_t want)
+{
+    size_t max = (size_t) config_getint(IMAPOPT_XCONVSORT_CACHE_SIZE) * 1024;
+
+    while (convsort_cache && convsort_cache_used + want > max) {
+        struct convsort_cache **tailp = &convsort_cache;
+        while ((*tailp)->next) tailp = &(*tailp)->next;
+
+        convsort_cache_used -= (*tailp)->size;
+        convsort_cache_free_entry(*tailp);
+        *tailp = NULL;
+    }
+}
+
+/* bring a cached entry up to date with state, or return non-zero if
+ * it's quicker to start again */
+static int convsort_cache_update(struct index_state *state,
+                                 const struct sortcrit *sortcrit,
+                                 struct convsort_cache *entry)
+{
+    hashu64_table changed = HASHU64_TABLE_INITIALIZER;
+    unsigned *msgno_list = NULL;
+    MsgData **fresh = NULL, **merged = NULL;
+    unsigned nfresh = 0, nkept = 0, i, j, k;
+    msgdata_cmp_t *cmp;
+    int r = 0;
+
+    if (entry->highestmodseq > state->highestmodseq)
+        return IMAP_AGAIN;
+
+    /* which messages moved on since the entry was made? */
+    msgno_list = xmalloc((state->exists + 1) * sizeof(unsigned));
+    for (i = 0; i < state->exists; i++) {
+        if (state->map[i].modseq > entry->highestmodseq)
+            msgno_list[nfresh++] = i + 1;
+    }
+
+    /* lots of them: a full sort will be quicker than this */
+    if (nfresh > state->exists / 4 + 16) {
+        r = IMAP_AGAIN;
+        goto done;
+    }
+
+    construct_hashu64_table(&changed, nfresh + 1, 0);
+    for (i = 0; i < nfresh; i++)
+        hashu64_insert(state->map[msgno_list[i]-1].uid, (void *)1, &changed);
+
+    /* drop those, and anything no longer in the map, and renumber the rest */
+    for (i = 0; i < entry->n; i++) {
+        MsgData *md = entry->msgdata[i];
+        uint32_t msgno = 0;
+
+        if (!hashu64_lookup(md->uid, &changed)) {
+            msgno = index_finduid(state, md->uid);
+            if (msgno && state->map[msgno-1].uid != md->uid)
+                msgno = 0;
+        }
+
+        if (msgno) {
+            md->msgno = msgno;
+            entry->msgdata[nkept++] = md;
+        }
+        else {
+            entry->size -= msgdata_size(md);
+            msgdata_fini(md);
+            free(md);
+        }
+    }
+    entry->n = nkept;
+
+    if (nkept + nfresh != state->exists) {
+        r = IMAP_AGAIN;
+        goto done;
+    }
+
+    /* load and sort the changed ones, and merge them in */
+    if (nfresh) {
+        fresh = index_msgdata_load(state, msgno_list, nfresh, sortcrit, 0, NULL);
+        index_msgdata_sort(fresh, nfresh, sortcrit);
+        fresh = msgdata_detach(fresh, nfresh);
+
+        /* same order as the sort, or the merge goes wrong */
+        cmp = index_msgdata_comparator(sortcrit);
+        merged = xmalloc(state->exists * sizeof(MsgData *));
+        for (i = j = k = 0; i < nkept || j < nfresh; k++) {
+            if (j == nfresh ||
+                (i < nkept && cmp(&entry->msgdata[i], &fresh[j]) <= 0))
+                merged[k] = entry->msgdata[i++];
+            else {
+                entry->size += msgdata_size(fresh[j]);
+                merged[k] = fresh[j++];
+            }
+        }
+        free(fresh);
+        free(entry->msgdata);
+        entry->msgdata = merged;
+        entry->n = k;
+    }
+
+    entry->highestmodseq = state->highestmodseq;
+    entry->renumber = 0;
+
+done:
+    free_hashu64_table(&changed, NULL);
+    free(msgno_list);
+    return r;
+}
+
+/*
+ * Load and sort MsgData for all of state's messages, from the cache if
+ * we can.  Release the result with convsort_msgdata_free().
+ */
+static MsgData **convsort_msgdata_load(struct index_state *state,
+                                       const struct sortcrit *sortcrit,
+                                       int *cached)
+{
+    struct buf key = BUF_INITIALIZER;
+    struct convsort_cache **prevp, *entry = NULL;
+    MsgData **msgdata;
+    unsigned i;
+
+    *cached = 0;
+
+    if (convsort_cache_orphan) {
+        convsort_cache_free_entry(convsort_cache_orphan);
+        convsort_cache_orphan = NULL;
+    }
+
+    if (!config_getint(IMAPOPT_XCONVSORT_CACHE_SIZE) ||
+        !convsort_cache_key(state, sortcrit, &key))
+        goto nocache;
+
+    for (prevp = &convsort_cache; *prevp; prevp = &(*prevp)->next) {
+        if (!strcmp((*prevp)->key, buf_cstring(&key))) {
+            entry = *prevp;
+            *prevp = entry->next;
+            break;
+        }
+    }
+
+    if (entry) {
+        convsort_cache_used -= entry->size;
+        if ((entry->highestmodseq != state->highestmodseq ||
+             entry->n != state->exists || entry->renumber) &&
+            convsort_cache_update(state, sortcrit, entry)) {
+            convsort_cache_free_entry(entry);
+            entry = NULL;
+        }
+    }
+
+    if (!entry) {
+        if (!state->exists) goto nocache;
+
+        msgdata = index_msgdata_load(state, NULL, state->exists, sortcrit, 0, NULL);
+        index_msgdata_sort(msgdata, state->exists, sortcrit);
+        msgdata = msgdata_detach(msgdata, state->exists);
+
+        entry = xzmalloc(sizeof(struct convsort_cache));
+        entry->key = buf_release(&key);
+        entry->msgdata = msgdata;
+        entry->n = state->exists;
+        entry->highestmodseq = state->highestmodseq;
+        for (i = 0; i < entry->n; i++)
+            entry->size += msgdata_size(msgdata[i]);
+    }
+
+    buf_free(&key);
+    *cached = 1;
+
+    /* keep it if it fits at all */
+    convsort_cache_evict(entry->size);
+    if (convsort_cache_used + entry->size >
+        (size_t) config_getint(IMAPOPT_XCONVSORT_CACHE_SIZE) * 1024) {
+        convsort_cache_orphan = entry;
+        return entry->msgdata;
+    }
+
+    entry->next = convsort_cache;
+    convsort_cache = entry;
+    convsort_cache_used += entry->size;
+
+    return entry->msgdata;
+
+nocache:
+    buf_free(&key);
+    msgdata = index_msgdata_load(state, NULL, state->exists, sortcrit, 0, NULL);
+    index_msgdata_sort(msgdata, state->exists, sortcrit);
+    return msgdata;
+}
+
+/* scribbled is set if the caller reused the msgno fields */
+static void convsort_msgdata_free(MsgData **msgdata, unsigned n,
+                                  int cached, int scribbled)
+{
+    if (!cached)
+        index_msgdata_free(msgdata, n);
+    else if (scribbled && convsort_cache && convsort_cache->msgdata == msgdata)
+        convsort_cache->renumber = 1;
+}
+
+/* for shutdown, and leak checkers */
+EXPORTED void index_convsort_cache_free(void)
+{
+    while (convsort_cache) {
+        struct convsort_cache *entry = convsort_cache;
+        convsort_cache = entry->next;
+        convsort_cache_free_entry(entry);
+    }
+    convsort_cache_used = 0;
+
+    if (convsort_cache_orphan) {
+        convsort_cache_free_entry(convsort_cache_orphan);
+        convsort_cache_orphan = NULL;
     }
 }
 
@@ -6800,17 +7440,7 @@ void index_msgdata_free(MsgData **msgdata, unsigned int n)
 
         if (!md) continue;
 
-        xfree(md->cc);
-        xfree(md->from);
-        xfree(md->to);
-        xfree(md->displayfrom);
-        xfree(md->displayto);
-        xfree(md->xsubj);
-        xfree(md->msgid);
-        xfree(md->listid);
-        xfree(md->contenttype);
-        strarray_fini(&md->ref);
-        strarray_fini(&md->annot);
+        msgdata_fini(md);
     }
     free(msgdata);
 }
@@ -7528,6 +8158,435 @@ static void index_thread_search(struct index_state *state,
     }
 }
 
+/*
+ * Persistent THREAD data
+ *
+ * Threading a big mailbox is dominated by reading every message's
+ * cache record and parsing its Message-ID, References and subject.
+ * None of those ever change for a given UID, so mailboxes with at
+ * least thread_cache_min messages keep them in cyrus.thread as 64-bit
+ * hashes, and each THREAD command only has to parse the messages that
+ * arrived since the last one.  Records of expunged messages are left
+ * in place until they make up a quarter of the file, and then the
+ * file is rewritten without them.
+ *
+ * The threading code itself works on strings, so the hashes are
+ * handed to it in hex, which threads exactly like the real ids do.
+ *
+ * All fields are in network byte order:
+ *
+ *   header:  version, uidvalidity, last_uid, num_records (4 bytes each)
+ *            highestmodseq, reserved (8 bytes each)
+ *   record:  uid, flags (4 bytes each)
+ *            internaldate, sentdate, msgid hash, subject hash (8 each)
+ *            nrefs, reserved (4 bytes each)
+ *            nrefs reference hashes (8 bytes each)
+ */
+
+#define THREAD_CACHE_VERSION      1
+#define THREAD_HEADER_SIZE        32
+#define THREAD_RECORD_SIZE        48
+
+#define THREAD_RECORD_REFWD       (1<<0)
+#define THREAD_RECORD_EMPTYID     (1<<1)
+
+struct thread_record {
+    uint32_t uid;
+    uint32_t flags;
+    time_t internaldate;
+    time_t sentdate;
+    uint64_t msgid;
+    uint64_t subject;           /* 0 for an empty subject */
+    uint32_t nrefs;
+    const char *refs;           /* nrefs hashes, in network byte order */
+    const char *base;           /* the whole record, as stored */
+    size_t len;
+};
+
+static const struct sortcrit thread_cache_loadcrit[] =
+                             {{ LOAD_IDS,      0, {{NULL,NULL}} },
+                              { SORT_SUBJECT,  0, {{NULL,NULL}} },
+                              { SORT_DATE,     0, {{NULL,NULL}} },
+                              { SORT_SEQUENCE, 0, {{NULL,NULL}} }};
+
+/* 64-bit FNV-1a: the same on every platform, which matters for a
+ * file that can be on shared metadata storage */
+static uint64_t thread_hash(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 1099511628211ULL;
+    }
+
+    /* 0 is kept for "no subject" */
+    return h ? h : 1;
+}
+
+/* can the threading data for these load criteria come from the file? */
+static int thread_cache_usable(struct index_state *state,
+                               const struct sortcrit *loadcrit)
+{
+    int min = config_getint(IMAPOPT_THREAD_CACHE_MIN);
+    int i;
+
+    if (min <= 0 || state->exists < (unsigned) min)
+        return 0;
+
+    for (i = 0; loadcrit[i].key; i++) {
+        switch (loadcrit[i].key) {
+        case LOAD_IDS:
+        case SORT_SUBJECT:
+        case SORT_DATE:
+        case SORT_ARRIVAL:
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* parse n records from base, or return -1 if they don't fit in len */
+static int thread_cache_parse(const char *base, size_t len, unsigned n,
+                              struct thread_record *records)
+{
+    size_t offset = 0;
+    uint32_t lastuid = 0;
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        struct thread_record *rec = &records[i];
+        const char *p = base + offset;
+
+        if (len - offset < THREAD_RECORD_SIZE) return -1;
+
+        rec->base = p;
+        rec->uid = ntohl(*((bit32 *)(p+0)));
+        rec->flags = ntohl(*((bit32 *)(p+4)));
+        rec->internaldate = align_ntohll(p+8);
+        rec->sentdate = align_ntohll(p+16);
+        rec->msgid = align_ntohll(p+24);
+        rec->subject = align_ntohll(p+32);
+        rec->nrefs = ntohl(*((bit32 *)(p+40)));
+        rec->refs = p + THREAD_RECORD_SIZE;
+        rec->len = THREAD_RECORD_SIZE + 8 * (size_t) rec->nrefs;
+
+        if (len - offset < rec->len) return -1;
+        if (rec->uid <= lastuid) return -1;
+
+        lastuid = rec->uid;
+        offset += rec->len;
+    }
+
+    return 0;
+}
+
+static void thread_cache_append(struct buf *buf, const MsgData *md)
+{
+    uint32_t flags = 0;
+    int i;
+
+    if (md->is_refwd)
+        flags |= THREAD_RECORD_REFWD;
+    /* made up by index_get_ids() from the msgno, which isn't stable */
+    if (!strncmp(md->msgid, "<Empty-ID: ", 11))
+        flags |= THREAD_RECORD_EMPTYID;
+
+    buf_appendbit32(buf, md->uid);
+    buf_appendbit32(buf, flags);
+    buf_appendbit64(buf, md->internaldate);
+    buf_appendbit64(buf, md->sentdate);
+    buf_appendbit64(buf, (flags & THREAD_RECORD_EMPTYID) ?
+                         0 : thread_hash(md->msgid));
+    buf_appendbit64(buf, *md->xsubj ? thread_hash(md->xsubj) : 0);
+    buf_appendbit32(buf, md->ref.count);
+    buf_appendbit32(buf, 0);
+    for (i = 0; i < md->ref.count; i++)
+        buf_appendbit64(buf, thread_hash(md->ref.data[i]));
+}
+
+static void thread_cache_header(struct buf *buf, struct index_state *state,
+                                uint32_t last_uid, unsigned nrecords)
+{
+    buf_appendbit32(buf, THREAD_CACHE_VERSION);
+    buf_appendbit32(buf, state->mailbox->i.uidvalidity);
+    buf_appendbit32(buf, last_uid);
+    buf_appendbit32(buf, nrecords);
+    buf_appendbit64(buf, state->highestmodseq);
+    buf_appendbit64(buf, 0);
+}
+
+/* write a whole new file, with the live records and the new ones */
+static int thread_cache_rewrite(struct index_state *state,
+                                struct thread_record *records, unsigned n,
+                                const struct buf *fresh, unsigned nfresh,
+                                uint32_t last_uid)
+{
+    struct buf buf = BUF_INITIALIZER;
+    struct mailbox *mailbox = state->mailbox;
+    char *fname = xstrdup(mailbox_meta_fname(mailbox, META_THREAD));
+    struct buf tmpname = BUF_INITIALIZER;
+    unsigned i, nlive = 0;
+    int fd, r = 0;
+
+    for (i = 0; i < n; i++) {
+        if (records[i].base) nlive++;
+    }
+
+    /* our own temporary file, as nothing stops two of us writing */
+    buf_printf(&tmpname, "%s.%d",
+               mailbox_meta_newfname(mailbox, META_THREAD), (int) getpid());
+
+    thread_cache_header(&buf, state, last_uid, nlive + nfresh);
+    for (i = 0; i < n; i++) {
+        if (records[i].base)
+            buf_appendmap(&buf, records[i].base, records[i].len);
+    }
+    buf_append(&buf, fresh);
+
+    fd = open(buf_cstring(&tmpname), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd == -1 ||
+        retry_write(fd, buf.s, buf.len) != (ssize_t) buf.len ||
+        fsync(fd) || rename(buf_cstring(&tmpname), fname)) {
+        syslog(LOG_ERR, "IOERROR: writing %s: %m", fname);
+        unlink(buf_cstring(&tmpname));
+        r = IMAP_IOERROR;
+    }
+    if (fd != -1) close(fd);
+
+    buf_free(&buf);
+    buf_free(&tmpname);
+    free(fname);
+    return r;
+}
+
+/* add the new records to the end of the file we read them from */
+static int thread_cache_extend(struct index_state *state, int fd,
+                               const char *fname, size_t end,
+                               const struct buf *fresh, unsigned nrecords,
+                               uint32_t last_uid)
+{
+    struct buf header = BUF_INITIALIZER;
+    int r = 0;
+
+    thread_cache_header(&header, state, last_uid, nrecords);
+
+    /* records first, so a reader never sees a header that counts
+     * records which aren't there yet */
+    if (pwrite(fd, fresh->s, fresh->len, end) != (ssize_t) fresh->len ||
+        fsync(fd) ||
+        pwrite(fd, header.s, header.len, 0) != (ssize_t) header.len ||
+        ftruncate(fd, end + fresh->len)) {
+        syslog(LOG_ERR, "IOERROR: appending to %s: %m", fname);
+        r = IMAP_IOERROR;
+    }
+
+    buf_free(&header);
+    return r;
+}
+
+static int thread_record_cmp(const void *key, const void *mem)
+{
+    uint32_t uid = *((const uint32_t *) key);
+    const struct thread_record *rec = (const struct thread_record *) mem;
+
+    return uid < rec->uid ? -1 : uid > rec->uid;
+}
+
+/*
+ * Load the msgdata for threading from cyrus.thread, bringing the file
+ * up to date first.  Returns NULL if the file can't be used, and the
+ * caller should load from the cache as usual.
+ */
+static MsgData **thread_cache_load(struct index_state *state,
+                                   unsigned *msgno_list, unsigned nmsg,
+                                   const struct sortcrit *loadcrit)
+{
+    struct mailbox *mailbox = state->mailbox;
+    struct thread_record *records = NULL;
+    struct buf fresh = BUF_INITIALIZER;
+    struct buf hex = BUF_INITIALIZER;
+    MsgData **ptrs = NULL, *md, **tail = NULL;
+    const char *base = NULL;
+    size_t len = 0, end = THREAD_HEADER_SIZE;
+    char *fname = xstrdup(mailbox_meta_fname(mailbox, META_THREAD));
+    uint32_t last_uid = 0, new_last_uid;
+    unsigned nrecords = 0, nlive = 0, ntail = 0, i, j;
+    unsigned *tail_list = NULL;
+    int fd, r, want_ids = 0, want_subj = 0, want_date = 0, want_arrival = 0;
+
+    fd = open(fname, O_RDWR, 0666);
+    if (fd != -1) {
+        map_refresh(fd, 1, &base, &len, MAP_UNKNOWN_LEN, fname,
+                    mailbox->name);
+    }
+
+    if (len >= THREAD_HEADER_SIZE &&
+        ntohl(*((bit32 *)(base+0))) == THREAD_CACHE_VERSION &&
+        ntohl(*((bit32 *)(base+4))) == mailbox->i.uidvalidity) {
+        last_uid = ntohl(*((bit32 *)(base+8)));
+        nrecords = ntohl(*((bit32 *)(base+12)));
+
+        if (nrecords <= (len - THREAD_HEADER_SIZE) / THREAD_RECORD_SIZE) {
+            records = xmalloc(nrecords * sizeof(struct thread_record));
+            r = thread_cache_parse(base + THREAD_HEADER_SIZE,
+                                   len - THREAD_HEADER_SIZE, nrecords, records);
+        }
+        else r = -1;
+
+        if (r) {
+            syslog(LOG_NOTICE, "thread cache %s is damaged, rebuilding", fname);
+            last_uid = nrecords = 0;
+        }
+    }
+    if (nrecords) {
+        end = records[nrecords-1].base + records[nrecords-1].len - base;
+    }
+
+    /* count the records that are still in the mailbox, and forget the
+     * rest, so a rewrite drops them */
+    for (i = 0, j = 1; i < nrecords; i++) {
+        while (j <= state->exists && index_getuid(state, j) < records[i].uid)
+            j++;
+        if (j <= state->exists && index_getuid(state, j) == records[i].uid)
+            nlive++;
+        else
+            records[i].base = NULL;
+    }
+
+    /* every message up to last_uid must have a record, or the file is
+     * out of step with the mailbox (a reconstruct which kept the
+     * UIDVALIDITY, say) and has to be built again */
+    if ((nrecords && records[nrecords-1].uid > last_uid) ||
+        last_uid > mailbox->i.last_uid ||
+        nlive != index_finduid(state, last_uid)) {
+        syslog(LOG_NOTICE, "thread cache %s doesn't match the mailbox, "
+               "rebuilding", fname);
+        last_uid = nrecords = nlive = 0;
+        end = THREAD_HEADER_SIZE;
+    }
+
+    /* make room for the messages that arrived since */
+    ntail = state->exists - index_finduid(state, last_uid);
+    records = xrealloc(records,
+                       (nrecords + ntail) * sizeof(struct thread_record));
+    new_last_uid = ntail ? index_getuid(state, state->exists) : last_uid;
+
+    /* parse the messages that arrived since the file was written */
+    if (ntail) {
+        tail_list = xmalloc(ntail * sizeof(unsigned));
+        for (i = 0; i < ntail; i++)
+            tail_list[i] = state->exists - ntail + i + 1;
+
+        tail = index_msgdata_load(state, tail_list, ntail,
+                                  thread_cache_loadcrit, 0, NULL);
+        for (i = 0; i < ntail; i++) {
+            /* broken cache record, don't store anything */
+            if (!tail[i]->msgid || !tail[i]->xsubj) goto done;
+            thread_cache_append(&fresh, tail[i]);
+        }
+        if (thread_cache_parse(fresh.s, fresh.len, ntail,
+                               records + nrecords)) goto done;
+    }
+
+    if (fd == -1 || !nrecords || (nrecords - nlive) > nrecords / 4) {
+        thread_cache_rewrite(state, records, nrecords, &fresh, ntail,
+                             new_last_uid);
+    }
+    else if (ntail && !lock_nonblocking(fd, fname)) {
+        struct stat sbuf;
+
+        /* only if nobody else has extended it since we read it */
+        if (!fstat(fd, &sbuf) && (size_t) sbuf.st_size == len)
+            thread_cache_extend(state, fd, fname, end, &fresh,
+                                nrecords + ntail, new_last_uid);
+        lock_unlock(fd, fname);
+    }
+
+    for (i = 0; loadcrit[i].key; i++) {
+        switch (loadcrit[i].key) {
+        case LOAD_IDS:
+            want_ids = 1;
+            break;
+        case SORT_SUBJECT:
+            want_subj = 1;
+            break;
+        case SORT_DATE:
+            want_date = 1;
+            break;
+        case SORT_ARRIVAL:
+            want_arrival = 1;
+            break;
+        }
+    }
+
+    ptrs = (MsgData **) xzmalloc(nmsg * sizeof(MsgData *) + nmsg * sizeof(MsgData));
+    md = (MsgData *)(ptrs + nmsg);
+
+    for (i = 0; i < nmsg; i++) {
+        MsgData *cur = ptrs[i] = &md[i];
+        const struct thread_record *rec;
+
+        cur->msgno = msgno_list[i];
+        cur->uid = index_getuid(state, cur->msgno);
+
+        rec = bsearch(&cur->uid, records, nrecords + ntail,
+                      sizeof(struct thread_record), thread_record_cmp);
+        if (!rec) {
+            /* can't happen, but the slow way still works */
+            index_msgdata_free(ptrs, nmsg);
+            ptrs = NULL;
+            goto done;
+        }
+
+        if (want_ids) {
+            if (rec->flags & THREAD_RECORD_EMPTYID) {
+                buf_printf(&hex, "<Empty-ID: %u>", cur->msgno);
+            }
+            else {
+                buf_printf(&hex, "%016llx", (unsigned long long) rec->msgid);
+            }
+            cur->msgid = buf_release(&hex);
+
+            for (j = 0; j < rec->nrefs; j++) {
+                buf_printf(&hex, "%016llx", align_ntohll(rec->refs + 8*j));
+                strarray_appendm(&cur->ref, buf_release(&hex));
+            }
+        }
+        if (want_subj) {
+            if (rec->subject)
+                buf_printf(&hex, "%016llx", (unsigned long long) rec->subject);
+            cur->xsubj = xstrdup(buf_cstring(&hex));
+            cur->xsubj_hash = strhash(cur->xsubj);
+            cur->is_refwd = !!(rec->flags & THREAD_RECORD_REFWD);
+            buf_reset(&hex);
+        }
+        if (want_date) {
+            cur->sentdate = rec->sentdate;
+        }
+        if (want_date || want_arrival) {
+            cur->internaldate = rec->internaldate;
+        }
+    }
+
+done:
+    if (tail) index_msgdata_free(tail, ntail);
+    if (fd != -1) {
+        map_free(&base, &len);
+        close(fd);
+    }
+    free(tail_list);
+    free(records);
+    buf_free(&fresh);
+    buf_free(&hex);
+    free(fname);
+
+    return ptrs;
+}
+
 /*
  * Guts of the REFERENCES algorithms.  Behavior is tweaked with loadcrit[],
  * threadproc(), searchproc() and sortcrit[].
@@ -7547,7 +8606,11 @@ static void _index_thread_ref(struct index_state *state, unsigned *msgno_list,
     struct rootset rootset;
 
     /* Create/load the msgdata array */
-    msgdata = index_msgdata_load(state, msgno_list, nmsg, loadcrit, 0, NULL);
+    msgdata = NULL;
+    if (thread_cache_usable(state, loadcrit))
+        msgdata = thread_cache_load(state, msgno_list, nmsg, loadcrit);
+    if (!msgdata)
+        msgdata = index_msgdata_load(state, msgno_list, nmsg, loadcrit, 0, NULL);
 
     /* calculate the sum of the number of references for all messages */
     for (mi = 0, tref = 0 ; mi < nmsg ; mi++)
@@ -46,6 +46,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#include <ctype.h>
 #include <errno.h>
 
 #include "append.h"
@@ -477,6 +478,27 @@ static jmap_method_t *find_methodproc(const char *name, hash_table *jmap_methods
     return hash_lookup(name, jmap_methods);
 }
 
+/* count a method call's time in the prometheus stats */
+static void method_timed(const char *mname, const struct timeval *start)
+{
+    struct timeval end;
+    char label[64], *p;
+    int id;
+
+    gettimeofday(&end, NULL);
+
+    /* Email/get is counted as email_get */
+    strlcpy(label, mname, sizeof(label));
+    for (p = label; *p; p++)
+        *p = *p == '/' ? '_' : tolower((unsigned char) *p);
+
+    id = prometheus_find_label(CYRUS_JMAP_METHOD_SECONDS, label);
+    if (id < 0) id = CYRUS_JMAP_METHOD_SECONDS_METHOD_OTHER_BUCKET_0;
+    prometheus_observe(id, cyrus_jmap_method_seconds_buckets,
+                       CYRUS_JMAP_METHOD_SECONDS_NUM_BUCKETS,
+                       timesub(start, &end));
+}
+
 /* Return the ACL for mbentry for the authstate of userid.
  * Lookup and store ACL rights in the mboxrights cache. */
 static int _rights_for_mbentry(struct auth_state *authstate,
@@ -832,7 +854,10 @@ HIDDEN int jmap_api(struct transaction_t *txn, json_t **res,
         }
 
         /* Call the message processor. */
+        struct timeval method_start;
+        gettimeofday(&method_start, NULL);
         r = mp->proc(&req);
+        method_timed(mname, &method_start);
 
         /* Finalize request context */
         jmap_finireq(&req);
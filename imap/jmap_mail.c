@@ -5872,6 +5872,8 @@ static void jmap_email_get_threadsonly(jmap_req_t *req, struct jmap_get *get)
 struct _warmup_mboxcache_cb_rock {
     jmap_req_t *req;
     ptrarray_t mboxes;
+    int want_annots;
+    ptrarray_t uids;    /* arrayu64_t of UIDs for each of mboxes */
 };
 
 static int _warmup_mboxcache_cb(const conv_guidrec_t *rec, void* vrock)
@@ -5881,6 +5883,8 @@ static int _warmup_mboxcache_cb(const conv_guidrec_t *rec, void* vrock)
     for (i = 0; i < ptrarray_size(&rock->mboxes); i++) {
         struct mailbox *mbox = ptrarray_nth(&rock->mboxes, i);
         if (!strcmp(rec->mboxname, mbox->name)) {
+            if (rock->want_annots)
+                arrayu64_append(ptrarray_nth(&rock->uids, i), rec->uid);
             return 0;
         }
     }
@@ -5888,17 +5892,55 @@ static int _warmup_mboxcache_cb(const conv_guidrec_t *rec, void* vrock)
     int r = jmap_openmbox(rock->req, rec->mboxname, &mbox, /*rw*/0);
     if (!r) {
         ptrarray_append(&rock->mboxes, mbox);
+        if (rock->want_annots) {
+            arrayu64_t *uids = arrayu64_new();
+            arrayu64_append(uids, rec->uid);
+            ptrarray_append(&rock->uids, uids);
+        }
     }
     return r;
 }
 
+/* Read the annotations of the requested emails with one scan of each
+ * mailbox, rather than a lookup per email.  The mailboxes it cached go
+ * into @cached, for annotatemore_uncache() when done. */
+static void _warmup_annotcache(struct _warmup_mboxcache_cb_rock *rock,
+                               strarray_t *cached)
+{
+    int i, j;
+
+    for (i = 0; i < ptrarray_size(&rock->mboxes); i++) {
+        struct mailbox *mbox = ptrarray_nth(&rock->mboxes, i);
+        arrayu64_t *uids = ptrarray_nth(&rock->uids, i);
+        struct seqset *seq;
+
+        arrayu64_sort(uids, NULL/*ascending*/);
+        arrayu64_uniq(uids);
+        if (!ANNOTATE_CACHE_WORTHWHILE((unsigned) arrayu64_size(uids),
+                                       mbox->i.exists))
+            continue;
+
+        seq = seqset_init(0, SEQ_SPARSE);
+        for (j = 0; j < arrayu64_size(uids); j++)
+            seqset_add(seq, arrayu64_nth(uids, j), 1);
+        if (!annotatemore_cache_uids(mbox->name, seq))
+            strarray_append(cached, mbox->name);
+        seqset_free(seq);
+    }
+}
+
 static void jmap_email_get_full(jmap_req_t *req, struct jmap_get *get, struct email_getargs *args)
 {
     size_t i;
     json_t *val;
 
     /* Warm up the mailbox cache by opening all mailboxes */
-    struct _warmup_mboxcache_cb_rock rock = { req, PTRARRAY_INITIALIZER };
+    struct _warmup_mboxcache_cb_rock rock =
+        { req, PTRARRAY_INITIALIZER, 0, PTRARRAY_INITIALIZER };
+    strarray_t annotcached = STRARRAY_INITIALIZER;
+    rock.want_annots = jmap_wantprop(args->props, "snoozedUntil") ||
+        (jmap_wantprop(args->props, "preview") &&
+         config_getstring(IMAPOPT_JMAP_PREVIEW_ANNOT));
     json_array_foreach(get->ids, i, val) {
         const char *email_id = json_string_value(val);
         if (email_id[0] != 'M' || strlen(email_id) != 25) {
@@ -5912,6 +5954,8 @@ static void jmap_email_get_full(jmap_req_t *req, struct jmap_get *get, struct em
             continue;
         }
     }
+    if (rock.want_annots)
+        _warmup_annotcache(&rock, &annotcached);
 
     /* Process emails one after the other */
     json_array_foreach(get->ids, i, val) {
@@ -5947,6 +5991,17 @@ static void jmap_email_get_full(jmap_req_t *req, struct jmap_get *get, struct em
         msgrecord_unref(&mr);
     }
 
+    /* Drop cached annotations */
+    for (i = 0; i < (size_t) strarray_size(&annotcached); i++) {
+        annotatemore_uncache(strarray_nth(&annotcached, i));
+    }
+    strarray_fini(&annotcached);
+    arrayu64_t *uids;
+    while ((uids = ptrarray_pop(&rock.uids))) {
+        arrayu64_free(uids);
+    }
+    ptrarray_fini(&rock.uids);
+
     /* Close cached mailboxes */
     struct mailbox *mbox = NULL;
     while ((mbox = ptrarray_pop(&rock.mboxes))) {
@@ -92,6 +92,7 @@
 #include "telemetry.h"
 #include "times.h"
 #include "tls.h"
+#include "user.h"
 #include "userdeny.h"
 #include "util.h"
 #include "version.h"
@@ -791,6 +792,72 @@ EXPORTED int deliver_local(deliver_data_t *mydata, struct imap4flags *imap4flags
     return ret;
 }
 
+/*
+ * When consecutive recipients of one transaction belong to the same
+ * user (aliases, list expansions), hold that user's conversations DB
+ * open across all of their deliveries.  The mailbox code then finds it
+ * already open and leaves the commit to us, so the DB is locked and
+ * committed once per batch rather than once per delivery.  Mailbox
+ * changes are still committed first, as they are when the mailbox
+ * commits its own conversations state.
+ */
+struct convbatch {
+    char *userid;
+    struct mboxlock *namespacelock;
+    struct conversations_state *cstate;
+};
+
+static void convbatch_end(struct convbatch *batch)
+{
+    if (batch->cstate) {
+        int r = conversations_commit(&batch->cstate);
+        if (r) {
+            syslog(LOG_ERR, "IOERROR: committing conversations for %s: %s",
+                   batch->userid, error_message(r));
+        }
+    }
+    mboxname_release(&batch->namespacelock);
+    free(batch->userid);
+    batch->userid = NULL;
+}
+
+static void convbatch_begin(struct convbatch *batch,
+                            message_data_t *msgdata, int n)
+{
+    const char *userid = mbname_userid(msg_getrcpt(msgdata, n));
+    const char *nextuserid = NULL;
+    int r;
+
+    /* still the same user?  keep going */
+    if (batch->userid && userid && !strcmp(batch->userid, userid))
+        return;
+
+    convbatch_end(batch);
+
+    if (!userid || !config_getswitch(IMAPOPT_CONVERSATIONS))
+        return;
+
+    /* only worth it if the next recipient is the same user */
+    if (n + 1 < msg_getnumrcpt(msgdata))
+        nextuserid = mbname_userid(msg_getrcpt(msgdata, n + 1));
+    if (!nextuserid || strcmp(userid, nextuserid))
+        return;
+
+    /* same lock order as mailbox creation: namespace, then conversations */
+    batch->namespacelock = user_namespacelock(userid);
+    if (!batch->namespacelock) return;
+
+    r = conversations_open_user(userid, 0/*shared*/, &batch->cstate);
+    if (r) {
+        syslog(LOG_WARNING, "error opening conversations for %s: %s",
+               userid, error_message(r));
+        mboxname_release(&batch->namespacelock);
+        return;
+    }
+
+    batch->userid = xstrdup(userid);
+}
+
 int deliver(message_data_t *msgdata, char *authuser,
             const struct auth_state *authstate, const struct namespace *ns)
 {
@@ -800,6 +867,7 @@ int deliver(message_data_t *msgdata, char *authuser,
     struct message_content content = { NULL, 0, NULL };
     char *notifyheader;
     deliver_data_t mydata;
+    struct convbatch convbatch = { NULL, NULL, NULL };
 
     assert(msgdata);
     nrcpts = msg_getnumrcpt(msgdata);
@@ -843,6 +911,7 @@ int deliver(message_data_t *msgdata, char *authuser,
 
             /* local mailbox */
             mydata.cur_rcpt = n;
+            convbatch_begin(&convbatch, msgdata, n);
 #ifdef USE_SIEVE
             struct sieve_interp_ctx ctx = { mbname_userid(mbname), NULL };
             sieve_interp_t *interp = setup_sieve(&ctx);
@@ -876,6 +945,8 @@ int deliver(message_data_t *msgdata, char *authuser,
         mboxlist_entry_free(&mbentry);
     }
 
+    convbatch_end(&convbatch);
+
     if (dlist) {
         struct dest *d;
 
@@ -924,6 +924,21 @@ static int reset_saslconn(sasl_conn_t **conn)
     return SASL_OK;
 }
 
+/* count an LMTP phase's time in the prometheus stats, and log it if it
+ * was slow */
+static void phase_timed(enum prom_metric_id id, const char *phase,
+                        message_data_t *msg, const char *rcpt)
+{
+    double cmdtime = 0.0, nettime = 0.0;
+
+    cmdtime_endtimer(&cmdtime, &nettime);
+
+    prometheus_observe(id, cyrus_lmtp_phase_seconds_buckets,
+                       CYRUS_LMTP_PHASE_SECONDS_NUM_BUCKETS, cmdtime);
+
+    cmdtime_log(msg->authuser, phase, rcpt, msg->rcpt_num, msg->size);
+}
+
 void lmtpmode(struct lmtp_func *func,
               struct protstream *pin,
               struct protstream *pout,
@@ -1012,9 +1027,14 @@ void lmtpmode(struct lmtp_func *func,
     }
     prot_printf(pout, " server ready\r\n");
 
+    /* Time transactions for the prometheus stats.  Phases which take
+     * commandmintimer seconds or more are logged */
+    cmdtime_settimer(config_getswitch(IMAPOPT_PROMETHEUS_ENABLED));
+
     for (;;) {
     nextcmd:
       signals_poll();
+      prometheus_flush_before_read(pin);
 
       if (!prot_fgets(buf, sizeof(buf), pin)) {
           const char *err = prot_error(pin);
@@ -1172,10 +1192,13 @@ void lmtpmode(struct lmtp_func *func,
                     continue;
                 }
                 /* copy message from input to msg structure */
+                cmdtime_starttimer();
                 r = savemsg(&cd, func, msg);
                 if (r) {
                     goto rset;
                 }
+                phase_timed(CYRUS_LMTP_PHASE_SECONDS_PHASE_DATA_BUCKET_0,
+                            "data", msg, NULL);
 
                 if (msg->size > max_msgsize) {
                     prot_printf(pout,
@@ -1194,7 +1217,10 @@ void lmtpmode(struct lmtp_func *func,
                 snmp_increment(mtaReceivedRecipients, msg->rcpt_num);
 
                 /* do delivery, report status */
+                cmdtime_starttimer();
                 func->deliver(msg, msg->authuser, msg->authstate, msg->ns);
+                phase_timed(CYRUS_LMTP_PHASE_SECONDS_PHASE_DELIVER_BUCKET_0,
+                            "deliver", msg, NULL);
                 for (j = 0; j < msg->rcpt_num; j++) {
                     if (!msg->rcpt[j]->status) delivered++;
                     send_lmtp_error(pout, msg->rcpt[j]->status,
@@ -1420,10 +1446,13 @@ void lmtpmode(struct lmtp_func *func,
                     continue;
                 }
 
+                cmdtime_starttimer();
                 r = process_recipient(rcpt,
                                       ignorequota,
                                       func->verify_user,
                                       msg);
+                phase_timed(CYRUS_LMTP_PHASE_SECONDS_PHASE_RCPT_BUCKET_0,
+                            "rcpt", msg, rcpt);
                 if (rcpt) free(rcpt); /* malloc'd in parseaddr() */
                 if (r) {
                     send_lmtp_error(pout, r, NULL);
@@ -872,6 +872,8 @@ static void mailbox_release_resources(struct mailbox *mailbox)
     xclose(mailbox->header_fd);
 
     /* release and unmap index */
+    lockstats_released(&mailbox->index_lockstats,
+                       LOCKSTATS_MAILBOX, mailbox->name);
     xclose(mailbox->index_fd);
     mailbox->index_locktype = 0; /* lock was released by closing fd */
     if (mailbox->index_base)
@@ -1560,6 +1562,7 @@ static int mailbox_buf_to_index_header(const char *buf, size_t len,
     case 15:
     case 16:
     case 17:
+    case 18:
         headerlen = 160;
         break;
     default:
@@ -1570,6 +1573,10 @@ static int mailbox_buf_to_index_header(const char *buf, size_t len,
 
     i->start_offset = ntohl(*((bit32 *)(buf+OFFSET_START_OFFSET)));
     i->record_size = ntohl(*((bit32 *)(buf+OFFSET_RECORD_SIZE)));
+    /* the split layout has fixed offsets, so it must be what we expect */
+    if (INDEX_IS_SPLIT(i->minor_version) &&
+        i->record_size != INDEX_SPLIT_RECORD_SIZE)
+        return IMAP_MAILBOX_BADFORMAT;
     i->num_records = ntohl(*((bit32 *)(buf+OFFSET_NUM_RECORDS)));
     i->last_appenddate = ntohl(*((bit32 *)(buf+OFFSET_LAST_APPENDDATE)));
     i->last_uid = ntohl(*((bit32 *)(buf+OFFSET_LAST_UID)));
@@ -1641,6 +1648,84 @@ done:
     return 0;
 }
 
+/*
+ * Where record 'recno' lives in an index file.  For split layouts this
+ * is the hot part, and index_cold_offset() gives the cold part.
+ */
+static size_t index_record_offset(const struct index_header *i,
+                                  uint32_t recno)
+{
+    size_t block, slot;
+
+    if (!INDEX_IS_SPLIT(i->minor_version))
+        return i->start_offset + (size_t)(recno-1) * i->record_size;
+
+    block = (recno-1) / INDEX_BLOCK_RECORDS;
+    slot = (recno-1) % INDEX_BLOCK_RECORDS;
+
+    return i->start_offset +
+           block * INDEX_BLOCK_RECORDS * INDEX_SPLIT_RECORD_SIZE +
+           slot * INDEX_HOT_RECORD_SIZE;
+}
+
+static size_t index_cold_offset(const struct index_header *i, uint32_t recno)
+{
+    size_t block, slot;
+
+    if (!INDEX_IS_SPLIT(i->minor_version))
+        return index_record_offset(i, recno);
+
+    block = (recno-1) / INDEX_BLOCK_RECORDS;
+    slot = (recno-1) % INDEX_BLOCK_RECORDS;
+
+    return i->start_offset +
+           block * INDEX_BLOCK_RECORDS * INDEX_SPLIT_RECORD_SIZE +
+           INDEX_BLOCK_RECORDS * INDEX_HOT_RECORD_SIZE +
+           slot * INDEX_COLD_RECORD_SIZE;
+}
+
+/* the size of an index file holding 'num_records' records.  The last
+ * block of a split index is only as long as its last cold part, the
+ * unused hot slots before that are never written */
+static size_t index_file_size(const struct index_header *i,
+                              uint32_t num_records)
+{
+    if (!num_records)
+        return i->start_offset;
+
+    if (!INDEX_IS_SPLIT(i->minor_version))
+        return i->start_offset + (size_t)num_records * i->record_size;
+
+    return index_cold_offset(i, num_records) + INDEX_COLD_RECORD_SIZE;
+}
+
+/* write the buffer from mailbox_index_record_to_buf() for record
+ * 'recno' into place.  Returns -1 with errno set on failure */
+static int index_write_record(int fd, const struct index_header *i,
+                              uint32_t recno, const unsigned char *buf)
+{
+    if (lseek(fd, index_record_offset(i, recno), SEEK_SET) == -1)
+        return -1;
+
+    if (!INDEX_IS_SPLIT(i->minor_version)) {
+        if (retry_write(fd, buf, i->record_size) != (ssize_t)i->record_size)
+            return -1;
+        return 0;
+    }
+
+    if (retry_write(fd, buf, INDEX_HOT_RECORD_SIZE) != INDEX_HOT_RECORD_SIZE)
+        return -1;
+
+    if (lseek(fd, index_cold_offset(i, recno), SEEK_SET) == -1)
+        return -1;
+
+    if (retry_write(fd, buf + INDEX_HOT_RECORD_SIZE,
+                    INDEX_COLD_RECORD_SIZE) != INDEX_COLD_RECORD_SIZE)
+        return -1;
+
+    return 0;
+}
+
 static int mailbox_refresh_index_map(struct mailbox *mailbox)
 {
     size_t need_size;
@@ -1648,8 +1733,7 @@ static int mailbox_refresh_index_map(struct mailbox *mailbox)
 
     /* check if we need to extend the mmaped space for the index file
      * (i.e. new records appended since last read) */
-    need_size = mailbox->i.start_offset +
-                mailbox->i.num_records * mailbox->i.record_size;
+    need_size = index_file_size(&mailbox->i, mailbox->i.num_records);
     if (mailbox->index_size < need_size) {
         if (fstat(mailbox->index_fd, &sbuf) == -1)
             return IMAP_IOERROR;
@@ -1704,9 +1788,67 @@ static int mailbox_read_index_header(struct mailbox *mailbox)
 }
 
 /*
- * Read an index record from a mapped index file
+ * Read the hot part of a split index record
  */
-static int mailbox_buf_to_index_record(const char *buf, int version,
+static int mailbox_buf_to_index_hot(const char *buf,
+                                    struct index_record *record, int dirty)
+{
+    uint32_t stored_system_flags;
+    int n;
+
+    record->uid = ntohl(*((bit32 *)(buf+OFFSET_HOT_UID)));
+    stored_system_flags = ntohl(*((bit32 *)(buf+OFFSET_HOT_SYSTEM_FLAGS)));
+    record->system_flags = stored_system_flags & 0x000000ff;
+    record->internal_flags = stored_system_flags & 0xff000000;
+    record->modseq = ntohll(*((bit64 *)(buf+OFFSET_HOT_MODSEQ)));
+    for (n = 0; n < MAX_USER_FLAGS/32; n++) {
+        record->user_flags[n] =
+            ntohl(*((bit32 *)(buf+OFFSET_HOT_USER_FLAGS+4*n)));
+    }
+    record->cache_offset = ntohll(*((bit64 *)(buf+OFFSET_HOT_CACHE_OFFSET)));
+    record->last_updated = ntohl(*((bit32 *)(buf+OFFSET_HOT_LAST_UPDATED)));
+
+    if (dirty) return 0;
+    /* check CRC32 */
+    if (crc32_map(buf, OFFSET_HOT_CRC) != ntohl(*((bit32 *)(buf+OFFSET_HOT_CRC))))
+        return IMAP_MAILBOX_CHECKSUM;
+
+    return 0;
+}
+
+/*
+ * Read the cold part of a split index record
+ */
+static int mailbox_buf_to_index_cold(const char *buf,
+                                     struct index_record *record, int dirty)
+{
+    record->internaldate = ntohl(*((bit32 *)(buf+OFFSET_COLD_INTERNALDATE)));
+    record->sentdate = ntohl(*((bit32 *)(buf+OFFSET_COLD_SENTDATE)));
+    record->size = ntohl(*((bit32 *)(buf+OFFSET_COLD_SIZE)));
+    record->header_size = ntohl(*((bit32 *)(buf+OFFSET_COLD_HEADER_SIZE)));
+    record->gmtime = ntohl(*((bit32 *)(buf+OFFSET_COLD_GMTIME)));
+    record->savedate = ntohl(*((bit32 *)(buf+OFFSET_COLD_SAVEDATE)));
+    record->cache_version = ntohl(*((bit32 *)(buf+OFFSET_COLD_CACHE_VERSION)));
+    message_guid_import(&record->guid, buf+OFFSET_COLD_MESSAGE_GUID);
+    record->cid = ntohll(*((bit64 *)(buf+OFFSET_COLD_THRID)));
+    record->createdmodseq = ntohll(*((bit64 *)(buf+OFFSET_COLD_CREATEDMODSEQ)));
+    record->cache_crc = ntohl(*((bit32 *)(buf+OFFSET_COLD_CACHE_CRC)));
+
+    if (dirty) return 0;
+    /* check CRC32 */
+    if (crc32_map(buf, OFFSET_COLD_CRC) != ntohl(*((bit32 *)(buf+OFFSET_COLD_CRC))))
+        return IMAP_MAILBOX_CHECKSUM;
+
+    return 0;
+}
+
+/*
+ * Read an index record from a mapped index file.  For split layouts,
+ * 'buf' is the hot part and 'cold' the cold part; if 'cold' is NULL
+ * only the hot fields are read.  'cold' is ignored for other versions.
+ */
+static int mailbox_buf_to_index_record(const char *buf, const char *cold,
+                                       int version,
                                        struct index_record *record, int dirty)
 {
     uint32_t crc;
@@ -1716,6 +1858,12 @@ static int mailbox_buf_to_index_record(const char *buf, int version,
     /* tracking fields - initialise */
     memset(record, 0, sizeof(struct index_record));
 
+    if (INDEX_IS_SPLIT(version)) {
+        int r = mailbox_buf_to_index_hot(buf, record, dirty);
+        if (!r && cold) r = mailbox_buf_to_index_cold(cold, record, dirty);
+        return r;
+    }
+
     /* parse the shared bits first */
     record->uid = ntohl(*((bit32 *)(buf+OFFSET_UID)));
     record->internaldate = ntohl(*((bit32 *)(buf+OFFSET_INTERNALDATE)));
@@ -1870,22 +2018,13 @@ static int _commit_one(struct mailbox *mailbox, struct index_change *change)
 {
     indexbuffer_t ibuf;
     unsigned char *buf = ibuf.buf;
-    size_t offset;
     struct index_record *record = &change->record;
     uint32_t recno = record->recno;
 
     mailbox_index_record_to_buf(&change->record, mailbox->i.minor_version, buf);
 
-    offset = mailbox->i.start_offset + ((recno-1) * mailbox->i.record_size);
-
     /* any failure here is a disaster! */
-    if (lseek(mailbox->index_fd, offset, SEEK_SET) == -1) {
-        syslog(LOG_ERR, "IOERROR: seeking index record %u for %s: %m",
-               recno, mailbox->name);
-        return IMAP_IOERROR;
-    }
-
-    if (retry_write(mailbox->index_fd, buf, mailbox->i.record_size) != mailbox->i.record_size) {
+    if (index_write_record(mailbox->index_fd, &mailbox->i, recno, buf)) {
         syslog(LOG_ERR, "IOERROR: writing index record %u for %s: %m",
                recno, mailbox->name);
         return IMAP_IOERROR;
@@ -1972,7 +2111,7 @@ static int _commit_changes(struct mailbox *mailbox)
     _cleanup_changes(mailbox);
 
     /* recalculate the size */
-    mailbox->index_size = mailbox->i.start_offset + (mailbox->i.num_records * mailbox->i.record_size);
+    mailbox->index_size = index_file_size(&mailbox->i, mailbox->i.num_records);
 
     r = mailbox_refresh_index_map(mailbox);
     if (r) return r;
@@ -1984,17 +2123,17 @@ EXPORTED int mailbox_reload_index_record_dirty(struct mailbox *mailbox,
                                                struct index_record *record)
 {
     unsigned recno = record->recno;
-    unsigned offset = mailbox->i.start_offset + (recno-1) * mailbox->i.record_size;
 
-    if (offset + mailbox->i.record_size > mailbox->index_size) {
+    if (index_file_size(&mailbox->i, recno) > mailbox->index_size) {
         syslog(LOG_ERR,
                "IOERROR: index record %u for %s past end of file",
                recno, mailbox->name);
         return IMAP_IOERROR;
     }
 
-    const char *buf = mailbox->index_base + offset;
-    mailbox_buf_to_index_record(buf, mailbox->i.minor_version, record, 1);
+    const char *buf = mailbox->index_base + index_record_offset(&mailbox->i, recno);
+    const char *cold = mailbox->index_base + index_cold_offset(&mailbox->i, recno);
+    mailbox_buf_to_index_record(buf, cold, mailbox->i.minor_version, record, 1);
     record->recno = recno;
 
     return 0;
@@ -2008,8 +2147,7 @@ static int mailbox_read_index_record(struct mailbox *mailbox,
                                      uint32_t recno,
                                      struct index_record *record)
 {
-    const char *buf;
-    unsigned offset;
+    const char *buf, *cold;
     int r;
     struct index_change *change = _find_change(mailbox, recno);
 
@@ -2018,18 +2156,51 @@ static int mailbox_read_index_record(struct mailbox *mailbox,
         return 0;
     }
 
-    offset = mailbox->i.start_offset + (recno-1) * mailbox->i.record_size;
+    if (index_file_size(&mailbox->i, recno) > mailbox->index_size) {
+        syslog(LOG_ERR,
+               "IOERROR: index record %u for %s past end of file",
+               recno, mailbox->name);
+        return IMAP_IOERROR;
+    }
+
+    buf = mailbox->index_base + index_record_offset(&mailbox->i, recno);
+    cold = mailbox->index_base + index_cold_offset(&mailbox->i, recno);
+
+    r = mailbox_buf_to_index_record(buf, cold, mailbox->i.minor_version,
+                                    record, 0);
 
-    if (offset + mailbox->i.record_size > mailbox->index_size) {
+    record->recno = recno;
+
+    return r;
+}
+
+/*
+ * Read just the hot fields of an index record, see ITER_HOTFIELDS.
+ * Versions without a split layout read the whole record.
+ */
+static int mailbox_read_index_hot(struct mailbox *mailbox,
+                                  uint32_t recno,
+                                  struct index_record *record)
+{
+    const char *buf;
+    int r;
+
+    if (!INDEX_IS_SPLIT(mailbox->i.minor_version) ||
+        _find_change(mailbox, recno))
+        return mailbox_read_index_record(mailbox, recno, record);
+
+    /* the hot part is always before the end of the record's block */
+    if (index_file_size(&mailbox->i, recno) > mailbox->index_size) {
         syslog(LOG_ERR,
                "IOERROR: index record %u for %s past end of file",
                recno, mailbox->name);
         return IMAP_IOERROR;
     }
 
-    buf = mailbox->index_base + offset;
+    buf = mailbox->index_base + index_record_offset(&mailbox->i, recno);
 
-    r = mailbox_buf_to_index_record(buf, mailbox->i.minor_version, record, 0);
+    r = mailbox_buf_to_index_record(buf, NULL, mailbox->i.minor_version,
+                                    record, 0);
 
     record->recno = recno;
 
@@ -2151,8 +2322,7 @@ static uint32_t mailbox_getuid(struct mailbox *mailbox, uint32_t recno)
 {
     struct index_record record;
     record.uid = 0;
-    /* XXX - cheaper memory-access reads? */
-    mailbox_read_index_record(mailbox, recno, &record);
+    mailbox_read_index_hot(mailbox, recno, &record);
     return record.uid;
 }
 
@@ -2227,9 +2397,11 @@ static int mailbox_lock_index_internal(struct mailbox *mailbox, int locktype)
             mailbox->is_readonly = 0;
             r = mailbox_open_index(mailbox);
         }
+        lockstats_requested(&mailbox->index_lockstats);
         if (!r) r = lock_blocking(mailbox->index_fd, index_fname);
     }
     else if (locktype == LOCK_SHARED) {
+        lockstats_requested(&mailbox->index_lockstats);
         r = lock_shared(mailbox->index_fd, index_fname);
     }
     else {
@@ -2237,6 +2409,9 @@ static int mailbox_lock_index_internal(struct mailbox *mailbox, int locktype)
         fatal("invalid locktype for index", EX_SOFTWARE);
     }
 
+    if (!r) lockstats_granted(&mailbox->index_lockstats,
+                              LOCKSTATS_MAILBOX, mailbox->name);
+
     /* double check that the index exists and has at least enough
      * data to check the version number */
     if (!r) {
@@ -2244,8 +2419,11 @@ static int mailbox_lock_index_internal(struct mailbox *mailbox, int locktype)
             r = IMAP_MAILBOX_BADFORMAT;
         else if (mailbox->index_size < OFFSET_NUM_RECORDS)
             r = IMAP_MAILBOX_BADFORMAT;
-        if (r)
+        if (r) {
+            lockstats_released(&mailbox->index_lockstats,
+                               LOCKSTATS_MAILBOX, mailbox->name);
             lock_unlock(mailbox->index_fd, index_fname);
+        }
     }
 
     if (r) {
@@ -2371,6 +2549,8 @@ EXPORTED void mailbox_unlock_index(struct mailbox *mailbox, struct statusdata *s
         statuscache_invalidate(mailbox->name, sdata);
 
     if (mailbox->index_locktype) {
+        lockstats_released(&mailbox->index_lockstats,
+                           LOCKSTATS_MAILBOX, mailbox->name);
         if (lock_unlock(mailbox->index_fd, index_fname))
             syslog(LOG_ERR, "IOERROR: unlocking index of %s: %m",
                 mailbox->name);
@@ -2727,6 +2907,49 @@ EXPORTED int mailbox_commit(struct mailbox *mailbox)
     return 0;
 }
 
+/*
+ * Put a split index record into a buffer, hot part first
+ */
+static bit32 mailbox_index_record_to_split_buf(struct index_record *record,
+                                               unsigned char *buf)
+{
+    unsigned char *cold = buf + INDEX_HOT_RECORD_SIZE;
+    uint32_t system_flags;
+    bit32 crc;
+    int n;
+
+    memset(buf, 0, INDEX_SPLIT_RECORD_SIZE);
+
+    system_flags = record->system_flags | record->internal_flags;
+
+    *((bit32 *)(buf+OFFSET_HOT_UID)) = htonl(record->uid);
+    *((bit32 *)(buf+OFFSET_HOT_SYSTEM_FLAGS)) = htonl(system_flags);
+    *((bit64 *)(buf+OFFSET_HOT_MODSEQ)) = htonll(record->modseq);
+    for (n = 0; n < MAX_USER_FLAGS/32; n++) {
+        *((bit32 *)(buf+OFFSET_HOT_USER_FLAGS+4*n)) = htonl(record->user_flags[n]);
+    }
+    *((bit64 *)(buf+OFFSET_HOT_CACHE_OFFSET)) = htonll(record->cache_offset);
+    *((bit32 *)(buf+OFFSET_HOT_LAST_UPDATED)) = htonl(record->last_updated);
+    crc = crc32_map((char *)buf, OFFSET_HOT_CRC);
+    *((bit32 *)(buf+OFFSET_HOT_CRC)) = htonl(crc);
+
+    *((bit32 *)(cold+OFFSET_COLD_INTERNALDATE)) = htonl(record->internaldate);
+    *((bit32 *)(cold+OFFSET_COLD_SENTDATE)) = htonl(record->sentdate);
+    *((bit32 *)(cold+OFFSET_COLD_SIZE)) = htonl(record->size);
+    *((bit32 *)(cold+OFFSET_COLD_HEADER_SIZE)) = htonl(record->header_size);
+    *((bit32 *)(cold+OFFSET_COLD_GMTIME)) = htonl(record->gmtime);
+    *((bit32 *)(cold+OFFSET_COLD_SAVEDATE)) = htonl(record->savedate);
+    *((bit32 *)(cold+OFFSET_COLD_CACHE_VERSION)) = htonl(record->cache_version);
+    message_guid_export(&record->guid, (char *)cold+OFFSET_COLD_MESSAGE_GUID);
+    *((bit64 *)(cold+OFFSET_COLD_THRID)) = htonll(record->cid);
+    *((bit64 *)(cold+OFFSET_COLD_CREATEDMODSEQ)) = htonll(record->createdmodseq);
+    *((bit32 *)(cold+OFFSET_COLD_CACHE_CRC)) = htonl(record->cache_crc);
+    *((bit32 *)(cold+OFFSET_COLD_CRC)) =
+        htonl(crc32_map((char *)cold, OFFSET_COLD_CRC));
+
+    return crc;
+}
+
 /*
  * Put an index record into a buffer suitable for writing to a file.
  */
@@ -2737,6 +2960,9 @@ static bit32 mailbox_index_record_to_buf(struct index_record *record, int versio
     bit32 crc;
     uint32_t system_flags = 0;
 
+    if (INDEX_IS_SPLIT(version))
+        return mailbox_index_record_to_split_buf(record, buf);
+
     memset(buf, 0, INDEX_RECORD_SIZE);
 
     /* keep the low bits of the offset in the offset field */
@@ -4164,6 +4390,10 @@ static int mailbox_repack_setup(struct mailbox *mailbox, int version,
         repack->newmailbox.i.start_offset = 160;
         repack->newmailbox.i.record_size = 112;
         break;
+    case 18:
+        repack->newmailbox.i.start_offset = 160;
+        repack->newmailbox.i.record_size = INDEX_SPLIT_RECORD_SIZE;
+        break;
     default:
         fatal("index version not supported", EX_SOFTWARE);
     }
@@ -4252,7 +4482,8 @@ static int mailbox_repack_add(struct mailbox_repack *repack,
 
     /* write the index record out */
     mailbox_index_record_to_buf(record, repack->newmailbox.i.minor_version, buf);
-    n = retry_write(repack->newmailbox.index_fd, buf, repack->newmailbox.i.record_size);
+    n = index_write_record(repack->newmailbox.index_fd, &repack->newmailbox.i,
+                           repack->newmailbox.i.num_records + 1, buf);
     if (n == -1)
         return IMAP_IOERROR;
 
@@ -4850,6 +5081,7 @@ EXPORTED int mailbox_expunge(struct mailbox *mailbox,
 {
     int r = 0;
     int numexpunged = 0;
+    unsigned iterflags = ITER_SKIP_EXPUNGED;
     const message_t *msg;
     struct mboxevent *mboxevent = NULL;
 
@@ -4864,19 +5096,27 @@ EXPORTED int mailbox_expunge(struct mailbox *mailbox,
     if (event_type)
         mboxevent = mboxevent_new(event_type);
 
-    if (!decideproc) decideproc = expungedeleted;
+    /* the default only looks at flags, so the rest of the record only
+     * needs reading for the messages that do get expunged */
+    if (!decideproc) {
+        decideproc = expungedeleted;
+        iterflags |= ITER_HOTFIELDS;
+    }
 
-    struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, ITER_SKIP_EXPUNGED);
+    struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, iterflags);
     while ((msg = mailbox_iter_step(iter))) {
         const struct index_record *record = msg_record(msg);
         if (decideproc(mailbox, record, deciderock)) {
             numexpunged++;
 
             struct index_record copyrecord = *record;
+            if (iterflags & ITER_HOTFIELDS)
+                r = mailbox_reload_index_record(mailbox, &copyrecord);
+
             /* mark deleted */
             copyrecord.internal_flags |= FLAG_INTERNAL_EXPUNGED;
 
-            r = mailbox_rewrite_index_record(mailbox, &copyrecord);
+            if (!r) r = mailbox_rewrite_index_record(mailbox, &copyrecord);
             if (r) {
                 mboxevent_free(&mboxevent);
                 mailbox_iter_done(&iter);
@@ -5140,7 +5380,8 @@ EXPORTED int mailbox_create(const char *name,
     mailbox_index_dirty(mailbox);
     mailbox->i.minor_version = MAILBOX_MINOR_VERSION;
     mailbox->i.start_offset = INDEX_HEADER_SIZE;
-    mailbox->i.record_size = INDEX_RECORD_SIZE;
+    mailbox->i.record_size = INDEX_IS_SPLIT(mailbox->i.minor_version) ?
+                             INDEX_SPLIT_RECORD_SIZE : INDEX_RECORD_SIZE;
     mailbox->i.options = options;
     mailbox->i.uidvalidity = uidvalidity;
     mailbox->i.createdmodseq = createdmodseq;
@@ -5508,6 +5749,7 @@ static struct meta_file meta_files[] = {
     { META_SQUAT,        1, 0 },
     { META_ANNOTATIONS,  1, 1 },
     { META_ARCHIVECACHE, 1, 1 },
+    { META_THREAD,       1, 1 },
     { 0, 0, 0 }
 };
 
@@ -6062,7 +6304,7 @@ static void cleanup_stale_expunged(struct mailbox *mailbox)
     for (erecno = 1; erecno <= expunge_num; erecno++) {
         struct index_record record;
         bufp = expunge_base + eoffset + (erecno-1)*expungerecord_size;
-        mailbox_buf_to_index_record(bufp, eversion, &record, 0);
+        mailbox_buf_to_index_record(bufp, NULL, eversion, &record, 0);
         record.internal_flags |= FLAG_INTERNAL_EXPUNGED | FLAG_INTERNAL_UNLINKED;
         mailbox_record_cleanup(mailbox, &record);
     }
@@ -6736,7 +6978,6 @@ static int mailbox_wipe_index_record(struct mailbox *mailbox,
     int n;
     indexbuffer_t ibuf;
     unsigned char *buf = ibuf.buf;
-    size_t offset;
 
     assert(mailbox_index_islocked(mailbox, 1));
     assert(record->recno > 0 &&
@@ -6750,17 +6991,7 @@ static int mailbox_wipe_index_record(struct mailbox *mailbox,
 
     mailbox_index_record_to_buf(record, mailbox->i.minor_version, buf);
 
-    offset = mailbox->i.start_offset +
-             (record->recno-1) * mailbox->i.record_size;
-
-    off_t p = lseek(mailbox->index_fd, offset, SEEK_SET);
-    if (p == -1) {
-        syslog(LOG_ERR, "IOERROR: seeking index record %u for %s: %m",
-               record->recno, mailbox->name);
-        return IMAP_IOERROR;
-    }
-
-    n = retry_write(mailbox->index_fd, buf, mailbox->i.record_size);
+    n = index_write_record(mailbox->index_fd, &mailbox->i, record->recno, buf);
     if (n < 0) {
         syslog(LOG_ERR, "IOERROR: writing index record %u for %s: %m",
                record->recno, mailbox->name);
@@ -7137,6 +7368,8 @@ EXPORTED struct mailbox_iter *mailbox_iter_init(struct mailbox *mailbox,
     if (flags & ITER_SKIP_DELETED)
         iter->skipflags |= FLAG_DELETED;
 
+    iter->hotonly = (flags & ITER_HOTFIELDS) ? 1 : 0;
+
     return iter;
 }
 
@@ -7151,7 +7384,15 @@ EXPORTED const message_t *mailbox_iter_step(struct mailbox_iter *iter)
     if (mailbox_wait_cb) mailbox_wait_cb(mailbox_wait_cb_rock);
 
     for (iter->recno++; iter->recno <= iter->num_records; iter->recno++) {
-        message_set_from_mailbox(iter->mailbox, iter->recno, iter->msg);
+        struct index_record hotrecord;
+        if (iter->hotonly &&
+            !mailbox_read_index_hot(iter->mailbox, iter->recno, &hotrecord) &&
+            hotrecord.uid) {
+            message_set_from_record(iter->mailbox, &hotrecord, iter->msg);
+        }
+        else {
+            message_set_from_mailbox(iter->mailbox, iter->recno, iter->msg);
+        }
         const struct index_record *record = msg_record(iter->msg);
         if (!record->uid) continue; /* can happen on damaged mailboxes */
         if ((record->system_flags & iter->skipflags)) continue;
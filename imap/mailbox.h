@@ -50,6 +50,7 @@
 
 #include "byteorder64.h"
 #include "conversations.h"
+#include "lockstats.h"
 #include "message_guid.h"
 #include "message.h"
 #include "ptrarray.h"
@@ -75,6 +76,9 @@
  * changed to be able to convert both backwards and forwards between the
  * new version and all supported previous versions */
 #define MAILBOX_MINOR_VERSION   17
+/* version 18 (split hot and cold index records) is only written when a
+ * mailbox is explicitly converted with reconstruct -V 18 */
+#define MAILBOX_SPLIT_MINOR_VERSION 18
 #define MAILBOX_CACHE_MINOR_VERSION 9
 
 #define FNAME_HEADER "/cyrus.header"
@@ -86,6 +90,7 @@
 #define FNAME_DAV "/cyrus.dav"
 #endif
 #define FNAME_ANNOTATIONS "/cyrus.annotations"
+#define FNAME_THREAD "/cyrus.thread"
 
 #define CRC_INIT_BASIC 0
 // annot value should be visible as an integer via replication protocol,
@@ -102,7 +107,8 @@ enum meta_filename {
 #ifdef WITH_DAV
   META_DAV,
 #endif
-  META_ARCHIVECACHE
+  META_ARCHIVECACHE,
+  META_THREAD
 };
 
 #define MAILBOX_FNAME_LEN 256
@@ -141,10 +147,14 @@ struct statusdata {
     quota_t size;
     modseq_t createdmodseq;
     modseq_t highestmodseq;
+    /* index header counts for users with internal seen (v14+ only) */
+    int has_internal;
+    uint32_t internal_unseen;
+    uint32_t internal_recentuid;
     conv_status_t xconv;
 };
 
-#define STATUSDATA_INIT { NULL, 0, 0, 0, 0, 0, NULL, 0, 0, 0, 0, 0, CONV_STATUS_INIT }
+#define STATUSDATA_INIT { NULL, 0, 0, 0, 0, 0, NULL, 0, 0, 0, 0, 0, 0, 0, 0, CONV_STATUS_INIT }
 
 struct index_record {
     uint32_t uid;
@@ -243,6 +253,7 @@ struct mailbox {
     size_t index_len;   /* mapped size */
 
     int index_locktype; /* 0 = none, 1 = shared, 2 = exclusive */
+    struct lockstats_timer index_lockstats;
     int is_readonly; /* true = open index and cache files readonly */
 
     ino_t header_file_ino;
@@ -299,6 +310,9 @@ struct mailbox {
 #define ITER_SKIP_UNLINKED (1<<0)
 #define ITER_SKIP_EXPUNGED (1<<1)
 #define ITER_SKIP_DELETED (1<<2)
+/* only read the hot fields of each record (uid, flags, modseq,
+ * cache_offset and last_updated); the rest are left zero */
+#define ITER_HOTFIELDS (1<<3)
 
 /* pre-declare message_t to avoid circular dependency problems */
 typedef struct message message_t;
@@ -310,6 +324,7 @@ struct mailbox_iter {
     uint32_t recno;
     uint32_t num_records;
     unsigned skipflags;
+    int hotonly;
 };
 
 /* Offsets of index/expunge header fields
@@ -390,6 +405,45 @@ struct mailbox_iter {
 #define INDEX_HEADER_SIZE (OFFSET_HEADER_CRC+4)
 #define INDEX_RECORD_SIZE (OFFSET_RECORD_CRC+4)
 
+/* Version 18 splits each index record into a "hot" part, with the
+ * fields that change or get scanned for every message (flags, modseq),
+ * and a "cold" part with everything else.  Records are stored in
+ * blocks of INDEX_BLOCK_RECORDS: the hot parts of all the records in
+ * the block, followed by all their cold parts.  Scanning flags or
+ * modseqs only touches the hot parts.  Each part has its own CRC.
+ *
+ * The index header is unchanged, and record_size is the size of both
+ * parts together.
+ */
+#define INDEX_BLOCK_RECORDS 128
+
+#define OFFSET_HOT_UID 0
+#define OFFSET_HOT_SYSTEM_FLAGS 4
+#define OFFSET_HOT_MODSEQ 8
+#define OFFSET_HOT_USER_FLAGS 16
+#define OFFSET_HOT_CACHE_OFFSET 32 /* all 64 bits */
+#define OFFSET_HOT_LAST_UPDATED 40
+#define OFFSET_HOT_CRC 44
+
+#define OFFSET_COLD_INTERNALDATE 0
+#define OFFSET_COLD_SENTDATE 4
+#define OFFSET_COLD_SIZE 8
+#define OFFSET_COLD_HEADER_SIZE 12
+#define OFFSET_COLD_GMTIME 16
+#define OFFSET_COLD_SAVEDATE 20
+#define OFFSET_COLD_CACHE_VERSION 24
+#define OFFSET_COLD_MESSAGE_GUID 28
+#define OFFSET_COLD_THRID 48
+#define OFFSET_COLD_CREATEDMODSEQ 56
+#define OFFSET_COLD_CACHE_CRC 64
+#define OFFSET_COLD_CRC 68
+
+#define INDEX_HOT_RECORD_SIZE (OFFSET_HOT_CRC+4)
+#define INDEX_COLD_RECORD_SIZE (OFFSET_COLD_CRC+4)
+#define INDEX_SPLIT_RECORD_SIZE (INDEX_HOT_RECORD_SIZE+INDEX_COLD_RECORD_SIZE)
+
+#define INDEX_IS_SPLIT(version) ((version) >= MAILBOX_SPLIT_MINOR_VERSION)
+
 typedef enum _MsgFlags {
     FLAG_ANSWERED           = (1<<0),
     FLAG_FLAGGED            = (1<<1),
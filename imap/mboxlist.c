@@ -61,6 +61,7 @@
 #include "acl.h"
 #include "annotate.h"
 #include "bsearch.h"
+#include "crc32.h"
 #include "glob.h"
 #include "assert.h"
 #include "global.h"
@@ -3375,6 +3376,106 @@ EXPORTED int mboxlist_alluser(user_cb *proc, void *rock)
     return r;
 }
 
+EXPORTED int mboxlist_usershard(const char *userid, int nshards)
+{
+    if (!userid || !*userid || nshards <= 1) return 0;
+    /* checkpoints record which users a shard has done, so this must
+     * not change between runs; not strhash(), whose low bit is always
+     * clear */
+    return crc32_cstring(userid) % nshards;
+}
+
+struct shardmbox_rock {
+    int shard;
+    int nshards;
+    char *prev;
+    strarray_t users;
+    mboxlist_cb *proc;
+    void *rock;
+};
+
+static int shardmbox_users_cb(const mbentry_t *mbentry, void *rock)
+{
+    struct shardmbox_rock *srock = (struct shardmbox_rock *)rock;
+    char *userid = mboxname_to_userid(mbentry->name);
+
+    if (!userid) return 0;
+
+    /* a user's mailboxes are mostly adjacent, so this catches most
+     * duplicates before the sort */
+    if (strcmpsafe(srock->prev, userid) &&
+        mboxlist_usershard(userid, srock->nshards) == srock->shard) {
+        strarray_append(&srock->users, userid);
+    }
+    free(srock->prev);
+    srock->prev = userid;
+
+    return 0;
+}
+
+static int shardmbox_shared_cb(const mbentry_t *mbentry, void *rock)
+{
+    struct shardmbox_rock *srock = (struct shardmbox_rock *)rock;
+    char *userid = mboxname_to_userid(mbentry->name);
+
+    if (userid) {
+        free(userid);
+        return 0;
+    }
+
+    return srock->proc(mbentry, srock->rock);
+}
+
+EXPORTED int mboxlist_shardmbox(int shard, int nshards, const char *after,
+                                mboxlist_cb *proc, user_cb *done,
+                                void *rock, int flags)
+{
+    struct shardmbox_rock srock;
+    int i, r = 0;
+
+    init_internal();
+
+    memset(&srock, 0, sizeof(struct shardmbox_rock));
+    srock.shard = shard;
+    srock.nshards = nshards;
+    srock.proc = proc;
+    srock.rock = rock;
+
+    /* mailboxes that don't belong to anyone go first, as user "" */
+    if (!shard && !after) {
+        r = mboxlist_allmbox(NULL, shardmbox_shared_cb, &srock, flags);
+        if (!r && done) r = done("", rock);
+        if (r) goto done;
+    }
+
+    r = mboxlist_allmbox(NULL, shardmbox_users_cb, &srock,
+                         flags | MBOXTREE_TOMBSTONES);
+    if (r) goto done;
+
+    strarray_sort(&srock.users, cmpstringp_raw);
+    strarray_uniq(&srock.users);
+
+    /* find where to resume before calling anything, which might
+     * free 'after' */
+    for (i = 0; after && i < strarray_size(&srock.users); i++) {
+        if (strcmp(strarray_nth(&srock.users, i), after) > 0) break;
+    }
+
+    for (; i < strarray_size(&srock.users); i++) {
+        const char *userid = strarray_nth(&srock.users, i);
+
+        r = mboxlist_usermboxtree(userid, NULL, proc, rock,
+                                  flags | MBOXTREE_DELETED);
+        if (!r && done) r = done(userid, rock);
+        if (r) break;
+    }
+
+ done:
+    free(srock.prev);
+    strarray_fini(&srock.users);
+    return r;
+}
+
 struct raclrock {
     int prefixlen;
     strarray_t *list;
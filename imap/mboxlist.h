@@ -337,6 +337,22 @@ int mboxlist_alluser(user_cb *proc, void *rock);
 
 typedef int mboxlist_cb(const mbentry_t *mbentry, void *rock);
 
+/* which of 'nshards' shards 'userid' belongs to; mailboxes that don't
+ * belong to a user (NULL userid) are in shard 0 */
+int mboxlist_usershard(const char *userid, int nshards);
+
+/* Walk the mailboxes of every user in shard 'shard' of 'nshards', one
+ * user at a time in userid order, calling 'done' (if given) once each
+ * user's mailboxes are finished.  Shard 0 first walks the mailboxes
+ * that don't belong to any user, and reports them as user "".  Users
+ * that sort at or before 'after' are skipped, so an interrupted walk
+ * can be resumed from the last user 'done' was called for.
+ * 'flags' are as for mboxlist_allmbox(); a user's deleted mailboxes
+ * are always included. */
+int mboxlist_shardmbox(int shard, int nshards, const char *after,
+                       mboxlist_cb *proc, user_cb *done,
+                       void *rock, int flags);
+
 #define MBOXTREE_TOMBSTONES (1<<0)
 #define MBOXTREE_DELETED (1<<1)
 #define MBOXTREE_SKIP_ROOT (1<<2)
@@ -47,6 +47,7 @@
 #include <string.h>
 #include <sysexits.h>
 #include <syslog.h>
+#include <sys/time.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -56,9 +57,13 @@
 #include "crc32.h"
 #include "glob.h"
 #include "global.h"
+#include "lockstats.h"
+#include "locktable.h"
 #include "mailbox.h"
 #include "map.h"
+#include "prometheus.h"
 #include "retry.h"
+#include "strhash.h"
 #include "user.h"
 #include "util.h"
 #include "xmalloc.h"
@@ -74,10 +79,13 @@ struct mboxlocklist {
     struct mboxlocklist *next;
     struct mboxlock l;
     int nopen;
+    struct lockstats_timer lockstats;
 };
 
 static struct mboxlocklist *open_mboxlocks = NULL;
 
+static struct locktable *mboxlocktable = NULL;
+
 static struct namespace *admin_namespace;
 
 struct mbname_parts {
@@ -125,6 +133,10 @@ static const char index_mod64[256] = {
 #define FNAME_SHAREDPREFIX "shared"
 
 
+/* see user_namespacelock() */
+#define lockitem_type(item) \
+    (strncmp((item)->l.name, "*U*", 3) ? LOCKSTATS_MBOXNAME : LOCKSTATS_NAMESPACE)
+
 static struct mboxlocklist *create_lockitem(const char *name)
 {
     struct mboxlocklist *item = xmalloc(sizeof(struct mboxlocklist));
@@ -162,11 +174,16 @@ static void remove_lockitem(struct mboxlocklist *remitem)
                 previtem->next = item->next;
             else
                 open_mboxlocks = item->next;
+            lockstats_released(&item->lockstats, lockitem_type(item),
+                               item->l.name);
             if (item->l.lock_fd != -1) {
                 if (item->l.locktype)
                     lock_unlock(item->l.lock_fd, item->l.name);
                 close(item->l.lock_fd);
             }
+            else if (item->l.locktype && mboxlocktable) {
+                locktable_unlock(mboxlocktable, item->l.name);
+            }
             free(item->l.name);
             free(item);
             return;
@@ -179,12 +196,60 @@ static void remove_lockitem(struct mboxlocklist *remitem)
 
 /* name locking support */
 
+static int use_locktable(void)
+{
+    return config_getenum(IMAPOPT_MBOXNAME_LOCKMETHOD) ==
+        IMAP_ENUM_MBOXNAME_LOCKMETHOD_SHM;
+}
+
+/* one table per lock directory, so separate instances don't share */
+static struct locktable *mboxname_locktable(void)
+{
+    const char *root = config_getstring(IMAPOPT_MBOXNAME_LOCKPATH);
+    char basepath[MAX_MAILBOX_PATH+1];
+    char name[64];
+
+    if (mboxlocktable) return mboxlocktable;
+
+    if (!root) {
+        snprintf(basepath, MAX_MAILBOX_PATH, "%s/lock", config_dir);
+        root = basepath;
+    }
+
+    snprintf(name, sizeof(name), "/cyrus-mboxlocks-%08x", strhash(root));
+
+    if (locktable_open(name, &mboxlocktable)) {
+        syslog(LOG_ERR, "IOERROR: opening lock table %s: %m", name);
+        return NULL;
+    }
+
+    return mboxlocktable;
+}
+
+static void mboxname_lock_waited(uint64_t wait_usec)
+{
+    prometheus_increment(CYRUS_MBOXNAME_LOCK_WAITS_TOTAL);
+    prometheus_apply_delta(CYRUS_MBOXNAME_LOCK_WAIT_SECONDS_TOTAL,
+                           wait_usec / 1000000.0);
+}
+
+static uint64_t usec_since(const struct timeval *start)
+{
+    struct timeval end;
+
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) * 1000000 +
+        (end.tv_usec - start->tv_usec);
+}
+
 EXPORTED int mboxname_lock(const char *mboxname, struct mboxlock **mboxlockptr,
                   int locktype_and_flags)
 {
     const char *fname;
     int r = 0;
     struct mboxlocklist *lockitem;
+    struct timeval start;
+    uint64_t wait_usec = 0;
     int nonblock;
     int locktype;
 
@@ -208,6 +273,20 @@ EXPORTED int mboxname_lock(const char *mboxname, struct mboxlock **mboxlockptr,
     }
 
     lockitem = create_lockitem(mboxname);
+    lockstats_requested(&lockitem->lockstats);
+
+    if (use_locktable()) {
+        struct locktable *table = mboxname_locktable();
+
+        if (!table) {
+            r = IMAP_IOERROR;
+            goto done;
+        }
+
+        r = locktable_lock(table, mboxname, locktype == LOCK_EXCLUSIVE,
+                           nonblock, &wait_usec);
+        goto locked;
+    }
 
     /* assume success, and only create directory on failure.
      * More efficient on a common codepath */
@@ -225,13 +304,31 @@ EXPORTED int mboxname_lock(const char *mboxname, struct mboxlock **mboxlockptr,
         goto done;
     }
 
+    /* try without waiting first, to find out whether we had to.
+     * POSIX lets fcntl() say EACCES rather than EAGAIN for a lock
+     * somebody else holds */
     r = lock_setlock(lockitem->l.lock_fd,
                      locktype == LOCK_EXCLUSIVE,
-                     nonblock, fname);
-    if (!r) lockitem->l.locktype = locktype;
-    else if (errno == EWOULDBLOCK) r = IMAP_MAILBOX_LOCKED;
+                     /*nonblock*/1, fname);
+    if (r && (errno == EWOULDBLOCK || errno == EACCES) && !nonblock) {
+        gettimeofday(&start, NULL);
+        r = lock_setlock(lockitem->l.lock_fd,
+                         locktype == LOCK_EXCLUSIVE,
+                         /*nonblock*/0, fname);
+        wait_usec = usec_since(&start);
+    }
+
+locked:
+    if (!r) {
+        lockitem->l.locktype = locktype;
+        lockstats_granted(&lockitem->lockstats, lockitem_type(lockitem),
+                          mboxname);
+    }
+    else if (errno == EWOULDBLOCK || errno == EACCES) r = IMAP_MAILBOX_LOCKED;
     else r = errno;
 
+    if (wait_usec) mboxname_lock_waited(wait_usec);
+
 done:
     if (r) remove_lockitem(lockitem);
     else *mboxlockptr = &lockitem->l;
@@ -259,6 +356,18 @@ EXPORTED void mboxname_release(struct mboxlock **mboxlockptr)
     remove_lockitem(lockitem);
 }
 
+EXPORTED int mboxname_foreach_lockinfo(locktable_foreach_cb *cb, void *rock)
+{
+    struct locktable *table;
+
+    if (!use_locktable()) return IMAP_NOTFOUND;
+
+    table = mboxname_locktable();
+    if (!table) return IMAP_IOERROR;
+
+    return locktable_foreach(table, cb, rock);
+}
+
 EXPORTED int mboxname_islocked(const char *mboxname)
 {
     return find_lockitem(mboxname) ? 1 : 0;
@@ -1957,6 +2066,11 @@ EXPORTED char *mboxname_metapath(const char *partition,
         filename = FNAME_CACHE;
         archiveflag = 1;
         break;
+    case META_THREAD:
+        snprintf(confkey, 256, "metadir-index-%s", partition);
+        metaflag = IMAP_ENUM_METAPARTITION_FILES_THREAD;
+        filename = FNAME_THREAD;
+        break;
     case 0:
         break;
     default:
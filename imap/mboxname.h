@@ -44,6 +44,7 @@
 #define INCLUDED_MBOXNAME_H
 
 #include "auth.h"
+#include "locktable.h"
 #include "strarray.h"
 #include "util.h"
 
@@ -128,6 +129,8 @@ int mboxname_lock(const char *mboxname, struct mboxlock **mboxlockptr,
                   int locktype);
 void mboxname_release(struct mboxlock **mboxlockptr);
 int mboxname_islocked(const char *mboxname);
+/* with mboxname_lockmethod: shm, report every name in the lock table */
+int mboxname_foreach_lockinfo(locktable_foreach_cb *cb, void *rock);
 struct mboxlock *mboxname_usernamespacelock(const char *mboxname);
 
 /* Create namespace based on config options. */
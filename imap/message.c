@@ -175,11 +175,16 @@ static char *message_ucase(char *s)
  * The message is read from 'from'. If 'to' is not NULL, the message
  * is copied to 'to', otherwise an in-memory buffer of 'from' is checked.
  *
+ * If 'guid' is not NULL, it is set to the GUID of the bytes as copied
+ * (after any 8bit munging), so that the caller need not read the
+ * message again to hash it.  It is left NULL on error.
+ *
  * Caller must have initialized config_* routines (with cyrus_init) to read
  * imapd.conf before calling.
  */
-EXPORTED int message_copy_strict(struct protstream *from, FILE *to,
-                                 unsigned size, int allow_null)
+EXPORTED int message_copy_strict_full(struct protstream *from, FILE *to,
+                                      unsigned size, int allow_null,
+                                      struct message_guid *guid)
 {
     char buf[4096+1];
     unsigned char *p, *endp;
@@ -190,8 +195,16 @@ EXPORTED int message_copy_strict(struct protstream *from, FILE *to,
     int munge8bit = config_getswitch(IMAPOPT_MUNGE8BIT);
     int inheader = 1, blankline = 1;
     struct buf tmp = BUF_INITIALIZER;
+    struct message_guid_ctx guidctx;
+
+    if (guid) {
+        message_guid_set_null(guid);
+        message_guid_init(&guidctx);
+    }
 
     while (size) {
+        int wasinheader = inheader;
+
         n = prot_read(from, buf, size > 4096 ? 4096 : size);
         if (!n) {
             syslog(LOG_ERR, "IOERROR: reading message: unexpected end of file");
@@ -209,12 +222,28 @@ EXPORTED int message_copy_strict(struct protstream *from, FILE *to,
         if (r) continue;
 
         for (p = (unsigned char *)buf, endp = p + n; p < endp; p++) {
-            if (!*p && inheader) {
+            if (!inheader) {
+                /* In the body only bare newlines matter, so skip
+                   straight from one newline to the next */
+                unsigned char *nl;
+
+                if (allow_null) break;
+                nl = memchr(p, '\n', endp - p);
+                if (!nl) {
+                    sawcr = (endp[-1] == '\r');
+                    break;
+                }
+                if (nl > p) sawcr = (nl[-1] == '\r');
+                if (!sawcr) r = IMAP_MESSAGE_CONTAINSNL;
+                sawcr = 0;
+                p = nl;
+            }
+            else if (!*p) {
                 /* NUL in header is always bad */
                 r = IMAP_MESSAGE_CONTAINSNULL;
             }
             else if (*p == '\n') {
-                if (!sawcr && (inheader || !allow_null))
+                if (!sawcr)
                     r = IMAP_MESSAGE_CONTAINSNL;
                 sawcr = 0;
                 if (blankline) {
@@ -228,7 +257,7 @@ EXPORTED int message_copy_strict(struct protstream *from, FILE *to,
             else {
                 sawcr = 0;
                 blankline = 0;
-                if (inheader && *p >= 0x80) {
+                if (*p >= 0x80) {
                     if (reject8bit) {
                         /* We have been configured to reject all mail of this
                            form. */
@@ -242,9 +271,14 @@ EXPORTED int message_copy_strict(struct protstream *from, FILE *to,
             }
         }
 
+        if (guid)
+            message_guid_update(&guidctx, buf, n);
+
+        /* keep the header section for the checks below, rather than
+         * reading it back from 'to' */
         if (to)
             fwrite(buf, 1, n, to);
-        else
+        if (!to || wasinheader)
             buf_appendmap(&tmp, buf, n);
     }
 
@@ -266,32 +300,23 @@ EXPORTED int message_copy_strict(struct protstream *from, FILE *to,
     const char *top = buf_base(&tmp) + buf_len(&tmp);
     for (;;) {
         /* Read headers into buffer */
-        if (to) {
-            if (!fgets(buf, sizeof(buf), to)) {
-                r = sawnl ? 0 : IMAP_MESSAGE_BADHEADER;
-                goto done;
-            }
+        if (cur >= top) {
+            r = sawnl ? 0 : IMAP_MESSAGE_BADHEADER;
+            goto done;
+        }
+        const char *q = memchr(cur, '\n', top - cur);
+        if (q == NULL) {
+            q = top;
         }
         else {
-            if (cur >= top) {
-                r = sawnl ? 0 : IMAP_MESSAGE_BADHEADER;
-                goto done;
-            }
-            const char *q = strchr(cur, '\n');
-            if (q == NULL) {
-                q = cur + sizeof(buf);
-                if (q > top) q = top;
-            }
-            else {
-                q++;
-            }
-            if (q > cur + sizeof(buf) - 1) {
-                q = cur + sizeof(buf) - 1;
-            }
-            memcpy(buf, cur, q - cur);
-            buf[q-cur] = '\0';
-            cur = q;
+            q++;
+        }
+        if (q > cur + sizeof(buf) - 1) {
+            q = cur + sizeof(buf) - 1;
         }
+        memcpy(buf, cur, q - cur);
+        buf[q-cur] = '\0';
+        cur = q;
 
         /* End of header section */
         if (sawnl && buf[0] == '\r') {
@@ -323,6 +348,8 @@ EXPORTED int message_copy_strict(struct protstream *from, FILE *to,
         sawnl = (p > (unsigned char *)buf) && (p[-1] == '\n');
     }
 done:
+    if (guid && !r)
+        message_guid_final(&guidctx, guid);
     buf_free(&tmp);
     return r;
 }
@@ -357,10 +384,11 @@ EXPORTED int message_parse(const char *fname, struct index_record *record)
  * If msg_base/msg_len are non-NULL, the file will remain memory-mapped
  * and returned to the caller.  The caller MUST unmap the file.
  */
-EXPORTED int message_parse_file(FILE *infile,
-                                const char **msg_base, size_t *msg_len,
-                                struct body **body,
-                                const char *efname)
+EXPORTED int message_parse_file_full(FILE *infile,
+                                     const char **msg_base, size_t *msg_len,
+                                     struct body **body,
+                                     const char *efname,
+                                     const struct message_guid *guid)
 {
     int fd = fileno(infile);
     struct stat sbuf;
@@ -391,7 +419,7 @@ EXPORTED int message_parse_file(FILE *infile,
         return IMAP_IOERROR; /* zero length file? */
 
     if (!*body) *body = (struct body *) xzmalloc(sizeof(struct body));
-    r = message_parse_mapped(*msg_base, *msg_len, *body, efname);
+    r = message_parse_mapped_full(*msg_base, *msg_len, *body, efname, guid);
 
     if (unmap) map_free(msg_base, msg_len);
 
@@ -471,9 +499,14 @@ EXPORTED int message_parse_binary_file(FILE *infile, struct body **body,
 
 /*
  * Parse the message at 'msg_base' of length 'msg_len'.
+ *
+ * If 'guid' is not NULL, it must be the GUID of exactly these bytes,
+ * and is used rather than hashing them again.
  */
-EXPORTED int message_parse_mapped(const char *msg_base, unsigned long msg_len,
-                                  struct body *body, const char *efname)
+EXPORTED int message_parse_mapped_full(const char *msg_base,
+                                       unsigned long msg_len,
+                                       struct body *body, const char *efname,
+                                       const struct message_guid *guid)
 {
     struct msg msg;
 
@@ -486,7 +519,10 @@ EXPORTED int message_parse_mapped(const char *msg_base, unsigned long msg_len,
 
     body->filesize = msg_len;
 
-    message_guid_generate(&body->guid, msg_base, msg_len);
+    if (guid && !message_guid_isnull(guid))
+        message_guid_copy(&body->guid, guid);
+    else
+        message_guid_generate(&body->guid, msg_base, msg_len);
 
     if (body->filesize != body->header_size + body->content_size) {
         if (efname)
@@ -2039,6 +2075,15 @@ EXPORTED int message_write_cache(struct index_record *record, const struct body
 
     /* initialise data structures */
     buf_reset(&cacheitem_buffer);
+
+    if (body->cacheitems) {
+        /* already built for an earlier append of this message */
+        buf_copy(&cacheitem_buffer, &body->cacherecord);
+        for (i = 0; i < NUM_CACHE_FIELDS; i++)
+            record->crec.item[i] = body->cacheitems[i];
+        goto done;
+    }
+
     memset(ib, 0, sizeof(ib));
 
     toplevel.type = "MESSAGE";
@@ -2071,6 +2116,13 @@ EXPORTED int message_write_cache(struct index_record *record, const struct body
         buf_free(&ib[i]);
     }
 
+    /* we cast away const because the saved copy is only ever
+     * used to answer this same question again */
+    buf_copy((struct buf *) &body->cacherecord, &cacheitem_buffer);
+    ((struct body *) body)->cacheitems = xmalloc(sizeof(record->crec.item));
+    memcpy(body->cacheitems, record->crec.item, sizeof(record->crec.item));
+
+ done:
     /* copy the fields into the message */
     record->cache_offset = 0; /* calculate on write! */
     record->cache_version = MAILBOX_CACHE_MINOR_VERSION;
@@ -2698,6 +2750,8 @@ EXPORTED void message_free_body(struct body *body)
     }
 
     buf_free(&body->cacheheaders);
+    buf_free(&body->cacherecord);
+    free(body->cacheitems);
 
     if (body->decoded_body) free(body->decoded_body);
 }
@@ -126,6 +126,14 @@ struct body {
 
     /* Message GUID. Only filled in at top level */
     struct message_guid guid;
+
+    /*
+     * Cache record built by message_write_cache(), kept so that
+     * appending the same message to many mailboxes only builds it
+     * once.  Only filled in at top level
+     */
+    struct buf cacherecord;
+    struct cacheitem *cacheitems;
 };
 
 /* List of Content-type parameters */
@@ -136,8 +144,11 @@ struct param {
 };
 extern void param_free(struct param **paramp);
 
-extern int message_copy_strict(struct protstream *from, FILE *to,
-                               unsigned size, int allow_null);
+extern int message_copy_strict_full(struct protstream *from, FILE *to,
+                                    unsigned size, int allow_null,
+                                    struct message_guid *guid);
+#define message_copy_strict(f, t, s, n) \
+    message_copy_strict_full((f), (t), (s), (n), NULL)
 
 extern int message_parse(const char *fname, struct index_record *record);
 
@@ -156,14 +167,23 @@ struct bodypart {
 
 extern void parse_cached_envelope(char *env, char *tokens[], int tokens_size);
 
-extern int message_parse_mapped(const char *msg_base, unsigned long msg_len,
-                                struct body *body, const char *efname);
+/* The _full variants take the message GUID if the caller already
+ * knows it (e.g. from message_copy_strict_full()), NULL to compute it */
+extern int message_parse_mapped_full(const char *msg_base,
+                                     unsigned long msg_len,
+                                     struct body *body, const char *efname,
+                                     const struct message_guid *guid);
+#define message_parse_mapped(b, l, body, e) \
+    message_parse_mapped_full((b), (l), (body), (e), NULL)
 extern int message_parse_binary_file(FILE *infile, struct body **body,
                                      const char *efname);
-extern int message_parse_file(FILE *infile,
-                              const char **msg_base, size_t *msg_len,
-                              struct body **body,
-                              const char *efname);
+extern int message_parse_file_full(FILE *infile,
+                                   const char **msg_base, size_t *msg_len,
+                                   struct body **body,
+                                   const char *efname,
+                                   const struct message_guid *guid);
+#define message_parse_file(f, b, l, body, e) \
+    message_parse_file_full((f), (b), (l), (body), (e), NULL)
 extern void message_parse_string(const char *hdr, char **hdrp);
 extern void message_pruneheader(char *buf, const strarray_t *headers,
                                 const strarray_t *headers_not);
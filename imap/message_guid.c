@@ -89,6 +89,37 @@ EXPORTED void message_guid_generate(struct message_guid *guid,
     xsha1((const unsigned char *) msg_base, msg_len, guid->value);
 }
 
+/* message_guid_init(), message_guid_update(), message_guid_final() *****
+ *
+ * Generate GUID from a message that arrives in pieces
+ *
+ ************************************************************************/
+
+EXPORTED void message_guid_init(struct message_guid_ctx *ctx)
+{
+    SHA1_Init(&ctx->sha);
+}
+
+EXPORTED void message_guid_update(struct message_guid_ctx *ctx,
+                                  const char *base, size_t len)
+{
+    /* SHA1_Update() takes an unsigned int length in the fallback */
+    while (len) {
+        unsigned int n = len > (1U << 30) ? (1U << 30) : len;
+
+        SHA1_Update(&ctx->sha, (const unsigned char *) base, n);
+        base += n;
+        len -= n;
+    }
+}
+
+EXPORTED void message_guid_final(struct message_guid_ctx *ctx,
+                                 struct message_guid *guid)
+{
+    guid->status = GUID_NONNULL;
+    SHA1_Final(guid->value, &ctx->sha);
+}
+
 /* message_guid_copy() ***************************************************
  *
  * Copy GUID
@@ -43,8 +43,11 @@
 #ifndef MESSAGE_GUID_H
 #define MESSAGE_GUID_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "xsha1.h"
+
 /* Public interface */
 
 #define MESSAGE_GUID_SIZE         (20)    /* Size of GUID byte sequence */
@@ -64,6 +67,19 @@ struct message_guid {
 void message_guid_generate(struct message_guid *guid,
                            const char *msg_base, unsigned long msg_len);
 
+/* Generate GUID incrementally, as the message streams past.
+ * message_guid_final() gives the same GUID as message_guid_generate()
+ * over the concatenation of every message_guid_update() */
+struct message_guid_ctx {
+    SHA_CTX sha;
+};
+
+void message_guid_init(struct message_guid_ctx *ctx);
+void message_guid_update(struct message_guid_ctx *ctx,
+                         const char *base, size_t len);
+void message_guid_final(struct message_guid_ctx *ctx,
+                        struct message_guid *guid);
+
 /* Copy a GUID */
 void message_guid_copy(struct message_guid *dst, const struct message_guid *src);
 
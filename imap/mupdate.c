@@ -1052,6 +1052,8 @@ static void dobanner(struct conn *c)
 #ifdef HAVE_ZLIB
     if (!c->compress_done && !c->tls_comp) {
         prot_printf(c->pout, "* COMPRESS \"DEFLATE\"\r\n");
+        if (prot_compress_available("ZSTD"))
+            prot_printf(c->pout, "* COMPRESS \"ZSTD\"\r\n");
     }
 #endif
 
@@ -2033,11 +2035,12 @@ static void cmd_compress(struct conn *C, const char *tag, const char *alg)
                     tag, SSL_COMP_get_name(C->tls_comp));
     }
 #endif
-    else if (strcasecmp(alg, "DEFLATE")) {
+    else if (!prot_compress_available(alg)) {
         prot_printf(C->pout,
                     "%s NO Unknown COMPRESS algorithm: %s\r\n", tag, alg);
     }
-    else if (ZLIB_VERSION[0] != zlibVersion()[0]) {
+    else if (!strcasecmp(alg, "DEFLATE") &&
+             ZLIB_VERSION[0] != zlibVersion()[0]) {
         prot_printf(C->pout,
                     "%s NO Error initializing %s (incompatible zlib version)\r\n",
                     tag, alg);
@@ -2047,8 +2050,8 @@ static void cmd_compress(struct conn *C, const char *tag, const char *alg)
                     "%s OK %s active\r\n", tag, alg);
 
         /* enable (de)compression for the prot layer */
-        prot_setcompress(C->pin);
-        prot_setcompress(C->pout);
+        prot_setcompress_alg(C->pin, alg);
+        prot_setcompress_alg(C->pout, alg);
 
         C->compress_done = 1;
     }
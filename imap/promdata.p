@@ -1,7 +1,7 @@
 # Prometheus metric definitions file
 #
 # metric <type> <name> <description>
-#   * type is one of "counter" or "gauge"
+#   * type is one of "counter", "gauge" or "histogram"
 #   * name must be [a-z0-9_] only
 #   * description is free text until EOL but don't be silly
 #
@@ -10,7 +10,14 @@
 #   * key must be [a-z0-9_] only
 #   * values must be [a-z0-9_] only and are whitespace delimited until EOL
 #
+# buckets <metric> <bounds...>
+#   * metric is the name of an already defined histogram
+#   * bounds are the buckets' upper bounds, in increasing order; +Inf is
+#     added automatically
+#   * the bounds are available to C code as <metric>_buckets[]
+#
 # Each metric may have zero or one labels applied to it
+# Each histogram must have buckets
 #
 # '#' begins a comment
 #
@@ -138,3 +145,27 @@ metric counter cyrus_http_unbind_total            The total number of HTTP UNBIN
     label cyrus_http_unbind_total namespace default admin applepush calendar freebusy addressbook principal notify dblookup ischedule domainkeys jmap prometheus rss tzdist drive cgi
 metric counter cyrus_http_unlock_total            The total number of HTTP UNLOCKs
     label cyrus_http_unlock_total namespace default admin applepush calendar freebusy addressbook principal notify dblookup ischedule domainkeys jmap prometheus rss tzdist drive cgi
+
+metric counter cyrus_mboxname_lock_waits_total         The number of mailbox name locks that had to wait
+metric counter cyrus_mboxname_lock_wait_seconds_total  The time spent waiting for mailbox name locks
+metric counter cyrus_lock_contended_total              The number of locks which were waited for, by lock type
+    label cyrus_lock_contended_total type mailbox twoskip conversations namespace mboxname
+metric histogram cyrus_lock_wait_seconds              How long locks were waited for, by lock type
+    label cyrus_lock_wait_seconds type mailbox twoskip conversations namespace mboxname
+    buckets cyrus_lock_wait_seconds 0.0001 0.001 0.01 0.1 1 10
+metric histogram cyrus_lock_hold_seconds              How long locks were held, by lock type
+    label cyrus_lock_hold_seconds type mailbox twoskip conversations namespace mboxname
+    buckets cyrus_lock_hold_seconds 0.0001 0.001 0.01 0.1 1 10
+
+metric histogram cyrus_imap_command_seconds            How long IMAP commands took, not counting waiting for the client
+    label cyrus_imap_command_seconds command append authenticate capability check close compress copy create delete deleteacl dump enable examine expunge fetch genurlauth getacl getannotation getmetadata getquota getquotaroot id list listrights localappend localcreate localdelete login logout lsub move mupdatepush myrights namespace noop reconstruct rename resetkey rlist rlsub scan search select setacl setannotation setmetadata setquota sort starttls status store subscribe syncapply syncget syncrestart syncrestore thread unauthenticate undump unselect unsubscribe urlfetch xapplepushservice xbackup xconvfetch xconvmeta xconvmultisort xconvsort xconvupdates xfer xforever xkillmy xlist xmeid xmove xrunannotator xsnippets xstats xwarmup other
+    buckets cyrus_imap_command_seconds 0.001 0.01 0.1 1 10
+metric histogram cyrus_lmtp_phase_seconds              How long each phase of an LMTP transaction took
+    label cyrus_lmtp_phase_seconds phase rcpt data deliver
+    buckets cyrus_lmtp_phase_seconds 0.001 0.01 0.1 1 10
+metric histogram cyrus_http_request_seconds            How long HTTP requests took, not counting waiting for the client
+    label cyrus_http_request_seconds method acl bind connect copy delete get head lock mkcalendar mkcol move options patch post propfind proppatch put report trace unbind unlock
+    buckets cyrus_http_request_seconds 0.001 0.01 0.1 1 10
+metric histogram cyrus_jmap_method_seconds             How long JMAP method calls took
+    label cyrus_jmap_method_seconds method backup_restorecalendars backup_restorecontacts backup_restoremail backup_restorenotes blob_copy blob_get calendar_changes calendar_get calendar_set calendarevent_changes calendarevent_copy calendarevent_get calendarevent_query calendarevent_set contact_changes contact_copy contact_get contact_query contact_set contactgroup_changes contactgroup_get contactgroup_query contactgroup_set core_echo email_changes email_copy email_get email_import email_matchmime email_parse email_query email_querychanges email_set emailsubmission_changes emailsubmission_get emailsubmission_query emailsubmission_querychanges emailsubmission_set identity_get mailbox_changes mailbox_get mailbox_query mailbox_querychanges mailbox_set notes_changes notes_get notes_set quota_get searchsnippet_get thread_changes thread_get vacationresponse_get vacationresponse_set other
+    buckets cyrus_jmap_method_seconds 0.001 0.01 0.1 1 10
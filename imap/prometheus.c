@@ -70,6 +70,13 @@ struct prometheus_handle {
 static struct prometheus_handle *promhandle = NULL;
 static int prometheus_enabled = -1;
 
+/* observations are added up here and written out every so often, so
+ * that timing every command doesn't cost a file lock each time */
+#define PROMETHEUS_FLUSH_MS 10000
+static double pending[PROM_NUM_METRICS];
+static int havepending = 0;
+static int64_t last_flush = 0;
+
 static void prometheus_init(void);
 static void prometheus_done(void *rock __attribute__((unused)));
 
@@ -177,6 +184,8 @@ static void prometheus_done(void *rock __attribute__((unused)))
 
     if (!promhandle) return; /* make double-call safe */
 
+    prometheus_flush();
+
     /* hold a lock on .doneprocs.lock - this keeps promstatsd from double
      * counting while we're juggling files */
     doneprocs_lock_fname = strconcat(prometheus_stats_dir(), ".",
@@ -268,14 +277,40 @@ done:
     free(doneprocs_lock_fname);
 }
 
+/* add 'delta' to a metric; the stats file must be write locked */
+static int apply_locked(enum prom_metric_id metric_id, double delta,
+                        int64_t now)
+{
+    struct prom_metric metric;
+    size_t offset;
+    int r;
+
+    offset = offsetof(struct prom_stats, metrics) + metric_id * sizeof(metric);
+    memcpy(&metric, mappedfile_base(promhandle->mf) + offset, sizeof(metric));
+    if (delta < 0) {
+        /* counters must not be decremented */
+        assert(prom_metric_descs[metric_id].type != PROM_METRIC_COUNTER);
+    }
+    metric.value = metric.value + delta;
+    metric.last_updated = now;
+
+    r = mappedfile_pwrite(promhandle->mf, &metric, sizeof(metric), offset);
+    if (r != sizeof(metric)) {
+        syslog(LOG_ERR, "IOERROR: mappedfile_pwrite: expected to write "
+                        SIZE_T_FMT " bytes, actually wrote %d",
+                        sizeof(metric), r);
+        return IMAP_IOERROR;
+    }
+
+    return 0;
+}
+
 /* use the prometheus_increment() and prometheus_decrement() wrapper macros
  * for readability if that's all you're doing.
  */
 EXPORTED void prometheus_apply_delta(enum prom_metric_id metric_id,
                                      double delta)
 {
-    struct prom_metric metric;
-    size_t offset;
     int r;
 
     if (!prometheus_enabled) return;
@@ -293,28 +328,126 @@ EXPORTED void prometheus_apply_delta(enum prom_metric_id metric_id,
         return;
     }
 
-    offset = offsetof(struct prom_stats, metrics) + metric_id * sizeof(metric);
-    memcpy(&metric, mappedfile_base(promhandle->mf) + offset, sizeof(metric));
-    if (delta < 0) {
-        /* counters must not be decremented */
-        assert(prom_metric_descs[metric_id].type != PROM_METRIC_COUNTER);
+    if (!apply_locked(metric_id, delta, now_ms()))
+        mappedfile_commit(promhandle->mf);
+
+    mappedfile_unlock(promhandle->mf);
+}
+
+EXPORTED void prometheus_observe(enum prom_metric_id metric_id,
+                                 const double *buckets, size_t nbuckets,
+                                 double value)
+{
+    size_t i;
+
+    if (!prometheus_enabled) return;
+
+    assert(metric_id >= 0 && metric_id + nbuckets + 1 < PROM_NUM_METRICS);
+
+    /* prometheus buckets count everything up to their bound */
+    for (i = 0; i < nbuckets - 1; i++)
+        if (value <= buckets[i]) break;
+    for (; i < nbuckets; i++)
+        pending[metric_id + i]++;
+    pending[metric_id + nbuckets] += value;
+    pending[metric_id + nbuckets + 1]++;
+    havepending = 1;
+
+    /* the first observation after a quiet spell goes straight out */
+    if (now_ms() - last_flush >= PROMETHEUS_FLUSH_MS)
+        prometheus_flush();
+}
+
+EXPORTED void prometheus_flush(void)
+{
+    int64_t now = now_ms();
+    int i, r;
+
+    last_flush = now;
+    if (!havepending) return;
+
+    if (!promhandle) prometheus_init();
+
+    if (!prometheus_enabled) return;
+
+    r = mappedfile_writelock(promhandle->mf);
+    if (r) {
+        syslog(LOG_ERR, "IOERROR: mappedfile_writelock unable to obtain lock on %s",
+                        mappedfile_fname(promhandle->mf));
+        return;
     }
-    metric.value = metric.value + delta;
-    metric.last_updated = now_ms();
 
-    r = mappedfile_pwrite(promhandle->mf, &metric, sizeof(metric), offset);
-    if (r != sizeof(metric)) {
-        syslog(LOG_ERR, "IOERROR: mappedfile_pwrite: expected to write "
-                        SIZE_T_FMT " bytes, actually wrote %d",
-                        sizeof(metric), r);
+    for (i = 0; i < PROM_NUM_METRICS; i++) {
+        if (!pending[i]) continue;
+        if (apply_locked(i, pending[i], now)) break;
     }
-    else {
+
+    if (i == PROM_NUM_METRICS) {
         mappedfile_commit(promhandle->mf);
+        memset(pending, 0, sizeof(pending));
+        havepending = 0;
     }
 
     mappedfile_unlock(promhandle->mf);
 }
 
+static void flush_readcallback(struct protstream *s __attribute__((unused)),
+                               void *rock __attribute__((unused)))
+{
+    prometheus_flush();
+}
+
+EXPORTED void prometheus_flush_before_read(struct protstream *in)
+{
+    if (havepending)
+        prot_setreadcallback(in, flush_readcallback, NULL);
+}
+
+EXPORTED void prometheus_apply_histogram(enum prom_metric_id metric_id,
+                                         const uint64_t *buckets,
+                                         size_t nbuckets, double sum)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    if (!prometheus_enabled) return;
+
+    /* prometheus buckets count everything up to their bound */
+    for (i = 0; i < nbuckets; i++) {
+        count += buckets[i];
+        if (count) prometheus_apply_delta(metric_id + i, count);
+    }
+
+    if (count) {
+        prometheus_apply_delta(metric_id + nbuckets, sum);
+        prometheus_apply_delta(metric_id + nbuckets + 1, count);
+    }
+}
+
+#if CYRUS_LOCK_WAIT_SECONDS_NUM_BUCKETS != LOCKSTATS_NUMBUCKETS || \
+    CYRUS_LOCK_HOLD_SECONDS_NUM_BUCKETS != LOCKSTATS_NUMBUCKETS
+#error lock histogram buckets in promdata.p and lockstats.h differ
+#endif
+
+EXPORTED void prometheus_lockstats_report(enum lockstats_type type,
+                                          const struct lockstats_counts *counts)
+{
+    const char *typename = lockstats_typename(type);
+
+    if (counts->ncontended) {
+        prometheus_apply_delta(
+            prometheus_lookup_label(CYRUS_LOCK_CONTENDED_TOTAL, typename),
+            counts->ncontended);
+    }
+
+    prometheus_apply_histogram(
+        prometheus_lookup_label(CYRUS_LOCK_WAIT_SECONDS, typename),
+        counts->wait_buckets, LOCKSTATS_NUMBUCKETS, counts->wait_seconds);
+    prometheus_apply_histogram(
+        prometheus_lookup_label(CYRUS_LOCK_HOLD_SECONDS, typename),
+        counts->hold_buckets, LOCKSTATS_NUMBUCKETS, counts->hold_seconds);
+}
+
 EXPORTED int prometheus_text_report(struct buf *buf, const char **mimetype)
 {
     char *report_fname = NULL;
@@ -364,8 +497,8 @@ EXPORTED int prometheus_text_report(struct buf *buf, const char **mimetype)
     return 0;
 }
 
-EXPORTED enum prom_metric_id prometheus_lookup_label(enum prom_labelled_metric metric,
-                                                     const char *value)
+EXPORTED int prometheus_find_label(enum prom_labelled_metric metric,
+                                   const char *value)
 {
     size_t i;
 
@@ -381,5 +514,16 @@ EXPORTED enum prom_metric_id prometheus_lookup_label(enum prom_labelled_metric m
             break;
     }
 
-    fatal("invalid metric value -- compile time bug", EX_SOFTWARE);
+    return -1;
+}
+
+EXPORTED enum prom_metric_id prometheus_lookup_label(enum prom_labelled_metric metric,
+                                                     const char *value)
+{
+    int id = prometheus_find_label(metric, value);
+
+    if (id < 0)
+        fatal("invalid metric value -- compile time bug", EX_SOFTWARE);
+
+    return id;
 }
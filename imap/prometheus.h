@@ -47,7 +47,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "lib/lockstats.h"
 #include "lib/mappedfile.h"
+#include "lib/prot.h"
 #include "lib/util.h"
 
 #include "imap/promdata.h"
@@ -68,9 +70,36 @@ extern const char *prometheus_stats_dir(void);
 extern void prometheus_apply_delta(enum prom_metric_id metric_id,
                                    double delta);
 
+/* add observations to the histogram whose series start at 'metric_id',
+ * the first bucket of a label value.  'buckets' holds how many fell in
+ * each bucket (not cumulative), 'sum' what they add up to */
+extern void prometheus_apply_histogram(enum prom_metric_id metric_id,
+                                       const uint64_t *buckets,
+                                       size_t nbuckets, double sum);
+
+/* observe 'value' in the histogram whose series start at 'metric_id',
+ * the first bucket of a label value.  'buckets' are its bounds, as
+ * generated from promdata.p.  Observations are kept in memory and
+ * written out every few seconds, and by prometheus_flush() */
+extern void prometheus_observe(enum prom_metric_id metric_id,
+                               const double *buckets, size_t nbuckets,
+                               double value);
+extern void prometheus_flush(void);
+/* flush what's been observed the next time a read from 'in' would
+ * block, so that it doesn't wait for the client's next command */
+extern void prometheus_flush_before_read(struct protstream *in);
+
+extern void prometheus_lockstats_report(enum lockstats_type type,
+                                        const struct lockstats_counts *counts);
+
 extern int prometheus_text_report(struct buf *buf, const char **mimetype);
 
 extern enum prom_metric_id prometheus_lookup_label(enum prom_labelled_metric metric,
                                                    const char *value);
 
+/* like prometheus_lookup_label(), but returns -1 if 'value' is not one
+ * of the metric's label values, rather than failing */
+extern int prometheus_find_label(enum prom_labelled_metric metric,
+                                 const char *value);
+
 #endif
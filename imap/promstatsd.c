@@ -233,7 +233,7 @@ static void format_metric(const char *key __attribute__((unused)),
     buf_printf(fmrock->buf, "{service=\"%s\"", stats->ident);
     if (prom_metric_descs[fmrock->metric].label)
         buf_printf(fmrock->buf, ",%s", prom_metric_descs[fmrock->metric].label);
-    buf_printf(fmrock->buf, "} %0.f %" PRId64 "\n",
+    buf_printf(fmrock->buf, "} %.15g %" PRId64 "\n",
                             stats->metrics[fmrock->metric].value,
                             stats->metrics[fmrock->metric].last_updated);
 }
@@ -285,12 +285,18 @@ static void do_collate_report(struct buf *buf)
 
     /* format it into buf */
     for (i = 0; i < PROM_NUM_METRICS; i++) {
+        /* histograms are described by their family name, not by the
+         * names of their _bucket, _sum and _count series */
+        const char *family = prom_metric_descs[i].family ?
+                             prom_metric_descs[i].family :
+                             prom_metric_descs[i].name;
+
         if (prom_metric_descs[i].help) {
-            buf_printf(buf, "# HELP %s %s\n", prom_metric_descs[i].name,
+            buf_printf(buf, "# HELP %s %s\n", family,
                             prom_metric_descs[i].help);
         }
         if (prom_metric_descs[i].type != PROM_METRIC_CONTINUED) {
-            buf_printf(buf, "# TYPE %s %s\n", prom_metric_descs[i].name,
+            buf_printf(buf, "# TYPE %s %s\n", family,
                             prom_metric_type_names[prom_metric_descs[i].type]);
         }
 
@@ -48,7 +48,7 @@
 
 /* name of the statuscache database */
 #define FNAME_STATUSCACHEDB "/statuscache.db"
-#define STATUSCACHE_VERSION 8
+#define STATUSCACHE_VERSION 9
 
 /* fill a statuscache entry */
 extern void status_fill_mbentry(const mbentry_t *mbentry, struct statusdata *sdata);
@@ -66,6 +66,18 @@ extern int status_lookup_mbentry(const mbentry_t *mbentry, const char *userid,
 extern int status_lookup_mailbox(struct mailbox *mailbox, const char *userid,
                                  unsigned statusitems, struct statusdata *sdata);
 
+/* read all of a user's statuscache entries up front, and keep their
+ * seen database open, for a run of lookups (e.g. LIST-STATUS) */
+extern void status_batch_begin(const char *userid);
+extern void status_batch_end(void);
+
+/* lookup many entries in one batch, passing each result to proc */
+typedef int status_many_cb(const char *mboxname, int r,
+                           struct statusdata *sdata, void *rock);
+extern int status_lookup_many(const strarray_t *mboxnames, const char *userid,
+                              unsigned statusitems,
+                              status_many_cb *proc, void *rock);
+
 /* invalidate (delete) statuscache entry for the mailbox,
    optionally writing the data for one user in the same transaction */
 extern int statuscache_invalidate(const char *mboxname,
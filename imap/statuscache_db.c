@@ -75,6 +75,18 @@
 static struct db *statuscachedb = NULL;
 static int _initted = 0;
 
+/* statuscache records for all of one user's mailboxes, read with a
+ * single prefix scan, plus that user's seen database held open, for
+ * answering LIST-STATUS without a DB round trip per mailbox */
+struct status_batch {
+    char *userid;
+    char *inbox;
+    hash_table records;         /* statuscache key => struct buf */
+    struct seen *seendb;
+};
+
+static struct status_batch *batch = NULL;
+
 /********************* CACHE METHODS ***********************/
 
 static void statuscache_open(void)
@@ -135,9 +147,46 @@ static void statuscache_buildkey(const char *mboxname, const char *userid,
     }
 }
 
-static void statuscache_read_index(const char *mboxname, struct statusdata *sdata)
+static int batch_covers(const char *mboxname, const char *userid)
+{
+    if (!batch || !batch->inbox)
+        return 0;
+
+    if (userid && strcmp(userid, batch->userid))
+        return 0;
+
+    return mboxname_is_prefix(mboxname, batch->inbox);
+}
+
+static int statuscache_fetch(const char *mboxname, const char *userid,
+                             const char **data, size_t *datalen)
 {
     struct buf keybuf = BUF_INITIALIZER;
+    int r;
+
+    statuscache_buildkey(mboxname, userid, &keybuf);
+
+    if (batch_covers(mboxname, userid)) {
+        /* everything there was got read by status_batch_begin() */
+        struct buf *val = hash_lookup(buf_cstring(&keybuf), &batch->records);
+        if (val) {
+            *data = val->s;
+            *datalen = val->len;
+            r = 0;
+        }
+        else r = CYRUSDB_NOTFOUND;
+    }
+    else {
+        r = cyrusdb_fetch(statuscachedb, keybuf.s, keybuf.len,
+                          data, datalen, NULL);
+    }
+
+    buf_free(&keybuf);
+    return r;
+}
+
+static void statuscache_read_index(const char *mboxname, struct statusdata *sdata)
+{
     const char *data = NULL;
     size_t datalen = 0;
 
@@ -146,10 +195,7 @@ static void statuscache_read_index(const char *mboxname, struct statusdata *sdat
         return;
 
     /* Check if there is an entry in the database */
-    statuscache_buildkey(mboxname, NULL, &keybuf);
-    int r = cyrusdb_fetch(statuscachedb, keybuf.s, keybuf.len, &data, &datalen, NULL);
-    buf_free(&keybuf);
-
+    int r = statuscache_fetch(mboxname, NULL, &data, &datalen);
     if (r || !data || !datalen)
         return;
 
@@ -176,6 +222,9 @@ static void statuscache_read_index(const char *mboxname, struct statusdata *sdat
     if (p < dend) sdata->size = strtoull(p, &p, 10);
     if (p < dend) sdata->createdmodseq = strtoull(p, &p, 10);
     if (p < dend) sdata->highestmodseq = strtoull(p, &p, 10);
+    if (p < dend) sdata->has_internal = strtoul(p, &p, 10);
+    if (p < dend) sdata->internal_unseen = strtoul(p, &p, 10);
+    if (p < dend) sdata->internal_recentuid = strtoul(p, &p, 10);
 
     if (*p++ != ')') return;
 
@@ -189,7 +238,6 @@ static void statuscache_read_index(const char *mboxname, struct statusdata *sdat
 static void statuscache_read_seen(const char *mboxname, const char *userid,
                                   struct statusdata *sdata)
 {
-    struct buf keybuf = BUF_INITIALIZER;
     const char *data = NULL;
     size_t datalen = 0;
 
@@ -213,11 +261,21 @@ static void statuscache_read_seen(const char *mboxname, const char *userid,
     if (!(sdata->statusitems & STATUS_HIGHESTMODSEQ))
         return;
 
-    /* Check if there is an entry in the database */
-    statuscache_buildkey(mboxname, userid, &keybuf);
-    int r = cyrusdb_fetch(statuscachedb, keybuf.s, keybuf.len, &data, &datalen, NULL);
-    buf_free(&keybuf);
+    // internal seen: the counts from the index header are good enough,
+    // unless there are messages newer than recentuid to count
+    if (sdata->has_internal &&
+        sdata->internal_recentuid + 1 >= sdata->uidnext &&
+        ((sdata->mboptions & OPT_IMAP_SHAREDSEEN) ||
+         mboxname_userownsmailbox(userid, mboxname))) {
+        sdata->recent = 0;
+        sdata->unseen = sdata->internal_unseen;
+        sdata->userid = userid;
+        sdata->statusitems |= STATUS_SEENITEMS;
+        return;
+    }
 
+    /* Check if there is an entry in the database */
+    int r = statuscache_fetch(mboxname, userid, &data, &datalen);
     if (r || !data || !datalen)
         return;
 
@@ -292,11 +350,14 @@ static int statuscache_store(const char *mboxname,
 
 
     buf_printf(&databuf,
-                       "I %u (%u %u %u %u %llu " MODSEQ_FMT " " MODSEQ_FMT ")",
+                       "I %u (%u %u %u %u %llu " MODSEQ_FMT " " MODSEQ_FMT
+                       " %d %u %u)",
                        STATUSCACHE_VERSION,
                        sdata->messages, sdata->uidnext,
                        sdata->uidvalidity, sdata->mboptions, sdata->size,
-                       sdata->createdmodseq, sdata->highestmodseq);
+                       sdata->createdmodseq, sdata->highestmodseq,
+                       sdata->has_internal, sdata->internal_unseen,
+                       sdata->internal_recentuid);
 
     r = cyrusdb_store(statuscachedb, keybuf.s, keybuf.len, databuf.s, databuf.len, tidptr);
 
@@ -402,6 +463,13 @@ HIDDEN void status_fill_mailbox(struct mailbox *mailbox, struct statusdata *sdat
     sdata->createdmodseq = mailbox->i.createdmodseq;
     sdata->highestmodseq = mailbox->i.highestmodseq;
 
+    // the index header keeps the unseen count for internal seen
+    if (mailbox->i.minor_version > 13) {
+        sdata->has_internal = 1;
+        sdata->internal_unseen = mailbox->i.unseen;
+        sdata->internal_recentuid = mailbox->i.recentuid;
+    }
+
     // mbentry items are also available from an open mailbox
     sdata->uidvalidity = mailbox->i.uidvalidity;
     sdata->mailboxid = mailbox->uniqueid;
@@ -425,6 +493,27 @@ HIDDEN void status_fill_seen(const char *userid, struct statusdata *sdata,
     sdata->statusitems |= STATUS_SEENITEMS;
 }
 
+static int status_read_seendb(const char *userid, const char *uniqueid,
+                              struct seendata *sd)
+{
+    struct seen *seendb = NULL;
+    int r = 0;
+
+    /* inside a batch, open the seen database just the once */
+    if (batch && !strcmpsafe(userid, batch->userid)) {
+        if (!batch->seendb)
+            r = seen_open(userid, SEEN_CREATE, &batch->seendb);
+        if (!r) r = seen_read(batch->seendb, uniqueid, sd);
+        return r;
+    }
+
+    r = seen_open(userid, SEEN_CREATE, &seendb);
+    if (!r) r = seen_read(seendb, uniqueid, sd);
+    seen_close(&seendb);
+
+    return r;
+}
+
 static int status_load_mailbox(struct mailbox *mailbox, const char *userid,
                                unsigned statusitems, struct statusdata *sdata)
 {
@@ -437,16 +526,21 @@ static int status_load_mailbox(struct mailbox *mailbox, const char *userid,
         struct seqset *seq = NULL;
         int internalseen = mailbox_internal_seen(mailbox, userid);
         unsigned recentuid;
+        uint32_t startuid = 0;
 
         if (internalseen) {
             recentuid = mailbox->i.recentuid;
+            if (mailbox->i.minor_version > 13) {
+                /* the index header already counts unseen messages for
+                 * internal seen, so only the messages after recentuid
+                 * (usually none) need looking at for \Recent */
+                numunseen = mailbox->i.unseen;
+                startuid = recentuid + 1;
+            }
         } else {
-            struct seen *seendb = NULL;
             struct seendata sd = SEENDATA_INITIALIZER;
 
-            int r = seen_open(userid, SEEN_CREATE, &seendb);
-            if (!r) r = seen_read(seendb, mailbox->uniqueid, &sd);
-            seen_close(&seendb);
+            int r = status_read_seendb(userid, mailbox->uniqueid, &sd);
             if (r) return r;
 
             recentuid = sd.lastuid;
@@ -454,22 +548,28 @@ static int status_load_mailbox(struct mailbox *mailbox, const char *userid,
             seen_freedata(&sd);
         }
 
-        struct mailbox_iter *iter = mailbox_iter_init(mailbox, 0, ITER_SKIP_EXPUNGED);
-        const message_t *msg;
-        while ((msg = mailbox_iter_step(iter))) {
-            const struct index_record *record = msg_record(msg);
-            if (record->uid > recentuid)
-                numrecent++;
-            if (internalseen) {
-                if (!(record->system_flags & FLAG_SEEN))
-                    numunseen++;
-            }
-            else {
-                if (!seqset_ismember(seq, record->uid))
-                    numunseen++;
+        if (!startuid || recentuid < mailbox->i.last_uid) {
+            struct mailbox_iter *iter =
+                mailbox_iter_init(mailbox, 0, ITER_SKIP_EXPUNGED|ITER_HOTFIELDS);
+            const message_t *msg;
+            if (startuid) mailbox_iter_startuid(iter, startuid);
+            while ((msg = mailbox_iter_step(iter))) {
+                const struct index_record *record = msg_record(msg);
+                if (record->uid > recentuid)
+                    numrecent++;
+                if (startuid)
+                    continue;
+                if (internalseen) {
+                    if (!(record->system_flags & FLAG_SEEN))
+                        numunseen++;
+                }
+                else {
+                    if (!seqset_ismember(seq, record->uid))
+                        numunseen++;
+                }
             }
+            mailbox_iter_done(&iter);
         }
-        mailbox_iter_done(&iter);
         seqset_free(seq);
 
         status_fill_seen(userid, sdata, numrecent, numunseen);
@@ -589,3 +689,113 @@ EXPORTED int status_lookup_mailbox(struct mailbox *mailbox, const char *userid,
 
     return status_load_mailbox(mailbox, userid, statusitems, sdata);
 }
+
+
+/****************** BATCHED LOOKUPS ************************/
+
+static int batch_read_cb(void *rock __attribute__((unused)),
+                         const char *key, size_t keylen,
+                         const char *data, size_t datalen)
+{
+    char *keystr = xstrndup(key, keylen);
+    char *sep = strchr(keystr, '%');
+
+    if (!sep) goto done;
+
+    /* only records for mailboxes really in the tree (the prefix alone
+     * lets user.foobar through for user.foo), and only our own user's
+     * seen records */
+    *sep = '\0';
+    if (!mboxname_is_prefix(keystr, batch->inbox))
+        goto done;
+    if (sep[1] == '%' && strcmp(sep + 2, batch->userid))
+        goto done;
+    *sep = '%';
+
+    struct buf *val = buf_new();
+    buf_setmap(val, data, datalen);
+    hash_insert(keystr, val, &batch->records);
+
+done:
+    free(keystr);
+    return 0;
+}
+
+static void batch_free_record(void *val)
+{
+    buf_destroy((struct buf *) val);
+}
+
+/*
+ * Read the statuscache records for all of userid's own mailboxes in
+ * one go, and keep their seen database open, until status_batch_end().
+ * Lookups for other mailboxes work as usual in the meantime.
+ */
+EXPORTED void status_batch_begin(const char *userid)
+{
+    if (batch) status_batch_end();
+    if (!userid) return;
+
+    batch = xzmalloc(sizeof(struct status_batch));
+    batch->userid = xstrdup(userid);
+    construct_hash_table(&batch->records, 1024, 0);
+
+    if (!config_getswitch(IMAPOPT_STATUSCACHE))
+        return;
+
+    init_internal();
+    if (!statuscachedb)
+        return;
+
+    char *inbox = mboxname_user_mbox(userid, NULL);
+    int r = cyrusdb_foreach(statuscachedb, inbox, strlen(inbox),
+                            NULL, batch_read_cb, NULL, NULL);
+    if (r) {
+        syslog(LOG_ERR, "DBERROR: reading statuscache for %s: %s",
+               userid, cyrusdb_strerror(r));
+        free(inbox);
+        free_hash_table(&batch->records, batch_free_record);
+        construct_hash_table(&batch->records, 1024, 0);
+        return;
+    }
+
+    batch->inbox = inbox;
+}
+
+EXPORTED void status_batch_end(void)
+{
+    if (!batch) return;
+
+    if (batch->seendb) seen_close(&batch->seendb);
+    free_hash_table(&batch->records, batch_free_record);
+    free(batch->inbox);
+    free(batch->userid);
+    free(batch);
+    batch = NULL;
+}
+
+/*
+ * Look up the status of each of mboxnames in turn, passing the result
+ * (or error) for each to proc.  Only mailboxes whose cached status is
+ * stale get opened.
+ */
+EXPORTED int status_lookup_many(const strarray_t *mboxnames, const char *userid,
+                                unsigned statusitems,
+                                status_many_cb *proc, void *rock)
+{
+    int i, r = 0;
+
+    status_batch_begin(userid);
+
+    for (i = 0; !r && i < strarray_size(mboxnames); i++) {
+        const char *mboxname = strarray_nth(mboxnames, i);
+        struct statusdata sdata = STATUSDATA_INIT;
+        int r2 = status_lookup_mboxname(mboxname, userid, statusitems, &sdata);
+
+        r = proc(mboxname, r2, &sdata, rock);
+    }
+
+    status_batch_end();
+
+    return r;
+}
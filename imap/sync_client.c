@@ -739,21 +739,14 @@ static void replica_connect(const char *channel)
 
 #ifdef HAVE_ZLIB
     /* Does the backend support compression? */
-    if (CAPA(sync_backend, CAPA_COMPRESS)) {
-        prot_printf(sync_backend->out, "%s\r\n",
-                    sync_backend->prot->u.std.compress_cmd.cmd);
-        prot_flush(sync_backend->out);
-
-        if (sync_parse_response("COMPRESS", sync_backend->in, NULL)) {
-            if (do_compress) fatal("Failed to enable compression, aborting", EX_SOFTWARE);
-            syslog(LOG_NOTICE, "Failed to enable compression, continuing uncompressed");
-        }
-        else {
-            prot_setcompress(sync_backend->in);
-            prot_setcompress(sync_backend->out);
-        }
+    int r = sync_compress(sync_backend);
+    if (r == IMAP_NOTFOUND) {
+        if (do_compress) fatal("Backend does not support compression, aborting", EX_SOFTWARE);
+    }
+    else if (r) {
+        if (do_compress) fatal("Failed to enable compression, aborting", EX_SOFTWARE);
+        syslog(LOG_NOTICE, "Failed to enable compression, continuing uncompressed");
     }
-    else if (do_compress) fatal("Backend does not support compression, aborting", EX_SOFTWARE);
 #endif
 
     /* links to sockets */
@@ -287,6 +287,8 @@ static void dobanner(void)
 #ifdef HAVE_ZLIB
         if (!sync_compress_done && !sync_starttls_done) {
             prot_printf(sync_out, "* COMPRESS DEFLATE\r\n");
+            if (prot_compress_available("ZSTD"))
+                prot_printf(sync_out, "* COMPRESS ZSTD\r\n");
         }
 #endif
     }
@@ -850,19 +852,19 @@ static void cmd_compress(char *alg)
         prot_printf(sync_out, "NO Compression already active: %s\r\n", alg);
         return;
     }
-    if (strcasecmp(alg, "DEFLATE")) {
+    if (!prot_compress_available(alg)) {
         prot_printf(sync_out, "NO Unknown compression algorithm: %s\r\n", alg);
         return;
     }
-    if (ZLIB_VERSION[0] != zlibVersion()[0]) {
+    if (!strcasecmp(alg, "DEFLATE") && ZLIB_VERSION[0] != zlibVersion()[0]) {
         prot_printf(sync_out, "NO Error initializing %s "
                     "(incompatible zlib version)\r\n", alg);
         return;
     }
     prot_printf(sync_out, "OK %s active\r\n", alg);
     prot_flush(sync_out);
-    prot_setcompress(sync_in);
-    prot_setcompress(sync_out);
+    prot_setcompress_alg(sync_in, alg);
+    prot_setcompress_alg(sync_out, alg);
     sync_compress_done = 1;
 }
 #else
@@ -133,6 +133,7 @@ struct protocol_t csync_protocol =
         { { "SASL", CAPA_AUTH },
           { "STARTTLS", CAPA_STARTTLS },
           { "COMPRESS=DEFLATE", CAPA_COMPRESS },
+          { "COMPRESS=ZSTD", CAPA_COMPRESS_ZSTD },
           { NULL, 0 } } },
       { "STARTTLS", "OK", "NO", 1 },
       { "AUTHENTICATE", USHRT_MAX, 0, "OK", "NO", "+ ", "*", NULL, 0 },
@@ -2174,6 +2175,42 @@ int sync_parse_response(const char *cmd, struct protstream *in,
     return IMAP_PROTOCOL_ERROR;
 }
 
+/* Negotiate COMPRESS with a freshly connected sync backend, preferring
+ * the algorithm named by sync_compression when the backend offers it.
+ * Returns 0 if compression is active, IMAP_NOTFOUND if the backend
+ * doesn't offer it, or the sync_parse_response() error. */
+EXPORTED int sync_compress(struct backend *backend)
+{
+#ifdef HAVE_ZLIB
+    const char *alg = "DEFLATE";
+    const char *cmd = backend->prot->u.std.compress_cmd.cmd;
+    int r;
+
+    if (!CAPA(backend, CAPA_COMPRESS)) return IMAP_NOTFOUND;
+
+    if (CAPA(backend, CAPA_COMPRESS_ZSTD) &&
+        config_getenum(IMAPOPT_SYNC_COMPRESSION) == IMAP_ENUM_SYNC_COMPRESSION_ZSTD &&
+        prot_compress_available("ZSTD")) {
+        alg = "ZSTD";
+        cmd = "COMPRESS ZSTD";
+    }
+
+    prot_printf(backend->out, "%s\r\n", cmd);
+    prot_flush(backend->out);
+
+    r = sync_parse_response("COMPRESS", backend->in, NULL);
+    if (r) return r;
+
+    prot_setcompress_alg(backend->in, alg);
+    prot_setcompress_alg(backend->out, alg);
+
+    return 0;
+#else
+    (void) backend;
+    return IMAP_NOTFOUND;
+#endif
+}
+
 int sync_append_copyfile(struct mailbox *mailbox,
                          struct index_record *record,
                          const struct sync_annot_list *annots,
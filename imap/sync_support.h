@@ -68,6 +68,13 @@ int sync_get_switchconfig(const char *channel, const char *val);
 int sync_parse_response(const char *name, struct protstream *in,
                         struct dlist **klp);
 
+int sync_compress(struct backend *backend);
+
+/* csync protocol specific capabilities */
+enum {
+    CAPA_COMPRESS_ZSTD  = (1 << 3)
+};
+
 #define SYNC_PARSE_EAT_OKLINE   (1)
 #define SYNC_PARSE_NOEAT_OKLINE (0)
 
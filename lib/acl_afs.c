@@ -55,22 +55,56 @@
 
 #include "acl.h"
 #include "auth.h"
+#include "hash.h"
 #include "xmalloc.h"
 #include "strarray.h"
 #include "libconfig.h"
 
 /*
- * Calculate the set of rights the user in 'auth_state' has in the ACL 'acl'.
+ * Compiled ACLs, by ACL text.  Most mailboxes share one of a handful
+ * of ACLs, so LIST and friends usually find theirs here already
+ * parsed, along with the rights it gave the last auth_state asked.
  */
-EXPORTED int cyrus_acl_myrights(const struct auth_state *auth_state, const char *origacl)
+#define ACL_CACHE_MAX 4096
+
+struct acl_entry {
+    const char *id;
+    int negative;
+    int mask;
+};
+
+struct compiled_acl {
+    unsigned long gen;          /* auth_cachegen() of rights, 0 if none */
+    int rights;
+    int nentries;
+    struct acl_entry *entries;
+};
+
+static hash_table acl_cache = HASH_TABLE_INITIALIZER;
+
+/* everything is in one allocation: the struct, the entries, and a
+ * copy of the text for the identifiers to point into */
+static struct compiled_acl *acl_compile(const char *acl)
 {
-    char *acl = xstrdupsafe(origacl);
-    char *thisid, *rights, *nextid;
-    long acl_positive = 0, acl_negative = 0;
-    long *acl_ptr;
+    struct compiled_acl *compiled;
+    char *text, *thisid, *rights, *nextid;
+    size_t len = strlen(acl);
+    int maxentries = 1;
+    const char *p;
+
+    for (p = acl; (p = strchr(p, '\t')); p++)
+        maxentries++;
+    maxentries /= 2;
+
+    compiled = xzmalloc(sizeof(struct compiled_acl) +
+                        maxentries * sizeof(struct acl_entry) + len + 1);
+    compiled->entries = (struct acl_entry *) (compiled + 1);
+    text = (char *) (compiled->entries + maxentries);
+    memcpy(text, acl, len + 1);
+
+    for (thisid = text; *thisid; thisid = nextid) {
+        struct acl_entry *entry = &compiled->entries[compiled->nentries];
 
-    for (thisid = acl; *thisid; thisid = nextid) {
-        acl_ptr = &acl_positive;
         rights = strchr(thisid, '\t');
         if (!rights) {
             break;
@@ -79,26 +113,58 @@ EXPORTED int cyrus_acl_myrights(const struct auth_state *auth_state, const char
 
         nextid = strchr(rights, '\t');
         if (!nextid) {
-            rights[-1] = '\t';
             break;
         }
         *nextid++ = '\0';
 
         if (*thisid == '-') {
-            acl_ptr = &acl_negative;
+            entry->negative = 1;
             thisid++;
         }
-        if (auth_memberof(auth_state, thisid)) {
-            int mask;
-            cyrus_acl_strtomask(rights, &mask);
-            /* XXX and if strtomask fails? */
-            *acl_ptr |= mask;
+        entry->id = thisid;
+        cyrus_acl_strtomask(rights, &entry->mask);
+        /* XXX and if strtomask fails? */
+        compiled->nentries++;
+    }
+
+    return compiled;
+}
+
+/*
+ * Calculate the set of rights the user in 'auth_state' has in the ACL 'acl'.
+ */
+EXPORTED int cyrus_acl_myrights(const struct auth_state *auth_state, const char *origacl)
+{
+    unsigned long gen = auth_cachegen(auth_state);
+    const char *acl = origacl ? origacl : "";
+    struct compiled_acl *compiled;
+    long acl_positive = 0, acl_negative = 0;
+    int i;
+
+    compiled = hash_lookup(acl, &acl_cache);
+    if (!compiled) {
+        if (hash_numrecords(&acl_cache) >= ACL_CACHE_MAX)
+            free_hash_table(&acl_cache, free);
+        compiled = acl_compile(acl);
+        hash_insert(acl, compiled, &acl_cache);
+    }
+
+    if (compiled->gen == gen)
+        return compiled->rights;
+
+    for (i = 0; i < compiled->nentries; i++) {
+        const struct acl_entry *entry = &compiled->entries[i];
+
+        if (auth_memberof(auth_state, entry->id)) {
+            if (entry->negative) acl_negative |= entry->mask;
+            else acl_positive |= entry->mask;
         }
     }
 
-    free(acl);
+    compiled->rights = acl_positive & ~acl_negative;
+    compiled->gen = gen;
 
-    return acl_positive & ~acl_negative;
+    return compiled->rights;
 }
 
 /*
@@ -40,11 +40,13 @@
  */
 
 #include <config.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
 
 #include "auth.h"
+#include "hash.h"
 #include "libcyr_cfg.h"
 #include "xmalloc.h"
 
@@ -83,11 +85,61 @@ static struct auth_mech *auth_fromname(void)
     return auth;
 }
 
+/*
+ * auth_memberof() answers for the auth_state it was last asked about,
+ * by identifier.  LIST and friends check the same few identifiers
+ * against every mailbox's ACL, and mechanisms like pts answer each
+ * with a scan of all the groups.  An auth_state never changes once
+ * made, so the answers hold until it is freed.
+ */
+#define MEMBEROF_CACHE_MAX 4096
+
+static struct {
+    int valid;
+    const struct auth_state *auth_state;
+    unsigned long gen;
+    hash_table ids;
+} memberof_cache = { 0, NULL, 0, HASH_TABLE_INITIALIZER };
+
+static void memberof_cache_reset(const struct auth_state *auth_state)
+{
+    free_hash_table(&memberof_cache.ids, NULL);
+    construct_hash_table(&memberof_cache.ids, 64, 1);
+    memberof_cache.valid = 1;
+    memberof_cache.auth_state = auth_state;
+    memberof_cache.gen++;
+}
+
+EXPORTED unsigned long auth_cachegen(const struct auth_state *auth_state)
+{
+    if (!memberof_cache.valid || memberof_cache.auth_state != auth_state)
+        memberof_cache_reset(auth_state);
+
+    return memberof_cache.gen;
+}
+
 EXPORTED int auth_memberof(const struct auth_state *auth_state, const char *identifier)
 {
     struct auth_mech *auth = auth_fromname();
+    void *cached;
+    int r;
+
+    auth_cachegen(auth_state);
+
+    /* stored off by one, so that "not a member" isn't NULL */
+    cached = hash_lookup(identifier, &memberof_cache.ids);
+    if (cached) return (int) ((intptr_t) cached - 1);
 
-    return auth->memberof(auth_state, identifier);
+    r = auth->memberof(auth_state, identifier);
+
+    if (hash_numrecords(&memberof_cache.ids) >= MEMBEROF_CACHE_MAX) {
+        /* still the same answers, so no need for a new generation */
+        free_hash_table(&memberof_cache.ids, NULL);
+        construct_hash_table(&memberof_cache.ids, 64, 1);
+    }
+    hash_insert(identifier, (void *) ((intptr_t) r + 1), &memberof_cache.ids);
+
+    return r;
 }
 
 EXPORTED const char *auth_canonifyid(const char *identifier, size_t len)
@@ -108,7 +160,17 @@ EXPORTED void auth_freestate(struct auth_state *auth_state)
 {
     struct auth_mech *auth = auth_fromname();
 
-    if (auth_state) auth->freestate(auth_state);
+    if (!auth_state) return;
+
+    /* a new state could be allocated at the same address */
+    if (memberof_cache.valid && memberof_cache.auth_state == auth_state) {
+        free_hash_table(&memberof_cache.ids, NULL);
+        memberof_cache.valid = 0;
+        memberof_cache.auth_state = NULL;
+        memberof_cache.gen++;
+    }
+
+    auth->freestate(auth_state);
 }
 
 EXPORTED strarray_t *auth_groups(const struct auth_state *auth_state)
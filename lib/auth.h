@@ -76,6 +76,12 @@ const char *auth_canonifyid(const char *identifier, size_t len);
 
 int auth_memberof(const struct auth_state *auth_state,
          const char *identifier);
+
+/* auth_cachegen: auth_memberof() caches its answers for the last
+ *                auth_state it was asked about.  Returns a number
+ *                that stays the same for as long as those answers
+ *                do, so callers can cache results derived from them */
+unsigned long auth_cachegen(const struct auth_state *auth_state);
 struct auth_state *auth_newstate(const char *identifier);
 void auth_freestate(struct auth_state *auth_state);
 strarray_t *auth_groups(const struct auth_state *auth_state);
@@ -325,6 +325,40 @@ static struct auth_state *mynewstate(const char *identifier)
 }
 
 static const char *the_ptscache_db = NULL;
+static struct db *ptdb = NULL;
+
+/* The cache db stays open for the life of the process: opening it
+ * was most of the cost of a cache hit */
+static struct db *ptscache_open(void)
+{
+    const char *fname;
+    char *tofree = NULL;
+    int r;
+
+    if (ptdb) return ptdb;
+
+    /* xxx this sucks, but it seems to be the only way to satisfy the linker */
+    if(the_ptscache_db == NULL) {
+        the_ptscache_db = libcyrus_config_getstring(CYRUSOPT_PTSCACHE_DB);
+    }
+
+    fname = libcyrus_config_getstring(CYRUSOPT_PTSCACHE_DB_PATH);
+    if (!fname) {
+        tofree = strconcat(libcyrus_config_getstring(CYRUSOPT_CONFIG_DIR),
+                           PTS_DBFIL, (char *)NULL);
+        fname = tofree;
+    }
+
+    r = cyrusdb_open(the_ptscache_db, fname, CYRUSDB_CREATE, &ptdb);
+    if (r != 0) {
+        syslog(LOG_ERR, "DBERROR: opening %s: %s", fname,
+               cyrusdb_strerror(r));
+        ptdb = NULL;
+    }
+    free(tofree);
+
+    return ptdb;
+}
 
 /* Returns 0 on success */
 static int ptload(const char *identifier, struct auth_state **state)
@@ -335,7 +369,6 @@ static int ptload(const char *identifier, struct auth_state **state)
     size_t dsize;
     const char *fname = NULL;
     char *tofree = NULL;
-    struct db *ptdb;
     int s;
     struct sockaddr_un srvaddr;
     int r, rc=0;
@@ -346,31 +379,14 @@ static int ptload(const char *identifier, struct auth_state **state)
     const char *config_dir =
         libcyrus_config_getstring(CYRUSOPT_CONFIG_DIR);
 
-    /* xxx this sucks, but it seems to be the only way to satisfy the linker */
-    if(the_ptscache_db == NULL) {
-        the_ptscache_db = libcyrus_config_getstring(CYRUSOPT_PTSCACHE_DB);
-    }
-
     if(!state || *state) {
         fatal("bad state pointer passed to ptload()", EX_TEMPFAIL);
     }
 
-    fname = libcyrus_config_getstring(CYRUSOPT_PTSCACHE_DB_PATH);
-
-    if (!fname) {
-        tofree = strconcat(config_dir, PTS_DBFIL, (char *)NULL);
-        fname = tofree;
-    }
-    r = cyrusdb_open(the_ptscache_db, fname, CYRUSDB_CREATE, &ptdb);
-    if (r != 0) {
-        syslog(LOG_ERR, "DBERROR: opening %s: %s", fname,
-               cyrusdb_strerror(r));
-        free(tofree);
+    if (!ptscache_open()) {
         *state = NULL;
         return -1;
     }
-    free(tofree);
-    tofree = NULL;
 
     id_len = strlen(identifier);
     if(id_len > PTS_DB_KEYSIZE) {
@@ -506,6 +522,11 @@ static int ptload(const char *identifier, struct auth_state **state)
     if (fetched == NULL) {
       *state = NULL;
       syslog(LOG_DEBUG, "No data available at all from ptload()");
+    } else if (fetched->ngroups == PTS_NEGATIVE) {
+      /* ptloader told us recently that there's no such identifier */
+      *state = NULL;
+      rc = -1;
+      syslog(LOG_DEBUG, "ptload(): %s does not exist", identifier);
     } else  {
       /* copy it into our structure */
       *state = (struct auth_state *)xmalloc(dsize);
@@ -513,9 +534,6 @@ static int ptload(const char *identifier, struct auth_state **state)
       syslog(LOG_DEBUG, "ptload returning data");
     }
 
-    /* close and unlock the database */
-    (cyrusdb_close)(ptdb);
-
     return rc;
 }
 
@@ -63,10 +63,13 @@ struct auth_ident {
     char id[PTS_DB_KEYSIZE];
 };
 
+/* ngroups of a cache record saying the identifier doesn't exist */
+#define PTS_NEGATIVE (-1)
+
 struct auth_state {
     struct auth_ident userid; /* the CANONICAL userid */
     time_t mark;
-    int ngroups;
+    int ngroups;              /* or PTS_NEGATIVE */
     struct auth_ident groups[1]; /* variable sized */
 };
 
@@ -58,6 +58,7 @@
 #include "cyrusdb.h"
 #include "crc32.h"
 #include "libcyr_cfg.h"
+#include "lockstats.h"
 #include "mappedfile.h"
 #include "util.h"
 #include "xmalloc.h"
@@ -254,6 +255,25 @@
  * more reliable than just using the inode, because inodes
  * can be reused.
  *
+ * SNAPSHOT READS:
+ * Everything before current_size was there at the last commit,
+ * and only ever changes by a writer rewriting record heads in
+ * place.  Within one transaction, a head still holds a pointer
+ * to the record that followed it at the last commit: the higher
+ * of its level zero pointers below current_size, which is never
+ * the one that gets replaced.  Pointers above level zero may already point
+ * into the transaction, but they are only shortcuts.
+ *
+ * So a fetch or foreach outside of a transaction doesn't need a
+ * lock.  It takes current_size from the header as its end, and
+ * ignores pointers past it at every level.  A head caught half
+ * rewritten fails its CRC.  Once a second transaction commits the
+ * guarantee is gone, so when it's done the reader checks that the
+ * header still has the same generation and current_size, and if
+ * not it tries again.  After a few tries it takes the read lock.
+ * A checkpoint replaces the file rather than changing it, so a
+ * reader with the old one open just sees the old records.
+ *
  * LOCATION OPTIMISATION:
  * If the generation is unchanged AND the size of the file
  * is unchanged, then all offsets stored in the skiploc are
@@ -278,6 +298,8 @@
 
 /* release lock in foreach at least every N records */
 #define FOREACH_LOCK_RELEASE 256
+/* stale snapshots a reader puts up with before taking a lock */
+#define SNAPSHOT_TRIES 3
 
 /* format specifics */
 #undef VERSION /* defined in config.h */
@@ -358,6 +380,10 @@ struct skiploc {
     /* need a generation so we know if the location is still valid */
     uint64_t generation;
     size_t end;
+
+    /* found by a snapshot read, which doesn't follow pointers into
+     * a transaction, so a writer can't use backloc and forwardloc */
+    int is_snapshot;
 };
 
 #define DIRTY (1<<0)
@@ -388,9 +414,11 @@ struct dbengine {
 
     /* tracking info */
     int is_open;
+    int is_snapshot;
     size_t end;
     int txn_num;
     struct txn *current_txn;
+    struct lockstats_timer lockstats;
 
     /* comparator function to use for sorting */
     int open_flags;
@@ -514,6 +542,8 @@ static int read_header(struct dbengine *db)
     crc = ntohl(*((uint32_t *)(BASE(db) + OFFSET_CRC32)));
 
     if (crc32_map(BASE(db), OFFSET_CRC32) != crc) {
+        /* a writer may be rewriting it right now */
+        if (db->is_snapshot) return CYRUSDB_AGAIN;
         syslog(LOG_ERR, "DBERROR: %s: twoskip header CRC failure",
                FNAME(db));
         return CYRUSDB_IOERROR;
@@ -564,6 +594,7 @@ static int check_tailcrc(struct dbengine *db, struct skiprecord *record)
     crc = crc32_map(BASE(db) + record->keyoffset,
                     roundup(record->keylen + record->vallen, 8));
     if (crc != record->crc32_tail) {
+        if (db->is_snapshot) return CYRUSDB_AGAIN;
         syslog(LOG_ERR, "DBERROR: invalid tail crc %s at %llX",
                FNAME(db), (LLU)record->offset);
         return CYRUSDB_IOERROR;
@@ -583,6 +614,12 @@ static int read_onerecord(struct dbengine *db, size_t offset,
 
     if (!offset) return 0;
 
+    /* a snapshot never looks past its end, and any inconsistency
+     * before it is down to a writer: it'll try again, or take the
+     * lock and report the error then */
+    if (db->is_snapshot && offset >= db->end)
+        return CYRUSDB_AGAIN;
+
     record->offset = offset;
     record->len = 24; /* absolute minimum */
 
@@ -601,6 +638,7 @@ static int read_onerecord(struct dbengine *db, size_t offset,
 
     /* make sure we fit */
     if (record->level > MAXLEVEL) {
+        if (db->is_snapshot) return CYRUSDB_AGAIN;
         syslog(LOG_ERR, "DBERROR: twoskip invalid level %d for %s at %08llX",
                record->level, FNAME(db), (LLU)offset);
         return CYRUSDB_IOERROR;
@@ -643,6 +681,7 @@ static int read_onerecord(struct dbengine *db, size_t offset,
 
     if (crc32_map(BASE(db) + record->offset, (offset - record->offset))
         != record->crc32_head) {
+        if (db->is_snapshot) return CYRUSDB_AGAIN;
         syslog(LOG_ERR, "DBERROR: twoskip checksum head error for %s at %08llX",
                FNAME(db), (LLU)offset);
         return CYRUSDB_IOERROR;
@@ -651,6 +690,7 @@ static int read_onerecord(struct dbengine *db, size_t offset,
     return 0;
 
 badsize:
+    if (db->is_snapshot) return CYRUSDB_AGAIN;
     syslog(LOG_ERR, "twoskip: attempt to read past end of file %s: %08llX > %08llX",
            FNAME(db), (LLU)record->offset + record->len, (LLU)SIZE(db));
     return CYRUSDB_IOERROR;
@@ -845,8 +885,13 @@ static int append_record(struct dbengine *db, struct skiprecord *record,
 static size_t _getloc(struct dbengine *db, struct skiprecord *record,
                       uint8_t level)
 {
-    if (level)
+    if (level) {
+        /* a snapshot drops down a level rather than follow a
+         * pointer into a transaction */
+        if (db->is_snapshot && record->nextloc[level + 1] >= db->end)
+            return 0;
         return record->nextloc[level + 1];
+    }
 
     /* if one is past, must be the other */
     if (record->nextloc[0] >= db->end)
@@ -900,6 +945,7 @@ static int relocate(struct dbengine *db)
     /* pointer validity */
     loc->generation = db->header.generation;
     loc->end = db->end;
+    loc->is_snapshot = db->is_snapshot;
 
     /* start with the dummy */
     r = read_onerecord(db, DUMMY_OFFSET, &loc->record);
@@ -1221,13 +1267,22 @@ static int db_is_clean(struct dbengine *db)
 
 static int unlock(struct dbengine *db)
 {
+    lockstats_released(&db->lockstats, LOCKSTATS_TWOSKIP, FNAME(db));
     return mappedfile_unlock(db->mf);
 }
 
 static int write_lock(struct dbengine *db)
 {
-    int r = mappedfile_writelock(db->mf);
+    int r;
+
+    lockstats_requested(&db->lockstats);
+    r = mappedfile_writelock(db->mf);
     if (r) return r;
+    lockstats_granted(&db->lockstats, LOCKSTATS_TWOSKIP, FNAME(db));
+
+    /* a location found by a snapshot read is no good for writing */
+    if (db->loc.is_snapshot)
+        db->loc.end = 0;
 
     /* reread header */
     if (db->is_open) {
@@ -1268,6 +1323,87 @@ static int read_lock(struct dbengine *db)
     return 0;
 }
 
+/* take a snapshot of the database as of the last commit, without a
+ * lock - see SNAPSHOT READS above */
+static int read_snapshot(struct dbengine *db)
+{
+    int r = mappedfile_snapshot(db->mf);
+    if (r) return CYRUSDB_IOERROR;
+
+    db->is_snapshot = 1;
+
+    r = read_header(db);
+
+    /* committed since we mapped it? */
+    if (!r && db->header.current_size > SIZE(db))
+        r = CYRUSDB_AGAIN;
+
+    if (r) db->is_snapshot = 0;
+
+    return r;
+}
+
+/* finish with a snapshot read which returned 'r', and check nothing
+ * was committed while we were reading.  Returns CYRUSDB_AGAIN if the
+ * read has to be done again */
+static int end_snapshot(struct dbengine *db, int r)
+{
+    char buf[HEADER_SIZE];
+
+    db->is_snapshot = 0;
+
+    if (r != CYRUSDB_AGAIN) {
+        /* from the file itself, the map may not be shared */
+        if (mappedfile_pread(db->mf, buf, HEADER_SIZE, 0) != HEADER_SIZE
+            || ntohl(*((uint32_t *)(buf + OFFSET_CRC32)))
+               != crc32_map(buf, OFFSET_CRC32)
+            || ntohll(*((uint64_t *)(buf + OFFSET_GENERATION)))
+               != db->header.generation
+            || ntohll(*((uint64_t *)(buf + OFFSET_CURRENT_SIZE)))
+               != db->header.current_size)
+            r = CYRUSDB_AGAIN;
+    }
+
+    /* don't trust anything we found on the way */
+    if (r == CYRUSDB_AGAIN)
+        db->loc.end = 0;
+
+    return r;
+}
+
+/* start a read outside of a transaction: a snapshot unless too many
+ * have gone stale, otherwise a read lock.  'fails' counts the stale
+ * snapshots */
+static int read_begin(struct dbengine *db, int *fails)
+{
+    if (libcyrus_config_getswitch(CYRUSOPT_TWOSKIP_SNAPSHOT_READS)) {
+        while (*fails < SNAPSHOT_TRIES) {
+            int r = read_snapshot(db);
+            if (r != CYRUSDB_AGAIN) return r;
+            (*fails)++;
+        }
+    }
+
+    return read_lock(db);
+}
+
+/* finish a read started by read_begin() which returned 'r' */
+static int read_end(struct dbengine *db, int r, int *fails)
+{
+    int r1;
+
+    if (db->is_snapshot) {
+        r = end_snapshot(db, r);
+        if (r == CYRUSDB_AGAIN) (*fails)++;
+        return r;
+    }
+
+    r1 = unlock(db);
+    if (r1 < 0) return r1;
+
+    return r;
+}
+
 static int newtxn(struct dbengine *db, int shared, struct txn **tidptr)
 {
     int r;
@@ -1338,6 +1474,17 @@ static int opendb(const char *fname, int flags, struct dbengine **ret, struct tx
 
     db->is_open = 0;
 
+    /* don't wait for a writer just to read the header, anything that
+     * needs fixing will be seen to by whoever next takes a lock */
+    if (mappedfile_size(db->mf) &&
+        libcyrus_config_getswitch(CYRUSOPT_TWOSKIP_SNAPSHOT_READS)) {
+        db->is_open = 1;
+        r = read_snapshot(db);
+        db->is_snapshot = 0;
+        if (!r) goto opened;
+        db->is_open = 0;
+    }
+
     /* grab a read lock, only reading the header */
     r = read_lock(db);
     if (r) goto done;
@@ -1403,6 +1550,7 @@ static int opendb(const char *fname, int flags, struct dbengine **ret, struct tx
     /* unlock the DB */
     unlock(db);
 
+opened:
     *ret = db;
 
     if (mytid) {
@@ -1485,12 +1633,46 @@ static int myclose(struct dbengine *db)
 
 /*************** EXTERNAL APIS ***********************/
 
+static int fetch_loc(struct dbengine *db,
+                     const char *key, size_t keylen,
+                     const char **foundkey, size_t *foundkeylen,
+                     const char **data, size_t *datalen,
+                     int fetchnext)
+{
+    int r;
+
+    if (data) *data = NULL;
+    if (datalen) *datalen = 0;
+
+    r = find_loc(db, key, keylen);
+    if (r) return r;
+
+    if (fetchnext) {
+        r = advance_loc(db);
+        if (r) return r;
+    }
+
+    if (foundkey) *foundkey = db->loc.keybuf.s;
+    if (foundkeylen) *foundkeylen = db->loc.keybuf.len;
+
+    if (!db->loc.is_exactmatch) {
+        /* we didn't get an exact match */
+        return CYRUSDB_NOTFOUND;
+    }
+
+    if (data) *data = VAL(db, &db->loc.record);
+    if (datalen) *datalen = db->loc.record.vallen;
+
+    return 0;
+}
+
 static int myfetch(struct dbengine *db,
             const char *key, size_t keylen,
             const char **foundkey, size_t *foundkeylen,
             const char **data, size_t *datalen,
             struct txn **tidptr, int fetchnext)
 {
+    int fails = 0;
     int r = 0;
 
     assert(db);
@@ -1512,40 +1694,22 @@ static int myfetch(struct dbengine *db,
             r = newtxn(db, 0/*shared*/, tidptr);
             if (r) return r;
         }
-    } else {
-        /* grab a r lock */
-        r = read_lock(db);
-        if (r) return r;
-    }
 
-    r = find_loc(db, key, keylen);
-    if (r) goto done;
-
-    if (fetchnext) {
-        r = advance_loc(db);
-        if (r) goto done;
+        return fetch_loc(db, key, keylen, foundkey, foundkeylen,
+                         data, datalen, fetchnext);
     }
 
-    if (foundkey) *foundkey = db->loc.keybuf.s;
-    if (foundkeylen) *foundkeylen = db->loc.keybuf.len;
+    do {
+        /* grab a snapshot or a r lock */
+        r = read_begin(db, &fails);
+        if (r) return r;
 
-    if (!r && db->loc.is_exactmatch) {
-        if (data) *data = VAL(db, &db->loc.record);
-        if (datalen) *datalen = db->loc.record.vallen;
-    }
-    else {
-        /* we didn't get an exact match */
-        r = CYRUSDB_NOTFOUND;
-    }
+        r = fetch_loc(db, key, keylen, foundkey, foundkeylen,
+                      data, datalen, fetchnext);
 
-done:
-    if (!tidptr) {
-        /* release read lock */
-        int r1;
-        if ((r1 = unlock(db)) < 0) {
-            return r1;
-        }
-    }
+        /* and let it go again */
+        r = read_end(db, r, &fails);
+    } while (r == CYRUSDB_AGAIN);
 
     return r;
 }
@@ -1562,6 +1726,8 @@ static int myforeach(struct dbengine *db,
     int r = 0, cb_r = 0;
     int num_misses = 0;
     int need_unlock = 0;
+    int have_key = 0;
+    int fails = 0;
     const char *val;
     size_t vallen;
     struct buf keybuf = BUF_INITIALIZER;
@@ -1583,22 +1749,27 @@ static int myforeach(struct dbengine *db,
             if (r) return r;
         }
     } else {
-        /* grab a r lock */
-        r = read_lock(db);
+        /* grab a snapshot or a r lock */
+        r = read_begin(db, &fails);
         if (r) return r;
         need_unlock = 1;
     }
 
-    r = find_loc(db, prefix, prefixlen);
-    if (r) goto done;
+ again:
+    if (have_key) {
+        /* carry on after the last key we dealt with */
+        r = find_loc(db, keybuf.s, keybuf.len);
+        if (!r) r = advance_loc(db);
+    }
+    else {
+        r = find_loc(db, prefix, prefixlen);
 
-    if (!db->loc.is_exactmatch) {
         /* advance to the first match */
-        r = advance_loc(db);
-        if (r) goto done;
+        if (!r && !db->loc.is_exactmatch)
+            r = advance_loc(db);
     }
 
-    while (db->loc.is_exactmatch) {
+    while (!r && db->loc.is_exactmatch) {
         /* does it match prefix? */
         if (prefixlen) {
             if (db->loc.record.keylen < prefixlen) break;
@@ -1610,25 +1781,27 @@ static int myforeach(struct dbengine *db,
 
         if (!goodp || goodp(rock, db->loc.keybuf.s, db->loc.keybuf.len,
                                   val, vallen)) {
-            /* take a copy of they key - just in case cb does actions on this database
-             * and clobbers loc */
-            buf_copy(&keybuf, &db->loc.keybuf);
-
             if (!tidptr) {
-                /* release read lock */
-                r = unlock(db);
-                if (r) goto done;
+                /* release read lock, or check the snapshot still
+                 * holds before we pass anything on from it */
+                r = read_end(db, 0, &fails);
                 need_unlock = 0;
+                if (r) break;
             }
 
+            /* take a copy of they key - just in case cb does actions on this database
+             * and clobbers loc */
+            buf_copy(&keybuf, &db->loc.keybuf);
+            have_key = 1;
+
             /* make callback */
             cb_r = cb(rock, db->loc.keybuf.s, db->loc.keybuf.len,
                             val, vallen);
             if (cb_r) break;
 
             if (!tidptr) {
-                /* grab a r lock */
-                r = read_lock(db);
+                /* grab a snapshot or a r lock */
+                r = read_begin(db, &fails);
                 if (r) goto done;
                 need_unlock = 1;
 
@@ -1637,36 +1810,48 @@ static int myforeach(struct dbengine *db,
 
             /* should be cheap if we're already here */
             r = find_loc(db, keybuf.s, keybuf.len);
-            if (r) goto done;
         }
         else if (!tidptr) {
             num_misses++;
             if (num_misses > FOREACH_LOCK_RELEASE) {
+                /* release read lock */
+                r = read_end(db, 0, &fails);
+                need_unlock = 0;
+                if (r) break;
+
                 /* take a copy of they key - just in case cb does actions on this database
                  * and clobbers loc */
                 buf_copy(&keybuf, &db->loc.keybuf);
+                have_key = 1;
 
-                /* release read lock */
-                r = unlock(db);
-                if (r) goto done;
-                need_unlock = 0;
-
-                /* grab a r lock */
-                r = read_lock(db);
+                /* grab a snapshot or a r lock */
+                r = read_begin(db, &fails);
                 if (r) goto done;
                 need_unlock = 1;
 
                 /* should be cheap if we're already here */
                 r = find_loc(db, keybuf.s, keybuf.len);
-                if (r) goto done;
 
                 num_misses = 0;
             }
         }
 
         /* move to the next one */
-        r = advance_loc(db);
+        if (!r) r = advance_loc(db);
+    }
+
+    /* a writer may have cut a snapshot short */
+    if (need_unlock && db->is_snapshot) {
+        r = read_end(db, r, &fails);
+        need_unlock = 0;
+    }
+
+    if (r == CYRUSDB_AGAIN) {
+        /* the snapshot went stale, pick up where we were in a new one */
+        r = read_begin(db, &fails);
         if (r) goto done;
+        need_unlock = 1;
+        goto again;
     }
 
  done:
@@ -1675,7 +1860,7 @@ static int myforeach(struct dbengine *db,
 
     if (need_unlock) {
         /* release read lock */
-        int r1 = unlock(db);
+        int r1 = read_end(db, 0, &fails);
         if (r1) return r1;
     }
 
@@ -59,6 +59,16 @@ EXPORTED glob *glob_init(const char *str, char sep)
 {
     struct buf buf = BUF_INITIALIZER;
 
+    /* most patterns are just a name, which isn't worth a regcomp().
+     * '|' and '{' aren't escaped below, so leave those to the regex */
+    if (!strpbrk(str, "*%|{")) {
+        glob *g = xzmalloc(sizeof(glob));
+        g->literal = xstrdup(str);
+        g->len = strlen(str);
+        g->sep = sep;
+        return g;
+    }
+
     buf_appendcstr(&buf, "(^");
     while (*str) {
         switch (*str) {
@@ -108,7 +118,7 @@ EXPORTED glob *glob_init(const char *str, char sep)
     buf_putc(&buf, sep);
     buf_appendcstr(&buf, "]|$)");
 
-    glob *g = xmalloc(sizeof(glob));
+    glob *g = xzmalloc(sizeof(glob));
     regcomp(&g->regex, buf_cstring(&buf), REG_EXTENDED);
     buf_free(&buf);
 
@@ -121,7 +131,10 @@ EXPORTED void glob_free(glob **gp)
 {
     glob *g = *gp;
     if (g) {
-        regfree(&g->regex);
+        if (g->literal)
+            free(g->literal);
+        else
+            regfree(&g->regex);
         free(g);
     }
     *gp = NULL;
@@ -139,6 +152,14 @@ EXPORTED int glob_test(glob *g, const char *str)
 {
     regmatch_t match[3];
 
+    if (g->literal) {
+        /* same as the regex: the whole name, or a parent of str */
+        if (strncmp(str, g->literal, g->len) ||
+            (str[g->len] && str[g->len] != g->sep))
+            return -1;
+        return g->len;
+    }
+
     if (regexec(&g->regex, str, 2, match, 0))
         return -1;
 
@@ -55,6 +55,9 @@
  */
 typedef struct glob {
     regex_t regex;
+    char *literal;      /* no wildcards: compared directly, no regex */
+    size_t len;
+    char sep;
 } glob;
 
 /* initialize globbing structure
@@ -3,6 +3,7 @@
 #include <config.h>
 #endif
 
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -30,36 +31,117 @@
 **  - sort the buckets for faster searching
 **  - actually, we'll just use a memory pool for this sucker
 **    (atleast, in the cases where it is advantageous to do so)
+**
+** Rewritten as an open addressing table.
+**  - linear probing over a power-of-two array of buckets, with a byte
+**    of control data per bucket (SwissTable style, minus the SIMD)
+**  - grows by doubling, so the constructed size is only a hint
+**  - MurmurHash3 rather than strhash(), whose low bits are poor
+**  - the memory pool, if any, only holds the keys
 */
 
-/* Initialize the hash_table to the size asked for.  Allocates space
-** for the correct number of pointers and sets them to NULL.  If it
-** can't allocate sufficient memory, signals error by setting the size
-** of the table to 0.
+/* any constant will do, but it must not vary between runs or the
+ * order hash_enumerate() visits entries in would too */
+#define HASH_SEED       0x3c6ef372
+
+#define CTRL_EMPTY      0
+#define CTRL_DELETED    1
+#define CTRL_TAG(h)     (0x80 | ((h) >> 25))
+#define CTRL_ISFULL(c)  ((c) & 0x80)
+
+/* smallest power of two that holds 'n' entries at 3/4 load */
+static size_t hash_capacity(size_t n)
+{
+    size_t size = 8;
+
+    while (size - size / 4 < n)
+        size <<= 1;
+
+    return size;
+}
+
+/* buckets and control bytes share one allocation */
+static void hash_alloc(hash_table *table, size_t size)
+{
+    table->size = size;
+    table->table = xmalloc(size * (sizeof(bucket) + 1));
+    table->ctrl = (unsigned char *) (table->table + size);
+    memset(table->ctrl, CTRL_EMPTY, size);
+}
+
+/* Returns the bucket holding 'key', or else the empty bucket that ends
+** its probe sequence.  If 'tombstone' is given, it is set to the first
+** deleted bucket passed on the way, which is a better place to insert.
+*/
+static size_t hash_find(const hash_table *table, const char *key,
+                        uint32_t hash, size_t *tombstone)
+{
+    size_t mask = table->size - 1;
+    size_t i = hash & mask;
+    unsigned char tag = CTRL_TAG(hash);
+
+    for (;; i = (i + 1) & mask) {
+        unsigned char c = table->ctrl[i];
+
+        if (c == CTRL_EMPTY)
+            return i;
+        if (c == tag) {
+            if (!strcmp(key, table->table[i].key))
+                return i;
+        }
+        else if (c == CTRL_DELETED && tombstone && *tombstone == SIZE_MAX) {
+            *tombstone = i;
+        }
+    }
+}
+
+/* Move every entry into a fresh array of 'newsize' buckets, which also
+** drops the tombstones.  The keys are reused, not copied.
+*/
+static void hash_rehash(hash_table *table, size_t newsize)
+{
+    bucket *oldtable = table->table;
+    unsigned char *oldctrl = table->ctrl;
+    size_t oldsize = table->size;
+    size_t mask = newsize - 1;
+    size_t i;
+
+    hash_alloc(table, newsize);
+
+    for (i = 0; i < oldsize; i++) {
+        size_t j;
+
+        if (!CTRL_ISFULL(oldctrl[i]))
+            continue;
+
+        j = strhash_seeded(oldtable[i].key, HASH_SEED) & mask;
+        while (table->ctrl[j] != CTRL_EMPTY)
+            j = (j + 1) & mask;
+
+        table->ctrl[j] = oldctrl[i];
+        table->table[j] = oldtable[i];
+    }
+    table->used = table->count;
+
+    free(oldtable);
+}
+
+/* Initialize the hash_table with room for the number of entries asked
+** for.  Any number of entries can be inserted later, the table grows
+** as it needs to.
 */
 
 EXPORTED hash_table *construct_hash_table(hash_table *table, size_t size, int use_mpool)
 {
       assert(table);
-      assert(size);
-
-      table->size  = size;
-
-      /* Allocate the table -- different for using memory pools and not */
-      if(use_mpool) {
-          /* Allocate an initial memory pool for 32 byte keys + the hash table
-           * + the buckets themselves */
-          table->pool =
-              new_mpool(size * (32 + sizeof(bucket*) + sizeof(bucket)));
-          table->table =
-              (bucket **)mpool_malloc(table->pool,sizeof(bucket *) * size);
-      } else {
-          table->pool = NULL;
-          table->table = xmalloc(sizeof(bucket *) * size);
-      }
 
-      /* Allocate the table and initialize it */
-      memset(table->table, 0, sizeof(bucket *) * size);
+      hash_alloc(table, hash_capacity(size));
+      table->count = 0;
+      table->used = 0;
+      table->iterating = 0;
+
+      /* the pool only holds the keys, guess 32 bytes each */
+      table->pool = use_mpool ? new_mpool(size * 32) : NULL;
 
       return table;
 }
@@ -72,76 +154,50 @@ EXPORTED hash_table *construct_hash_table(hash_table *table, size_t size, int us
 
 EXPORTED void *hash_insert(const char *key, void *data, hash_table *table)
 {
-      unsigned val = strhash(key) % table->size;
-      bucket *ptr, *newptr;
-      bucket **prev;
+      uint32_t hash = strhash_seeded(key, HASH_SEED);
+      size_t tombstone = SIZE_MAX;
+      size_t i;
 
-      /*
-      ** NULL means this bucket hasn't been used yet.  We'll simply
-      ** allocate space for our new bucket and put our data there, with
-      ** the table pointing at it.
-      */
-      if (!((table->table)[val]))
-      {
-          if(table->pool) {
-              (table->table)[val] =
-                  (bucket *)mpool_malloc(table->pool, sizeof(bucket));
-              (table->table)[val] -> key = mpool_strdup(table->pool, key);
-          } else {
-              (table->table)[val] = (bucket *)xmalloc(sizeof(bucket));
-              (table->table)[val] -> key = xstrdup(key);
-          }
-          (table->table)[val] -> next = NULL;
-          (table->table)[val] -> data = data;
-          return (table->table)[val] -> data;
-      }
+      if (!table->size)
+          construct_hash_table(table, 0, 0);
 
-      /*
-      ** This spot in the table is already in use.  See if the current string
-      ** has already been inserted, and if so, increment its count.
-      */
-      for (prev = &((table->table)[val]), ptr=(table->table)[val];
-           ptr;
-           prev=&(ptr->next),ptr=ptr->next) {
-          int cmpresult = strcmp(key,ptr->key);
-          if (!cmpresult) {
-              /* Match! Replace this value and return the old */
-              void *old_data;
-
-              old_data = ptr->data;
-              ptr -> data = data;
-              return old_data;
-          } else if (cmpresult < 0) {
-              /* The new key is smaller than the current key--
-               * insert a node and return this data */
-              if(table->pool) {
-                  newptr = (bucket *)mpool_malloc(table->pool, sizeof(bucket));
-                  newptr->key = mpool_strdup(table->pool, key);
-              } else {
-                  newptr = (bucket *)xmalloc(sizeof(bucket));
-                  newptr->key = xstrdup(key);
-              }
-              newptr->data = data;
-              newptr->next = ptr;
-              *prev = newptr;
-              return data;
-          }
+      i = hash_find(table, key, hash, &tombstone);
+
+      if (table->ctrl[i] != CTRL_EMPTY) {
+          /* Match! Replace this value and return the old */
+          void *old_data = table->table[i].data;
+
+          table->table[i].data = data;
+          return old_data;
       }
 
-      /*
-      ** This key is the largest one so far.  Add it to the end
-      ** of the list (*prev should be correct)
-      */
-      if(table->pool) {
-          newptr=(bucket *)mpool_malloc(table->pool,sizeof(bucket));
-          newptr->key = mpool_strdup(table->pool,key);
-      } else {
-          newptr=(bucket *)xmalloc(sizeof(bucket));
-          newptr->key = xstrdup(key);
+      if (tombstone != SIZE_MAX) {
+          /* reusing a deleted bucket doesn't change the load */
+          i = tombstone;
       }
-      newptr->data = data;
-      newptr->next = NULL;
-      *prev = newptr;
+      else if (table->used >= table->size - table->size / 4 &&
+               (!table->iterating || table->used + 1 >= table->size)) {
+          /*
+          ** Too full.  Double the size, unless most of the load is
+          ** tombstones, in which case a rehash at the same size clears
+          ** them.  While hash_enumerate() is walking the buckets, put
+          ** this off until there is no choice.
+          */
+          hash_rehash(table, table->count >= table->size / 2 ?
+                             table->size * 2 : table->size);
+          i = hash_find(table, key, hash, NULL);
+          table->used++;
+      }
+      else {
+          table->used++;
+      }
+
+      table->ctrl[i] = CTRL_TAG(hash);
+      table->table[i].key = table->pool ? mpool_strdup(table->pool, key)
+                                        : xstrdup(key);
+      table->table[i].data = data;
+      table->count++;
+
       return data;
 }
 
@@ -153,26 +209,14 @@ EXPORTED void *hash_insert(const char *key, void *data, hash_table *table)
 
 EXPORTED void *hash_lookup(const char *key, hash_table *table)
 {
-      unsigned val;
-      bucket *ptr;
+      size_t i;
 
       if (!table->size)
           return NULL;
 
-      val = strhash(key) % table->size;
-
-      if (!(table->table)[val])
-            return NULL;
+      i = hash_find(table, key, strhash_seeded(key, HASH_SEED), NULL);
 
-      for ( ptr = (table->table)[val];NULL != ptr; ptr = ptr->next )
-      {
-          int cmpresult = strcmp(key, ptr->key);
-          if (!cmpresult)
-              return ptr->data;
-          else if(cmpresult < 0) /* key < ptr->key -- we passed it */
-              return NULL;
-      }
-      return NULL;
+      return table->ctrl[i] != CTRL_EMPTY ? table->table[i].data : NULL;
 }
 
 /*
@@ -183,68 +227,42 @@ EXPORTED void *hash_lookup(const char *key, hash_table *table)
  * since it will leak memory until you get rid of the entire hash table */
 EXPORTED void *hash_del(const char *key, hash_table *table)
 {
-      unsigned val = strhash(key) % table->size;
+      size_t mask = table->size - 1;
+      size_t i;
       void *data;
-      bucket *ptr, *last = NULL;
 
-      if (!(table->table)[val])
-            return NULL;
+      if (!table->size)
+          return NULL;
 
-      /*
-      ** Traverse the list, keeping track of the previous node in the list.
-      ** When we find the node to delete, we set the previous node's next
-      ** pointer to point to the node after ourself instead.  We then delete
-      ** the key from the present node, and return a pointer to the data it
-      ** contains.
-      */
+      i = hash_find(table, key, strhash_seeded(key, HASH_SEED), NULL);
+      if (table->ctrl[i] == CTRL_EMPTY)
+          return NULL;
 
-      for (last = NULL, ptr = (table->table)[val];
-            NULL != ptr;
-            last = ptr, ptr = ptr->next)
-      {
-          int cmpresult = strcmp(key, ptr->key);
-          if (!cmpresult)
-          {
-              if (last != NULL )
-              {
-                  data = ptr -> data;
-                  last -> next = ptr -> next;
-                  if(!table->pool) {
-                      free(ptr->key);
-                      free(ptr);
-                  }
-                  return data;
-              }
-
-              /*
-              ** If 'last' still equals NULL, it means that we need to
-              ** delete the first node in the list. This simply consists
-              ** of putting our own 'next' pointer in the array holding
-              ** the head of the list.  We then dispose of the current
-              ** node as above.
-              */
-
-              else
-              {
-                  data = ptr->data;
-                  (table->table)[val] = ptr->next;
-                  if(!table->pool) {
-                      free(ptr->key);
-                      free(ptr);
-                  }
-                  return data;
-              }
-          } else if (cmpresult < 0) {
-              /* its not here! */
-              return NULL;
-          }
-      }
+      data = table->table[i].data;
+      if (!table->pool)
+          free(table->table[i].key);
+      table->table[i].key = NULL;
+      table->count--;
 
       /*
-      ** If we get here, it means we didn't find the item in the table.
-      ** Signal this by returning NULL.
+      ** Other keys may have probed past this bucket, so normally it has
+      ** to become a tombstone.  But if the next bucket is empty, no probe
+      ** goes any further than here, and this bucket and any tombstones
+      ** right before it can be emptied.  Nothing else moves, which is
+      ** what makes deleting from hash_enumerate() safe.
       */
-      return NULL;
+      if (table->ctrl[(i + 1) & mask] == CTRL_EMPTY) {
+          do {
+              table->ctrl[i] = CTRL_EMPTY;
+              table->used--;
+              i = (i - 1) & mask;
+          } while (table->ctrl[i] == CTRL_DELETED);
+      }
+      else {
+          table->ctrl[i] = CTRL_DELETED;
+      }
+
+      return data;
 }
 
 /*
@@ -257,41 +275,35 @@ EXPORTED void *hash_del(const char *key, hash_table *table)
 
 EXPORTED void free_hash_table(hash_table *table, void (*func)(void *))
 {
-      unsigned i;
-      bucket *ptr, *temp;
+      size_t i;
 
       if (!table) return;
 
       /* If we have a function to free the data, apply it everywhere */
       /* We also need to traverse this anyway if we aren't using a memory
        * pool */
-      if(func || !table->pool) {
-          for (i=0;i<table->size; i++)
-          {
-              ptr = (table->table)[i];
-              while (ptr)
-              {
-                  temp = ptr;
-                  ptr = ptr->next;
-                  if (func)
-                      func(temp->data);
-                  if(!table->pool) {
-                      free(temp->key);
-                      free(temp);
-                  }
-              }
+      if (func || !table->pool) {
+          for (i = 0; i < table->size; i++) {
+              if (!CTRL_ISFULL(table->ctrl[i]))
+                  continue;
+              if (func)
+                  func(table->table[i].data);
+              if (!table->pool)
+                  free(table->table[i].key);
           }
       }
 
       /* Free the main structures */
-      if(table->pool) {
+      if (table->pool) {
           free_mpool(table->pool);
           table->pool = NULL;
-      } else {
-          free(table->table);
       }
+      free(table->table);
       table->table = NULL;
+      table->ctrl = NULL;
       table->size = 0;
+      table->count = 0;
+      table->used = 0;
 }
 
 /*
@@ -302,37 +314,27 @@ EXPORTED void free_hash_table(hash_table *table, void (*func)(void *))
 EXPORTED void hash_enumerate(hash_table *table, void (*func)(const char *, void *, void *),
                     void *rock)
 {
-      unsigned i;
-      bucket *temp, *temp_next;
-
-      for (i=0;i<table->size; i++)
-      {
-            if ((table->table)[i] != NULL)
-            {
-                  for (temp = (table->table)[i];
-                        NULL != temp;
-                        temp = temp_next)
-                  {
-                        temp_next = temp->next;
-                        func(temp -> key, temp->data, rock);
-                  }
-            }
+      size_t i;
+
+      table->iterating++;
+
+      /* re-read size and table each time round, the callback may insert */
+      for (i = 0; i < table->size; i++) {
+          if (CTRL_ISFULL(table->ctrl[i]))
+              func(table->table[i].key, table->table[i].data, rock);
       }
+
+      table->iterating--;
 }
 
 EXPORTED strarray_t *hash_keys(hash_table *table)
 {
-    unsigned i;
-    bucket *temp;
-
     strarray_t *sa = strarray_new();
+    size_t i;
 
     for (i = 0; i < table->size; i++) {
-        temp = (table->table)[i];
-        while (temp) {
-            strarray_append(sa, temp->key);
-            temp = temp->next;
-        }
+        if (CTRL_ISFULL(table->ctrl[i]))
+            strarray_append(sa, table->table[i].key);
     }
 
     return sa;
@@ -340,19 +342,7 @@ EXPORTED strarray_t *hash_keys(hash_table *table)
 
 EXPORTED int hash_numrecords(hash_table *table)
 {
-    unsigned i;
-    bucket *temp;
-    int count = 0;
-
-    for (i = 0; i < table->size; i++) {
-        temp = (table->table)[i];
-        while (temp) {
-            count++;
-            temp = temp->next;
-        }
-    }
-
-    return count;
+    return table->count;
 }
 
 EXPORTED void hash_enumerate_sorted(hash_table *table, void (*func)(const char *, void *, void *),
@@ -372,11 +362,17 @@ EXPORTED void hash_enumerate_sorted(hash_table *table, void (*func)(const char *
 
 struct hash_iter {
     hash_table *table;
-    size_t i;
-    bucket *peek;
-    bucket *curr;
+    size_t peek;        /* next full bucket, or table->size */
+    size_t curr;
 };
 
+static size_t hash_iter_scan(hash_table *table, size_t i)
+{
+    while (i < table->size && !CTRL_ISFULL(table->ctrl[i]))
+        i++;
+    return i;
+}
+
 EXPORTED hash_iter *hash_table_iter(hash_table *table)
 {
     hash_iter *iter = xzmalloc(sizeof(struct hash_iter));
@@ -387,48 +383,35 @@ EXPORTED hash_iter *hash_table_iter(hash_table *table)
 
 EXPORTED void hash_iter_reset(hash_iter *iter)
 {
-    hash_table *table = iter->table;
-    iter->curr = NULL;
-    iter->peek = NULL;
-    for (iter->i = 0; iter->i < table->size; iter->i++) {
-        if ((iter->peek = table->table[iter->i])) {
-            break;
-        }
-    }
+    iter->curr = iter->table->size;
+    iter->peek = hash_iter_scan(iter->table, 0);
 }
 
 EXPORTED int hash_iter_has_next(hash_iter *iter)
 {
-    return iter->peek != NULL;
+    return iter->peek < iter->table->size;
 }
 
 EXPORTED const char *hash_iter_next(hash_iter *iter)
 {
     hash_table *table = iter->table;
+
     iter->curr = iter->peek;
-    iter->peek = NULL;
-    if (iter->curr == NULL)
+    if (iter->curr >= table->size)
         return NULL;
-    else if (iter->curr->next)
-        iter->peek = iter->curr->next;
-    else if (iter->i < table->size) {
-        for (iter->i = iter->i + 1; iter->i < table->size; iter->i++) {
-            if ((iter->peek = table->table[iter->i])) {
-                break;
-            }
-        }
-    }
-    return iter->curr->key;
+
+    iter->peek = hash_iter_scan(table, iter->curr + 1);
+    return table->table[iter->curr].key;
 }
 
 EXPORTED const char *hash_iter_key(hash_iter *iter)
 {
-    return iter->curr->key;
+    return iter->table->table[iter->curr].key;
 }
 
 EXPORTED void *hash_iter_val(hash_iter *iter)
 {
-    return iter->curr->data;
+    return iter->table->table[iter->curr].data;
 }
 
 EXPORTED void hash_iter_free(hash_iter **iterptr)
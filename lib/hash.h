@@ -6,39 +6,42 @@
 #include "mpool.h"
 #include "strarray.h"
 
-#define HASH_TABLE_INITIALIZER {0, NULL, NULL}
+#define HASH_TABLE_INITIALIZER {0, NULL, NULL, NULL, 0, 0, 0}
 
 /*
-** A hash table consists of an array of these buckets.  Each bucket
-** holds a copy of the key, a pointer to the data associated with the
-** key, and a pointer to the next bucket that collided with this one,
-** if there was one.
+** A hash table is an array of these buckets, probed linearly.  Each
+** bucket holds a copy of the key and a pointer to the data associated
+** with the key.  A parallel array of control bytes says whether each
+** bucket is empty, deleted or full, and for full ones keeps 7 bits of
+** the key's hash so most mismatches never touch the key itself.
 */
 
 typedef struct bucket {
     char *key;
     void *data;
-    struct bucket *next;
 } bucket;
 
 /*
 ** This is what you actually declare an instance of to create a table.
 ** You then call 'construct_table' with the address of this structure,
-** and a guess at the size of the table.  Note that more nodes than this
-** can be inserted in the table, but performance degrades as this
-** happens.  Performance should still be quite adequate until 2 or 3
-** times as many nodes have been inserted as the table was created with.
+** and a guess at the number of entries.  The table grows as needed, so
+** the guess only saves some rehashing; a zeroed table (as set up by
+** HASH_TABLE_INITIALIZER) is constructed on the first insert.
 */
 
 typedef struct hash_table {
-    size_t size;
-    bucket **table;
-    struct mpool *pool;
+    size_t size;                /* number of buckets, a power of two */
+    bucket *table;
+    struct mpool *pool;         /* for the keys, if use_mpool */
+    unsigned char *ctrl;
+    size_t count;               /* live entries */
+    size_t used;                /* live entries plus tombstones */
+    unsigned iterating;         /* hash_enumerate() depth */
 } hash_table;
 
 /*
-** This is used to construct the table.  If it doesn't succeed, it sets
-** the table's size to 0, and the pointer to the table to NULL.
+** This is used to construct the table, with room for at least 'size'
+** entries before it first has to grow.
 */
 
 hash_table *construct_hash_table(hash_table *table, size_t size,
@@ -62,7 +65,8 @@ void *hash_lookup(const char *key,hash_table *table);
 /*
 ** Deletes an entry from the table.  Returns a pointer to the data that
 ** was associated with the key so the calling code can dispose of it
-** properly.
+** properly.  It is safe to delete entries (the current one or others)
+** from a hash_enumerate() callback.
 */
 /* Warning: use this function judiciously if you are using memory pools,
  * since it will leak memory until you get rid of the entire hash table */
@@ -74,7 +78,9 @@ void *hash_del(const char *key,hash_table *table);
 ** a pointer to the key, a pointer to the data associated
 ** with it and 'rock'.
 ** the "sorted" version sorts the keys first and then iterates them in
-** sorted order.  It's slower but consistent
+** sorted order.  It's slower but consistent.
+** Inserting from the callback is allowed, but whether the new entries
+** are visited is undefined.
 */
 
 void hash_enumerate(hash_table *table,void (*func)(const char *,void *,void *),
@@ -85,7 +91,7 @@ void hash_enumerate_sorted(hash_table *table,void (*func)(const char *,void *,vo
 /* gets all the keys from the hashtable */
 strarray_t *hash_keys(hash_table *table);
 
-/* counts the number of nodes in the hash table */
+/* returns the number of nodes in the hash table */
 
 int hash_numrecords(hash_table *table);
 
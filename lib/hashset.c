@@ -49,9 +49,12 @@
 
 #include "assert.h"
 #include "hashset.h"
+#include "strhash.h"
 #include "xmalloc.h"
 #include "util.h"
 
+#define HASHSET_SEED    0x3c6ef372
+
 EXPORTED struct hashset *hashset_new(size_t bytesize)
 {
     assert(bytesize > 2);
@@ -62,44 +65,76 @@ EXPORTED struct hashset *hashset_new(size_t bytesize)
     return hs;
 }
 
-// returns 1 if added, 0 if already there
-EXPORTED int hashset_add(struct hashset *hs, const void *value)
+static inline uint32_t hashset_hash(const struct hashset *hs, const void *value)
 {
-    assert(hs);
-    uint32_t *pos = &hs->starts[*((uint16_t *)value)];
-    uint32_t *base = pos;
-    size_t offset = 0;
-    while (*pos) {
-        offset = hs->recsize * (*pos - 1);
-        if (!memcmp(hs->data+offset, value, hs->bytesize))
-            return 0; // found it
-        pos = hs->data + offset + hs->bytesize;
+    uint32_t hash = memhash_seeded(value, hs->bytesize, HASHSET_SEED);
+    return hash ? hash : 1; // zero marks an empty bucket
+}
+
+static inline uint32_t hashset_rechash(const void *rec, size_t bytesize)
+{
+    uint32_t hash;
+    memcpy(&hash, rec + bytesize, 4);
+    return hash;
+}
+
+// returns the bucket holding value, or the empty bucket where it would go
+static void *hashset_find(const struct hashset *hs, const void *value,
+                          uint32_t hash)
+{
+    size_t mask = hs->alloc - 1;
+    size_t i = hash & mask;
+
+    for (;; i = (i + 1) & mask) {
+        void *rec = hs->data + hs->recsize * i;
+        uint32_t rechash = hashset_rechash(rec, hs->bytesize);
+
+        if (!rechash)
+            return rec; // empty
+        if (rechash == hash && !memcmp(rec, value, hs->bytesize))
+            return rec; // found it
     }
+}
 
-    // make space
-    if (hs->alloc <= hs->count) {
-        if (!hs->alloc) {
-            hs->alloc = 1024;
-            hs->data = xmalloc(hs->alloc * hs->recsize);
-        }
-        else {
-            hs->alloc *= 2;  // double the allocation each time
-            hs->data = xrealloc(hs->data, hs->alloc * hs->recsize);
-
-            // relocate after realloc if necessary
-            if (pos != base)
-                pos = hs->data + offset + hs->bytesize;
-        }
+// move every record into a table of twice the size
+static void hashset_grow(struct hashset *hs)
+{
+    void *old = hs->data;
+    size_t oldalloc = hs->alloc;
+    size_t i;
+
+    hs->alloc = oldalloc ? oldalloc * 2 : 1024;
+    hs->data = xzmalloc(hs->alloc * hs->recsize);
 
+    for (i = 0; i < oldalloc; i++) {
+        void *rec = old + hs->recsize * i;
+        uint32_t hash = hashset_rechash(rec, hs->bytesize);
+
+        if (hash)
+            memcpy(hashset_find(hs, rec, hash), rec, hs->recsize);
     }
 
-    offset = hs->recsize * hs->count;
-    memcpy(hs->data + offset, value, hs->bytesize);
-    memset(hs->data + offset + hs->bytesize, 0, 4);
+    free(old);
+}
 
-    // make pointers start at 1 so the value is never zero
+// returns 1 if added, 0 if already there
+EXPORTED int hashset_add(struct hashset *hs, const void *value)
+{
+    assert(hs);
+    uint32_t hash = hashset_hash(hs, value);
+    void *rec;
+
+    // make space, keeping the table at most 3/4 full
+    if (hs->count >= hs->alloc - hs->alloc / 4)
+        hashset_grow(hs);
+
+    rec = hashset_find(hs, value, hash);
+    if (hashset_rechash(rec, hs->bytesize))
+        return 0; // found it
+
+    memcpy(rec, value, hs->bytesize);
+    memcpy(rec + hs->bytesize, &hash, 4);
     hs->count++;
-    *pos = hs->count;
 
     return 1; // added it
 }
@@ -107,17 +142,11 @@ EXPORTED int hashset_add(struct hashset *hs, const void *value)
 // returns 1 if present, 0 if not
 EXPORTED int hashset_exists(struct hashset *hs, const void *data)
 {
-    if (!hs) return 0;
-
-    uint32_t pos = hs->starts[*((uint16_t *)data)];
-    while (pos) {
-        size_t offset = hs->recsize * (pos - 1);
-        if (!memcmp(hs->data+offset, data, hs->bytesize))
-            return 1; // found it
-        pos = *(uint32_t *) (hs->data + offset + hs->bytesize);
-    }
+    if (!hs || !hs->count) return 0;
+
+    void *rec = hashset_find(hs, data, hashset_hash(hs, data));
 
-    return 0; // not found
+    return hashset_rechash(rec, hs->bytesize) ? 1 : 0;
 }
 
 EXPORTED void hashset_free(struct hashset **hsp)
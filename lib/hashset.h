@@ -4,11 +4,13 @@
 #include <stddef.h>           /* For size_t */
 #include <stdint.h>           /* For uint32_t */
 
+/* The records are the buckets of an open addressing table: each is
+ * the value followed by its 32 bit hash, which is never zero in a
+ * used bucket. */
 struct hashset {
-    uint32_t starts[65536];
     size_t bytesize;
     size_t recsize;
-    size_t alloc;
+    size_t alloc;       /* number of buckets, a power of two */
     size_t count;
     void *data;
 };
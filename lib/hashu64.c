@@ -8,7 +8,6 @@
 
 #include "assert.h"
 #include "hashu64.h"
-#include "mpool.h"
 #include "xmalloc.h"
 
 /*
@@ -29,41 +28,112 @@
 **  - sort the buckets for faster searching
 **  - actually, we'll just use a memory pool for this sucker
 **    (atleast, in the cases where it is advantageous to do so)
+**
+** Rewritten as an open addressing table, like hash.c.  The keys are
+** kept in the buckets, so there is nothing left for a memory pool to do.
 */
 
-/* Initialize the hashu64_table to the size asked for.  Allocates space
-** for the correct number of pointers and sets them to NULL.  If it
-** can't allocate sufficient memory, signals error by setting the size
-** of the table to 0.
-*/
+#define CTRL_EMPTY      0
+#define CTRL_DELETED    1
+#define CTRL_TAG(h)     (0x80 | ((h) >> 57))
+#define CTRL_ISFULL(c)  ((c) & 0x80)
+
+/* the MurmurHash3 finalizer: keys are often UIDs or counters, so every
+ * bit of the key has to reach the low bits used for the bucket */
+static inline uint64_t hashu64_mix(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= UINT64_C(0xff51afd7ed558ccd);
+    key ^= key >> 33;
+    key *= UINT64_C(0xc4ceb9fe1a85ec53);
+    key ^= key >> 33;
+    return key;
+}
 
-static inline int u64cmp(uint64_t a, uint64_t b)
+static size_t hashu64_capacity(size_t n)
 {
-    return (a < b ? -1 : (a > b ? 1 : 0));
+    size_t size = 8;
+
+    while (size - size / 4 < n)
+        size <<= 1;
+
+    return size;
 }
 
-EXPORTED hashu64_table *construct_hashu64_table(hashu64_table *table, size_t size, int use_mpool)
+static void hashu64_alloc(hashu64_table *table, size_t size)
+{
+    table->size = size;
+    table->table = xmalloc(size * (sizeof(bucketu64) + 1));
+    table->ctrl = (unsigned char *) (table->table + size);
+    memset(table->ctrl, CTRL_EMPTY, size);
+}
+
+/* see hash_find() */
+static size_t hashu64_find(const hashu64_table *table, uint64_t key,
+                           uint64_t hash, size_t *tombstone)
+{
+    size_t mask = table->size - 1;
+    size_t i = hash & mask;
+    unsigned char tag = CTRL_TAG(hash);
+
+    for (;; i = (i + 1) & mask) {
+        unsigned char c = table->ctrl[i];
+
+        if (c == CTRL_EMPTY)
+            return i;
+        if (c == tag) {
+            if (table->table[i].key == key)
+                return i;
+        }
+        else if (c == CTRL_DELETED && tombstone && *tombstone == SIZE_MAX) {
+            *tombstone = i;
+        }
+    }
+}
+
+static void hashu64_rehash(hashu64_table *table, size_t newsize)
+{
+    bucketu64 *oldtable = table->table;
+    unsigned char *oldctrl = table->ctrl;
+    size_t oldsize = table->size;
+    size_t mask = newsize - 1;
+    size_t i;
+
+    hashu64_alloc(table, newsize);
+
+    for (i = 0; i < oldsize; i++) {
+        size_t j;
+
+        if (!CTRL_ISFULL(oldctrl[i]))
+            continue;
+
+        j = hashu64_mix(oldtable[i].key) & mask;
+        while (table->ctrl[j] != CTRL_EMPTY)
+            j = (j + 1) & mask;
+
+        table->ctrl[j] = oldctrl[i];
+        table->table[j] = oldtable[i];
+    }
+    table->used = table->count;
+
+    free(oldtable);
+}
+
+/* Initialize the hashu64_table with room for the number of entries
+** asked for.  Any number of entries can be inserted later, the table
+** grows as it needs to.
+*/
+
+EXPORTED hashu64_table *construct_hashu64_table(hashu64_table *table, size_t size,
+                                                int use_mpool __attribute__((unused)))
 {
       assert(table);
-      assert(size);
-
-      table->size  = size;
-
-      /* Allocate the table -- different for using memory pools and not */
-      if(use_mpool) {
-          /* Allocate an initial memory pool for 32 byte keys + the hash table
-           * + the buckets themselves */
-          table->pool =
-              new_mpool(size * (32 + sizeof(bucketu64*) + sizeof(bucketu64)));
-          table->table =
-              (bucketu64 **)mpool_malloc(table->pool,sizeof(bucketu64 *) * size);
-      } else {
-          table->pool = NULL;
-          table->table = xmalloc(sizeof(bucketu64 *) * size);
-      }
 
-      /* Allocate the table and initialize it */
-      memset(table->table, 0, sizeof(bucketu64 *) * size);
+      hashu64_alloc(table, hashu64_capacity(size));
+      table->pool = NULL;
+      table->count = 0;
+      table->used = 0;
+      table->iterating = 0;
 
       return table;
 }
@@ -76,76 +146,43 @@ EXPORTED hashu64_table *construct_hashu64_table(hashu64_table *table, size_t siz
 
 EXPORTED void *hashu64_insert(uint64_t key, void *data, hashu64_table *table)
 {
-      unsigned val = key % table->size;
-      bucketu64 *ptr, *newptr;
-      bucketu64 **prev;
-
-      /*
-      ** NULL means this bucket hasn't been used yet.  We'll simply
-      ** allocate space for our new bucket and put our data there, with
-      ** the table pointing at it.
-      */
-      if (!((table->table)[val]))
-      {
-          if(table->pool) {
-              (table->table)[val] =
-                  (bucketu64 *)mpool_malloc(table->pool, sizeof(bucketu64));
-              (table->table)[val] -> key = key;
-          } else {
-              (table->table)[val] = (bucketu64 *)xmalloc(sizeof(bucketu64));
-              (table->table)[val] -> key = key;
-          }
-          (table->table)[val] -> next = NULL;
-          (table->table)[val] -> data = data;
-          return (table->table)[val] -> data;
-      }
+      uint64_t hash = hashu64_mix(key);
+      size_t tombstone = SIZE_MAX;
+      size_t i;
 
-      /*
-      ** This spot in the table is already in use.  See if the current string
-      ** has already been inserted, and if so, increment its count.
-      */
-      for (prev = &((table->table)[val]), ptr=(table->table)[val];
-           ptr;
-           prev=&(ptr->next),ptr=ptr->next) {
-          int cmpresult = u64cmp(key, ptr->key);
-          if (!cmpresult) {
-              /* Match! Replace this value and return the old */
-              void *old_data;
-
-              old_data = ptr->data;
-              ptr -> data = data;
-              return old_data;
-          } else if (cmpresult < 0) {
-              /* The new key is smaller than the current key--
-               * insert a node and return this data */
-              if(table->pool) {
-                  newptr = (bucketu64 *)mpool_malloc(table->pool, sizeof(bucketu64));
-                  newptr->key = key;
-              } else {
-                  newptr = (bucketu64 *)xmalloc(sizeof(bucketu64));
-                  newptr->key = key;
-              }
-              newptr->data = data;
-              newptr->next = ptr;
-              *prev = newptr;
-              return data;
-          }
+      if (!table->size)
+          construct_hashu64_table(table, 0, 0);
+
+      i = hashu64_find(table, key, hash, &tombstone);
+
+      if (table->ctrl[i] != CTRL_EMPTY) {
+          /* Match! Replace this value and return the old */
+          void *old_data = table->table[i].data;
+
+          table->table[i].data = data;
+          return old_data;
       }
 
-      /*
-      ** This key is the largest one so far.  Add it to the end
-      ** of the list (*prev should be correct)
-      */
-      if(table->pool) {
-          newptr=(bucketu64 *)mpool_malloc(table->pool,sizeof(bucketu64));
-          newptr->key = key;
-      } else {
-          newptr=(bucketu64 *)xmalloc(sizeof(bucketu64));
-          newptr->key = key;
+      if (tombstone != SIZE_MAX) {
+          i = tombstone;
       }
-      newptr->data = data;
-      newptr->next = NULL;
-      *prev = newptr;
+      else if (table->used >= table->size - table->size / 4 &&
+               (!table->iterating || table->used + 1 >= table->size)) {
+          /* same growth rules as hash_insert() */
+          hashu64_rehash(table, table->count >= table->size / 2 ?
+                                table->size * 2 : table->size);
+          i = hashu64_find(table, key, hash, NULL);
+          table->used++;
+      }
+      else {
+          table->used++;
+      }
+
+      table->ctrl[i] = CTRL_TAG(hash);
+      table->table[i].key = key;
+      table->table[i].data = data;
+      table->count++;
+
       return data;
 }
 
@@ -157,91 +194,50 @@ EXPORTED void *hashu64_insert(uint64_t key, void *data, hashu64_table *table)
 
 EXPORTED void *hashu64_lookup(uint64_t key, hashu64_table *table)
 {
-      unsigned val = key % table->size;
-      bucketu64 *ptr;
-
-      if (!(table->table)[val])
-            return NULL;
-
-      for ( ptr = (table->table)[val];NULL != ptr; ptr = ptr->next )
-      {
-          int cmpresult = u64cmp(key, ptr->key);
-          if (!cmpresult)
-              return ptr->data;
-          else if(cmpresult < 0) /* key < ptr->key -- we passed it */
-              return NULL;
-      }
-      return NULL;
+      size_t i;
+
+      if (!table->size)
+          return NULL;
+
+      i = hashu64_find(table, key, hashu64_mix(key), NULL);
+
+      return table->ctrl[i] != CTRL_EMPTY ? table->table[i].data : NULL;
 }
 
 /*
 ** Delete a key from the hashu64 table and return associated
 ** data, or NULL if not present.
 */
-/* Warning: use this function judiciously if you are using memory pools,
- * since it will leak memory until you get rid of the entire hash table */
+
 EXPORTED void *hashu64_del(uint64_t key, hashu64_table *table)
 {
-      unsigned val = key % table->size;
+      size_t mask = table->size - 1;
+      size_t i;
       void *data;
-      bucketu64 *ptr, *last = NULL;
-
-      if (!(table->table)[val])
-            return NULL;
-
-      /*
-      ** Traverse the list, keeping track of the previous node in the list.
-      ** When we find the node to delete, we set the previous node's next
-      ** pointer to point to the node after ourself instead.  We then delete
-      ** the key from the present node, and return a pointer to the data it
-      ** contains.
-      */
-
-      for (last = NULL, ptr = (table->table)[val];
-            NULL != ptr;
-            last = ptr, ptr = ptr->next)
-      {
-          int cmpresult = u64cmp(key, ptr->key);
-          if (!cmpresult)
-          {
-              if (last != NULL )
-              {
-                  data = ptr -> data;
-                  last -> next = ptr -> next;
-                  if(!table->pool) {
-                      xfree(ptr);
-                  }
-                  return data;
-              }
-
-              /*
-              ** If 'last' still equals NULL, it means that we need to
-              ** delete the first node in the list. This simply consists
-              ** of putting our own 'next' pointer in the array holding
-              ** the head of the list.  We then dispose of the current
-              ** node as above.
-              */
-
-              else
-              {
-                  data = ptr->data;
-                  (table->table)[val] = ptr->next;
-                  if(!table->pool) {
-                      xfree(ptr);
-                  }
-                  return data;
-              }
-          } else if (cmpresult < 0) {
-              /* its not here! */
-              return NULL;
-          }
+
+      if (!table->size)
+          return NULL;
+
+      i = hashu64_find(table, key, hashu64_mix(key), NULL);
+      if (table->ctrl[i] == CTRL_EMPTY)
+          return NULL;
+
+      data = table->table[i].data;
+      table->count--;
+
+      /* see hash_del() */
+      if (table->ctrl[(i + 1) & mask] == CTRL_EMPTY) {
+          do {
+              table->ctrl[i] = CTRL_EMPTY;
+              table->used--;
+              i = (i - 1) & mask;
+          } while (table->ctrl[i] == CTRL_DELETED);
+      }
+      else {
+          table->ctrl[i] = CTRL_DELETED;
       }
 
-      /*
-      ** If we get here, it means we didn't find the item in the table.
-      ** Signal this by returning NULL.
-      */
-      return NULL;
+      return data;
 }
 
 /*
@@ -254,38 +250,22 @@ EXPORTED void *hashu64_del(uint64_t key, hashu64_table *table)
 
 EXPORTED void free_hashu64_table(hashu64_table *table, void (*func)(void *))
 {
-      unsigned i;
-      bucketu64 *ptr, *temp;
+      size_t i;
 
       /* If we have a function to free the data, apply it everywhere */
-      /* We also need to traverse this anyway if we aren't using a memory
-       * pool */
-      if(func || !table->pool) {
-          for (i=0;i<table->size; i++)
-          {
-              ptr = (table->table)[i];
-              while (ptr)
-              {
-                  temp = ptr;
-                  ptr = ptr->next;
-                  if (func)
-                      func(temp->data);
-                  if(!table->pool) {
-                      xfree(temp);
-                  }
-              }
+      if (func) {
+          for (i = 0; i < table->size; i++) {
+              if (CTRL_ISFULL(table->ctrl[i]))
+                  func(table->table[i].data);
           }
       }
 
       /* Free the main structures */
-      if(table->pool) {
-          free_mpool(table->pool);
-          table->pool = NULL;
-      } else {
-          xfree(table->table);
-      }
-      table->table = NULL;
+      xfree(table->table);
+      table->ctrl = NULL;
       table->size = 0;
+      table->count = 0;
+      table->used = 0;
 }
 
 /*
@@ -297,35 +277,19 @@ EXPORTED void hashu64_enumerate(hashu64_table *table,
                                 void (*func)(uint64_t, void *, void *),
                                 void *rock)
 {
-      unsigned i;
-      bucketu64 *temp, *temp_next;
-
-      for (i=0;i<table->size; i++)
-      {
-            if ((table->table)[i] != NULL)
-            {
-                  for (temp = (table->table)[i];
-                        NULL != temp;
-                        temp = temp_next)
-                  {
-                        temp_next = temp->next;
-                        func(temp -> key, temp->data, rock);
-                  }
-            }
+      size_t i;
+
+      table->iterating++;
+
+      for (i = 0; i < table->size; i++) {
+          if (CTRL_ISFULL(table->ctrl[i]))
+              func(table->table[i].key, table->table[i].data, rock);
       }
+
+      table->iterating--;
 }
 
 EXPORTED size_t hashu64_count(hashu64_table *table)
 {
-    size_t count = 0;
-    unsigned i;
-
-    for (i = 0; i < table->size; i++) {
-        bucketu64 *temp;
-        for (temp = (table->table)[i]; temp; temp = temp->next)
-             count++;
-    }
-
-    return count;
+    return table->count;
 }
-
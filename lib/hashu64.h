@@ -3,40 +3,40 @@
 #define __CYRUS_HASHU64_H__
 
 #include <stddef.h>           /* For size_t     */
+#include <stdint.h>           /* For uint64_t   */
 
-#define HASHU64_TABLE_INITIALIZER {0, NULL, NULL}
+#define HASHU64_TABLE_INITIALIZER {0, NULL, NULL, NULL, 0, 0, 0}
 
 /*
-** A hash table consists of an array of these buckets.  Each bucket
-** holds a copy of the key, a pointer to the data associated with the
-** key, and a pointer to the next bucket that collided with this one,
-** if there was one.
+** A hash table is an array of these buckets, probed linearly, plus a
+** control byte per bucket; see hash.h.
 */
 
 typedef struct bucketu64 {
     uint64_t key;
     void *data;
-    struct bucketu64 *next;
 } bucketu64;
 
 /*
 ** This is what you actually declare an instance of to create a table.
 ** You then call 'construct_table' with the address of this structure,
-** and a guess at the size of the table.  Note that more nodes than this
-** can be inserted in the table, but performance degrades as this
-** happens.  Performance should still be quite adequate until 2 or 3
-** times as many nodes have been inserted as the table was created with.
+** and a guess at the number of entries.  The table grows as needed, so
+** the guess only saves some rehashing.
 */
 
 typedef struct hashu64_table {
-    size_t size;
-    bucketu64 **table;
-    struct mpool *pool;
+    size_t size;                /* number of buckets, a power of two */
+    bucketu64 *table;
+    struct mpool *pool;         /* unused: the keys are stored inline */
+    unsigned char *ctrl;
+    size_t count;               /* live entries */
+    size_t used;                /* live entries plus tombstones */
+    unsigned iterating;         /* hashu64_enumerate() depth */
 } hashu64_table;
 
 /*
-** This is used to construct the table.  If it doesn't succeed, it sets
-** the table's size to 0, and the pointer to the table to NULL.
+** This is used to construct the table, with room for at least 'size'
+** entries before it first has to grow.
 */
 
 hashu64_table *construct_hashu64_table(hashu64_table *table, size_t size,
@@ -60,10 +60,8 @@ void *hashu64_lookup(uint64_t key,hashu64_table *table);
 /*
 ** Deletes an entry from the table.  Returns a pointer to the data that
 ** was associated with the key so the calling code can dispose of it
-** properly.
+** properly.  It is safe to delete from a hashu64_enumerate() callback.
 */
-/* Warning: use this function judiciously if you are using memory pools,
- * since it will leak memory until you get rid of the entire hash table */
 void *hashu64_del(uint64_t key,hashu64_table *table);
 
 /*
@@ -77,7 +75,7 @@ void hashu64_enumerate(hashu64_table *table,void (*func)(uint64_t ,void *,void *
                     void *rock);
 
 
-/* just count how many items are in the table */
+/* how many items are in the table */
 size_t hashu64_count(hashu64_table *table);
 
 /*
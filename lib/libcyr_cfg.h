@@ -105,6 +105,8 @@ enum cyrus_opt {
     CYRUSOPT_SQL_USESSL,
     /* Checkpoint after every recovery (OFF) */
     CYRUSOPT_SKIPLIST_ALWAYS_CHECKPOINT,
+    /* Read twoskip databases without locking (ON) */
+    CYRUSOPT_TWOSKIP_SNAPSHOT_READS,
 
     CYRUSOPT_LAST
 
@@ -0,0 +1,235 @@
+/* lockstats.c -- lock wait and hold time statistics
+ *
+ * Copyright (c) 1994-2011 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Each process adds up how long it waited for and held each type of
+ * lock, and hands the totals over every LOCKSTATS_REPORT_SEC seconds,
+ * so that timing a lock costs a couple of clock reads and no system
+ * calls.  Only contended locks are counted by name, in a lock table
+ * shared by every process, which keeps the ones waited for longest.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "cyr_lock.h"
+#include "lockstats.h"
+#include "util.h"
+#include "xmalloc.h"
+
+#define LOCKSTATS_REPORT_SEC    10
+
+EXPORTED const double lockstats_buckets[LOCKSTATS_NUMBUCKETS - 1] = {
+    0.0001, 0.001, 0.01, 0.1, 1, 10
+};
+
+static const char *const typenames[LOCKSTATS_NUMTYPES] = {
+    "mailbox", "twoskip", "conversations", "namespace", "mboxname"
+};
+
+static lockstats_report_cb *reporter = NULL;
+static char *contended_tablename = NULL;
+static struct locktable *contended_table = NULL;
+static struct lockstats_counts counts[LOCKSTATS_NUMTYPES];
+static uint64_t last_report = 0;
+
+static uint64_t now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void add_to_buckets(uint64_t *buckets, double seconds)
+{
+    int i;
+
+    for (i = 0; i < LOCKSTATS_NUMBUCKETS - 1; i++)
+        if (seconds <= lockstats_buckets[i]) break;
+    buckets[i]++;
+}
+
+EXPORTED void lockstats_init(lockstats_report_cb *report,
+                             const char *tablename)
+{
+    lockstats_done();
+
+    reporter = report;
+    contended_tablename = xstrdupnull(tablename);
+    last_report = now_usec();
+}
+
+EXPORTED void lockstats_done(void)
+{
+    lockstats_flush();
+
+    reporter = NULL;
+    locktable_close(&contended_table);
+    free(contended_tablename);
+    contended_tablename = NULL;
+}
+
+EXPORTED void lockstats_flush(void)
+{
+    int type;
+
+    last_report = now_usec();
+    if (!reporter) return;
+
+    for (type = 0; type < LOCKSTATS_NUMTYPES; type++) {
+        struct lockstats_counts *c = &counts[type];
+        int i;
+
+        for (i = 0; i < LOCKSTATS_NUMBUCKETS; i++)
+            if (c->wait_buckets[i] || c->hold_buckets[i]) break;
+        if (i == LOCKSTATS_NUMBUCKETS) continue;
+
+        reporter(type, c);
+        memset(c, 0, sizeof(struct lockstats_counts));
+    }
+}
+
+EXPORTED const char *lockstats_typename(enum lockstats_type type)
+{
+    return typenames[type];
+}
+
+static int is_timed(void)
+{
+    return reporter || contended_tablename || debug_locks_longer_than;
+}
+
+EXPORTED void lockstats_requested(struct lockstats_timer *timer)
+{
+    cmdtime_lockstart();
+    timer->requested = is_timed() ? now_usec() : 0;
+    timer->granted = 0;
+}
+
+static void note_contended(enum lockstats_type type, const char *name,
+                           uint64_t wait_usec)
+{
+    char key[1024];
+
+    if (!contended_table &&
+        locktable_open(contended_tablename, &contended_table)) {
+        syslog(LOG_ERR, "IOERROR: opening lock table %s: %m",
+               contended_tablename);
+        /* don't try again */
+        free(contended_tablename);
+        contended_tablename = NULL;
+        return;
+    }
+
+    snprintf(key, sizeof(key), "%s:%s", typenames[type], name);
+    locktable_note_wait(contended_table, key, wait_usec);
+}
+
+EXPORTED void lockstats_granted(struct lockstats_timer *timer,
+                                enum lockstats_type type, const char *name)
+{
+    uint64_t wait_usec;
+    double seconds;
+
+    cmdtime_lockend();
+
+    if (!timer->requested) return;
+
+    timer->granted = now_usec();
+    wait_usec = timer->granted - timer->requested;
+    seconds = wait_usec / 1000000.0;
+
+    add_to_buckets(counts[type].wait_buckets, seconds);
+    counts[type].wait_seconds += seconds;
+
+    if (wait_usec >= LOCKSTATS_CONTENDED_USEC) {
+        counts[type].ncontended++;
+        if (contended_tablename) note_contended(type, name, wait_usec);
+    }
+
+    if (debug_locks_longer_than && seconds > debug_locks_longer_than)
+        syslog(LOG_NOTICE, "locktimer: waited for %s lock %s (%0.3fs)",
+               typenames[type], name, seconds);
+}
+
+EXPORTED void lockstats_released(struct lockstats_timer *timer,
+                                 enum lockstats_type type, const char *name)
+{
+    uint64_t now;
+    double seconds;
+
+    if (!timer->granted) return;
+
+    now = now_usec();
+    seconds = (now - timer->granted) / 1000000.0;
+    timer->requested = timer->granted = 0;
+
+    add_to_buckets(counts[type].hold_buckets, seconds);
+    counts[type].hold_seconds += seconds;
+
+    if (debug_locks_longer_than && seconds > debug_locks_longer_than)
+        syslog(LOG_NOTICE, "locktimer: held %s lock %s (%0.3fs)",
+               typenames[type], name, seconds);
+
+    /* between locks is a good time to hand the counts over */
+    if (reporter && now - last_report >= LOCKSTATS_REPORT_SEC * 1000000)
+        lockstats_flush();
+}
+
+EXPORTED int lockstats_foreach_contended(locktable_foreach_cb *cb, void *rock)
+{
+    if (!contended_tablename) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (!contended_table &&
+        locktable_open(contended_tablename, &contended_table))
+        return -1;
+
+    return locktable_foreach(contended_table, cb, rock);
+}
@@ -0,0 +1,106 @@
+/* lockstats.h -- lock wait and hold time statistics
+ *
+ * Copyright (c) 1994-2011 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _LOCKSTATS_H
+#define _LOCKSTATS_H
+
+#include <stdint.h>
+
+#include "locktable.h"
+
+/* the locks which are timed */
+enum lockstats_type {
+    LOCKSTATS_MAILBOX = 0,      /* mailbox index */
+    LOCKSTATS_TWOSKIP,          /* twoskip database write lock */
+    LOCKSTATS_CONVERSATIONS,    /* conversations database */
+    LOCKSTATS_NAMESPACE,        /* user namespace */
+    LOCKSTATS_MBOXNAME,         /* any other mailbox name lock */
+};
+#define LOCKSTATS_NUMTYPES (LOCKSTATS_MBOXNAME + 1)
+
+/* histogram buckets: upper bounds in seconds, then everything longer.
+ * These must match the buckets in imap/promdata.p */
+#define LOCKSTATS_NUMBUCKETS 7
+extern const double lockstats_buckets[LOCKSTATS_NUMBUCKETS - 1];
+
+/* a wait at least this long counts as contended */
+#define LOCKSTATS_CONTENDED_USEC 1000
+
+struct lockstats_counts {
+    uint64_t ncontended;
+    double wait_seconds;
+    double hold_seconds;
+    uint64_t wait_buckets[LOCKSTATS_NUMBUCKETS];   /* not cumulative */
+    uint64_t hold_buckets[LOCKSTATS_NUMBUCKETS];
+};
+
+/* one lock, from being asked for until it is released */
+struct lockstats_timer {
+    uint64_t requested;         /* usec, monotonic; 0 if not timed */
+    uint64_t granted;           /* 0 unless held */
+};
+
+/* called with what was counted for 'type' since the last report */
+typedef void lockstats_report_cb(enum lockstats_type type,
+                                 const struct lockstats_counts *counts);
+
+/* Start timing locks.  Counts are passed to 'report' every so often
+ * and by lockstats_flush(); contended names are counted in the shared
+ * lock table 'tablename', if given.  Slow locks are logged if
+ * debug_locks_longer_than is set, whether or not this is called. */
+extern void lockstats_init(lockstats_report_cb *report, const char *tablename);
+extern void lockstats_done(void);
+extern void lockstats_flush(void);
+
+extern const char *lockstats_typename(enum lockstats_type type);
+
+/* waits are also added to the command timer's lock time */
+extern void lockstats_requested(struct lockstats_timer *timer);
+extern void lockstats_granted(struct lockstats_timer *timer,
+                              enum lockstats_type type, const char *name);
+extern void lockstats_released(struct lockstats_timer *timer,
+                               enum lockstats_type type, const char *name);
+
+/* the contended names, as "type:name" */
+extern int lockstats_foreach_contended(locktable_foreach_cb *cb, void *rock);
+
+#endif /* _LOCKSTATS_H */
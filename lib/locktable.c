@@ -0,0 +1,689 @@
+/* locktable.c -- named read/write locks in shared memory
+ *
+ * Copyright (c) 1994-2011 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* A fixed size hash table of lock entries, keyed by name, in a POSIX
+ * shared memory object that every process maps.  One robust
+ * process-shared mutex protects the whole table; it is only ever held
+ * for a few comparisons, never while waiting.
+ *
+ * Waiters don't sleep on a process-shared condition variable: it
+ * keeps state about its waiters which nothing cleans up if one is
+ * killed, and with glibc that can leave the next broadcast blocked for
+ * good with the table locked.  On Linux they sleep on a futex on their
+ * entry's wakeup counter instead, which keeps nothing in the table;
+ * elsewhere they poll, backing off to a few milliseconds between looks.
+ *
+ * Holders and waiters are recorded by pid, so that what a process
+ * which died held or was waiting for can be taken back: waiters check
+ * every second, and a lock looking for a slot checks the busy ones.
+ * Shared memory doesn't outlive a reboot, so neither does a table
+ * with a stale mutex in it.
+ *
+ * Entries are kept after they're unlocked, with their statistics,
+ * until the slot is needed for another name.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sysexits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_ROBUST_MUTEX
+#include <pthread.h>
+#endif
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "locktable.h"
+#include "strhash.h"
+#include "util.h"
+#include "xmalloc.h"
+#include "xstrlcpy.h"
+
+#ifdef HAVE_ROBUST_MUTEX
+
+#define LT_MAGIC        0x4c4f434b      /* "LOCK" */
+#define LT_VERSION      2
+#define LT_NSLOTS       8192
+#define LT_WINDOW       64      /* a name lives this close to its hash */
+#define LT_MAXHOLDERS   32
+#define LT_MAXWAITERS   32      /* more wait, but aren't counted */
+#define LT_NAMELEN      512
+#define LT_WAKEUP_SEC   1       /* how often waiters look for the dead */
+#define LT_POLL_MIN_USEC 20     /* without futexes, waiters look this */
+#define LT_POLL_MAX_USEC 10000  /* often at first, backing off to this */
+
+struct lt_slot {
+    uint32_t used;              /* ever used: lookups stop at unused */
+    uint32_t hash;
+    uint32_t exclusive;
+    uint32_t nholders;
+    uint32_t nwaiters;
+    uint32_t nxwaiters;
+    uint32_t wakeups;           /* bumped when waiters should look again */
+    pid_t holders[LT_MAXHOLDERS];
+    pid_t waiters[LT_MAXWAITERS];
+    pid_t xwaiters[LT_MAXWAITERS];      /* exclusive waiters go first */
+    uint64_t nlocks;
+    uint64_t nwaits;
+    uint64_t wait_usec;
+    uint64_t max_wait_usec;
+    char name[LT_NAMELEN];
+};
+
+struct lt_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t slotsize;
+    pthread_mutex_t mutex;
+    uint64_t recovered;
+};
+
+#define LT_HEADER_SIZE  ((sizeof(struct lt_header) + 63) & ~(size_t) 63)
+#define LT_SIZE         (LT_HEADER_SIZE + LT_NSLOTS * sizeof(struct lt_slot))
+
+struct locktable {
+    char *name;
+    struct lt_header *header;
+    struct lt_slot *slots;
+};
+
+static uint64_t lt_now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void lt_init(struct lt_header *header)
+{
+    pthread_mutexattr_t mattr;
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    header->version = LT_VERSION;
+    header->nslots = LT_NSLOTS;
+    header->slotsize = sizeof(struct lt_slot);
+    __sync_synchronize();
+    header->magic = LT_MAGIC;
+}
+
+static int lt_isvalid(const struct lt_header *header)
+{
+    return header->magic == LT_MAGIC &&
+           header->version == LT_VERSION &&
+           header->nslots == LT_NSLOTS &&
+           header->slotsize == sizeof(struct lt_slot);
+}
+
+EXPORTED int locktable_open(const char *name, struct locktable **tablep)
+{
+    struct lt_header *header = NULL;
+    struct locktable *table;
+    int tries, fd, e;
+    int creator = 0;
+
+    for (tries = 0; tries < 2; tries++) {
+        struct stat sbuf;
+        int i;
+
+        creator = 1;
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd == -1 && errno == EEXIST) {
+            creator = 0;
+            fd = shm_open(name, O_RDWR, 0600);
+        }
+        if (fd == -1) return -1;
+
+        if (creator && ftruncate(fd, LT_SIZE) == -1) goto fail;
+
+        /* the name is easy to guess, so anyone could have created it
+         * first: only use a table which only we can write to */
+        if (fstat(fd, &sbuf) == -1) goto fail;
+        if (sbuf.st_uid != geteuid() ||
+            (sbuf.st_mode & (S_IWGRP | S_IWOTH))) {
+            syslog(LOG_ERR, "locktable %s: owned by uid %d with mode %o, "
+                   "refusing to use it", name, (int) sbuf.st_uid,
+                   (unsigned) (sbuf.st_mode & 07777));
+            close(fd);
+            errno = EPERM;
+            return -1;
+        }
+
+        /* if someone else is creating it, give them a moment */
+        for (i = 0; i < 50 && sbuf.st_size != (off_t) LT_SIZE; i++) {
+            poll(NULL, 0, 100);
+            if (fstat(fd, &sbuf) == -1) goto fail;
+        }
+        if (sbuf.st_size != (off_t) LT_SIZE) {
+            /* mapping it would fault on the pages past the end */
+            syslog(LOG_WARNING, "locktable %s: wrong size, recreating", name);
+            close(fd);
+            fd = -1;
+            shm_unlink(name);
+            continue;
+        }
+
+        header = mmap(NULL, LT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+        if (header == MAP_FAILED) goto fail;
+        close(fd);
+        fd = -1;
+
+        if (creator) lt_init(header);
+
+        for (i = 0; i < 50 && !lt_isvalid(header); i++)
+            poll(NULL, 0, 100);
+        if (lt_isvalid(header)) break;
+
+        /* a creator that died half way, or a table from another version */
+        syslog(LOG_WARNING, "locktable %s: invalid table, recreating", name);
+        munmap(header, LT_SIZE);
+        header = NULL;
+        shm_unlink(name);
+    }
+
+    if (!header) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    table = xzmalloc(sizeof(struct locktable));
+    table->name = xstrdup(name);
+    table->header = header;
+    table->slots = (struct lt_slot *) ((char *) header + LT_HEADER_SIZE);
+    *tablep = table;
+
+    return 0;
+
+ fail:
+    e = errno;
+    if (fd != -1) close(fd);
+    /* don't leave a table behind that nobody will ever initialise */
+    if (creator) shm_unlink(name);
+    errno = e;
+    return -1;
+}
+
+EXPORTED void locktable_close(struct locktable **tablep)
+{
+    struct locktable *table = *tablep;
+
+    if (!table) return;
+
+    munmap(table->header, LT_SIZE);
+    free(table->name);
+    free(table);
+    *tablep = NULL;
+}
+
+static void lt_lock(struct locktable *table)
+{
+    int r = pthread_mutex_lock(&table->header->mutex);
+
+    if (r == EOWNERDEAD) {
+        syslog(LOG_WARNING, "locktable %s: recovering from dead owner",
+               table->name);
+        pthread_mutex_consistent(&table->header->mutex);
+    }
+    else if (r) {
+        syslog(LOG_ERR, "locktable %s: can't lock table: %s",
+               table->name, strerror(r));
+        fatal("locktable: can't lock table", EX_SOFTWARE);
+    }
+}
+
+static void lt_unlock(struct locktable *table)
+{
+    pthread_mutex_unlock(&table->header->mutex);
+}
+
+/* sleep until the slot's wakeup counter moves on from 'seen', or
+ * for a while */
+static void lt_sleep(struct lt_slot *slot __attribute__((unused)),
+                     uint32_t seen __attribute__((unused)),
+                     useconds_t *delayp __attribute__((unused)))
+{
+#if defined(__linux__)
+    struct timespec timeout = { LT_WAKEUP_SEC, 0 };
+
+    syscall(SYS_futex, &slot->wakeups, FUTEX_WAIT, seen, &timeout, NULL, 0);
+#else
+    usleep(*delayp);
+    if (*delayp < LT_POLL_MAX_USEC) *delayp *= 2;
+#endif
+}
+
+static void lt_wake(struct lt_slot *slot)
+{
+    if (!slot->nwaiters) return;
+
+    slot->wakeups++;
+#if defined(__linux__)
+    syscall(SYS_futex, &slot->wakeups, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+static int lt_find_pid(const pid_t *pids, uint32_t npids, pid_t pid)
+{
+    uint32_t i;
+
+    for (i = 0; i < npids; i++) {
+        if (pids[i] == pid) return 1;
+    }
+
+    return 0;
+}
+
+static void lt_add_pid(pid_t *pids, uint32_t *npids, uint32_t max, pid_t pid)
+{
+    if (*npids < max && !lt_find_pid(pids, *npids, pid))
+        pids[(*npids)++] = pid;
+}
+
+static int lt_remove_pid(pid_t *pids, uint32_t *npids, pid_t pid)
+{
+    uint32_t i;
+
+    for (i = 0; i < *npids; i++) {
+        if (pids[i] == pid) {
+            pids[i] = pids[--*npids];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int lt_reap_waiters(pid_t *pids, uint32_t *npids)
+{
+    uint32_t i = 0;
+    int reaped = 0;
+
+    while (i < *npids) {
+        if (kill(pids[i], 0) == -1 && errno == ESRCH) {
+            pids[i] = pids[--*npids];
+            reaped++;
+        }
+        else i++;
+    }
+
+    return reaped;
+}
+
+/* take back whatever dead processes held or were waiting for */
+static int lt_reap(struct locktable *table, struct lt_slot *slot)
+{
+    uint32_t i = 0;
+    int reaped = 0;
+
+    while (i < slot->nholders) {
+        pid_t pid = slot->holders[i];
+
+        if (kill(pid, 0) == -1 && errno == ESRCH) {
+            syslog(LOG_WARNING, "locktable %s: taking back %s from "
+                   "dead process %d", table->name, slot->name, (int) pid);
+            slot->holders[i] = slot->holders[--slot->nholders];
+            table->header->recovered++;
+            reaped++;
+        }
+        else i++;
+    }
+    if (!slot->nholders) slot->exclusive = 0;
+
+    reaped += lt_reap_waiters(slot->waiters, &slot->nwaiters);
+    reaped += lt_reap_waiters(slot->xwaiters, &slot->nxwaiters);
+    if (reaped) lt_wake(slot);
+
+    return reaped;
+}
+
+/* find the slot for 'name', or with 'claim', take over an unused one
+ * for it, or failing that the idle one with the least time waited for */
+static struct lt_slot *lt_find(struct locktable *table, const char *name,
+                               uint32_t hash, int claim)
+{
+    struct lt_slot *idle = NULL;
+    unsigned i;
+
+    for (i = 0; i < LT_WINDOW; i++) {
+        struct lt_slot *slot = &table->slots[(hash + i) % LT_NSLOTS];
+
+        if (!slot->used) {
+            idle = slot;
+            break;
+        }
+        if (slot->hash == hash && !strcmp(slot->name, name))
+            return slot;
+        if (!slot->nholders && !slot->nwaiters &&
+            (!idle || slot->wait_usec < idle->wait_usec))
+            idle = slot;
+    }
+
+    if (claim && !idle) {
+        /* every slot is busy: perhaps only with the dead */
+        for (i = 0; i < LT_WINDOW; i++) {
+            struct lt_slot *slot = &table->slots[(hash + i) % LT_NSLOTS];
+
+            lt_reap(table, slot);
+            if (!slot->nholders && !slot->nwaiters &&
+                (!idle || slot->wait_usec < idle->wait_usec))
+                idle = slot;
+        }
+    }
+
+    if (!claim || !idle) return NULL;
+
+    idle->used = 1;
+    idle->hash = hash;
+    idle->exclusive = 0;
+    idle->nwaiters = idle->nxwaiters = 0;
+    idle->nlocks = idle->nwaits = 0;
+    idle->wait_usec = idle->max_wait_usec = 0;
+    strlcpy(idle->name, name, sizeof(idle->name));
+
+    return idle;
+}
+
+static int lt_grantable(const struct lt_slot *slot, int exclusive)
+{
+    if (exclusive) return !slot->nholders;
+
+    /* readers queue behind waiting writers, so as not to starve them */
+    return !slot->exclusive && !slot->nxwaiters &&
+           slot->nholders < LT_MAXHOLDERS;
+}
+
+EXPORTED int locktable_lock(struct locktable *table, const char *name,
+                            int exclusive, int nonblock,
+                            uint64_t *wait_usecp)
+{
+    uint32_t hash = strhash(name);
+    pid_t pid = getpid();
+    struct lt_slot *slot;
+    uint64_t start = 0, lastreap = 0, waited = 0;
+    useconds_t delay = LT_POLL_MIN_USEC;
+    uint32_t seen;
+    int warned = 0;
+
+    if (strlen(name) >= LT_NAMELEN) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    lt_lock(table);
+
+    for (;;) {
+        slot = lt_find(table, name, hash, /*claim*/1);
+        if (!slot) {
+            /* every slot near this name is busy: wait for one to free */
+            lt_unlock(table);
+            if (!warned++)
+                syslog(LOG_WARNING, "locktable %s: no free slot for %s",
+                       table->name, name);
+            poll(NULL, 0, 10);
+            lt_lock(table);
+            continue;
+        }
+
+        if (lt_grantable(slot, exclusive)) break;
+
+        if (nonblock) {
+            if (lt_reap(table, slot)) continue;
+            lt_unlock(table);
+            errno = EWOULDBLOCK;
+            return -1;
+        }
+
+        if (!start) start = lastreap = lt_now_usec();
+        else if (lt_now_usec() - lastreap >= LT_WAKEUP_SEC * 1000000) {
+            lastreap = lt_now_usec();
+            if (lt_reap(table, slot)) continue;
+        }
+
+        /* while we're counted as waiting, the slot isn't given away */
+        lt_add_pid(slot->waiters, &slot->nwaiters, LT_MAXWAITERS, pid);
+        if (exclusive)
+            lt_add_pid(slot->xwaiters, &slot->nxwaiters, LT_MAXWAITERS, pid);
+
+        seen = slot->wakeups;
+        lt_unlock(table);
+        lt_sleep(slot, seen, &delay);
+        lt_lock(table);
+    }
+
+    lt_remove_pid(slot->waiters, &slot->nwaiters, pid);
+    lt_remove_pid(slot->xwaiters, &slot->nxwaiters, pid);
+
+    slot->holders[slot->nholders++] = pid;
+    slot->exclusive = exclusive;
+    slot->nlocks++;
+    if (start) {
+        waited = lt_now_usec() - start;
+        slot->nwaits++;
+        slot->wait_usec += waited;
+        if (waited > slot->max_wait_usec) slot->max_wait_usec = waited;
+    }
+
+    lt_unlock(table);
+
+    if (wait_usecp) *wait_usecp = waited;
+
+    return 0;
+}
+
+EXPORTED int locktable_unlock(struct locktable *table, const char *name)
+{
+    struct lt_slot *slot;
+    int found;
+
+    lt_lock(table);
+
+    slot = lt_find(table, name, strhash(name), /*claim*/0);
+    if (!slot) {
+        lt_unlock(table);
+        errno = ENOENT;
+        return -1;
+    }
+
+    found = lt_remove_pid(slot->holders, &slot->nholders, getpid());
+    if (!slot->nholders) slot->exclusive = 0;
+    lt_wake(slot);
+
+    lt_unlock(table);
+
+    if (!found) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    return 0;
+}
+
+EXPORTED int locktable_note_wait(struct locktable *table, const char *name,
+                                 uint64_t wait_usec)
+{
+    struct lt_slot *slot;
+
+    if (strlen(name) >= LT_NAMELEN) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    lt_lock(table);
+
+    slot = lt_find(table, name, strhash(name), /*claim*/1);
+    if (!slot) {
+        lt_unlock(table);
+        errno = ENOSPC;
+        return -1;
+    }
+
+    slot->nlocks++;
+    slot->nwaits++;
+    slot->wait_usec += wait_usec;
+    if (wait_usec > slot->max_wait_usec) slot->max_wait_usec = wait_usec;
+
+    lt_unlock(table);
+
+    return 0;
+}
+
+EXPORTED uint64_t locktable_recovered(struct locktable *table)
+{
+    return table->header->recovered;
+}
+
+EXPORTED int locktable_foreach(struct locktable *table,
+                               locktable_foreach_cb *cb, void *rock)
+{
+    struct locktable_info *infos;
+    char *names;
+    unsigned i, n = 0;
+    int r = 0;
+
+    /* copy out, so the callback runs without the table locked */
+    infos = xmalloc(LT_NSLOTS * sizeof(struct locktable_info));
+    names = xmalloc(LT_NSLOTS * LT_NAMELEN);
+
+    lt_lock(table);
+    for (i = 0; i < LT_NSLOTS; i++) {
+        const struct lt_slot *slot = &table->slots[i];
+        struct locktable_info *info = &infos[n];
+
+        if (!slot->used) continue;
+
+        memcpy(names + n * LT_NAMELEN, slot->name, LT_NAMELEN);
+        info->name = names + n * LT_NAMELEN;
+        info->exclusive = slot->exclusive;
+        info->nholders = slot->nholders;
+        info->nwaiters = slot->nwaiters;
+        info->nlocks = slot->nlocks;
+        info->nwaits = slot->nwaits;
+        info->wait_usec = slot->wait_usec;
+        info->max_wait_usec = slot->max_wait_usec;
+        n++;
+    }
+    lt_unlock(table);
+
+    for (i = 0; !r && i < n; i++)
+        r = cb(&infos[i], rock);
+
+    free(names);
+    free(infos);
+
+    return r;
+}
+
+#else /* !HAVE_ROBUST_MUTEX */
+
+EXPORTED int locktable_open(const char *name __attribute__((unused)),
+                            struct locktable **tablep __attribute__((unused)))
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+EXPORTED void locktable_close(struct locktable **tablep)
+{
+    *tablep = NULL;
+}
+
+EXPORTED int locktable_lock(struct locktable *table __attribute__((unused)),
+                            const char *name __attribute__((unused)),
+                            int exclusive __attribute__((unused)),
+                            int nonblock __attribute__((unused)),
+                            uint64_t *wait_usecp __attribute__((unused)))
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+EXPORTED int locktable_unlock(struct locktable *table __attribute__((unused)),
+                              const char *name __attribute__((unused)))
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+EXPORTED int locktable_note_wait(struct locktable *table __attribute__((unused)),
+                                 const char *name __attribute__((unused)),
+                                 uint64_t wait_usec __attribute__((unused)))
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+EXPORTED uint64_t locktable_recovered(struct locktable *table __attribute__((unused)))
+{
+    return 0;
+}
+
+EXPORTED int locktable_foreach(struct locktable *table __attribute__((unused)),
+                               locktable_foreach_cb *cb __attribute__((unused)),
+                               void *rock __attribute__((unused)))
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* HAVE_ROBUST_MUTEX */
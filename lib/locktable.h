@@ -0,0 +1,93 @@
+/* locktable.h -- named read/write locks in shared memory
+ *
+ * Copyright (c) 1994-2011 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _LOCKTABLE_H
+#define _LOCKTABLE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct locktable;
+
+/* what locktable_foreach() reports for each name in the table */
+struct locktable_info {
+    const char *name;
+    int exclusive;              /* held exclusively, else shared */
+    unsigned nholders;
+    unsigned nwaiters;
+    uint64_t nlocks;            /* times granted */
+    uint64_t nwaits;            /* of which had to wait */
+    uint64_t wait_usec;         /* total time spent waiting */
+    uint64_t max_wait_usec;
+};
+
+typedef int locktable_foreach_cb(const struct locktable_info *info,
+                                 void *rock);
+
+/* open (creating if need be) the table called 'name', a POSIX shared
+ * memory object.  Returns 0, or -1 with errno set */
+extern int locktable_open(const char *name, struct locktable **tablep);
+extern void locktable_close(struct locktable **tablep);
+
+/* Lock 'name' exclusively or shared.  Normally blocks until the lock
+ * is granted; with 'nonblock' fails with errno=EWOULDBLOCK instead.
+ * Locks held by processes which have died are taken back.  If
+ * 'wait_usecp' is given, it is set to how long the call waited.
+ * Returns 0, or -1 with errno set */
+extern int locktable_lock(struct locktable *table, const char *name,
+                          int exclusive, int nonblock,
+                          uint64_t *wait_usecp);
+extern int locktable_unlock(struct locktable *table, const char *name);
+
+/* count a wait of 'wait_usec' for 'name' without locking it, for
+ * tables which only keep statistics about locks taken some other way */
+extern int locktable_note_wait(struct locktable *table, const char *name,
+                               uint64_t wait_usec);
+
+/* number of locks taken back from dead processes */
+extern uint64_t locktable_recovered(struct locktable *table);
+
+/* call 'cb' for every name in the table (held or recently used) */
+extern int locktable_foreach(struct locktable *table,
+                             locktable_foreach_cb *cb, void *rock);
+
+#endif /* _LOCKTABLE_H */
@@ -226,6 +226,46 @@ EXPORTED int mappedfile_readlock(struct mappedfile *mf)
     return 0;
 }
 
+/* map the file as it is now without taking a lock, reopening it first if
+ * it has been replaced.  Only for readers who can tell for themselves
+ * whether a writer got in the way */
+EXPORTED int mappedfile_snapshot(struct mappedfile *mf)
+{
+    struct stat sbuf, sbuffile;
+    int newfd = -1;
+
+    assert(mf->lock_status == MF_UNLOCKED);
+    assert(mf->fd != -1);
+    assert(!mf->dirty);
+
+    for (;;) {
+        if (fstat(mf->fd, &sbuf) == -1) {
+            syslog(LOG_ERR, "IOERROR: fstat %s: %m", mf->fname);
+            return -EIO;
+        }
+
+        if (stat(mf->fname, &sbuffile) == -1) {
+            syslog(LOG_ERR, "IOERROR: stat %s: %m", mf->fname);
+            return -EIO;
+        }
+        if (sbuf.st_ino == sbuffile.st_ino) break;
+        buf_free(&mf->map_buf);
+
+        newfd = open(mf->fname, mf->is_rw ? O_RDWR : O_RDONLY, 0644);
+        if (newfd == -1) {
+            syslog(LOG_ERR, "IOERROR: open %s: %m", mf->fname);
+            return -EIO;
+        }
+
+        dup2(newfd, mf->fd);
+        close(newfd);
+    }
+
+    _ensure_mapped(mf, sbuf.st_size, /*update*/0);
+
+    return 0;
+}
+
 EXPORTED int mappedfile_writelock(struct mappedfile *mf)
 {
     int r;
@@ -312,6 +352,29 @@ EXPORTED int mappedfile_commit(struct mappedfile *mf)
     return 0;
 }
 
+/* read straight from the file rather than the map, which may be a copy */
+EXPORTED ssize_t mappedfile_pread(struct mappedfile *mf,
+                                  void *base, size_t len,
+                                  off_t offset)
+{
+    ssize_t n;
+
+    assert(mf->fd != -1);
+    assert(base);
+
+    do {
+        n = pread(mf->fd, base, len, offset);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        syslog(LOG_ERR, "IOERROR: %s read %llu bytes at %llX: %m",
+               mf->fname, (long long unsigned int)len,
+               (long long unsigned int)offset);
+    }
+
+    return n;
+}
+
 EXPORTED ssize_t mappedfile_pwrite(struct mappedfile *mf,
                                    const void *base, size_t len,
                                    off_t offset)
@@ -79,10 +79,14 @@ extern int mappedfile_open(struct mappedfile **mfp,
 extern int mappedfile_close(struct mappedfile **mfp);
 
 extern int mappedfile_readlock(struct mappedfile *mf);
+extern int mappedfile_snapshot(struct mappedfile *mf);
 extern int mappedfile_writelock(struct mappedfile *mf);
 extern int mappedfile_unlock(struct mappedfile *mf);
 
 extern int mappedfile_commit(struct mappedfile *mf);
+extern ssize_t mappedfile_pread(struct mappedfile *mf,
+                                void *base, size_t len,
+                                off_t offset);
 extern ssize_t mappedfile_pwrite(struct mappedfile *mf,
                                  const void *base, size_t len,
                                  off_t offset);
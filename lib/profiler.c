@@ -0,0 +1,402 @@
+/* profiler.c -- sampling profiler for Cyrus processes
+ *
+ * Copyright (c) 1994-2011 Carnegie Mellon University.  All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name "Carnegie Mellon University" must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission. For permission or any legal
+ *    details, please contact
+ *      Carnegie Mellon University
+ *      Center for Technology Transfer and Enterprise Creation
+ *      4615 Forbes Avenue
+ *      Suite 302
+ *      Pittsburgh, PA  15213
+ *      (412) 268-7393, fax: (412) 268-7395
+ *      innovation@andrew.cmu.edu
+ *
+ * 4. Redistributions of any form whatsoever must retain the following
+ *    acknowledgment:
+ *    "This product includes software developed by Computing Services
+ *     at Carnegie Mellon University (http://www.cmu.edu/computing/)."
+ *
+ * CARNEGIE MELLON UNIVERSITY DISCLAIMS ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL CARNEGIE MELLON UNIVERSITY BE LIABLE
+ * FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* While profiling, SIGPROF arrives 'hz' times per second of CPU time
+ * used, and the handler records the stack it interrupted in a table
+ * allocated up front, so that taking a sample needs no locks and no
+ * malloc.  The table is written out as folded stacks ("root;...;leaf
+ * count", one per line) when profiling stops, for flamegraph.pl or
+ * tools/mergeprofiles.  Frames without a dynamic symbol are written as
+ * "file+0xoffset" so that they can be resolved later with addr2line.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+#ifdef HAVE_DLADDR
+#include <dlfcn.h>
+#endif
+#ifdef HAVE_LINK_H
+#include <link.h>
+#endif
+
+#include "profiler.h"
+#include "util.h"
+#include "xmalloc.h"
+
+#define PROFILER_MAXDEPTH       64
+#define PROFILER_NSTACKS        2048    /* a power of two */
+
+/* the frames of the handler and the signal trampoline */
+#define PROFILER_SKIP           2
+
+struct stack {
+    unsigned long count;
+    unsigned depth;
+    void *pc[PROFILER_MAXDEPTH];    /* leaf first */
+};
+
+static struct stack *stacks = NULL;
+static volatile unsigned long nstacks = 0;
+static volatile unsigned long dropped = 0;
+static volatile sig_atomic_t sampling = 0;
+static volatile sig_atomic_t toggle = 0;
+
+static char *profiler_dir = NULL;
+static char *profiler_ident = NULL;
+static int profiler_hz;
+static struct timeval interval;
+static pid_t profiler_pid = 0;
+
+#if defined(HAVE_DLADDR) && defined(HAVE_LINK_H)
+/* dladdr() names the main program after argv[0], which master sets to
+ * the service name, so remember the real path and where it's loaded */
+static char *profiler_exe = NULL;
+static uintptr_t profiler_exe_base = 0;
+
+static int find_exe_base(struct dl_phdr_info *info,
+                         size_t size __attribute__((unused)),
+                         void *rock __attribute__((unused)))
+{
+    uintptr_t pagemask = ~((uintptr_t) sysconf(_SC_PAGESIZE) - 1);
+    int i;
+
+    /* the main program comes first: its lowest mapping is what
+     * dladdr() gives as dli_fbase */
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        uintptr_t start;
+
+        if (info->dlpi_phdr[i].p_type != PT_LOAD) continue;
+
+        start = info->dlpi_addr + (info->dlpi_phdr[i].p_vaddr & pagemask);
+        if (!profiler_exe_base || start < profiler_exe_base)
+            profiler_exe_base = start;
+    }
+
+    return 1;
+}
+
+static void find_exe(void)
+{
+    char path[PATH_MAX];
+    ssize_t len;
+
+    len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (len <= 0) return;
+    path[len] = '\0';
+
+    profiler_exe_base = 0;
+    dl_iterate_phdr(find_exe_base, NULL);
+    if (profiler_exe_base) profiler_exe = xstrdup(path);
+}
+#endif
+
+#ifdef HAVE_BACKTRACE
+static void sample(int sig __attribute__((unused)),
+                   siginfo_t *si __attribute__((unused)),
+                   void *ucontext __attribute__((unused)))
+{
+    void *pc[PROFILER_SKIP + PROFILER_MAXDEPTH];
+    int saved_errno = errno;
+    uint32_t hash = 2166136261U;
+    unsigned depth, i, slot;
+    int n;
+
+    if (!sampling) return;
+
+    n = backtrace(pc, PROFILER_SKIP + PROFILER_MAXDEPTH) - PROFILER_SKIP;
+    if (n <= 0) goto done;
+    depth = n;
+
+    for (i = 0; i < depth; i++) {
+        hash = (hash ^ (uint32_t) (uintptr_t) pc[PROFILER_SKIP + i]) * 16777619U;
+    }
+
+    /* open addressing, and give up rather than fill the last slots */
+    for (i = 0; i < PROFILER_NSTACKS / 8; i++) {
+        struct stack *s;
+
+        slot = (hash + i) & (PROFILER_NSTACKS - 1);
+        s = &stacks[slot];
+
+        if (!s->count) {
+            s->depth = depth;
+            memcpy(s->pc, pc + PROFILER_SKIP, depth * sizeof(void *));
+            s->count = 1;
+            nstacks++;
+            goto done;
+        }
+        if (s->depth == depth &&
+            !memcmp(s->pc, pc + PROFILER_SKIP, depth * sizeof(void *))) {
+            s->count++;
+            goto done;
+        }
+    }
+    dropped++;
+
+ done:
+    errno = saved_errno;
+}
+#endif /* HAVE_BACKTRACE */
+
+static void sigusr1(int sig __attribute__((unused)))
+{
+    toggle = 1;
+}
+
+static void print_frame(FILE *f, void *pc, int leaf)
+{
+    /* a return address may be the first byte of the next function */
+    uintptr_t addr = (uintptr_t) pc - (leaf ? 0 : 1);
+
+#ifdef HAVE_DLADDR
+    Dl_info info;
+
+    if (dladdr((void *) addr, &info) && info.dli_fname) {
+        uintptr_t base = (uintptr_t) info.dli_fbase;
+        const char *fname = info.dli_fname;
+
+        if (info.dli_sname) {
+            fputs(info.dli_sname, f);
+            return;
+        }
+
+#ifdef HAVE_LINK_H
+        if (profiler_exe && base == profiler_exe_base)
+            fname = profiler_exe;
+
+        /* a non-PIE executable is already at its link-time address */
+        if (((ElfW(Ehdr) *) info.dli_fbase)->e_type == ET_EXEC)
+            base = 0;
+#endif
+        fprintf(f, "%s+0x%lx", fname, (unsigned long) (addr - base));
+        return;
+    }
+#endif
+
+    fprintf(f, "0x%lx", (unsigned long) addr);
+}
+
+static void write_stacks(void)
+{
+    struct buf fname = BUF_INITIALIZER;
+    FILE *f;
+    unsigned i, j;
+
+    if (!nstacks && !dropped) return;
+
+    /* a child doesn't get the timer, only the parent's samples */
+    if (getpid() != profiler_pid) goto reset;
+
+    buf_printf(&fname, "%s/%s.%d.folded",
+               profiler_dir, profiler_ident, (int) profiler_pid);
+    f = fopen(buf_cstring(&fname), "a");
+    if (!f) {
+        syslog(LOG_ERR, "IOERROR: opening %s: %m", buf_cstring(&fname));
+        goto reset;
+    }
+
+    for (i = 0; i < PROFILER_NSTACKS; i++) {
+        struct stack *s = &stacks[i];
+
+        if (!s->count) continue;
+
+        for (j = s->depth; j > 0; j--) {
+            print_frame(f, s->pc[j-1], j == 1);
+            if (j > 1) putc(';', f);
+        }
+        fprintf(f, " %lu\n", s->count);
+    }
+    if (dropped) fprintf(f, "[dropped] %lu\n", dropped);
+
+    if (fclose(f) == EOF)
+        syslog(LOG_ERR, "IOERROR: writing %s: %m", buf_cstring(&fname));
+
+ reset:
+    memset(stacks, 0, PROFILER_NSTACKS * sizeof(struct stack));
+    nstacks = 0;
+    dropped = 0;
+    buf_free(&fname);
+}
+
+static void set_timer(int on)
+{
+    struct itimerval it;
+
+    memset(&it, 0, sizeof(it));
+    if (on) {
+        it.it_interval = interval;
+        it.it_value = interval;
+    }
+    setitimer(ITIMER_PROF, &it, NULL);
+}
+
+EXPORTED int profiler_init(const char *dir, const char *ident,
+                           int hz, int start)
+{
+#ifdef HAVE_BACKTRACE
+    struct sigaction action;
+    void *pc[1];
+
+    if (stacks) return 0;
+
+    if (hz < 1) hz = 1;
+    if (hz > 1000) hz = 1000;
+    profiler_hz = hz;
+    interval.tv_sec = hz == 1;
+    interval.tv_usec = hz == 1 ? 0 : 1000000 / hz;
+
+    /* the first call may load the unwinder, which isn't safe in a
+     * signal handler */
+    backtrace(pc, 1);
+
+    profiler_dir = xstrdup(dir);
+    profiler_ident = xstrdup(ident);
+    profiler_pid = getpid();
+    stacks = xzmalloc(PROFILER_NSTACKS * sizeof(struct stack));
+#if defined(HAVE_DLADDR) && defined(HAVE_LINK_H)
+    find_exe();
+#endif
+
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    action.sa_sigaction = sample;
+    if (sigaction(SIGPROF, &action, NULL) < 0) {
+        syslog(LOG_ERR, "profiler: unable to install handler for SIGPROF: %m");
+        profiler_done();
+        return -1;
+    }
+
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = sigusr1;
+    if (sigaction(SIGUSR1, &action, NULL) < 0) {
+        syslog(LOG_ERR, "profiler: unable to install handler for SIGUSR1: %m");
+    }
+
+    if (start) profiler_start();
+
+    return 0;
+#else
+    (void) dir;
+    (void) ident;
+    (void) hz;
+    (void) start;
+
+    syslog(LOG_ERR, "profiler: not supported on this platform");
+    return -1;
+#endif
+}
+
+EXPORTED void profiler_done(void)
+{
+    if (!stacks) return;
+
+    profiler_stop();
+    signal(SIGPROF, SIG_DFL);
+
+    free(stacks);
+    stacks = NULL;
+    free(profiler_dir);
+    profiler_dir = NULL;
+    free(profiler_ident);
+    profiler_ident = NULL;
+#if defined(HAVE_DLADDR) && defined(HAVE_LINK_H)
+    free(profiler_exe);
+    profiler_exe = NULL;
+#endif
+}
+
+EXPORTED void profiler_start(void)
+{
+    if (!stacks || sampling) return;
+
+    profiler_pid = getpid();
+    sampling = 1;
+    set_timer(1);
+}
+
+EXPORTED void profiler_stop(void)
+{
+    if (!stacks || !sampling) return;
+
+    set_timer(0);
+    sampling = 0;
+    write_stacks();
+}
+
+EXPORTED void profiler_poll(void)
+{
+    if (!stacks) return;
+
+    if (toggle) {
+        toggle = 0;
+        if (sampling) {
+            profiler_stop();
+            syslog(LOG_NOTICE, "profiler: stopped sampling");
+        }
+        else {
+            profiler_start();
+            syslog(LOG_NOTICE, "profiler: sampling at %dHz", profiler_hz);
+        }
+    }
+    else if (sampling && nstacks > PROFILER_NSTACKS / 2) {
+        /* write out what we have before stacks start being dropped */
+        set_timer(0);
+        sampling = 0;
+        write_stacks();
+        sampling = 1;
+        set_timer(1);
+    }
+}
@@ -53,10 +53,14 @@
 #endif
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #ifdef HAVE_SYS_SELECT_H
 #include <sys/select.h>
 #endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "assert.h"
 #include "imparse.h"
@@ -94,8 +98,10 @@ EXPORTED struct protstream *prot_new(int fd, int write)
     newstream->write = write;
     newstream->logfd = PROT_NO_FD;
     newstream->big_buffer = PROT_NO_FD;
-    if(write)
+    if(write) {
         newstream->cnt = PROT_BUFSIZE;
+        newstream->max_bufsize = PROT_BUFSIZE_MAX;
+    }
 
     return newstream;
 }
@@ -112,6 +118,7 @@ EXPORTED struct protstream *prot_writebuf(struct buf *buf)
     newstream->ptr = newstream->buf;
     newstream->cnt = PROT_BUFSIZE;
     newstream->maxplain = PROT_BUFSIZE;
+    newstream->max_bufsize = PROT_BUFSIZE_MAX;
     newstream->write = 1;
     newstream->writetobuf = buf;
     newstream->fd = PROT_NO_FD;
@@ -192,6 +199,10 @@ EXPORTED int prot_free(struct protstream *s)
         else inflateEnd(s->zstrm);
         free(s->zstrm);
     }
+#ifdef HAVE_ZSTD
+    if (s->zstd_cctx) ZSTD_freeCCtx(s->zstd_cctx);
+    if (s->zstd_dctx) ZSTD_freeDCtx(s->zstd_dctx);
+#endif
     if (s->zbuf) free(s->zbuf);
 #endif
 
@@ -215,6 +226,16 @@ EXPORTED int prot_setisclient(struct protstream *s, int val)
     return 0;
 }
 
+EXPORTED int prot_setmaxbufsize(struct protstream *s, unsigned max)
+{
+    assert(s->write);
+
+    if (max < PROT_BUFSIZE) max = PROT_BUFSIZE;
+    s->max_bufsize = max;
+
+    return 0;
+}
+
 #ifdef HAVE_SSL
 
 /*
@@ -330,7 +351,7 @@ EXPORTED int prot_setsasl(struct protstream *s, sasl_conn_t *conn)
 EXPORTED void prot_unsetsasl(struct protstream *s)
 {
     s->conn = NULL;
-    s->maxplain = PROT_BUFSIZE;
+    s->maxplain = s->buf_size;
     s->saslssf = 0;
 }
 
@@ -393,8 +414,8 @@ EXPORTED int prot_setcompress(struct protstream *s)
      * format defined here, the worst case expansion is 5 bytes per 32K-
      * byte block, i.e., a size increase of 0.015% for large data sets.
      *
-     * We say: maxplain can never be bigger than PROT_BUFSIZE, which
-     * is currently 4096, so adding 5 bytes will do it!
+     * We say: deflateBound() knows the worst case for maxplain bytes,
+     * and the sync flush marker adds at most 5 more.
      *
      * Add another spare byte and we'll never totally fill the buffer,
      * which saves a loop.
@@ -402,7 +423,8 @@ EXPORTED int prot_setcompress(struct protstream *s)
      * NOTE: we do double check and handle buffer filling gracefully
      * anyway, but starting with the right size is good.
      */
-    s->zbuf_size = s->maxplain + 6;
+    s->zbuf_size = (s->write ? deflateBound(zstrm, s->maxplain)
+                             : (unsigned) s->maxplain) + 6;
     s->zbuf = (unsigned char *) xmalloc(sizeof(unsigned char) * s->zbuf_size);
     syslog(LOG_DEBUG, "created %scompress buffer of %u bytes",
            s->write ? "" : "de", s->zbuf_size);
@@ -417,6 +439,128 @@ error:
     return EOF;
 }
 
+#ifdef HAVE_ZSTD
+/*
+ * Raw content dictionary for the ZSTD algorithm, so that even the first
+ * messages and replication commands of a session compress well.  Both
+ * ends must use exactly the same bytes: DO NOT change this without also
+ * changing the name under which the algorithm is negotiated.
+ */
+static const char zstd_dict[] =
+    "Return-Path: <>\r\nReceived: from  by  (Cyrus) with LMTPA;"
+    " Mon, Tue, Wed, Thu, Fri, Sat, Sun,"
+    " Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec +0000 (UTC)\r\n"
+    "X-Cyrus-Session-Id: \r\nX-Sieve: CMU Sieve 3.0\r\n"
+    "X-Spam-Status: No, score=\r\nX-Spam-Score: \r\n"
+    "Authentication-Results: ; dkim=pass header.d=; spf=pass smtp.mailfrom=;"
+    " dmarc=pass header.from=\r\n"
+    "DKIM-Signature: v=1; a=rsa-sha256; c=relaxed/relaxed; d=; s=; t=;"
+    " h=From:To:Subject:Date:Message-ID; bh=; b=\r\n"
+    "List-Unsubscribe: <mailto:>\r\nList-Id: <>\r\n"
+    "MIME-Version: 1.0\r\n"
+    "Content-Type: multipart/alternative; boundary=\"\r\n"
+    "Content-Type: text/html; charset=\"utf-8\"\r\n"
+    "Content-Type: text/plain; charset=\"UTF-8\"; format=flowed\r\n"
+    "Content-Transfer-Encoding: quoted-printable\r\n"
+    "Content-Transfer-Encoding: base64\r\n"
+    "Content-Disposition: attachment; filename=\"\r\n"
+    "In-Reply-To: <>\r\nReferences: <>\r\n"
+    "Message-ID: <@>\r\nDate: \r\nFrom: \r\nTo: \r\nCc: \r\n"
+    "Subject: Re: \r\n\r\n"
+    "APPLY RESERVE %(PARTITION default MBOXNAME (user.) GUID ())\r\n"
+    "APPLY MESSAGE (%{default  }\r\n"
+    "APPLY MAILBOX %(UNIQUEID  MBOXNAME user. SYNC_CRC  SYNC_CRC_ANNOT "
+    " LAST_UID  HIGHESTMODSEQ  RECENTUID  RECENTTIME  LAST_APPENDDATE "
+    " POP3_LAST_LOGIN  POP3_SHOW_AFTER  UIDVALIDITY  PARTITION default"
+    " ACL \"\tlrswipkxtecdan\t\" OPTIONS P FOLDERMODSEQ  CREATEDMODSEQ "
+    " RECORD (%(UID  MODSEQ  LAST_UPDATED  FLAGS (\\Seen $X-ME-Annot-2)"
+    " INTERNALDATE  SIZE  GUID ))"
+    ")\r\nOK success\r\n";
+
+/* Turn on Zstandard (de)compression for this connection */
+static int prot_setcompress_zstd(struct protstream *s)
+{
+    size_t zr;
+
+    if (s->write) {
+        if (s->ptr != s->buf) {
+            /* flush any pending output */
+            if (prot_flush_internal(s, 0) == EOF)
+                goto error;
+        }
+
+        s->zstd_cctx = ZSTD_createCCtx();
+        if (!s->zstd_cctx) goto error;
+
+        zr = ZSTD_CCtx_setParameter(s->zstd_cctx, ZSTD_c_compressionLevel,
+                                    ZSTD_CLEVEL_DEFAULT);
+        if (!ZSTD_isError(zr))
+            zr = ZSTD_CCtx_loadDictionary(s->zstd_cctx,
+                                          zstd_dict, sizeof(zstd_dict) - 1);
+
+        /* enough for one flush of a full buffer; grown on demand */
+        s->zbuf_size = ZSTD_compressBound(s->maxplain);
+    }
+    else {
+        s->zstd_dctx = ZSTD_createDCtx();
+        if (!s->zstd_dctx) goto error;
+
+        zr = ZSTD_DCtx_loadDictionary(s->zstd_dctx,
+                                      zstd_dict, sizeof(zstd_dict) - 1);
+
+        s->zstd_next_in = NULL;
+        s->zstd_avail_in = 0;
+        s->zstd_pending = 0;
+        s->zbuf_size = ZSTD_DStreamOutSize();
+    }
+
+    if (ZSTD_isError(zr)) {
+        syslog(LOG_ERR, "Zstandard: %s", ZSTD_getErrorName(zr));
+        goto error;
+    }
+
+    s->zbuf = (unsigned char *) xmalloc(sizeof(unsigned char) * s->zbuf_size);
+    syslog(LOG_DEBUG, "created zstd %scompress buffer of %u bytes",
+           s->write ? "" : "de", s->zbuf_size);
+
+    return 0;
+
+error:
+    syslog(LOG_NOTICE, "failed to start zstd %scompression",
+           s->write ? "" : "de");
+    if (s->zstd_cctx) ZSTD_freeCCtx(s->zstd_cctx);
+    if (s->zstd_dctx) ZSTD_freeDCtx(s->zstd_dctx);
+    s->zstd_cctx = NULL;
+    s->zstd_dctx = NULL;
+    return EOF;
+}
+#endif /* HAVE_ZSTD */
+
+EXPORTED int prot_compress_available(const char *alg)
+{
+    if (!strcasecmp(alg, "DEFLATE"))
+        return 1;
+#ifdef HAVE_ZSTD
+    if (!strcasecmp(alg, "ZSTD"))
+        return 1;
+#endif
+
+    return 0;
+}
+
+EXPORTED int prot_setcompress_alg(struct protstream *s, const char *alg)
+{
+    if (!strcasecmp(alg, "DEFLATE"))
+        return prot_setcompress(s);
+#ifdef HAVE_ZSTD
+    if (!strcasecmp(alg, "ZSTD"))
+        return prot_setcompress_zstd(s);
+#endif
+
+    syslog(LOG_NOTICE, "unknown compression algorithm %s", alg);
+    return EOF;
+}
+
 EXPORTED void prot_unsetcompress(struct protstream *s)
 {
     if (s->zstrm) {
@@ -426,6 +570,16 @@ EXPORTED void prot_unsetcompress(struct protstream *s)
         free(s->zstrm);
         s->zstrm = NULL;
     }
+#ifdef HAVE_ZSTD
+    if (s->zstd_cctx) {
+        ZSTD_freeCCtx(s->zstd_cctx);
+        s->zstd_cctx = NULL;
+    }
+    if (s->zstd_dctx) {
+        ZSTD_freeDCtx(s->zstd_dctx);
+        s->zstd_dctx = NULL;
+    }
+#endif
     if (s->zbuf) {
         free(s->zbuf);
         s->zbuf = NULL;
@@ -523,8 +677,8 @@ EXPORTED int prot_setflushonread(struct protstream *s, struct protstream *flushs
  * Set on stream 's' the callback 'proc' and 'rock'
  * to make the next time we have to wait for input.
  */
-int prot_setreadcallback(struct protstream *s,
-                         prot_readcallback_t *proc, void *rock)
+EXPORTED int prot_setreadcallback(struct protstream *s,
+                                  prot_readcallback_t *proc, void *rock)
 {
     assert(!s->write);
 
@@ -676,6 +830,36 @@ EXPORTED int prot_fill(struct protstream *s)
                 break;
             }
         }
+#ifdef HAVE_ZSTD
+        /* likewise for the Zstandard decompressor */
+        if (s->zstd_dctx && (s->zstd_avail_in || s->zstd_pending)) {
+            ZSTD_inBuffer in = { s->zstd_next_in, s->zstd_avail_in, 0 };
+            ZSTD_outBuffer out = { s->zbuf, s->zbuf_size, 0 };
+            size_t zr = ZSTD_decompressStream(s->zstd_dctx, &out, &in);
+
+            if (ZSTD_isError(zr)) {
+                syslog(LOG_ERR, "zstd decompress error: %s",
+                       ZSTD_getErrorName(zr));
+                s->error = xstrdup("Error decompressing data");
+                return EOF;
+            }
+
+            s->zstd_next_in += in.pos;
+            s->zstd_avail_in -= in.pos;
+            /* a full output buffer may have left data inside zstd */
+            s->zstd_pending = (out.pos == out.size);
+
+            if (out.pos) {
+                s->ptr = s->zbuf;
+                s->cnt = out.pos;
+
+                syslog(LOG_DEBUG, "decompressed %zu -> %u bytes",
+                       in.pos, s->cnt);
+
+                break;
+            }
+        }
+#endif /* HAVE_ZSTD */
 #endif
 
         /* wait until get input */
@@ -808,6 +992,13 @@ EXPORTED int prot_fill(struct protstream *s)
             s->zstrm->avail_in = s->cnt;
             s->cnt = 0;
         }
+#ifdef HAVE_ZSTD
+        else if (s->zstd_dctx) {
+            s->zstd_next_in = s->ptr;
+            s->zstd_avail_in = s->cnt;
+            s->cnt = 0;
+        }
+#endif /* HAVE_ZSTD */
 #endif /* HAVE_ZLIB */
     } while (!s->cnt);
 
@@ -952,6 +1143,41 @@ static int prot_flush_encode(struct protstream *s,
 
         syslog(LOG_DEBUG, "compressed %u -> %u bytes", in, left);
     }
+#ifdef HAVE_ZSTD
+    else if (s->zstd_cctx) {
+        ZSTD_inBuffer in = { ptr, left, 0 };
+        ZSTD_outBuffer out = { s->zbuf, s->zbuf_size, 0 };
+        size_t remaining;
+
+        do {
+            if (out.pos == out.size) {
+                syslog(LOG_DEBUG, "growing compress buffer from %u to %u bytes",
+                       s->zbuf_size, s->zbuf_size + PROT_BUFSIZE);
+
+                s->zbuf = (unsigned char *)
+                    xrealloc(s->zbuf, s->zbuf_size + PROT_BUFSIZE);
+                s->zbuf_size += PROT_BUFSIZE;
+                out.dst = s->zbuf;
+                out.size = s->zbuf_size;
+            }
+
+            /* flush so the peer can decode everything we've sent */
+            remaining = ZSTD_compressStream2(s->zstd_cctx, &out, &in,
+                                             ZSTD_e_flush);
+            if (ZSTD_isError(remaining)) {
+                syslog(LOG_ERR, "zstd compress error: %s",
+                       ZSTD_getErrorName(remaining));
+                s->error = xstrdup("Error compressing data");
+                return EOF;
+            }
+        } while (remaining || in.pos != in.size);
+
+        ptr = s->zbuf;
+        left = out.pos;
+
+        syslog(LOG_DEBUG, "compressed %zu -> %u bytes", in.size, left);
+    }
+#endif /* HAVE_ZSTD */
 #endif /* HAVE_ZLIB */
 
     if (s->saslssf != 0) {
@@ -976,6 +1202,53 @@ static int prot_flush_encode(struct protstream *s,
     return 0;
 }
 
+/* Resize an empty write buffer, along with the compress buffer that
+ * has to hold one flush of it */
+static void prot_resize_buffer(struct protstream *s, unsigned size)
+{
+    assert(s->ptr == s->buf);
+
+    free(s->buf);
+    s->buf = (unsigned char *) xmalloc(sizeof(char) * size);
+    s->buf_size = size;
+    s->ptr = s->buf;
+    if (!s->saslssf) s->maxplain = size;
+    s->cnt = s->maxplain;
+
+#ifdef HAVE_ZLIB
+    if (s->zbuf) {
+        unsigned zsize = 0;
+
+        if (s->zstrm) zsize = deflateBound(s->zstrm, s->maxplain) + 6;
+#ifdef HAVE_ZSTD
+        else if (s->zstd_cctx) zsize = ZSTD_compressBound(s->maxplain);
+#endif
+        if (zsize) {
+            free(s->zbuf);
+            s->zbuf = (unsigned char *) xmalloc(sizeof(unsigned char) * zsize);
+            s->zbuf_size = zsize;
+        }
+    }
+#endif /* HAVE_ZLIB */
+}
+
+/* Adapt the write buffer to the output pattern: a flush because the
+ * buffer filled up means sustained output, so double it (fewer write
+ * syscalls, TLS records and deflate calls); a forced flush of a small
+ * response means the burst is over, so give the memory back */
+static void prot_adapt_buffer(struct protstream *s, unsigned flushed, int force)
+{
+    if (!force) {
+        if (flushed >= s->buf_size && s->buf_size < s->max_bufsize &&
+            !s->saslssf) {
+            prot_resize_buffer(s, MIN(s->buf_size * 2, s->max_bufsize));
+        }
+    }
+    else if (flushed < PROT_BUFSIZE && s->buf_size > PROT_BUFSIZE) {
+        prot_resize_buffer(s, PROT_BUFSIZE);
+    }
+}
+
 /* A wrapper for write() that handles SSL and EINTR */
 static int prot_flush_writebuffer(struct protstream *s,
                                   const char *buf, size_t len)
@@ -999,6 +1272,74 @@ static int prot_flush_writebuffer(struct protstream *s,
     return n;
 }
 
+/* Can a large write bypass the memory buffer?  Only when the bytes go
+ * to the descriptor unchanged and nothing else is queued ahead of them */
+static int prot_can_writev(struct protstream *s)
+{
+    if (s->writetobuf || s->dontblock || s->dontblock_isset) return 0;
+    if (s->big_buffer != PROT_NO_FD || s->logfd != PROT_NO_FD) return 0;
+    if (s->saslssf) return 0;
+#ifdef HAVE_SSL
+    if (s->tls_conn) return 0;
+#endif
+#ifdef HAVE_ZLIB
+    if (s->zstrm) return 0;
+#ifdef HAVE_ZSTD
+    if (s->zstd_cctx) return 0;
+#endif
+#endif /* HAVE_ZLIB */
+
+    return 1;
+}
+
+/* Write the buffered data and 'len' bytes of 'buf' with one writev()
+ * per pass, rather than copying 'buf' through the buffer */
+static int prot_flush_writev(struct protstream *s, const char *buf, unsigned len)
+{
+    struct iovec iov[2];
+    int iovcnt = 0, i;
+    ssize_t n;
+
+    if (s->ptr != s->buf) {
+        iov[iovcnt].iov_base = s->buf;
+        iov[iovcnt].iov_len = s->ptr - s->buf;
+        iovcnt++;
+    }
+    iov[iovcnt].iov_base = (char *) buf;
+    iov[iovcnt].iov_len = len;
+    iovcnt++;
+
+    for (i = 0; i < iovcnt; ) {
+        do {
+            cmdtime_netstart();
+            n = writev(s->fd, iov + i, iovcnt - i);
+            cmdtime_netend();
+        } while (n == -1 && errno == EINTR && !signals_poll());
+
+        if (n == -1) {
+            s->error = xstrdup(strerror(errno));
+            s->ptr = s->buf;
+            s->cnt = 1;
+            return EOF;
+        }
+
+        /* step over whatever was written */
+        while (i < iovcnt && (size_t) n >= iov[i].iov_len) {
+            n -= iov[i].iov_len;
+            i++;
+        }
+        if (i < iovcnt) {
+            iov[i].iov_base = (char *) iov[i].iov_base + n;
+            iov[i].iov_len -= n;
+        }
+    }
+
+    s->ptr = s->buf;
+    s->cnt = s->maxplain;
+
+    return 0;
+}
+
 int prot_flush_internal(struct protstream *s, int force)
 {
     int n;
@@ -1006,6 +1347,7 @@ int prot_flush_internal(struct protstream *s, int force)
 
     const char *ptr = (char *) s->buf; /* Memory buffer info */
     unsigned left = s->ptr - s->buf;
+    unsigned flushed = left;
 
     assert(s->write);
 
@@ -1187,6 +1529,8 @@ int prot_flush_internal(struct protstream *s, int force)
     s->ptr = s->buf;
     s->cnt = s->maxplain;
 
+    prot_adapt_buffer(s, flushed, force);
+
  done:
     /* are we done with the big buffer? If so, free it. This includes
      * when we exit with error */
@@ -1255,9 +1599,14 @@ EXPORTED int prot_write(struct protstream *s, const char *buf, unsigned len)
         s->boundary = 0;
     }
 
+    s->bytes_out += len;
+
+    /* a big write to a plain descriptor goes straight from 'buf' */
+    if (len >= s->buf_size && prot_can_writev(s)) {
+        return prot_flush_writev(s, buf, len);
+    }
+
     while (len >= s->cnt) {
-        /* XXX can we manage to write data from 'buf' without copying it
-           to s->ptr ? */
         memcpy(s->ptr, buf, s->cnt);
         s->ptr += s->cnt;
         buf += s->cnt;
@@ -1268,7 +1617,6 @@ EXPORTED int prot_write(struct protstream *s, const char *buf, unsigned len)
     memcpy(s->ptr, buf, len);
     s->ptr += len;
     s->cnt -= len;
-    s->bytes_out += len;
     if (s->error || s->eof) return EOF;
 
     assert(s->cnt > 0);
@@ -64,6 +64,9 @@
 #define PROT_BUFSIZE 4096
 /* #define PROT_BUFSIZE 8192 */
 
+/* write buffers double in size under sustained output, up to this */
+#define PROT_BUFSIZE_MAX (256*1024)
+
 #define PROT_NO_FD -1
 
 struct protstream;
@@ -78,6 +81,7 @@ struct protstream {
     unsigned buf_size;
     unsigned char *ptr; /* The end of data in the buffer */
     unsigned cnt; /* Space Remaining in buffer */
+    unsigned max_bufsize; /* Largest the write buffer may grow to */
 
     /* File Descriptors */
     int fd;         /* The Socket */
@@ -102,6 +106,15 @@ struct protstream {
     /* Compress parameters */
     int zlevel;
     int zflush;
+#ifdef HAVE_ZSTD
+    /* Zstandard (de)compress context, used instead of zstrm */
+    struct ZSTD_CCtx_s *zstd_cctx;
+    struct ZSTD_DCtx_s *zstd_dctx;
+    /* compressed input not yet consumed by the decompressor */
+    const unsigned char *zstd_next_in;
+    size_t zstd_avail_in;
+    int zstd_pending; /* decompressor may hold more output */
+#endif /* HAVE_ZSTD */
 #endif /* HAVE_ZLIB */
 
     /* Big Buffer Information */
@@ -240,6 +253,10 @@ extern void prot_unsetsasl(struct protstream *s);
 extern int prot_settls(struct protstream *s, SSL *tlsconn);
 #endif /* HAVE_SSL */
 
+/* Set the largest size the write buffer may grow to under sustained
+ * output (PROT_BUFSIZE disables growth) */
+extern int prot_setmaxbufsize(struct protstream *s, unsigned max);
+
 /* Mark this protstream as a "client" for the purpose of generating
  * or consuming literals (thanks LITERAL+) */
 int prot_setisclient(struct protstream *s, int val);
@@ -248,6 +265,13 @@ int prot_setisclient(struct protstream *s, int val);
 /* Enable (de)compression for a given protstream */
 int prot_setcompress(struct protstream *s);
 
+/* Enable (de)compression using the named algorithm: "DEFLATE", or
+ * "ZSTD" when built with libzstd */
+int prot_setcompress_alg(struct protstream *s, const char *alg);
+
+/* Is the named compression algorithm available? */
+int prot_compress_available(const char *alg);
+
 /* Disable (de)compression for a given protstream */
 void prot_unsetcompress(struct protstream *s);
 #endif /* HAVE_ZLIB */
@@ -266,8 +290,8 @@ extern int prot_resettimeout(struct protstream *s);
 extern int prot_setflushonread(struct protstream *s,
                                struct protstream *flushs);
 
-
-int prot_setreadcallback(struct protstream *s,
+/* Call proc once, the next time a read from s would block */
+extern int prot_setreadcallback(struct protstream *s,
                                 prot_readcallback_t *proc, void *rock);
 extern struct prot_waitevent *prot_addwaitevent(struct protstream *s,
                                                 time_t mark,
@@ -51,6 +51,7 @@
 #include <errno.h>
 
 #include "assert.h"
+#include "profiler.h"
 #include "signals.h"
 #include "xmalloc.h"
 #include "util.h"
@@ -180,6 +181,8 @@ static int signals_poll_mask(sigset_t *oldmaskp)
 {
     int sig;
 
+    profiler_poll();
+
     if (!signals_in_shutdown &&
         (gotsignal[SIGINT] || gotsignal[SIGQUIT] || gotsignal[SIGTERM])) {
 
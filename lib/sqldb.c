@@ -55,6 +55,7 @@
 #include <sys/wait.h>
 
 #include "assert.h"
+#include "libconfig.h"
 #include "sqldb.h"
 #include "util.h"
 #include "xmalloc.h"
@@ -89,8 +90,14 @@ static void _debug(void *fname, const char *sql)
     syslog(LOG_DEBUG, "sqldb_exec(%s): %s", (const char *) fname, sql);
 }
 
+static void _finalize_stmt(void *stmt)
+{
+    sqlite3_finalize((sqlite3_stmt *) stmt);
+}
+
 static int _free_open(sqldb_t *open)
 {
+    if (open->stmts.size) free_hash_table(&open->stmts, _finalize_stmt);
     int rc = sqlite3_close(open->db);
     free(open->fname);
     free(open);
@@ -108,6 +115,64 @@ static int _version_cb(void *rock, int ncol, char **vals, char **names __attribu
     return 0;
 }
 
+/* Apply the journal, synchronous and mmap settings from imapd.conf.
+ * "default" leaves whatever SQLite (or the file itself, for a
+ * persistent journal_mode like WAL) would otherwise use.
+ */
+static int _tune(sqldb_t *open)
+{
+    struct buf buf = BUF_INITIALIZER;
+    int rc = SQLITE_OK;
+
+    switch (config_getenum(IMAPOPT_SQLDB_JOURNAL_MODE)) {
+    case IMAP_ENUM_SQLDB_JOURNAL_MODE_DELETE:
+        buf_appendcstr(&buf, "PRAGMA journal_mode = DELETE;");
+        break;
+    case IMAP_ENUM_SQLDB_JOURNAL_MODE_TRUNCATE:
+        buf_appendcstr(&buf, "PRAGMA journal_mode = TRUNCATE;");
+        break;
+    case IMAP_ENUM_SQLDB_JOURNAL_MODE_PERSIST:
+        buf_appendcstr(&buf, "PRAGMA journal_mode = PERSIST;");
+        break;
+    case IMAP_ENUM_SQLDB_JOURNAL_MODE_WAL:
+        buf_appendcstr(&buf, "PRAGMA journal_mode = WAL;");
+        break;
+    default:
+        break;
+    }
+
+    switch (config_getenum(IMAPOPT_SQLDB_SYNCHRONOUS)) {
+    case IMAP_ENUM_SQLDB_SYNCHRONOUS_OFF:
+        buf_appendcstr(&buf, "PRAGMA synchronous = OFF;");
+        break;
+    case IMAP_ENUM_SQLDB_SYNCHRONOUS_NORMAL:
+        buf_appendcstr(&buf, "PRAGMA synchronous = NORMAL;");
+        break;
+    case IMAP_ENUM_SQLDB_SYNCHRONOUS_FULL:
+        buf_appendcstr(&buf, "PRAGMA synchronous = FULL;");
+        break;
+    default:
+        break;
+    }
+
+    int64_t mmap_size = config_getint(IMAPOPT_SQLDB_MMAP_SIZE);
+    if (mmap_size > 0) {
+        buf_printf(&buf, "PRAGMA mmap_size = %lld;",
+                   (long long) mmap_size * 1024);
+    }
+
+    if (buf_len(&buf)) {
+        rc = sqlite3_exec(open->db, buf_cstring(&buf), NULL, NULL, NULL);
+        if (rc != SQLITE_OK) {
+            syslog(LOG_ERR, "DBERROR: sqldb_open(%s) tune <%s>: %s",
+                   open->fname, buf_cstring(&buf), sqlite3_errmsg(open->db));
+        }
+    }
+
+    buf_free(&buf);
+    return rc;
+}
+
 /* Open DAV DB corresponding in file */
 EXPORTED sqldb_t *sqldb_open(const char *fname, const char *initsql,
                              int version, const struct sqldb_upgrade *upgrade,
@@ -128,6 +193,7 @@ EXPORTED sqldb_t *sqldb_open(const char *fname, const char *initsql,
 
     open = xzmalloc(sizeof(sqldb_t));
     open->fname = xstrdup(fname);
+    construct_hash_table(&open->stmts, 64, 0);
 
     rc = stat(open->fname, &sbuf);
     if (rc == -1 && errno == ENOENT) {
@@ -180,6 +246,12 @@ EXPORTED sqldb_t *sqldb_open(const char *fname, const char *initsql,
         return NULL;
     }
 
+    rc = _tune(open);
+    if (rc != SQLITE_OK) {
+        _free_open(open);
+        return NULL;
+    }
+
     rc = sqlite3_exec(open->db, "PRAGMA user_version;", _version_cb, &open->version, NULL);
     if (rc != SQLITE_OK) {
         syslog(LOG_ERR, "DBERROR: sqldb_open(%s) get user_version: %s",
@@ -292,13 +364,9 @@ out:
 
 static sqlite3_stmt *_prepare_stmt(sqldb_t *open, const char *cmd)
 {
-    int i;
-    sqlite3_stmt *stmt;
-    for (i = 0; i < open->stmts.count; i++) {
-        stmt = ptrarray_nth(&open->stmts, i);
-        if (!strcmp(cmd, sqlite3_sql(stmt)))
-            return stmt;
-    }
+    sqlite3_stmt *stmt = hash_lookup(cmd, &open->stmts);
+    if (stmt) return stmt;
+
     /* prepare new statement */
     int rc = sqlite3_prepare_v2(open->db, cmd, -1, &stmt, NULL);
     if (rc != SQLITE_OK) {
@@ -306,42 +374,35 @@ static sqlite3_stmt *_prepare_stmt(sqldb_t *open, const char *cmd)
                open->fname, cmd, sqlite3_errmsg(open->db));
         return NULL;
     }
-    ptrarray_append(&open->stmts, stmt);
+    hash_insert(cmd, stmt, &open->stmts);
     return stmt;
 }
 
-static void _finish_stmt(sqldb_t *open)
+static void _bind_values(sqlite3_stmt *stmt, struct sqldb_bindval bval[],
+                         const int *cidx)
 {
     int i;
-    sqlite3_stmt *stmt;
-    for (i = 0; i < open->stmts.count; i++) {
-        stmt = ptrarray_nth(&open->stmts, i);
-        sqlite3_finalize(stmt);
-    }
-    ptrarray_fini(&open->stmts);
-}
-
-EXPORTED int sqldb_exec(sqldb_t *open, const char *cmd, struct sqldb_bindval bval[],
-                        int (*cb)(sqlite3_stmt *stmt, void *rock), void *rock)
-{
-    int rc, r = 0;
-    sqlite3_stmt *stmt = _prepare_stmt(open, cmd);
-    if (!stmt) return -1;
 
-    /* bind values */
-    for (; bval && bval->name; bval++) {
-        int cidx = sqlite3_bind_parameter_index(stmt, bval->name);
+    for (i = 0; bval && bval[i].name; i++) {
+        int idx = cidx ? cidx[i] :
+            sqlite3_bind_parameter_index(stmt, bval[i].name);
 
-        switch (bval->type) {
+        switch (bval[i].type) {
         case SQLITE_INTEGER:
-            sqlite3_bind_int64(stmt, cidx, bval->val.i);
+            sqlite3_bind_int64(stmt, idx, bval[i].val.i);
             break;
 
         case SQLITE_TEXT:
-            sqlite3_bind_text(stmt, cidx, bval->val.s, -1, NULL);
+            sqlite3_bind_text(stmt, idx, bval[i].val.s, -1, NULL);
             break;
         }
     }
+}
+
+static int _step_stmt(sqldb_t *open, sqlite3_stmt *stmt, const char *cmd,
+                      int (*cb)(sqlite3_stmt *stmt, void *rock), void *rock)
+{
+    int rc, r = 0;
 
     /* execute and process the results */
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -361,6 +422,56 @@ EXPORTED int sqldb_exec(sqldb_t *open, const char *cmd, struct sqldb_bindval bva
     return r;
 }
 
+EXPORTED int sqldb_exec(sqldb_t *open, const char *cmd, struct sqldb_bindval bval[],
+                        int (*cb)(sqlite3_stmt *stmt, void *rock), void *rock)
+{
+    sqlite3_stmt *stmt = _prepare_stmt(open, cmd);
+    if (!stmt) return -1;
+
+    _bind_values(stmt, bval, NULL);
+
+    return _step_stmt(open, stmt, cmd, cb, rock);
+}
+
+EXPORTED int sqldb_exec_many(sqldb_t *open, const char *cmd,
+                             struct sqldb_bindval bval[], int nrows,
+                             void (*fill)(struct sqldb_bindval bval[],
+                                          int row, void *rock),
+                             void *rock)
+{
+    int *cidx = NULL;
+    int i, nvals = 0, r = 0;
+
+    if (nrows <= 0) return 0;
+
+    sqlite3_stmt *stmt = _prepare_stmt(open, cmd);
+    if (!stmt) return -1;
+
+    /* resolve the parameter names once for the whole batch */
+    while (bval && bval[nvals].name) nvals++;
+    if (nvals) {
+        cidx = xmalloc(nvals * sizeof(int));
+        for (i = 0; i < nvals; i++)
+            cidx[i] = sqlite3_bind_parameter_index(stmt, bval[i].name);
+    }
+
+    r = sqldb_begin(open, "exec_many");
+    if (r) goto done;
+
+    for (i = 0; !r && i < nrows; i++) {
+        if (fill) fill(bval, i, rock);
+        _bind_values(stmt, bval, cidx);
+        r = _step_stmt(open, stmt, cmd, NULL, NULL);
+    }
+
+    if (r) sqldb_rollback(open, "exec_many");
+    else r = sqldb_commit(open, "exec_many");
+
+done:
+    free(cidx);
+    return r;
+}
+
 static int _onecmd(sqldb_t *open, const char *cmd, const char *name)
 {
     static struct buf buf = BUF_INITIALIZER;
@@ -466,7 +577,6 @@ EXPORTED int sqldb_close(sqldb_t **dbp)
     assert(!open->trans.count);
 
     strarray_fini(&open->trans);
-    _finish_stmt(open);
 
     *dbp = NULL;
 
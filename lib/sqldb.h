@@ -45,6 +45,7 @@
 #define SQLDB_H
 
 #include <sqlite3.h>
+#include "hash.h"
 #include "ptrarray.h"
 #include "strarray.h"
 
@@ -67,7 +68,7 @@ struct sqldb {
     int writelock;
     int attached;
     strarray_t trans;
-    ptrarray_t stmts;
+    hash_table stmts;           /* prepared statements, keyed by SQL text */
     struct sqldb *next;
 };
 
@@ -99,6 +100,15 @@ int sqldb_detach(sqldb_t *open);
 int sqldb_exec(sqldb_t *open, const char *cmd, struct sqldb_bindval bval[],
                int (*cb)(sqlite3_stmt *stmt, void *rock), void *rock);
 
+/* execute 'cmd' once for each of 'nrows' rows inside a single savepoint.
+   'fill' is called before each row to update the values in 'bval';
+   parameter names are only resolved once for the whole batch */
+int sqldb_exec_many(sqldb_t *open, const char *cmd,
+                    struct sqldb_bindval bval[], int nrows,
+                    void (*fill)(struct sqldb_bindval bval[],
+                                 int row, void *rock),
+                    void *rock);
+
 int sqldb_begin(sqldb_t *open, const char *name);
 int sqldb_commit(sqldb_t *open, const char *name);
 int sqldb_rollback(sqldb_t *open, const char *name);
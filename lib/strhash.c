@@ -42,6 +42,10 @@
 
 #include "config.h"
 
+#include <string.h>
+
+#include "strhash.h"
+
 EXPORTED unsigned strhash(const char *string)
 {
       unsigned ret_val = 0;
@@ -56,3 +60,57 @@ EXPORTED unsigned strhash(const char *string)
       }
       return ret_val;
 }
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+/* MurmurHash3 was written by Austin Appleby and placed in the public
+ * domain.  Blocks are read with memcpy so unaligned keys are fine. */
+EXPORTED uint32_t memhash_seeded(const void *data, size_t len, uint32_t seed)
+{
+    const unsigned char *p = data;
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    uint32_t h = seed, k;
+    size_t n;
+
+    for (n = len / 4; n; n--, p += 4) {
+        memcpy(&k, p, 4);
+        k *= c1;
+        k = rotl32(k, 15);
+        k *= c2;
+
+        h ^= k;
+        h = rotl32(h, 13);
+        h = h * 5 + 0xe6546b64;
+    }
+
+    k = 0;
+    switch (len & 3) {
+    case 3: k ^= p[2] << 16;
+        GCC_FALLTHROUGH
+    case 2: k ^= p[1] << 8;
+        GCC_FALLTHROUGH
+    case 1: k ^= p[0];
+        k *= c1;
+        k = rotl32(k, 15);
+        k *= c2;
+        h ^= k;
+    }
+
+    h ^= (uint32_t) len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+EXPORTED uint32_t strhash_seeded(const char *string, uint32_t seed)
+{
+    return memhash_seeded(string, strlen(string), seed);
+}
@@ -41,7 +41,17 @@
  */
 
 #ifndef _STRHASH_H_
+#define _STRHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
 
 unsigned strhash(const char *string);
 
+/* MurmurHash3 (x86_32): well mixed in every bit, so safe to mask down
+ * to a power-of-two table size.  Not for anything stored on disk: use
+ * strhash() there, whose values are already persisted. */
+uint32_t memhash_seeded(const void *data, size_t len, uint32_t seed);
+uint32_t strhash_seeded(const char *string, uint32_t seed);
+
 #endif /* _STRHASH_H_ */
@@ -758,7 +758,10 @@ EXPORTED const char *cyrus_group(void)
 
 static int cmdtime_enabled = 0;
 static struct timeval cmdtime_start, cmdtime_end, nettime_start, nettime_end;
-static double totaltime, cmdtime, nettime, search_maxtime;
+static struct timeval locktime_start;
+static struct timespec cputime_start;
+static double totaltime, cmdtime, nettime, locktime, cputime, search_maxtime;
+static double cmdtime_logtime = -1;
 
 EXPORTED double timeval_get_double(const struct timeval *tv)
 {
@@ -795,10 +798,26 @@ EXPORTED int64_t now_ms(void)
     }
 }
 
+static double cputime_since(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec)/1000000000.0;
+}
+
 EXPORTED void cmdtime_settimer(int enable)
 {
     cmdtime_enabled = enable;
 
+    /* always enable cmdtimer if commands are to be logged */
+    const char *mintimer = config_getstring(IMAPOPT_COMMANDMINTIMER);
+    if (mintimer) {
+        cmdtime_enabled = 1;
+        cmdtime_logtime = atof(mintimer);
+    }
+
     /* always enable cmdtimer if MAXTIME set */
     const char *maxtime = config_getstring(IMAPOPT_SEARCH_MAXTIME);
     if (maxtime) {
@@ -812,7 +831,8 @@ EXPORTED void cmdtime_starttimer(void)
     if (!cmdtime_enabled)
         return;
     gettimeofday(&cmdtime_start, 0);
-    totaltime = cmdtime = nettime = 0.0;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cputime_start);
+    totaltime = cmdtime = nettime = locktime = cputime = 0.0;
 }
 
 EXPORTED void cmdtime_endtimer(double *pcmdtime, double *pnettime)
@@ -822,10 +842,32 @@ EXPORTED void cmdtime_endtimer(double *pcmdtime, double *pnettime)
     gettimeofday(&cmdtime_end, 0);
     totaltime = timesub(&cmdtime_start, &cmdtime_end);
     cmdtime = totaltime - nettime;
+    cputime = cputime_since(&cputime_start);
     *pcmdtime = cmdtime;
     *pnettime = nettime;
 }
 
+EXPORTED void cmdtime_log(const char *userid, const char *cmd,
+                          const char *mboxname, unsigned long messages,
+                          unsigned long long bytes)
+{
+    double iotime;
+
+    if (cmdtime_logtime < 0 || cmdtime < cmdtime_logtime)
+        return;
+
+    /* what wasn't spent waiting for locks or on the CPU was mostly
+     * spent waiting for the disk */
+    iotime = cmdtime - locktime - cputime;
+    if (iotime < 0) iotime = 0;
+
+    syslog(LOG_NOTICE, "cmdtimer: '%s' '%s' '%s' '%f' '%f' '%f'"
+                       " lock=%f cpu=%f io=%f messages=%lu bytes=%llu",
+           userid ? userid : "<none>", cmd, mboxname ? mboxname : "<none>",
+           cmdtime, nettime, cmdtime + nettime,
+           locktime, cputime, iotime, messages, bytes);
+}
+
 EXPORTED int cmdtime_checksearch(void)
 {
     struct timeval nowtime;
@@ -854,6 +896,23 @@ EXPORTED void cmdtime_netend(void)
     nettime += timesub(&nettime_start, &nettime_end);
 }
 
+EXPORTED void cmdtime_lockstart(void)
+{
+    if (!cmdtime_enabled)
+        return;
+    gettimeofday(&locktime_start, 0);
+}
+
+EXPORTED void cmdtime_lockend(void)
+{
+    struct timeval locktime_end;
+
+    if (!cmdtime_enabled)
+        return;
+    gettimeofday(&locktime_end, 0);
+    locktime += timesub(&locktime_start, &locktime_end);
+}
+
 /*
  * Like the system clock() but works in system time
  * rather than process virtual time.  Would be more
@@ -253,7 +253,13 @@ extern void cmdtime_starttimer(void);
 extern void cmdtime_endtimer(double * cmdtime, double * nettime);
 extern void cmdtime_netstart(void);
 extern void cmdtime_netend(void);
+extern void cmdtime_lockstart(void);
+extern void cmdtime_lockend(void);
 extern int cmdtime_checksearch(void);
+/* log the command last timed, if it took at least commandmintimer */
+extern void cmdtime_log(const char *userid, const char *cmd,
+                        const char *mboxname, unsigned long messages,
+                        unsigned long long bytes);
 extern double timeval_get_double(const struct timeval *tv);
 extern void timeval_set_double(struct timeval *tv, double d);
 extern void timeval_add_double(struct timeval *tv, double delta);
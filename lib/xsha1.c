@@ -73,13 +73,6 @@
 /* to limit changes to the code below, set up the right types here */
 #include "lib/xsha1.h" /* for the typedefs and such */
 
-/* The SHA1 structure: */
-struct _SHA_CTX {
-    sha1_quadbyte   state[5];
-    sha1_quadbyte   count[2];
-    sha1_byte   buffer[SHA1_BLOCK_LENGTH];
-};
-
 /* Downloaded from http://www.aarongifford.com/computers/hmac_sha1.tar.gz
  * by Bron Gondwana <brong@fastmail.fm> on 2011-09-20
  */
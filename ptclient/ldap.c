@@ -79,6 +79,7 @@
 #include "strhash.h"
 #include "xmalloc.h"
 #include "xstrlcat.h"
+#include "xstrlcpy.h"
 
 /* xxx this just uses the UNIX canonicalization semantics, which is
  * most likely wrong */
@@ -183,6 +184,7 @@ typedef struct _ptsm {
 #define PTSM_FAIL -1
 #define PTSM_NOMEM -2
 #define PTSM_RETRY -3
+#define PTSM_NOTFOUND -4 /* the directory answered: no such identifier */
 
 #define PTSM_MEMBER_METHOD_ATTRIBUTE 0
 #define PTSM_MEMBER_METHOD_FILTER 1
@@ -1082,6 +1084,8 @@ static int ptsmodule_get_dn(
          */
         if (ldap_count_entries(ptsm->ld, res) < 1) {
             syslog(LOG_ERR, "No entries found");
+            ldap_msgfree(res);
+            return PTSM_NOTFOUND;
         } else if (ldap_count_entries(ptsm->ld, res) > 1) {
             syslog(LOG_ERR, "Multiple entries found: %d", ldap_count_entries(ptsm->ld, res));
         } else {
@@ -1519,7 +1523,7 @@ static int ptsmodule_make_authstate_group(
     n = ldap_count_entries(ptsm->ld, res);
     if (n != 1) {
         *reply = "group identifier not found";
-        rc = PTSM_FAIL;
+        rc = n ? PTSM_FAIL : PTSM_NOTFOUND;
         goto done;
     }
 
@@ -1586,6 +1590,16 @@ retry:;
         goto retry;
     }
 
+    if (rc == PTSM_NOTFOUND) {
+        /* hand back a negative entry, so ptloader can cache the answer */
+        *dsize = sizeof(struct auth_state);
+        newstate = xzmalloc(*dsize);
+        strlcpy(newstate->userid.id, canon_id, sizeof(newstate->userid.id));
+        newstate->userid.hash = strhash(canon_id);
+        newstate->mark = time(0);
+        newstate->ngroups = PTS_NEGATIVE;
+    }
+
     return newstate;
 }
 
@@ -59,6 +59,10 @@ static int dump_cb(void *rockp __attribute__((unused)),
 
     printf("user: ");
     fwrite(key, keylen, 1, stdout);
+    if (authstate->ngroups == PTS_NEGATIVE) {
+        printf(" time: %d not found\n", (unsigned)authstate->mark);
+        return 0;
+    }
     printf(" time: %d groups: %d\n",
            (unsigned)authstate->mark, (unsigned)authstate->ngroups);
 
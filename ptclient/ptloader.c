@@ -189,8 +189,29 @@ void service_abort(int error)
     exit(error);
 }
 
+/* Has someone else refreshed 'user' since the client found it stale?
+ * When a popular identifier expires, every process that needs it asks
+ * at once; the first request does the lookup and the rest are answered
+ * from the cache. */
+static int ptsdb_isfresh(const char *user, size_t size)
+{
+    const struct auth_state *cached;
+    const char *data = NULL;
+    size_t datalen = 0;
+    time_t timeout = config_getduration(IMAPOPT_PTSCACHE_TIMEOUT, 's');
+
+    if (cyrusdb_fetch(ptsdb, user, size, &data, &datalen, NULL))
+        return 0;
+    if (datalen < sizeof(struct auth_state))
+        return 0;
+
+    cached = (const struct auth_state *) data;
+    return cached->mark > time(0) - timeout;
+}
+
 /* we're a 'threaded' service, but since we never fork or create any
-   threads, we're just one-person-at-a-time based */
+   threads, we're just one-person-at-a-time based.  Run more of them
+   (maxchild in cyrus.conf) to serve requests in parallel */
 int service_main_fd(int c, int argc __attribute__((unused)),
                     char **argv __attribute__((unused)),
                     char **envp __attribute__((unused)))
@@ -232,8 +253,31 @@ int service_main_fd(int c, int argc __attribute__((unused)),
         syslog(LOG_DEBUG, "user %s", user);
     }
 
+    if (ptsdb_isfresh(user, size)) {
+        if (ptclient_debug) {
+            syslog(LOG_DEBUG, "user %s already refreshed", user);
+        }
+        reply = "OK";
+        goto sendreply;
+    }
+
     newstate = ptsmodule_make_authstate(user, size, &reply, &dsize);
 
+    if (newstate && newstate->ngroups == PTS_NEGATIVE) {
+        time_t timeout = config_getduration(IMAPOPT_PTSCACHE_TIMEOUT, 's');
+        time_t negative =
+            config_getduration(IMAPOPT_PTSCACHE_NEGATIVE_TIMEOUT, 's');
+
+        if (!negative) {
+            free(newstate);
+            newstate = NULL;
+        }
+        else if (negative < timeout) {
+            /* backdate it, so that it expires sooner than a real entry */
+            newstate->mark -= timeout - negative;
+        }
+    }
+
     if(newstate) {
         /* Success! */
         rc = cyrusdb_store(ptsdb, user, size, (void *)newstate, dsize, NULL);
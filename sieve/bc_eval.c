@@ -90,6 +90,71 @@ static regex_t * bc_compile_regex(const char *s, int ctag,
     return reg;
 }
 
+/* Look up a compiled regular expression in the cache of the running
+   script, compiling and caching it on first use */
+static regex_t *bc_cached_regex(sieve_execute_t *exe, const char *s, int ctag,
+                                char *errmsg, size_t errsiz)
+{
+    struct buf key = BUF_INITIALIZER;
+    regex_t *reg;
+
+    if (!exe->regexes) {
+        exe->regexes = xzmalloc(sizeof(hash_table));
+        construct_hash_table(exe->regexes, 64, 0);
+    }
+
+    buf_printf(&key, "%d:%s", ctag, s);
+    reg = hash_lookup(buf_cstring(&key), exe->regexes);
+    if (!reg) {
+        reg = bc_compile_regex(s, ctag, errmsg, errsiz);
+        if (reg) hash_insert(buf_cstring(&key), reg, exe->regexes);
+    }
+    buf_free(&key);
+
+    return reg;
+}
+
+/* Minimum number of keys before a test is worth a multi-key matcher */
+#define MULTIMATCH_MIN_KEYS 4
+
+/* Look up (or build) the multi-key matcher for the test at 'ip'.
+   Returns NULL if the test can't use one, in which case the keys
+   have to be compared one at a time */
+static comparator_multi_t *bc_cached_multimatch(sieve_execute_t *exe,
+                                                bytecode_input_t *bc, int ip,
+                                                int comparator, int match,
+                                                strarray_t *keys,
+                                                int requires)
+{
+    char key[100];
+    comparator_multi_t *cm;
+    int n;
+
+    if (match != B_IS && match != B_CONTAINS) return NULL;
+    if (strarray_size(keys) < MULTIMATCH_MIN_KEYS) return NULL;
+
+    if (requires & BFE_VARIABLES) {
+        /* keys that expand variables differ between executions */
+        for (n = 0; n < strarray_size(keys); n++) {
+            if (strstr(strarray_nth(keys, n), "${")) return NULL;
+        }
+    }
+
+    if (!exe->multimatch) {
+        exe->multimatch = xzmalloc(sizeof(hash_table));
+        construct_hash_table(exe->multimatch, 64, 0);
+    }
+
+    snprintf(key, sizeof(key), "%p:%d", (void *) bc, ip);
+    cm = hash_lookup(key, exe->multimatch);
+    if (!cm) {
+        cm = comparator_multi_new(comparator, match, keys);
+        if (cm) hash_insert(key, cm, exe->multimatch);
+    }
+
+    return cm;
+}
+
 /* Determine if addr is a system address */
 static int sysaddr(const char *addr)
 {
@@ -332,7 +397,8 @@ static int regcomp_flags(int comparator, int requires)
     return cflags;
 }
 
-static int do_comparison(const char *needle, const char *hay,
+static int do_comparison(sieve_execute_t *exe,
+                         const char *needle, const char *hay,
                          comparator_t *comp, void *comprock, int ctag,
                          variable_list_t *variables, strarray_t *match_vars)
 {
@@ -344,7 +410,8 @@ static int do_comparison(const char *needle, const char *hay,
 
     if (ctag) {
         char errbuf[100]; /* Basically unused, as regex is tested at compile */
-        regex_t *reg = bc_compile_regex(needle, ctag, errbuf, sizeof(errbuf));
+        regex_t *reg = bc_cached_regex(exe, needle, ctag,
+                                       errbuf, sizeof(errbuf));
 
         if (!reg) {
             /* Oops */
@@ -353,8 +420,6 @@ static int do_comparison(const char *needle, const char *hay,
         else {
             res = comp(hay, strlen(hay),
                        (const char *) reg, match_vars, comprock);
-            regfree(reg);
-            free(reg);
         }
     } else {
 #if VERBOSE
@@ -366,7 +431,8 @@ static int do_comparison(const char *needle, const char *hay,
     return res;
 }
 
-static int do_comparisons(strarray_t *needles, const char *hay,
+static int do_comparisons(sieve_execute_t *exe,
+                          strarray_t *needles, const char *hay,
                           comparator_t *comp, void *comprock, int ctag,
                           variable_list_t *variables, strarray_t *match_vars)
 {
@@ -379,7 +445,7 @@ static int do_comparisons(strarray_t *needles, const char *hay,
             needle = parse_string(needle, variables);
         }
 
-        int tmp = do_comparison(needle, hay,
+        int tmp = do_comparison(exe, needle, hay,
                                 comp, comprock, ctag, variables, match_vars);
         if (tmp < 0) res = tmp;
         else res |= tmp;
@@ -389,7 +455,8 @@ static int do_comparisons(strarray_t *needles, const char *hay,
 }
 
 /* Evaluate a bytecode test */
-static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
+static int eval_bc_test(sieve_execute_t *exe,
+                        sieve_interp_t *interp, void* m, void *sc,
                         bytecode_input_t * bc, int * ip,
 			variable_list_t *variables,
                         duptrack_list_t *duptrack_list,
@@ -421,7 +488,7 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
         break;
 
     case BC_NOT:
-        res = eval_bc_test(interp, m, sc, bc, &i, variables,
+        res = eval_bc_test(exe, interp, m, sc, bc, &i, variables,
                            duptrack_list, version, requires);
         if (res >= 0) res = !res; /* Only invert in non-error case */
         break;
@@ -475,7 +542,7 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
 
         /* return 0 unless you find one that is true, then return 1 */
         for (x = 0; x < list_len && !res; x++) {
-            int tmp = eval_bc_test(interp, m, sc, bc, &i, variables,
+            int tmp = eval_bc_test(exe, interp, m, sc, bc, &i, variables,
                                    duptrack_list, version, requires);
             if (tmp < 0) {
                 res = tmp;
@@ -495,7 +562,7 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
 
         /* return 1 unless you find one that isn't true, then return 0 */
         for (x = 0; x < list_len && res; x++) {
-            int tmp =  eval_bc_test(interp, m, sc, bc, &i, variables,
+            int tmp =  eval_bc_test(exe, interp, m, sc, bc, &i, variables,
                                     duptrack_list, version, requires);
             if (tmp < 0) {
                 res = tmp;
@@ -639,7 +706,7 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
                         count++;
                     } else {
                         /* search through all the data */
-                        res = do_comparisons(test.u.ae.pl, addr,
+                        res = do_comparisons(exe, test.u.ae.pl, addr,
                                              comp, comprock, ctag,
                                              (requires & BFE_VARIABLES) ?
                                              variables : NULL, match_vars);
@@ -662,7 +729,7 @@ static int eval_bc_test(sieve_interp_t *interp, void* m, void *sc,
         if (match == B_COUNT) {
             snprintf(scount, SCOUNT_SIZE, "%u", count);
             /* search through all the data */
-            res = do_comparisons(test.u.ae.pl, scount,
+            res = do_comparisons(exe, test.u.ae.pl, scount,
                                  comp, comprock, 0 /* regex */,
                                  (requires & BFE_VARIABLES) ? variables : NULL,
                                  match_vars);
@@ -689,12 +756,16 @@ envelope_err:
         int count = 0;
         int ctag = 0;
         char *decoded_header;
+        comparator_multi_t *multi;
 
         /* set up variables needed for compiling regex */
         if (match == B_REGEX) {
             ctag = regcomp_flags(comparator, requires);
         }
 
+        multi = bc_cached_multimatch(exe, bc, *ip, comparator, match,
+                                     test.u.hhs.pl, requires);
+
         /* find the correct comparator fcn */
         comp = lookup_comp(interp, comparator, match, relation, &comprock);
 
@@ -757,10 +828,17 @@ envelope_err:
                         charset_parse_mimeheader(val[y],
                                                  CHARSET_MIME_UTF8 | CHARSET_TRIMWS);
 
-                    res = do_comparisons(test.u.hhs.pl, decoded_header,
-                                         comp, comprock, ctag,
-                                         (requires & BFE_VARIABLES) ?
-                                         variables : NULL, match_vars);
+                    if (multi) {
+                        res = comparator_multi_match(multi, decoded_header,
+                                                     strlen(decoded_header));
+                    }
+                    else {
+                        res = do_comparisons(exe, test.u.hhs.pl,
+                                             decoded_header,
+                                             comp, comprock, ctag,
+                                             (requires & BFE_VARIABLES) ?
+                                             variables : NULL, match_vars);
+                    }
                     free(decoded_header);
 
                     if (res < 0) goto header_err;
@@ -771,7 +849,7 @@ envelope_err:
         if (match == B_COUNT) {
             snprintf(scount, SCOUNT_SIZE, "%u", count);
             /* search through all the data */
-            res = do_comparisons(test.u.hhs.pl, scount,
+            res = do_comparisons(exe, test.u.hhs.pl, scount,
                                  comp, comprock, 0 /* regex */,
                                  (requires & BFE_VARIABLES) ? variables : NULL,
                                  match_vars);
@@ -858,7 +936,7 @@ envelope_err:
 
 		snprintf(scount, SCOUNT_SIZE, "%u", count);
 		/* search through all the data */
-                res = do_comparisons(test.u.hhs.pl, scount,
+                res = do_comparisons(exe, test.u.hhs.pl, scount,
                                      comp, comprock, 0 /* regex */,
                                      (requires & BFE_VARIABLES) ?
                                      variables : NULL,
@@ -882,7 +960,7 @@ envelope_err:
 #endif
 
                 if (op == BC_STRING) {
-                    tmp = do_comparison(this_needle, this_haystack,
+                    tmp = do_comparison(exe, this_needle, this_haystack,
                                         comp, comprock, ctag,
                                         NULL /* variables */, match_vars);
                     if (tmp < 0) {
@@ -899,7 +977,7 @@ envelope_err:
 
                         active_flag = this_var->data[y];
 
-                        tmp = do_comparison(this_needle, active_flag,
+                        tmp = do_comparison(exe, this_needle, active_flag,
                                             comp, comprock, ctag,
                                             NULL /* variables */, match_vars);
                         if (tmp < 0) {
@@ -999,7 +1077,7 @@ envelope_err:
                     const char *content = val[y]->decoded_body;
 
                     /* search through all the data */
-                    res = do_comparisons(test.u.b.pl, content,
+                    res = do_comparisons(exe, test.u.b.pl, content,
                                         comp, comprock, ctag,
                                         (requires & BFE_VARIABLES) ?
                                         variables : NULL, match_vars);
@@ -1021,7 +1099,7 @@ envelope_err:
         if (match == B_COUNT) {
             snprintf(scount, SCOUNT_SIZE, "%u", count);
             /* search through all the data */
-            res = do_comparisons(test.u.b.pl, scount,
+            res = do_comparisons(exe, test.u.b.pl, scount,
                                  comp, comprock, 0 /* regex */,
                                  (requires & BFE_VARIABLES) ? variables : NULL,
                                  match_vars);
@@ -1369,7 +1447,7 @@ envelope_err:
             interp->getmetadata(sc, extname, keyname, &val);
 
         if (val) {
-            res = do_comparisons(test.u.mm.keylist, val,
+            res = do_comparisons(exe, test.u.mm.keylist, val,
                                  comp, comprock, ctag,
                                  (requires & BFE_VARIABLES) ? variables : NULL,
                                  match_vars);
@@ -1864,7 +1942,7 @@ int sieve_eval_bc(sieve_execute_t *exe, int is_incl, sieve_interp_t *i,
             int testend = cmd.u.i.testend;
             int result;
 
-            result = eval_bc_test(i, m, sc, bc, &ip, variables,
+            result = eval_bc_test(exe, i, m, sc, bc, &ip, variables,
                                 duptrack_list, version, requires);
 
             if (result < 0) {
@@ -2039,9 +2117,9 @@ int sieve_eval_bc(sieve_execute_t *exe, int is_incl, sieve_interp_t *i,
             if (comparator == B_REGEX) {
                 char errmsg[1024]; /* Basically unused */
 
-                reg = bc_compile_regex(pattern,
-                                       REG_EXTENDED | REG_NOSUB | REG_ICASE,
-                                       errmsg, sizeof(errmsg));
+                reg = bc_cached_regex(exe, pattern,
+                                      REG_EXTENDED | REG_NOSUB | REG_ICASE,
+                                      errmsg, sizeof(errmsg));
                 if (!reg) {
                     res = SIEVE_RUN_ERROR;
                     break;
@@ -2050,11 +2128,6 @@ int sieve_eval_bc(sieve_execute_t *exe, int is_incl, sieve_interp_t *i,
 
             res = do_denotify(notify_list, comp, reg,
                               match_vars, comprock, priority);
-
-            if (reg) {
-                regfree(reg);
-                free(reg);
-            }
             break;
         }
 
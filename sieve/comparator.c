@@ -56,6 +56,7 @@
 #include "sieve/sieve_interface.h"
 #include "sieve/sieve.h"
 #include "bytecode.h"
+#include "hash.h"
 #include "util.h"
 #include "xmalloc.h"
 
@@ -609,3 +610,230 @@ EXPORTED comparator_t *lookup_comp(sieve_interp_t *i, int comp, int mode,
       }
     return ret;
 }
+
+/* --- multi-pattern matching ---
+ *
+ * A test with a long key list (e.g. header :contains "from" [...hundreds
+ * of addresses...]) would otherwise compare every key against every
+ * header value in turn.  For literal :is and :contains keys with the
+ * i;octet and i;ascii-casemap comparators we instead build a single
+ * matcher that examines each value once, however many keys there are:
+ * a hash of the (case-folded) keys for :is, and an Aho-Corasick
+ * automaton for :contains.
+ */
+
+struct ac_edge {
+    unsigned char c;
+    int next;                   /* target state */
+    int sibling;                /* next edge out of the same state */
+};
+
+struct ac_state {
+    int edges;                  /* first outgoing edge, -1 if none */
+    int fail;                   /* longest proper suffix state */
+    int final;                  /* some key ends here (or at a suffix) */
+};
+
+struct comparator_multi {
+    int mode;                   /* B_IS or B_CONTAINS */
+    int casemap;
+    int matchall;               /* an empty :contains key matches anything */
+
+    /* B_IS */
+    hash_table keys;
+
+    /* B_CONTAINS */
+    struct ac_state *states;
+    int nstates, statealloc;
+    struct ac_edge *edges;
+    int nedges, edgealloc;
+};
+
+static inline unsigned char fold(int casemap, unsigned char c)
+{
+    return casemap ? toupper(c) : c;
+}
+
+static int ac_goto(const struct comparator_multi *cm, int s, unsigned char c)
+{
+    int e;
+
+    for (e = cm->states[s].edges; e >= 0; e = cm->edges[e].sibling) {
+        if (cm->edges[e].c == c) return cm->edges[e].next;
+    }
+
+    return -1;
+}
+
+static int ac_newstate(struct comparator_multi *cm)
+{
+    if (cm->nstates == cm->statealloc) {
+        cm->statealloc = cm->statealloc ? 2 * cm->statealloc : 64;
+        cm->states = xrealloc(cm->states,
+                              cm->statealloc * sizeof(struct ac_state));
+    }
+    cm->states[cm->nstates].edges = -1;
+    cm->states[cm->nstates].fail = 0;
+    cm->states[cm->nstates].final = 0;
+
+    return cm->nstates++;
+}
+
+static void ac_addkey(struct comparator_multi *cm, const char *key)
+{
+    int s = 0;
+
+    for (; *key; key++) {
+        unsigned char c = fold(cm->casemap, *key);
+        int next = ac_goto(cm, s, c);
+
+        if (next < 0) {
+            next = ac_newstate(cm);
+
+            if (cm->nedges == cm->edgealloc) {
+                cm->edgealloc = cm->edgealloc ? 2 * cm->edgealloc : 64;
+                cm->edges = xrealloc(cm->edges,
+                                     cm->edgealloc * sizeof(struct ac_edge));
+            }
+            cm->edges[cm->nedges].c = c;
+            cm->edges[cm->nedges].next = next;
+            cm->edges[cm->nedges].sibling = cm->states[s].edges;
+            cm->states[s].edges = cm->nedges++;
+        }
+        s = next;
+    }
+
+    cm->states[s].final = 1;
+}
+
+/* compute failure links breadth-first, so that every state's fail
+   target is complete before its children are visited */
+static void ac_link(struct comparator_multi *cm)
+{
+    int *queue = xmalloc(cm->nstates * sizeof(int));
+    int head = 0, tail = 0;
+    int e;
+
+    for (e = cm->states[0].edges; e >= 0; e = cm->edges[e].sibling) {
+        queue[tail++] = cm->edges[e].next;
+    }
+
+    while (head < tail) {
+        int s = queue[head++];
+
+        for (e = cm->states[s].edges; e >= 0; e = cm->edges[e].sibling) {
+            int child = cm->edges[e].next;
+            int f = cm->states[s].fail;
+            int target;
+
+            while ((target = ac_goto(cm, f, cm->edges[e].c)) < 0 && f)
+                f = cm->states[f].fail;
+
+            cm->states[child].fail = target < 0 ? 0 : target;
+            if (cm->states[cm->states[child].fail].final)
+                cm->states[child].final = 1;
+
+            queue[tail++] = child;
+        }
+    }
+
+    free(queue);
+}
+
+EXPORTED comparator_multi_t *comparator_multi_new(int comp, int mode,
+                                                  const strarray_t *keys)
+{
+    struct comparator_multi *cm;
+    int n;
+
+    if (comp != B_OCTET && comp != B_ASCIICASEMAP) return NULL;
+    if (mode != B_IS && mode != B_CONTAINS) return NULL;
+
+    cm = xzmalloc(sizeof(struct comparator_multi));
+    cm->mode = mode;
+    cm->casemap = (comp == B_ASCIICASEMAP);
+
+    if (mode == B_IS) {
+        struct buf key = BUF_INITIALIZER;
+
+        construct_hash_table(&cm->keys, 2 * strarray_size(keys) + 1, 0);
+
+        for (n = 0; n < strarray_size(keys); n++) {
+            const char *p;
+
+            buf_reset(&key);
+            for (p = strarray_nth(keys, n); *p; p++)
+                buf_putc(&key, fold(cm->casemap, *p));
+            hash_insert(buf_cstring(&key), (void *) 1, &cm->keys);
+        }
+        buf_free(&key);
+    }
+    else {
+        ac_newstate(cm);        /* root */
+
+        for (n = 0; n < strarray_size(keys); n++) {
+            const char *key = strarray_nth(keys, n);
+
+            if (!*key) cm->matchall = 1;
+            else ac_addkey(cm, key);
+        }
+        ac_link(cm);
+    }
+
+    return cm;
+}
+
+EXPORTED int comparator_multi_match(const comparator_multi_t *cm,
+                                    const char *text, size_t tlen)
+{
+    size_t i;
+
+    if (cm->mode == B_IS) {
+        struct buf val = BUF_INITIALIZER;
+        int r;
+
+        if (!cm->casemap) {
+            buf_init_ro(&val, text, tlen);
+        }
+        else {
+            for (i = 0; i < tlen; i++)
+                buf_putc(&val, fold(1, text[i]));
+        }
+        r = hash_lookup(buf_cstring(&val), (hash_table *) &cm->keys) != NULL;
+        buf_free(&val);
+
+        return r;
+    }
+    else {
+        int s = 0;
+
+        if (cm->matchall) return 1;
+
+        for (i = 0; i < tlen; i++) {
+            unsigned char c = fold(cm->casemap, text[i]);
+            int next;
+
+            while ((next = ac_goto(cm, s, c)) < 0 && s)
+                s = cm->states[s].fail;
+
+            s = next < 0 ? 0 : next;
+            if (cm->states[s].final) return 1;
+        }
+
+        return 0;
+    }
+}
+
+EXPORTED void comparator_multi_free(comparator_multi_t **cmp)
+{
+    struct comparator_multi *cm = *cmp;
+
+    if (!cm) return;
+
+    if (cm->mode == B_IS) free_hash_table(&cm->keys, NULL);
+    free(cm->states);
+    free(cm->edges);
+    free(cm);
+
+    *cmp = NULL;
+}
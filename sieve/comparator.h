@@ -72,4 +72,14 @@ typedef int comparator_t(const char *text, size_t tlen, const char *pat,
 comparator_t *lookup_comp(sieve_interp_t *i, int comp, int mode,
                           int relation, void **rock);
 
+/* matches text against a whole list of literal :is or :contains keys
+   in a single pass; only available for i;octet and i;ascii-casemap */
+typedef struct comparator_multi comparator_multi_t;
+
+comparator_multi_t *comparator_multi_new(int comp, int mode,
+                                         const strarray_t *keys);
+int comparator_multi_match(const comparator_multi_t *cm,
+                           const char *text, size_t tlen);
+void comparator_multi_free(comparator_multi_t **cmp);
+
 #endif /* COMPARATOR_H */
@@ -511,6 +511,17 @@ EXPORTED int sieve_script_load(const char *fname, sieve_execute_t **ret)
 
 
 
+static void free_regex(void *reg)
+{
+    regfree((regex_t *) reg);
+    free(reg);
+}
+
+static void free_multimatch(void *cm)
+{
+    comparator_multi_free((comparator_multi_t **) &cm);
+}
+
 EXPORTED int sieve_script_unload(sieve_execute_t **s)
 {
     if(s && *s) {
@@ -525,6 +536,14 @@ EXPORTED int sieve_script_unload(sieve_execute_t **s)
             free(bc);
             bc = nextbc;
         }
+        if ((*s)->regexes) {
+            free_hash_table((*s)->regexes, &free_regex);
+            free((*s)->regexes);
+        }
+        if ((*s)->multimatch) {
+            free_hash_table((*s)->multimatch, &free_multimatch);
+            free((*s)->multimatch);
+        }
         free(*s);
         *s = NULL;
     }
@@ -46,6 +46,7 @@
 
 #include <sys/types.h>
 
+#include "hash.h"
 #include "sieve_interface.h"
 #include "interp.h"
 #include "tree.h"
@@ -81,6 +82,8 @@ struct sieve_bytecode {
 struct sieve_execute {
     sieve_bytecode_t *bc_list;  /* list of loaded bytecode buffers */
     sieve_bytecode_t *bc_cur;   /* currently active bytecode buffer */
+    hash_table *regexes;        /* compiled regexes, keyed by flags+pattern */
+    hash_table *multimatch;     /* multi-key matchers, keyed by test */
 };
 
 int script_require(sieve_script_t *s, const char *req);
@@ -595,6 +595,7 @@ static int usage(const char *argv0)
     fprintf(stderr, "   -h local_hostname\n");
     fprintf(stderr, "   -H remote_hostname\n");
     fprintf(stderr, "   -I remote_ipaddr\n");
+    fprintf(stderr, "   -n count - execute the script count times and report timing\n");
     exit(1);
 }
 
@@ -605,7 +606,8 @@ int main(int argc, char *argv[])
     message_data_t *m = NULL;
     char *tmpscript = NULL, *script = NULL, *message = NULL;
     int c, force_fail = 0;
-    int fd, res;
+    int fd, res, n, count = 1;
+    struct timeval start, end;
     struct stat sbuf;
     static strarray_t mark = STRARRAY_INITIALIZER;
     static strarray_t e_from = STRARRAY_INITIALIZER;
@@ -618,7 +620,7 @@ int main(int argc, char *argv[])
     strarray_append(&e_from, "");
     strarray_append(&e_to, "");
 
-    while ((c = getopt(argc, argv, "C:v:fe:t:r:h:H:I:u:")) != EOF)
+    while ((c = getopt(argc, argv, "C:v:fe:t:r:h:H:I:u:n:")) != EOF)
         switch (c) {
         case 'C': /* alt config file */
             alt_config = optarg;
@@ -652,6 +654,10 @@ int main(int argc, char *argv[])
         case 'u':
             sd.userid = optarg;
             break;
+        case 'n':
+            count = atoi(optarg);
+            if (count < 1) usage(argv[0]);
+            break;
         default:
             usage(argv[0]);
             break;
@@ -798,10 +804,21 @@ int main(int argc, char *argv[])
         m->env_from = &e_from;
         m->env_to = &e_to;
 
-        res = sieve_execute_bytecode(exe, i, &sd, m);
-        if (res != SIEVE_OK) {
-            printf("sieve_execute_bytecode() returns %d\n", res);
-            exit(1);
+        gettimeofday(&start, NULL);
+        for (n = 0; n < count; n++) {
+            res = sieve_execute_bytecode(exe, i, &sd, m);
+            if (res != SIEVE_OK) {
+                printf("sieve_execute_bytecode() returns %d\n", res);
+                exit(1);
+            }
+        }
+        gettimeofday(&end, NULL);
+
+        if (count > 1) {
+            double secs = timesub(&start, &end);
+
+            fprintf(stderr, "%d executions in %.3f sec (%.1f usec each)\n",
+                    count, secs, secs * 1000000 / count);
         }
 
         fclose(f);